@@ -0,0 +1,150 @@
+#include "advisor.hh"
+#include "metrics.hh" // monotimeNs
+#include <stdio.h>
+#include <string.h>
+
+// _lastWrite is cleared when it grows beyond this many regions
+#define ADVISOR_MAX_REGIONS 8192
+
+// hashData is a fast non-cryptographic hash of size bytes, good enough to tell
+// whether an upload is the same as the previous one to the same region
+static uint64_t hashData(const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  uint64_t h = 0xCBF29CE484222325ull ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t v;
+    memcpy(&v, &p[i], 8);
+    h = (h ^ v) * 0x100000001B3ull;
+    h ^= h >> 29;
+  }
+  for (; i < size; i++)
+    h = (h ^ p[i]) * 0x100000001B3ull;
+  return h ^ (h >> 32);
+}
+
+const char* Advisor::kindName(Kind k) {
+  switch (k) {
+    case PipelinesPerFrame: return "pipelines_per_frame";
+    case RedundantUploads:  return "redundant_uploads";
+    case SmallSubmits:      return "small_submits";
+    case KindCount:         break;
+  }
+  return "?";
+}
+
+void Advisor::pipelineCreated() {
+  pipelinesCreated++;
+  _pipelines++;
+  _framePipelines++;
+}
+
+void Advisor::bufferWritten(const void* dst, uint64_t offset, const void* data, size_t size) {
+  written(dst, { offset, size }, data, size);
+}
+
+void Advisor::textureWritten(
+  const void* dst, uint32_t mipLevel, uint32_t x, uint32_t y, uint32_t z,
+  const void* data, size_t size)
+{
+  written(dst, { ((uint64_t)mipLevel << 32) | z, ((uint64_t)y << 32) | x }, data, size);
+}
+
+void Advisor::written(const void* dst, const Region& region, const void* data, size_t size) {
+  writes++;
+  writeBytes += size;
+  uint64_t h = hashData(data, size);
+  Regions& regions = _lastWrite[dst];
+  auto it = regions.find(region);
+  if (it != regions.end()) {
+    if (it->second == h) {
+      redundantWrites++;
+      redundantWriteBytes += size;
+      _redundantWrites++;
+      _redundantBytes += size;
+    } else {
+      it->second = h;
+    }
+    return;
+  }
+  if (_regions >= ADVISOR_MAX_REGIONS) {
+    _lastWrite.clear();
+    _regions = 0;
+    _lastWrite[dst].emplace(region, h);
+  } else {
+    regions.emplace(region, h);
+  }
+  _regions++;
+}
+
+void Advisor::released(const void* dst) {
+  auto it = _lastWrite.find(dst);
+  if (it == _lastWrite.end())
+    return;
+  _regions -= it->second.size();
+  _lastWrite.erase(it);
+}
+
+void Advisor::submitted(uint32_t commandBufferCount) {
+  submits++;
+  commandBuffers += commandBufferCount;
+  _submits++;
+  _commandBuffers += commandBufferCount;
+}
+
+void Advisor::endFrame() {
+  if (_framePipelines > 0)
+    _pipelineFrames++;
+  _framePipelines = 0;
+  if (++_frames >= window)
+    evaluate();
+}
+
+void Advisor::evaluate() {
+  char buf[256];
+  double frames = (double)_frames;
+
+  if (_pipelineFrames >= frames * pipelineFrames) {
+    snprintf(buf, sizeof(buf),
+      "created %llu pipelines in %u of the last %u frames; "
+      "create pipelines once at startup and reuse them",
+      (unsigned long long)_pipelines, _pipelineFrames, _frames);
+    warn(PipelinesPerFrame, buf);
+  }
+
+  if (_redundantBytes >= redundantBytesPerFrame * _frames) {
+    snprintf(buf, sizeof(buf),
+      "re-uploaded unchanged data %llu times (%.1f KB/frame) in the last %u frames; "
+      "only write buffers and textures when their contents change",
+      (unsigned long long)_redundantWrites, (double)_redundantBytes / frames / 1024.0, _frames);
+    warn(RedundantUploads, buf);
+  }
+
+  if (_submits >= submitsPerFrame * frames || _commandBuffers >= commandBuffersPerFrame * frames) {
+    snprintf(buf, sizeof(buf),
+      "submitted %.1f command buffers in %.1f queue submits per frame over the last %u "
+      "frames; record a frame into few command buffers and submit them together",
+      (double)_commandBuffers / frames, (double)_submits / frames, _frames);
+    warn(SmallSubmits, buf);
+  }
+
+  _frames = 0;
+  _pipelineFrames = 0;
+  _pipelines = 0;
+  _redundantBytes = 0;
+  _redundantWrites = 0;
+  _submits = 0;
+  _commandBuffers = 0;
+}
+
+void Advisor::warn(Kind k, const std::string& msg) {
+  uint64_t now = monotimeNs();
+  if (_lastWarnNs[k] != 0 && (double)(now - _lastWarnNs[k]) < warnInterval * 1e9)
+    return;
+  _lastWarnNs[k] = now;
+  warnings[k]++;
+  if (onWarning) {
+    std::string s = std::string(kindName(k)) + ": " + msg;
+    onWarning(s.c_str());
+  }
+}
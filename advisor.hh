@@ -0,0 +1,96 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Advisor watches what a client does through the wire and warns about patterns which
+// are known to be slow, with the numbers to back it up:
+//
+//   - creating pipelines every frame (instead of once, up front)
+//   - uploading the same data to the same buffer or texture region again
+//   - submitting many small command buffers per frame (instead of a few large ones)
+//
+// Activity is evaluated per window of `window` frames. A pattern is reported through
+// onWarning when the window crosses its threshold, at most once per warnInterval
+// seconds per pattern; counters are kept regardless.
+//
+// Example:
+//   advisor.onWarning = [](const char* msg) { fprintf(stderr, "%s\n", msg); };
+//   advisor.pipelineCreated();
+//   advisor.bufferWritten(buffer, offset, data, size);
+//   advisor.endFrame();
+//
+struct Advisor {
+  enum Kind {
+    PipelinesPerFrame,
+    RedundantUploads,
+    SmallSubmits,
+    KindCount,
+  };
+
+  // thresholds (per window)
+  uint32_t window = 120;                   // frames per evaluation
+  double   pipelineFrames = 0.5;           // fraction of frames which create a pipeline
+  uint64_t redundantBytesPerFrame = 16384; // average unchanged bytes re-uploaded
+  double   submitsPerFrame = 4;            // average queue submits...
+  double   commandBuffersPerFrame = 8;     // ...or command buffers per frame
+  double   warnInterval = 10;              // seconds between warnings of the same kind
+
+  std::function<void(const char* msg)> onWarning;
+
+  // counters (totals)
+  uint64_t pipelinesCreated = 0;
+  uint64_t writes = 0;
+  uint64_t writeBytes = 0;
+  uint64_t redundantWrites = 0;
+  uint64_t redundantWriteBytes = 0;
+  uint64_t submits = 0;
+  uint64_t commandBuffers = 0;
+  uint64_t warnings[KindCount] = {};
+
+  void pipelineCreated();
+  // bufferWritten & textureWritten record an upload of data to a destination, which is
+  // identified by the object (dst) and a region within it
+  void bufferWritten(const void* dst, uint64_t offset, const void* data, size_t size);
+  void textureWritten(
+    const void* dst, uint32_t mipLevel, uint32_t x, uint32_t y, uint32_t z,
+    const void* data, size_t size);
+  // released forgets the regions of a buffer or texture which the client released, so
+  // that a new object at the same address is not compared against the old one's data
+  void released(const void* dst);
+  void submitted(uint32_t commandBufferCount);
+  void endFrame();
+
+  static const char* kindName(Kind k);
+
+  // internal
+  struct Region {
+    uint64_t a, b;
+    bool operator==(const Region& r) const { return a == r.a && b == r.b; }
+  };
+  struct RegionHash {
+    size_t operator()(const Region& r) const {
+      return (size_t)(r.a * 0x9E3779B97F4A7C15ull) ^ (size_t)(r.b * 0xC2B2AE3D27D4EB4Full);
+    }
+  };
+  typedef std::unordered_map<Region,uint64_t,RegionHash> Regions; // data hash per region
+  std::unordered_map<const void*,Regions> _lastWrite; // by destination
+  size_t _regions = 0; // total in _lastWrite
+
+  // current window
+  uint32_t _frames = 0;
+  uint32_t _pipelineFrames = 0; // frames which created at least one pipeline
+  uint32_t _framePipelines = 0; // pipelines created in the current frame
+  uint64_t _pipelines = 0;
+  uint64_t _redundantBytes = 0;
+  uint64_t _redundantWrites = 0;
+  uint64_t _submits = 0;
+  uint64_t _commandBuffers = 0;
+  uint64_t _lastWarnNs[KindCount] = {};
+
+  void written(const void* dst, const Region& region, const void* data, size_t size);
+  void warn(Kind k, const std::string& msg);
+  void evaluate();
+};
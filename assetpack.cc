@@ -0,0 +1,304 @@
+#include "assetpack.hh"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define errlog(format, ...) \
+  (({ fprintf(stderr, "E " format "\n", ##__VA_ARGS__); fflush(stderr); }))
+
+#define PACK_HEADER_SIZE 16
+#define PACK_ENTRY_SIZE  24
+
+// XXH64 primes
+static const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t P3 = 0x165667B19E3779F9ULL;
+static const uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// read64 & read32 read little-endian integers (the hosts we run on are little-endian)
+static inline uint64_t read64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+  acc += input * P2;
+  return rotl64(acc, 31) * P1;
+}
+
+static inline uint64_t xxhMerge(uint64_t acc, uint64_t v) {
+  acc ^= xxhRound(0, v);
+  return acc * P1 + P4;
+}
+
+uint64_t assetHash(const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  const uint8_t* end = p + size;
+  uint64_t h;
+  if (size >= 32) {
+    uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = 0 - P1;
+    for (; end - p >= 32; p += 32) {
+      v1 = xxhRound(v1, read64(p));
+      v2 = xxhRound(v2, read64(p + 8));
+      v3 = xxhRound(v3, read64(p + 16));
+      v4 = xxhRound(v4, read64(p + 24));
+    }
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxhMerge(h, v1);
+    h = xxhMerge(h, v2);
+    h = xxhMerge(h, v3);
+    h = xxhMerge(h, v4);
+  } else {
+    h = P5;
+  }
+  h += (uint64_t)size;
+  for (; end - p >= 8; p += 8) {
+    h ^= xxhRound(0, read64(p));
+    h = rotl64(h, 27) * P1 + P4;
+  }
+  if (end - p >= 4) {
+    h ^= (uint64_t)read32(p) * P1;
+    h = rotl64(h, 23) * P2 + P3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= (uint64_t)*p * P5;
+    h = rotl64(h, 11) * P1;
+  }
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+// formatBlock sets the bytes per block and block width & height of a format assets can
+// be uploaded into. Returns false for other formats.
+static bool formatBlock(WGPUTextureFormat format, uint32_t* bytes, uint32_t* dim) {
+  *dim = 1;
+  switch (format) {
+    case WGPUTextureFormat_R8Unorm:
+      *bytes = 1;
+      return true;
+    case WGPUTextureFormat_RG8Unorm:
+      *bytes = 2;
+      return true;
+    case WGPUTextureFormat_RGBA8Unorm:
+    case WGPUTextureFormat_RGBA8UnormSrgb:
+    case WGPUTextureFormat_BGRA8Unorm:
+    case WGPUTextureFormat_BGRA8UnormSrgb:
+      *bytes = 4;
+      return true;
+    case WGPUTextureFormat_RGBA16Float:
+      *bytes = 8;
+      return true;
+    case WGPUTextureFormat_RGBA32Float:
+      *bytes = 16;
+      return true;
+    case WGPUTextureFormat_BC1RGBAUnorm:
+    case WGPUTextureFormat_BC1RGBAUnormSrgb:
+      *bytes = 8;
+      *dim = 4;
+      return true;
+    case WGPUTextureFormat_BC3RGBAUnorm:
+    case WGPUTextureFormat_BC3RGBAUnormSrgb:
+    case WGPUTextureFormat_BC7RGBAUnorm:
+    case WGPUTextureFormat_BC7RGBAUnormSrgb:
+      *bytes = 16;
+      *dim = 4;
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t assetTextureBytesPerRow(WGPUTextureFormat format, uint32_t width) {
+  uint32_t bytes, dim;
+  if (!formatBlock(format, &bytes, &dim) || width == 0 || width > ASSET_TEXTURE_SIZE_MAX ||
+      width % dim != 0)
+  {
+    return 0;
+  }
+  return width / dim * bytes;
+}
+
+size_t assetTextureSize(WGPUTextureFormat format, uint32_t width, uint32_t height) {
+  uint32_t bytes, dim;
+  uint32_t bytesPerRow = assetTextureBytesPerRow(format, width);
+  if (bytesPerRow == 0 || !formatBlock(format, &bytes, &dim) || height == 0 ||
+      height > ASSET_TEXTURE_SIZE_MAX || height % dim != 0)
+  {
+    return 0;
+  }
+  return (size_t)bytesPerRow * (height / dim);
+}
+
+bool assetPackWrite(const char* filename, const std::vector<AssetData>& assets) {
+  struct Entry {
+    uint64_t hash, offset, size;
+    const void* data;
+  };
+  std::vector<Entry> entries;
+  std::unordered_map<uint64_t,size_t> seen; // hash => index in entries
+  for (const AssetData& a : assets) {
+    uint64_t hash = assetHash(a.data, a.size);
+    auto it = seen.find(hash);
+    if (it != seen.end() && entries[it->second].size == a.size)
+      continue;
+    seen[hash] = entries.size();
+    entries.push_back({ hash, 0, (uint64_t)a.size, a.data });
+  }
+  std::sort(entries.begin(), entries.end(),
+    [](const Entry& a, const Entry& b) { return a.hash < b.hash; });
+  uint64_t offset = PACK_HEADER_SIZE + entries.size() * PACK_ENTRY_SIZE;
+  for (Entry& e : entries) {
+    e.offset = offset;
+    offset += e.size;
+  }
+
+  FILE* f = fopen(filename, "wb");
+  if (!f)
+    return false;
+  uint32_t header[3] = { ASSET_PACK_VERSION, (uint32_t)entries.size(), 0 };
+  bool ok = fwrite("DPAK", 4, 1, f) == 1 && fwrite(header, sizeof(header), 1, f) == 1;
+  for (size_t i = 0; ok && i < entries.size(); i++) {
+    uint64_t v[3] = { entries[i].hash, entries[i].offset, entries[i].size };
+    ok = fwrite(v, sizeof(v), 1, f) == 1;
+  }
+  for (size_t i = 0; ok && i < entries.size(); i++)
+    ok = entries[i].size == 0 || fwrite(entries[i].data, entries[i].size, 1, f) == 1;
+  int e = errno;
+  if (fclose(f) != 0 && ok) {
+    e = errno;
+    ok = false;
+  }
+  if (!ok) {
+    unlink(filename);
+    errno = e;
+  }
+  return ok;
+}
+
+bool AssetStore::openPack(const char* filename) {
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int e = errno;
+    ::close(fd);
+    errno = e;
+    return false;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size < PACK_HEADER_SIZE) {
+    ::close(fd);
+    errno = EINVAL;
+    return false;
+  }
+  void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  const uint8_t* base = (const uint8_t*)p;
+  uint32_t header[3];
+  memcpy(header, base + 4, sizeof(header));
+  uint64_t count = header[1];
+  if (memcmp(base, "DPAK", 4) != 0 || header[0] != ASSET_PACK_VERSION ||
+      count > (size - PACK_HEADER_SIZE) / PACK_ENTRY_SIZE)
+  {
+    munmap(p, size);
+    errno = EINVAL;
+    return false;
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t v[3]; // hash, offset, size
+    memcpy(v, base + PACK_HEADER_SIZE + i * PACK_ENTRY_SIZE, sizeof(v));
+    if (v[1] > size || v[2] > size - v[1]) {
+      errlog("asset pack %s: asset %llu out of bounds", filename, (unsigned long long)i);
+      continue;
+    }
+    if (_index.emplace(v[0], Asset{ base + v[1], v[2] }).second)
+      assets++;
+  }
+  // assets are read when clients use them, in no particular order
+  madvise(p, size, MADV_RANDOM);
+  _mappings.push_back({ p, size });
+  packs++;
+  bytes += size;
+  return true;
+}
+
+bool AssetStore::open(const std::vector<std::string>& paths) {
+  bool ok = true;
+  for (const std::string& path : paths) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      errlog("assets: %s: %s", path.c_str(), strerror(errno));
+      ok = false;
+      continue;
+    }
+    std::vector<std::string> files;
+    if (S_ISDIR(st.st_mode)) {
+      DIR* d = opendir(path.c_str());
+      if (!d) {
+        errlog("assets: %s: %s", path.c_str(), strerror(errno));
+        ok = false;
+        continue;
+      }
+      while (struct dirent* e = readdir(d)) {
+        size_t n = strlen(e->d_name);
+        if (n > 5 && strcmp(&e->d_name[n - 5], ".dpak") == 0)
+          files.push_back(path + "/" + e->d_name);
+      }
+      closedir(d);
+      std::sort(files.begin(), files.end());
+    } else {
+      files.push_back(path);
+    }
+    for (const std::string& f : files) {
+      if (!openPack(f.c_str())) {
+        errlog("assets: %s: %s", f.c_str(), strerror(errno));
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+void AssetStore::close() {
+  for (const Mapping& m : _mappings)
+    munmap(m.addr, m.size);
+  _mappings.clear();
+  _index.clear();
+  packs = 0;
+  assets = 0;
+  bytes = 0;
+}
+
+const AssetStore::Asset* AssetStore::find(uint64_t hash, uint64_t size) const {
+  auto it = _index.find(hash);
+  if (it == _index.end() || it->second.size != size)
+    return nullptr;
+  return &it->second;
+}
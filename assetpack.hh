@@ -0,0 +1,85 @@
+#pragma once
+#include <dawn/webgpu.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Asset packs hold static assets (fonts, textures, meshes) which are installed on servers
+// as well as shipped with clients. A server maps its packs (-assets=<path>) and indexes
+// their assets by content hash; a client which has the same data asks the server to
+// create a buffer or texture from the asset with that hash instead of sending the data
+// (see AssetUploader in assetupload.hh.)
+//
+// A pack file is the magic "DPAK", a uint32 version, a uint32 count and a uint32 zero,
+// followed by count index entries (uint64 hash, offset and size; offsets are from the
+// start of the file) and the asset data. Integers are in host byte order. Packs are
+// made with the dpak program or assetPackWrite.
+#define ASSET_PACK_VERSION 1
+
+// Buffers the server should fill from an asset are created with a label of
+// ASSET_BUFFER_LABEL_PREFIX followed by a token (decimal) which sendAsset refers to
+#define ASSET_BUFFER_LABEL_PREFIX "dawn-remote:asset:"
+
+// Largest texture dimension an asset can be uploaded into
+#define ASSET_TEXTURE_SIZE_MAX 16384
+
+enum AssetKind {
+  ASSET_BUFFER  = 0, // fill a buffer created with an asset label
+  ASSET_TEXTURE = 1, // create a texture for a texture reservation
+};
+
+// assetHash returns the content hash of size bytes of data (XXH64 with seed 0)
+uint64_t assetHash(const void* data, size_t size);
+
+// assetTextureBytesPerRow returns the bytes per row (of blocks for BC formats) of a
+// texture of the format and width, or 0 if assets can't be uploaded into the format
+// (or width is not a multiple of its block size.)
+uint32_t assetTextureBytesPerRow(WGPUTextureFormat format, uint32_t width);
+
+// assetTextureSize returns the size of a width x height texture's data, rows packed,
+// or 0 if assets can't be uploaded into the format or size
+size_t assetTextureSize(WGPUTextureFormat format, uint32_t width, uint32_t height);
+
+struct AssetData {
+  const void* data;
+  size_t      size;
+};
+
+// assetPackWrite writes a pack of assets to filename. Assets with the same data are
+// stored once. Returns false with errno set on failure.
+bool assetPackWrite(const char* filename, const std::vector<AssetData>& assets);
+
+// AssetStore (server) maps asset packs and finds their assets by hash & size. The
+// assets' data is read-only and stays valid until close.
+struct AssetStore {
+  struct Asset {
+    const uint8_t* data;
+    uint64_t       size;
+  };
+
+  uint32_t packs = 0;  // packs mapped
+  uint64_t assets = 0; // distinct assets indexed
+  uint64_t bytes = 0;  // bytes mapped
+
+  ~AssetStore() { close(); }
+
+  // open maps the packs at paths, which are pack files or directories of them
+  // (*.dpak.) Returns false if a path could not be read or a pack is malformed; the
+  // others are still mapped.
+  bool open(const std::vector<std::string>& paths);
+  void close();
+
+  // find returns the asset with the content hash and size, or null
+  const Asset* find(uint64_t hash, uint64_t size) const;
+
+  // internal
+  struct Mapping {
+    void*  addr;
+    size_t size;
+  };
+  std::vector<Mapping>               _mappings;
+  std::unordered_map<uint64_t,Asset> _index; // by hash
+  bool openPack(const char* filename);
+};
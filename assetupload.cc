@@ -0,0 +1,134 @@
+#include "assetupload.hh"
+#include <stdio.h>
+#include <string.h>
+
+bool AssetUploader::query(DawnRemoteProtocol& proto, const std::vector<AssetData>& assets) {
+  proto.onAssetQueryReply = [this](const uint8_t* found, size_t n) { onQueryReply(found, n); };
+  for (size_t i = 0; i < assets.size(); i += ASSET_QUERY_MAX) {
+    std::vector<DawnRemoteProtocol::AssetRef> refs;
+    for (size_t j = i; j < std::min(assets.size(), i + ASSET_QUERY_MAX); j++)
+      refs.push_back({ assetHash(assets[j].data, assets[j].size), (uint64_t)assets[j].size });
+    if (!proto.sendAssetQuery(refs.data(), refs.size()))
+      return false;
+    _pending.push_back(std::move(refs));
+  }
+  return true;
+}
+
+void AssetUploader::onQueryReply(const uint8_t* found, size_t n) {
+  if (_pending.empty())
+    return;
+  const std::vector<DawnRemoteProtocol::AssetRef>& refs = _pending.front();
+  for (size_t i = 0; i < std::min(n, refs.size()); i++) {
+    if (found[i])
+      _found[refs[i].hash] = refs[i].size;
+  }
+  _pending.pop_front();
+}
+
+bool AssetUploader::has(uint64_t hash, uint64_t size) const {
+  auto it = _found.find(hash);
+  return it != _found.end() && it->second == size;
+}
+
+wgpu::Buffer AssetUploader::createBuffer(
+  DawnRemoteProtocol& proto, const wgpu::Device& device, wgpu::BufferUsage usage,
+  const void* data, size_t size)
+{
+  static uint32_t nextToken = 1;
+  // hashing is only worth it if the server has some of our assets
+  uint64_t hash = _found.empty() ? 0 : assetHash(data, size);
+  wgpu::BufferDescriptor desc;
+  desc.usage = usage | wgpu::BufferUsage::CopyDst;
+  desc.size = (size + 3) & ~(size_t)3;
+
+  if (!_found.empty() && has(hash, size)) {
+    DawnRemoteProtocol::AssetInfo info = {};
+    info.asset = { hash, (uint64_t)size };
+    info.kind = ASSET_BUFFER;
+    info.token = nextToken++;
+    char label[64];
+    snprintf(label, sizeof(label), ASSET_BUFFER_LABEL_PREFIX "%u", info.token);
+    desc.label = label; // mapped at creation by the server
+    wgpu::Buffer buffer = device.CreateBuffer(&desc);
+    proto.sendAsset(info);
+    hits++;
+    bytesAvoided += size;
+    return buffer;
+  }
+
+  wgpu::Buffer buffer = device.CreateBuffer(&desc);
+  wgpu::Queue queue = device.GetQueue();
+  const uint8_t* p = (const uint8_t*)data;
+  size_t tail = size & 3; // WriteBuffer sizes are multiples of 4
+  for (size_t offs = 0; offs < size - tail; offs += ASSET_WRITE_CHUNK) {
+    size_t n = std::min((size_t)ASSET_WRITE_CHUNK, size - tail - offs);
+    queue.WriteBuffer(buffer, offs, &p[offs], n);
+  }
+  if (tail > 0) {
+    uint8_t last[4] = {};
+    memcpy(last, &p[size - tail], tail);
+    queue.WriteBuffer(buffer, size - tail, last, 4);
+  }
+  misses++;
+  bytesSent += size;
+  return buffer;
+}
+
+wgpu::Texture AssetUploader::createTexture(
+  DawnRemoteProtocol& proto, dawn_wire::WireClient* wireClient, const wgpu::Device& device,
+  wgpu::TextureFormat format, uint32_t width, uint32_t height, const void* data)
+{
+  size_t size = assetTextureSize((WGPUTextureFormat)format, width, height);
+  uint32_t bytesPerRow = assetTextureBytesPerRow((WGPUTextureFormat)format, width);
+  if (size == 0 || bytesPerRow > ASSET_WRITE_CHUNK)
+    return nullptr;
+  uint32_t blockRows = (uint32_t)(size / bytesPerRow);
+  uint32_t blockHeight = height / blockRows;
+
+  uint64_t hash = _found.empty() ? 0 : assetHash(data, size);
+  if (!_found.empty() && has(hash, size)) {
+    dawn_wire::ReservedTexture r = wireClient->ReserveTexture(device.Get());
+    wgpu::Texture texture = wgpu::Texture::Acquire(r.texture);
+    DawnRemoteProtocol::AssetInfo info = {};
+    info.asset = { hash, (uint64_t)size };
+    info.kind = ASSET_TEXTURE;
+    info.id = r.id;
+    info.generation = r.generation;
+    info.deviceId = r.deviceId;
+    info.deviceGeneration = r.deviceGeneration;
+    info.width = width;
+    info.height = height;
+    info.format = (uint32_t)format;
+    proto.sendAsset(info);
+    hits++;
+    bytesAvoided += size;
+    return texture;
+  }
+
+  wgpu::TextureDescriptor desc;
+  desc.size = { width, height, 1 };
+  desc.format = format;
+  desc.usage = wgpu::TextureUsage::Sampled | wgpu::TextureUsage::CopyDst |
+               wgpu::TextureUsage::CopySrc;
+  wgpu::Texture texture = device.CreateTexture(&desc);
+  wgpu::Queue queue = device.GetQueue();
+  // in chunks of rows (of blocks)
+  uint32_t chunkRows = ASSET_WRITE_CHUNK / bytesPerRow;
+  for (uint32_t row = 0; row < blockRows; row += chunkRows) {
+    uint32_t nrows = std::min(chunkRows, blockRows - row);
+    wgpu::ImageCopyTexture dst;
+    dst.texture = texture;
+    dst.origin = { 0, row * blockHeight, 0 };
+    wgpu::TextureDataLayout layout;
+    layout.bytesPerRow = bytesPerRow;
+    layout.rowsPerImage = nrows;
+    wgpu::Extent3D extent = { width, nrows * blockHeight, 1 };
+    queue.WriteTexture(
+      &dst, (const uint8_t*)data + (size_t)row * bytesPerRow, (size_t)nrows * bytesPerRow,
+      &layout, &extent);
+  }
+  misses++;
+  bytesSent += size;
+  return texture;
+}
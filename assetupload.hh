@@ -0,0 +1,59 @@
+#pragma once
+#include "protocol.hh"
+#include "assetpack.hh"
+#include <dawn/webgpu_cpp.h>
+#include <stdint.h>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// ASSET_WRITE_CHUNK is the largest write a miss is uploaded with, so that each fits in a
+// wire command buffer
+#define ASSET_WRITE_CHUNK (64*1024)
+
+// AssetUploader (client) creates buffers and textures from data which the server may
+// have in its asset store (see assetpack.hh.) For assets the server has, only their hash
+// is sent and the server uploads the data from its mapped packs; the others ("misses")
+// are uploaded with WriteBuffer or WriteTexture.
+//
+// Whether the server has an asset is known once it has answered a query, so query the
+// assets an app uses early, e.g. right after connecting. Objects created before the
+// answer arrives are misses.
+//
+// Example:
+//   uploader.query(proto, { { font, fontSize }, { mesh, meshSize } });
+//   ...
+//   wgpu::Buffer vb = uploader.createBuffer(
+//     proto, device, wgpu::BufferUsage::Vertex, mesh, meshSize);
+//
+struct AssetUploader {
+  uint32_t hits = 0;         // objects the server made from its assets
+  uint32_t misses = 0;       // objects whose data was sent
+  uint64_t bytesAvoided = 0; // asset bytes not sent thanks to hits
+  uint64_t bytesSent = 0;    // asset bytes sent for misses
+
+  // query asks the server which of the assets it has, and sets proto.onAssetQueryReply
+  // to take the answer. Returns false if the query could not be sent.
+  bool query(DawnRemoteProtocol& proto, const std::vector<AssetData>& assets);
+  bool answered() const { return _pending.empty(); } // all queries have been answered
+  bool has(uint64_t hash, uint64_t size) const;      // the server has the asset
+
+  // createBuffer creates a buffer of usage (plus CopyDst) holding size bytes of data.
+  // Its size is rounded up to a multiple of 4.
+  wgpu::Buffer createBuffer(
+    DawnRemoteProtocol& proto, const wgpu::Device& device, wgpu::BufferUsage usage,
+    const void* data, size_t size);
+
+  // createTexture creates a width x height texture of format (see assetTextureSize) with
+  // one mip level and usage Sampled, CopyDst and CopySrc, holding data (rows packed.)
+  // Returns null if the format or size is not supported, or a row of blocks is larger
+  // than ASSET_WRITE_CHUNK.
+  wgpu::Texture createTexture(
+    DawnRemoteProtocol& proto, dawn_wire::WireClient* wireClient, const wgpu::Device& device,
+    wgpu::TextureFormat format, uint32_t width, uint32_t height, const void* data);
+
+  // internal
+  std::deque<std::vector<DawnRemoteProtocol::AssetRef>> _pending; // awaiting an answer
+  std::unordered_map<uint64_t,uint64_t> _found; // hash => size of assets the server has
+  void onQueryReply(const uint8_t* found, size_t n);
+};
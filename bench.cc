@@ -0,0 +1,1056 @@
+#include "bench.hh"
+
+#include "utils/ComboRenderPipelineDescriptor.h"
+#include "utils/WGPUHelpers.h"
+
+#include <dawn/dawn_proc.h>
+#include <dawn_wire/WireClient.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DLOG_PREFIX "\e[1;35m[bench]\e[0m "
+
+#ifdef DEBUG
+  #define dlog(format, ...) ({ \
+    fprintf(stderr, DLOG_PREFIX format " \e[2m(%s %d)\e[0m\n", \
+      ##__VA_ARGS__, __FUNCTION__, __LINE__); \
+    fflush(stderr); \
+  })
+#else
+  #define dlog(...) do{}while(0)
+#endif
+
+#define errlog(format, ...) \
+  (({ fprintf(stderr, "E " format "\n", ##__VA_ARGS__); fflush(stderr); }))
+
+
+struct BenchEntry {
+  const char* name;
+  const char* description;
+  BenchFn     fn;
+};
+
+static std::vector<BenchEntry>& benchmarks() {
+  static std::vector<BenchEntry> v; // function-local since BENCH runs in constructors
+  return v;
+}
+
+void benchRegister(const char* name, const char* description, BenchFn fn) {
+  benchmarks().push_back({ name, description, fn });
+}
+
+
+static void jsonWriteString(FILE* f, const char* s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    char c = *s;
+    if (c == '"' || c == '\\') {
+      fputc('\\', f);
+      fputc(c, f);
+    } else if ((unsigned char)c < 0x20) {
+      fprintf(f, "\\u%04x", c);
+    } else {
+      fputc(c, f);
+    }
+  }
+  fputc('"', f);
+}
+
+void BenchContext::result(
+  const char* name, double value, const char* unit, const std::string& params)
+{
+  fprintf(stderr, "%-8s %-28s %14.3f %-6s %s%s\n",
+    bench, name, value, unit, params.c_str(), warmingUp ? " (warm-up)" : "");
+  if (warmingUp)
+    return;
+  for (BenchResult& r : results) {
+    if (r.bench == bench && r.name == name && r.params == params) {
+      r.samples.push_back(value);
+      return;
+    }
+  }
+  results.push_back({ bench, name, unit, params, { value } });
+}
+
+uint32_t BenchContext::random() {
+  // xorshift64*
+  _rand ^= _rand >> 12;
+  _rand ^= _rand << 25;
+  _rand ^= _rand >> 27;
+  return (uint32_t)((_rand * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+
+// ----------------------------------------------------------------------------------------
+// results & baselines
+
+// BENCH_SCHEMA_VERSION is the version of the JSON results document (see README.md)
+#define BENCH_SCHEMA_VERSION 1
+
+// BENCH_NOISE_K is how many standard errors a change must exceed to count
+#define BENCH_NOISE_K 3.0
+
+struct BenchStats {
+  double mean = 0, stddev = 0, min = 0, max = 0;
+  size_t n = 0;
+};
+
+static BenchStats benchStats(const std::vector<double>& samples) {
+  BenchStats s;
+  s.n = samples.size();
+  if (s.n == 0)
+    return s;
+  s.min = s.max = samples[0];
+  for (double v : samples) {
+    s.mean += v;
+    s.min = std::min(s.min, v);
+    s.max = std::max(s.max, v);
+  }
+  s.mean /= (double)s.n;
+  if (s.n > 1) {
+    double ss = 0;
+    for (double v : samples)
+      ss += (v - s.mean) * (v - s.mean);
+    s.stddev = sqrt(ss / (double)(s.n - 1));
+  }
+  return s;
+}
+
+// writeParams writes params "k1=v1,k2=v2" as JSON object members "k1": "v1", "k2": "v2"
+static void writeParams(FILE* out, const std::string& params) {
+  size_t start = 0;
+  bool first = true;
+  while (start < params.size()) {
+    size_t end = params.find(',', start);
+    if (end == std::string::npos)
+      end = params.size();
+    std::string kv = params.substr(start, end - start);
+    size_t eq = kv.find('=');
+    if (!kv.empty()) {
+      fprintf(out, "%s", first ? "" : ", ");
+      jsonWriteString(out, kv.substr(0, eq).c_str());
+      fprintf(out, ": ");
+      jsonWriteString(out, eq == std::string::npos ? "" : kv.substr(eq + 1).c_str());
+      first = false;
+    }
+    start = end + 1;
+  }
+}
+
+static void writeResults(FILE* out, const BenchContext& ctx, uint32_t repeat, uint32_t warmup) {
+  fprintf(out, "{\n  \"schema\": %d,\n", BENCH_SCHEMA_VERSION);
+  fprintf(out, "  \"seed\": %u, \"repeat\": %u, \"warmup\": %u, \"quick\": %s,\n",
+    ctx.seed, repeat, warmup, ctx.quick ? "true" : "false");
+  fprintf(out, "  \"results\": [");
+  for (size_t i = 0; i < ctx.results.size(); i++) {
+    const BenchResult& r = ctx.results[i];
+    BenchStats s = benchStats(r.samples);
+    fprintf(out, "%s\n    {\"bench\": ", i == 0 ? "" : ",");
+    jsonWriteString(out, r.bench.c_str());
+    fprintf(out, ", \"name\": ");
+    jsonWriteString(out, r.name.c_str());
+    fprintf(out, ", \"unit\": ");
+    jsonWriteString(out, r.unit.c_str());
+    fprintf(out, ", \"params\": {");
+    writeParams(out, r.params);
+    fprintf(out, "}, \"value\": %.17g, \"stddev\": %.17g, \"min\": %.17g, \"max\": %.17g",
+      s.mean, s.stddev, s.min, s.max);
+    fprintf(out, ", \"samples\": [");
+    for (size_t j = 0; j < r.samples.size(); j++)
+      fprintf(out, "%s%.17g", j == 0 ? "" : ", ", r.samples[j]);
+    fprintf(out, "]}");
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+// Json is a parsed JSON value; just enough to read back result documents
+struct Json {
+  enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+  double                                  num = 0;
+  std::string                             str;
+  std::vector<Json>                       items;
+  std::vector<std::pair<std::string,Json>> fields;
+
+  const Json* get(const char* key) const {
+    for (auto& f : fields) {
+      if (f.first == key)
+        return &f.second;
+    }
+    return nullptr;
+  }
+};
+
+static void jsonSkipSpace(const char*& p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+    p++;
+}
+
+static bool jsonParseString(const char*& p, const char* end, std::string& s) {
+  if (p >= end || *p != '"')
+    return false;
+  for (p++; p < end && *p != '"'; p++) {
+    if (*p != '\\') {
+      s += *p;
+      continue;
+    }
+    if (++p >= end)
+      return false;
+    switch (*p) {
+      case 'n': s += '\n'; break;
+      case 't': s += '\t'; break;
+      case 'r': s += '\r'; break;
+      case 'b': s += '\b'; break;
+      case 'f': s += '\f'; break;
+      case 'u': {
+        if (end - p < 5)
+          return false;
+        unsigned c = (unsigned)strtoul(std::string(p + 1, 4).c_str(), nullptr, 16);
+        s += c < 0x80 ? (char)c : '?'; // only control characters are escaped by us
+        p += 4;
+        break;
+      }
+      default: s += *p; break;
+    }
+  }
+  if (p >= end)
+    return false;
+  p++;
+  return true;
+}
+
+static bool jsonParse(const char*& p, const char* end, Json& v) {
+  jsonSkipSpace(p, end);
+  if (p >= end)
+    return false;
+  if (*p == '{' || *p == '[') {
+    bool object = *p == '{';
+    v.type = object ? Json::Object : Json::Array;
+    p++;
+    jsonSkipSpace(p, end);
+    if (p < end && *p == (object ? '}' : ']')) {
+      p++;
+      return true;
+    }
+    while (true) {
+      Json item;
+      if (object) {
+        std::string key;
+        jsonSkipSpace(p, end);
+        if (!jsonParseString(p, end, key))
+          return false;
+        jsonSkipSpace(p, end);
+        if (p >= end || *p++ != ':' || !jsonParse(p, end, item))
+          return false;
+        v.fields.emplace_back(key, std::move(item));
+      } else {
+        if (!jsonParse(p, end, item))
+          return false;
+        v.items.push_back(std::move(item));
+      }
+      jsonSkipSpace(p, end);
+      if (p < end && *p == ',') {
+        p++;
+      } else if (p < end && *p == (object ? '}' : ']')) {
+        p++;
+        return true;
+      } else {
+        return false;
+      }
+    }
+  }
+  if (*p == '"') {
+    v.type = Json::String;
+    return jsonParseString(p, end, v.str);
+  }
+  for (const char* lit : { "true", "false", "null" }) {
+    size_t len = strlen(lit);
+    if ((size_t)(end - p) >= len && memcmp(p, lit, len) == 0) {
+      v.type = lit[0] == 'n' ? Json::Null : Json::Bool;
+      v.num = lit[0] == 't';
+      p += len;
+      return true;
+    }
+  }
+  char* numend;
+  std::string tmp(p, std::min((size_t)(end - p), (size_t)64));
+  v.type = Json::Number;
+  v.num = strtod(tmp.c_str(), &numend);
+  if (numend == tmp.c_str())
+    return false;
+  p += numend - tmp.c_str();
+  return true;
+}
+
+// readBaseline reads the results of a JSON document written by writeResults
+static bool readBaseline(const char* filename, std::vector<BenchResult>* results) {
+  FILE* f = fopen(filename, "r");
+  if (!f)
+    return false;
+  std::string data;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.append(buf, n);
+  fclose(f);
+  Json doc;
+  const char* p = data.data();
+  errno = EINVAL;
+  if (!jsonParse(p, data.data() + data.size(), doc) || doc.type != Json::Object)
+    return false;
+  const Json* items = doc.get("results");
+  if (!items || items->type != Json::Array)
+    return false;
+  for (const Json& item : items->items) {
+    const Json* bench = item.get("bench");
+    const Json* name = item.get("name");
+    const Json* unit = item.get("unit");
+    const Json* params = item.get("params");
+    const Json* value = item.get("value");
+    const Json* samples = item.get("samples");
+    if (!bench || !name || !value)
+      return false;
+    BenchResult r = { bench->str, name->str, unit ? unit->str : "", "", {} };
+    if (params) {
+      for (auto& kv : params->fields)
+        r.params += (r.params.empty() ? "" : ",") + kv.first + "=" + kv.second.str;
+    }
+    if (samples && !samples->items.empty()) {
+      for (const Json& s : samples->items)
+        r.samples.push_back(s.num);
+    } else {
+      r.samples.push_back(value->num); // older documents have one value per result
+    }
+    results->push_back(std::move(r));
+  }
+  return true;
+}
+
+// resultDirection returns 1 if higher values of a result are better, -1 if lower values
+// are better and 0 if it is informational and not compared, based on its unit
+static int resultDirection(const std::string& unit) {
+  if (unit.size() > 2 && unit.compare(unit.size() - 2, 2, "/s") == 0)
+    return 1;
+  if (unit == "s" || unit == "ms" || unit == "us" || unit == "ns" || unit == "bytes")
+    return -1;
+  return 0;
+}
+
+// compareBaseline prints a table comparing results with baseline and returns the number
+// of regressions. A change counts when it is larger than threshold (a fraction of the
+// baseline) and than BENCH_NOISE_K standard errors of the difference of the means.
+static int compareBaseline(
+  const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline,
+  double threshold)
+{
+  int regressions = 0, improvements = 0, compared = 0;
+  fprintf(stderr, "\n%-10s %-30s %-32s %12s %12s %8s %8s  %s\n",
+    "bench", "result", "params", "baseline", "current", "change", "noise", "status");
+  for (const BenchResult& r : results) {
+    const BenchResult* b = nullptr;
+    for (const BenchResult& br : baseline) {
+      if (br.bench == r.bench && br.name == r.name && br.params == r.params) {
+        b = &br;
+        break;
+      }
+    }
+    BenchStats cs = benchStats(r.samples);
+    std::string label = r.name + (r.unit.empty() ? "" : " (" + r.unit + ")");
+    if (!b) {
+      fprintf(stderr, "%-10s %-30s %-32s %12s %12.4g %8s %8s  new\n",
+        r.bench.c_str(), label.c_str(), r.params.c_str(), "-", cs.mean, "", "");
+      continue;
+    }
+    BenchStats bs = benchStats(b->samples);
+    int dir = resultDirection(r.unit);
+    double change = bs.mean != 0 ? (cs.mean - bs.mean) / fabs(bs.mean) : 0;
+    double se = sqrt(bs.stddev * bs.stddev / (double)bs.n + cs.stddev * cs.stddev / (double)cs.n);
+    double noise = bs.mean != 0 ? BENCH_NOISE_K * se / fabs(bs.mean) : 0;
+    double tolerance = std::max(threshold, noise);
+    const char* status = "ok";
+    if (dir == 0) {
+      status = "info";
+    } else {
+      compared++;
+      if (change * dir < -tolerance) {
+        status = "REGRESSED";
+        regressions++;
+      } else if (change * dir > tolerance) {
+        status = "improved";
+        improvements++;
+      }
+    }
+    fprintf(stderr, "%-10s %-30s %-32s %12.4g %12.4g %+7.1f%% %7.1f%%  %s\n",
+      r.bench.c_str(), label.c_str(), r.params.c_str(), bs.mean, cs.mean,
+      change * 100.0, noise * 100.0, status);
+  }
+  // results of benchmarks which ran but no longer report them
+  for (const BenchResult& br : baseline) {
+    bool ran = false, found = false;
+    for (const BenchResult& r : results) {
+      ran |= r.bench == br.bench;
+      found |= r.bench == br.bench && r.name == br.name && r.params == br.params;
+    }
+    if (ran && !found) {
+      std::string label = br.name + (br.unit.empty() ? "" : " (" + br.unit + ")");
+      fprintf(stderr, "%-10s %-30s %-32s %12.4g %12s %8s %8s  missing\n",
+        br.bench.c_str(), label.c_str(), br.params.c_str(), benchStats(br.samples).mean,
+        "-", "", "");
+    }
+  }
+  fprintf(stderr, "\n%d results compared: %d regressed, %d improved (threshold %.1f%%)\n",
+    compared, regressions, improvements, threshold * 100.0);
+  return regressions;
+}
+
+
+// ----------------------------------------------------------------------------------------
+// BenchServer
+
+static double monotime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int connectUNIXSocket(const char* filename) {
+  sockaddr_un addr;
+  addr.sun_family = AF_UNIX;
+  size_t len = strlen(filename);
+  if (len > sizeof(addr.sun_path)-1) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(addr.sun_path, filename, len + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd > -1 && ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    int e = errno;
+    ::close(fd);
+    errno = e;
+    fd = -1;
+  }
+  return fd;
+}
+
+bool BenchServer::start(const BenchContext& ctx, const std::vector<std::string>& args) {
+  char tmpl[] = "/tmp/dawn-bench-XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return false;
+  }
+  dir = tmpl;
+  sockfile = dir + "/server.sock";
+  metricsfile = dir + "/metrics.txt";
+
+  std::vector<std::string> argstrs = { ctx.serverPath, "-headless", "-metrics=" + metricsfile };
+  argstrs.insert(argstrs.end(), args.begin(), args.end());
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    // child
+    if (chdir(dir.c_str()) != 0)
+      _exit(127);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull > -1 && getenv("BENCH_SERVER_LOG") == nullptr)
+      dup2(devnull, 2);
+    std::vector<char*> argv;
+    for (auto& s : argstrs)
+      argv.push_back((char*)s.c_str());
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+
+  // wait for the server to accept connections
+  double deadline = monotime() + 10.0;
+  while (monotime() < deadline) {
+    int fd = connectUNIXSocket(sockfile.c_str());
+    if (fd > -1) {
+      ::close(fd);
+      return true;
+    }
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+      errlog("server %s exited during startup (status %d)", ctx.serverPath.c_str(), status);
+      pid = -1;
+      return false;
+    }
+    usleep(10000);
+  }
+  errlog("timeout waiting for server to start");
+  stop();
+  return false;
+}
+
+void BenchServer::stop() {
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    int status;
+    double deadline = monotime() + 5.0;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+      if (monotime() > deadline) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        break;
+      }
+      usleep(10000);
+    }
+    pid = -1;
+  }
+  if (!dir.empty()) {
+    unlink(sockfile.c_str());
+    unlink(metricsfile.c_str());
+    rmdir(dir.c_str());
+    dir.clear();
+  }
+}
+
+bool BenchServer::metrics(std::map<std::string,double>* m, double timeout) {
+  unlink(metricsfile.c_str());
+  kill(pid, SIGUSR1);
+  double deadline = monotime() + timeout;
+  FILE* f = nullptr;
+  while ((f = fopen(metricsfile.c_str(), "r")) == nullptr) {
+    if (monotime() > deadline)
+      return false;
+    usleep(5000);
+  }
+  char name[256];
+  double value;
+  while (fscanf(f, "%255s %lf", name, &value) == 2)
+    (*m)[name] = value;
+  fclose(f);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------------------
+// BenchClient
+
+BenchClient::BenchClient() {
+  clearColorParam = frameTemplate.param("clear_color", sizeof(wgpu::Color));
+  proto.onFrame = [this]() {
+    if (render && ready())
+      renderFrame();
+  };
+  proto.onDawnBuffer = [this](const char* data, size_t len) {
+    if (wireClient->HandleCommands(data, len) == nullptr)
+      dlog("wireClient->HandleCommands FAILED");
+  };
+  proto.onFramebufferInfo = [this](const DawnRemoteProtocol::FramebufferInfo& fbinfo) {
+    if (!swapchain)
+      reserveSwapChain();
+  };
+}
+
+BenchClient::~BenchClient() {
+  close();
+}
+
+bool BenchClient::connect(RunLoop* rl, const char* sockfile) {
+  int fd = connectUNIXSocket(sockfile);
+  if (fd < 0)
+    return false;
+  return connectFD(rl, fd);
+}
+
+bool BenchClient::connectFD(RunLoop* rl, int fd_) {
+  fd = fd_;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  dawn_wire::WireClientDescriptor clientDesc = {};
+  clientDesc.serializer = &proto;
+  wireClient = new dawn_wire::WireClient(clientDesc);
+  deviceReservation = wireClient->ReserveDevice();
+  device = wgpu::Device::Acquire(deviceReservation.device);
+
+  static bool procsInstalled = false;
+  if (!procsInstalled) {
+    DawnProcTable procs = dawn_wire::client::GetProcs();
+    dawnProcSetProcs(&procs);
+    procsInstalled = true;
+  }
+
+  proto.start(rl, fd);
+  if (zeroRTT) {
+    proto.sendHello();
+    reserveSwapChain();
+  }
+  return true;
+}
+
+void BenchClient::reserveSwapChain() {
+  swapchainReservation = wireClient->ReserveSwapChain(device.Get());
+  swapchain = wgpu::SwapChain::Acquire(swapchainReservation.swapchain);
+  proto.sendReservation(swapchainReservation);
+}
+
+void BenchClient::close() {
+  proto.stop();
+  if (fd > -1) {
+    ::close(fd);
+    fd = -1;
+  }
+  if (wireClient) {
+    pipeline.Release();
+    renderTarget = RenderScaleTarget();
+    device.Release();
+    swapchain.Release();
+    delete wireClient;
+    wireClient = nullptr;
+  }
+}
+
+static wgpu::RenderPipeline createTrianglePipeline(const wgpu::Device& device) {
+  utils::ComboRenderPipelineDescriptor2 desc;
+  desc.vertex.module = utils::CreateShaderModule(device, R"(
+    let pos : array<vec2<f32>, 3> = array<vec2<f32>, 3>(
+        vec2<f32>( 0.0,  0.5),
+        vec2<f32>(-0.5, -0.5),
+        vec2<f32>( 0.5, -0.5)
+    );
+    [[stage(vertex)]] fn main(
+        [[builtin(vertex_index)]] VertexIndex : u32
+    ) -> [[builtin(position)]] vec4<f32> {
+        return vec4<f32>(pos[VertexIndex], 0.0, 1.0);
+    }
+  )");
+  desc.cFragment.module = utils::CreateShaderModule(device, R"(
+    [[stage(fragment)]] fn main() -> [[location(0)]] vec4<f32> {
+        return vec4<f32>(1.0, 0.0, 0.7, 1.0);
+    }
+  )");
+  desc.cTargets[0].format = wgpu::TextureFormat::BGRA8Unorm;
+  return device.CreateRenderPipeline2(&desc);
+}
+
+void BenchClient::renderFrame() {
+  if (draws > 0 && !pipeline)
+    pipeline = createTrianglePipeline(device);
+
+  wgpu::Color clearColor = {0.1f * (float)(frames % 10), 0.5f, 0.5f, 1.0f};
+  if (!useTemplate || !frameTemplate.recorded())
+    renderTarget.setScale(proto, wireClient, device, renderScale);
+  if (useTemplate && !frameTemplate.recorded()) {
+    // objects the frame creates are released when encodeFrame returns, within the recording
+    if (!frameTemplate.record(proto, [&]() {
+      encodeFrame(frameTemplate.placeholder<wgpu::Color>(clearColorParam));
+    })) {
+      dlog("recording frame template failed; sending frames as is");
+      useTemplate = false;
+    }
+  }
+  if (useTemplate) {
+    frameTemplate.set(clearColorParam, clearColor);
+    frameTemplate.instantiate(proto);
+  } else {
+    encodeFrame(clearColor);
+  }
+  proto.Flush();
+  frames++;
+}
+
+void BenchClient::encodeFrame(const wgpu::Color& clearColor) {
+  wgpu::RenderPassColorAttachmentDescriptor colorAttachment;
+  colorAttachment.view = renderTarget.view(swapchain);
+  colorAttachment.clearColor = clearColor;
+  colorAttachment.loadOp = wgpu::LoadOp::Clear;
+  colorAttachment.storeOp = wgpu::StoreOp::Store;
+
+  wgpu::RenderPassDescriptor renderPassDesc;
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorAttachment;
+
+  wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+  wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&renderPassDesc);
+  renderTarget.setViewport(pass);
+  if (draws > 0) {
+    pass.SetPipeline(pipeline);
+    for (uint32_t i = 0; i < draws; i++)
+      pass.Draw(3);
+  }
+  pass.EndPass();
+  wgpu::CommandBuffer commands = encoder.Finish();
+  device.GetQueue().Submit(1, &commands);
+  swapchain.Present();
+}
+
+
+// ----------------------------------------------------------------------------------------
+// BenchDelayProxy
+
+static void delayProxyFlush(BenchDelayProxy::Flow* f);
+
+static void delayProxyOnRead(RunLoop* rl, ev_io* w, int revents) {
+  auto f = (BenchDelayProxy::Flow*)w->data;
+  BenchDelayProxy* proxy = f->proxy;
+  char buf[65536];
+  // read no more than the link sends in a millisecond, so that data trickles out
+  size_t maxlen = sizeof(buf);
+  if (proxy->bandwidth > 0)
+    maxlen = std::min(maxlen, std::max((size_t)1024, (size_t)(proxy->bandwidth / 1000)));
+  ssize_t n = ::read(f->rfd, buf, maxlen);
+  if (n < 0 && errno == EAGAIN)
+    return;
+  if (n <= 0) {
+    f->eof = true;
+    ev_io_stop(rl, &f->rio);
+  } else {
+    double due = monotime();
+    if (proxy->bandwidth > 0) {
+      f->linkFree = std::max(f->linkFree, due) + (double)n / proxy->bandwidth;
+      due = f->linkFree;
+      f->qbytes += (size_t)n;
+      if (f->qbytes >= proxy->queueLimit)
+        ev_io_stop(rl, &f->rio); // queue is full; resumed by delayProxyFlush
+    }
+    f->q.emplace_back(due + proxy->delay, std::string(buf, (size_t)n));
+  }
+  delayProxyFlush(f);
+}
+
+static void delayProxyOnWritable(RunLoop* rl, ev_io* w, int revents) {
+  delayProxyFlush((BenchDelayProxy::Flow*)w->data);
+}
+
+static void delayProxyOnTimer(RunLoop* rl, ev_timer* w, int revents) {
+  delayProxyFlush((BenchDelayProxy::Flow*)w->data);
+}
+
+// delayProxyFlush writes queued data which is due and arranges to be called again
+// when more data becomes due or the socket becomes writable
+static void delayProxyFlush(BenchDelayProxy::Flow* f) {
+  RunLoop* rl = f->proxy->_rl;
+  ev_io_stop(rl, &f->wio);
+  ev_timer_stop(rl, &f->timer);
+  double now = monotime();
+  while (!f->q.empty() && f->q.front().first <= now) {
+    const std::string& data = f->q.front().second;
+    ssize_t n = ::write(f->wfd, data.data() + f->woffs, data.size() - f->woffs);
+    if (n < 0) {
+      if (errno == EAGAIN) {
+        ev_io_start(rl, &f->wio);
+        return;
+      }
+      f->q.clear(); // peer is gone
+      break;
+    }
+    f->woffs += (size_t)n;
+    if (f->woffs == data.size()) {
+      f->qbytes -= std::min(f->qbytes, data.size());
+      f->q.pop_front();
+      f->woffs = 0;
+    }
+  }
+  if (f->proxy->bandwidth > 0 && !f->eof && f->qbytes < f->proxy->queueLimit)
+    ev_io_start(rl, &f->rio);
+  if (!f->q.empty()) {
+    ev_timer_set(&f->timer, f->q.front().first - now, 0.0);
+    ev_timer_start(rl, &f->timer);
+  } else if (f->eof) {
+    shutdown(f->wfd, SHUT_WR);
+  }
+}
+
+static void delayProxyOnAccept(RunLoop* rl, ev_io* w, int revents) {
+  auto proxy = (BenchDelayProxy*)w->data;
+  int down = accept(proxy->_fd, nullptr, nullptr);
+  if (down < 0)
+    return;
+  int up = connectUNIXSocket(proxy->_upstream.c_str());
+  if (up < 0) {
+    perror("BenchDelayProxy connect");
+    ::close(down);
+    return;
+  }
+  int fds[2][2] = { { down, up }, { up, down } };
+  for (auto& rw : fds) {
+    fcntl(rw[0], F_SETFL, fcntl(rw[0], F_GETFL) | O_NONBLOCK);
+    auto f = new BenchDelayProxy::Flow();
+    f->proxy = proxy;
+    f->rfd = rw[0];
+    f->wfd = rw[1];
+    ev_io_init(&f->rio, delayProxyOnRead, f->rfd, EV_READ);
+    ev_io_init(&f->wio, delayProxyOnWritable, f->wfd, EV_WRITE);
+    ev_init(&f->timer, delayProxyOnTimer);
+    f->rio.data = f->wio.data = f->timer.data = f;
+    ev_io_start(rl, &f->rio);
+    proxy->_flows.push_back(f);
+  }
+}
+
+bool BenchDelayProxy::start(RunLoop* rl, const std::string& dir, const std::string& upstream) {
+  sockfile = dir + "/proxy.sock";
+  _upstream = upstream;
+  sockaddr_un addr;
+  addr.sun_family = AF_UNIX;
+  if (sockfile.size() > sizeof(addr.sun_path)-1) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  memcpy(addr.sun_path, sockfile.c_str(), sockfile.size() + 1);
+  unlink(sockfile.c_str());
+  _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_fd < 0 ||
+      bind(_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(_fd, 16) != 0)
+  {
+    stop();
+    return false;
+  }
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+  _rl = rl;
+  ev_io_init(&_io, delayProxyOnAccept, _fd, EV_READ);
+  _io.data = this;
+  ev_io_start(rl, &_io);
+  return true;
+}
+
+void BenchDelayProxy::stop() {
+  if (_rl) {
+    ev_io_stop(_rl, &_io);
+    for (Flow* f : _flows) {
+      ev_io_stop(_rl, &f->rio);
+      ev_io_stop(_rl, &f->wio);
+      ev_timer_stop(_rl, &f->timer);
+      ::close(f->rfd); // each fd is the rfd of exactly one flow
+      delete f;
+    }
+    _flows.clear();
+    _rl = nullptr;
+  }
+  if (_fd > -1) {
+    ::close(_fd);
+    _fd = -1;
+    unlink(sockfile.c_str());
+  }
+}
+
+
+// ----------------------------------------------------------------------------------------
+// helpers
+
+static void onRunLoopTimeout(RunLoop* rl, ev_timer* w, int revents) {
+  ev_break(rl, EVBREAK_ONE);
+}
+
+void benchRunLoopFor(RunLoop* rl, double seconds) {
+  ev_timer timer;
+  ev_timer_init(&timer, onRunLoopTimeout, seconds, 0.0);
+  ev_timer_start(rl, &timer);
+  ev_run(rl, 0);
+  ev_timer_stop(rl, &timer);
+}
+
+bool benchRunLoopUntil(RunLoop* rl, double timeout, std::function<bool()> cond) {
+  double deadline = monotime() + timeout;
+  while (!cond()) {
+    if (monotime() > deadline)
+      return false;
+    benchRunLoopFor(rl, 0.01);
+  }
+  return true;
+}
+
+int benchConnectUNIX(const char* sockfile) {
+  return connectUNIXSocket(sockfile);
+}
+
+int benchConnectTCP(const char* host, int port) {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd > -1 && ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    int e = errno;
+    ::close(fd);
+    errno = e;
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+int benchFreeTCPPort() {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  int port = -1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd > -1 &&
+      bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+      getsockname(fd, (struct sockaddr*)&addr, &len) == 0)
+  {
+    port = ntohs(addr.sin_port);
+  }
+  if (fd > -1)
+    ::close(fd);
+  return port;
+}
+
+
+// ----------------------------------------------------------------------------------------
+// main
+
+// The suite run when no benchmark names are given: ring buffer, protocol throughput,
+// RTT, replay and load. Others (e.g. mem, stream) are slow or need special setups and
+// are run by name or with "all".
+static const char* kSuite[] = { "pipe", "throughput", "rtt", "replay", "load" };
+
+static bool inSuite(const char* name) {
+  for (const char* s : kSuite) {
+    if (strcmp(s, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+    "usage: %s [options] [<benchmark> ... | all]\n"
+    "Runs the default suite (see -list) when no benchmarks are named.\n"
+    "options:\n"
+    "  -o=<file>          Write JSON results to <file> instead of stdout\n"
+    "  -server=<path>     Server program (default: \"server\" next to this program)\n"
+    "  -quick             Use smaller parameters (smoke test; implies -repeat=1 -warmup=0)\n"
+    "  -repeat=<n>        Run each benchmark n times and aggregate results (default: 3)\n"
+    "  -warmup=<n>        Discard the results of n runs before that (default: 1)\n"
+    "  -seed=<n>          Seed of the random data benchmarks use (default: 1)\n"
+    "  -baseline=<file>   Compare results with those of an earlier run and exit with\n"
+    "                     status 2 if any regressed\n"
+    "  -threshold=<pct>   Smallest change that counts as a regression (default: 5)\n"
+    "  -list              List benchmarks and exit\n"
+    "  -h, -help          Show help and exit\n",
+    prog);
+}
+
+int main(int argc, const char* argv[]) {
+  BenchContext ctx;
+  const char* outfile = nullptr;
+  const char* baselineFile = nullptr;
+  double threshold = 5.0;
+  int repeat = -1, warmup = -1; // -1 = default
+  std::vector<std::string> names;
+
+  { // default server path is next to this program
+    std::string self = argv[0];
+    size_t slash = self.rfind('/');
+    ctx.serverPath = (slash == std::string::npos ? std::string(".") : self.substr(0, slash))
+                   + "/server";
+  }
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "-o=", 3) == 0) {
+      outfile = &arg[3];
+    } else if (strncmp(arg, "-server=", 8) == 0) {
+      ctx.serverPath = &arg[8];
+    } else if (strcmp(arg, "-quick") == 0) {
+      ctx.quick = true;
+    } else if (strncmp(arg, "-repeat=", 8) == 0) {
+      repeat = std::max(1, atoi(&arg[8]));
+    } else if (strncmp(arg, "-warmup=", 8) == 0) {
+      warmup = std::max(0, atoi(&arg[8]));
+    } else if (strncmp(arg, "-seed=", 6) == 0) {
+      ctx.seed = (uint32_t)strtoul(&arg[6], nullptr, 10);
+    } else if (strncmp(arg, "-baseline=", 10) == 0) {
+      baselineFile = &arg[10];
+    } else if (strncmp(arg, "-threshold=", 11) == 0) {
+      threshold = atof(&arg[11]);
+    } else if (strcmp(arg, "-list") == 0) {
+      for (auto& b : benchmarks())
+        printf("%-12s %s %s\n", b.name, inSuite(b.name) ? "*" : " ", b.description);
+      printf("(* = in the default suite)\n");
+      return 0;
+    } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0 || strcmp(arg, "--help") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else if (arg[0] == '-') {
+      fprintf(stderr, "%s: unknown option %s (see %s -help)\n", argv[0], arg, argv[0]);
+      return 1;
+    } else {
+      names.push_back(arg);
+    }
+  }
+  if (repeat < 0)
+    repeat = ctx.quick ? 1 : 3;
+  if (warmup < 0)
+    warmup = ctx.quick ? 0 : 1;
+  bool all = std::find(names.begin(), names.end(), "all") != names.end();
+  for (auto& name : names) {
+    if (name == "all")
+      continue;
+    auto& v = benchmarks();
+    if (std::find_if(v.begin(), v.end(), [&](const BenchEntry& b) { return name == b.name; })
+        == v.end())
+    {
+      errlog("unknown benchmark %s (see %s -list)", name.c_str(), argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<BenchResult> baseline;
+  if (baselineFile && !readBaseline(baselineFile, &baseline)) {
+    errlog("%s: %s", baselineFile, errno == EINVAL ? "malformed results" : strerror(errno));
+    return 1;
+  }
+
+  // a disconnecting server must not kill us
+  signal(SIGPIPE, SIG_IGN);
+
+  int status = 0;
+  for (auto& b : benchmarks()) {
+    bool selected = names.empty() ? inSuite(b.name) :
+                    all || std::find(names.begin(), names.end(), b.name) != names.end();
+    if (!selected)
+      continue;
+    ctx.bench = b.name;
+    for (int run = 0; run < warmup + repeat; run++) {
+      ctx.warmingUp = run < warmup;
+      ctx._rand = 0x9E3779B97F4A7C15ull ^ ctx.seed;
+      if (b.fn(ctx) != 0) {
+        errlog("benchmark %s failed", b.name);
+        status = 1;
+        break;
+      }
+    }
+  }
+  ctx.warmingUp = false;
+
+  FILE* out = outfile ? fopen(outfile, "w") : stdout;
+  if (out == nullptr) {
+    perror(outfile);
+    return 1;
+  }
+  writeResults(out, ctx, (uint32_t)repeat, (uint32_t)warmup);
+  if (outfile)
+    fclose(out);
+
+  if (baselineFile && compareBaseline(ctx.results, baseline, threshold / 100.0) > 0 && status == 0)
+    status = 2;
+  return status;
+}
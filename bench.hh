@@ -0,0 +1,164 @@
+#pragma once
+#include "protocol.hh"
+#include "cmdtemplate.hh"
+#include "upscale.hh"
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Benchmarks are registered with BENCH(name, description) and run by the bench program:
+//
+//   BENCH(mem, "memory footprint per connection") {
+//     ...
+//     ctx.result("rss", bytes, "bytes", "conns=10");
+//     return 0;
+//   }
+//
+// Each benchmark is run -warmup times with its results discarded, then -repeat times.
+// Results are aggregated over the repeats (mean, stddev, min, max) and written as one
+// JSON document; with -baseline=<file> they are compared against an earlier document
+// (see README.md, "Benchmarks".)
+
+struct BenchContext;
+typedef int(*BenchFn)(BenchContext& ctx);
+
+void benchRegister(const char* name, const char* description, BenchFn fn);
+
+#define BENCH(name, description) \
+  static int bench_##name(BenchContext& ctx); \
+  __attribute__((constructor)) static void bench_register_##name() { \
+    benchRegister(#name, description, bench_##name); \
+  } \
+  static int bench_##name(BenchContext& ctx)
+
+
+struct BenchResult {
+  std::string bench, name, unit, params;
+  std::vector<double> samples; // one per repeat
+};
+
+struct BenchContext {
+  const char*  bench = ""; // name of the running benchmark
+  std::string  serverPath; // path to the server program
+  bool         quick = false; // -quick: smaller parameters, for smoke testing
+  uint32_t     seed = 1;      // -seed: benchmarks draw random data from random()
+  bool         warmingUp = false; // results are discarded
+  std::vector<BenchResult> results;
+
+  // result records one measurement.
+  // params is a comma-separated list of key=value pairs describing the configuration,
+  // e.g. "mode=idle,conns=100"
+  void result(const char* name, double value, const char* unit, const std::string& params = "");
+
+  // random returns the next number of a generator which is reset to seed before each
+  // run of a benchmark, so that every run sees the same data
+  uint32_t random();
+  uint64_t _rand = 0;
+};
+
+
+// BenchServer runs a headless server process in a private temporary directory
+struct BenchServer {
+  pid_t       pid = -1;
+  std::string dir;         // working directory of the server
+  std::string sockfile;    // dir/server.sock
+  std::string metricsfile; // dir/metrics.txt
+
+  // start launches ctx.serverPath -headless -metrics=... with extra args and waits
+  // until it accepts connections.
+  bool start(const BenchContext& ctx, const std::vector<std::string>& args);
+  void stop();
+
+  // metrics asks the server for a metrics report (SIGUSR1) and parses it into m
+  bool metrics(std::map<std::string,double>* m, double timeout = 5.0);
+};
+
+
+// BenchClient is a minimal wire client connection, like the one in client.cc
+struct BenchClient {
+  DawnRemoteProtocol           proto;
+  int                          fd = -1;
+  dawn_wire::WireClient*       wireClient = nullptr;
+  wgpu::Device                 device;
+  wgpu::SwapChain              swapchain;
+  dawn_wire::ReservedDevice    deviceReservation;
+  dawn_wire::ReservedSwapChain swapchainReservation;
+  bool                         render = false; // render a frame on each frame signal
+  bool                         zeroRTT = true; // reserve at connect instead of after fbinfo
+  uint32_t                     draws = 0;      // draw calls per frame
+  uint32_t                     frames = 0;     // number of frames rendered
+  wgpu::RenderPipeline         pipeline;       // created on first use when draws > 0
+  bool                         useTemplate = false; // send frames as template instances
+  CommandTemplate              frameTemplate;  // recorded by the first frame with useTemplate
+  uint32_t                     clearColorParam; // of frameTemplate
+  float                        renderScale = 1.0f; // fixed once frameTemplate is recorded
+  RenderScaleTarget            renderTarget;
+
+  BenchClient();
+  ~BenchClient();
+
+  // connect connects to the server's UNIX socket and starts the wire client.
+  // With zeroRTT, hello and swapchain reservation are sent right away and the client
+  // is ready immediately; otherwise it reserves a swapchain when it receives fbinfo.
+  bool connect(RunLoop* rl, const char* sockfile);
+  bool connectFD(RunLoop* rl, int fd); // takes ownership of a connected socket
+  void close();
+  bool ready() const { return (bool)swapchain; } // made a swapchain reservation
+  void reserveSwapChain();
+
+  // renderFrame encodes a frame (one clear pass with `draws` triangles) and presents it
+  void renderFrame();
+  void encodeFrame(const wgpu::Color& clearColor);
+};
+
+// BenchDelayProxy accepts connections on its own UNIX socket and forwards them to
+// another one, delaying data in each direction by `delay` seconds (RTT = 2 * delay.)
+// With a bandwidth it also shapes each direction into a link of that rate, which
+// forwards data as it would have been serialized, with a bottleneck queue of
+// queueLimit bytes (the proxy stops reading while it is full.) It runs on the caller's
+// runloop.
+struct BenchDelayProxy {
+  double      delay = 0.025;
+  double      bandwidth = 0;         // bytes/s per direction (0 = unlimited)
+  size_t      queueLimit = 256*1024; // with bandwidth
+  std::string sockfile; // dir/proxy.sock
+
+  bool start(RunLoop* rl, const std::string& dir, const std::string& upstream);
+  void stop();
+
+  // internal
+  struct Flow {
+    BenchDelayProxy* proxy;
+    int              rfd, wfd;
+    ev_io            rio, wio;
+    ev_timer         timer;
+    std::deque<std::pair<double,std::string>> q; // data and when it may be written
+    size_t           woffs = 0;
+    bool             eof = false;
+    size_t           qbytes = 0;   // in q
+    double           linkFree = 0; // when the link has sent what's queued (bandwidth)
+  };
+  RunLoop*           _rl = nullptr;
+  int                _fd = -1;
+  ev_io              _io;
+  std::string        _upstream;
+  std::vector<Flow*> _flows;
+};
+
+// benchRunLoopFor runs the libev loop for the given number of seconds
+void benchRunLoopFor(RunLoop* rl, double seconds);
+
+// benchRunLoopUntil runs the libev loop until cond returns true or timeout seconds
+// have passed. Returns the value of cond.
+bool benchRunLoopUntil(RunLoop* rl, double timeout, std::function<bool()> cond);
+
+// benchConnectUNIX connects to a UNIX socket (blocking)
+int benchConnectUNIX(const char* sockfile);
+
+// benchConnectTCP connects to host:port over TCP (with TCP_NODELAY)
+int benchConnectTCP(const char* host, int port);
+
+// benchFreeTCPPort returns a TCP port on the loopback interface which is not in use
+int benchFreeTCPPort();
@@ -0,0 +1,153 @@
+// Asset packs: time and bytes sent for a client to create textures and buffers from
+// static assets over a shaped link, against a server without the assets (every asset
+// is uploaded) vs one with them in an asset pack (-assets; only hashes are sent.)
+#include "bench.hh"
+#include "assetupload.hh"
+#include "metrics.hh" // monotimeNs
+#include <unistd.h>
+
+#define TEXTURE_SIZE 512         // RGBA8 pixels square
+#define BUFFER_SIZE  (256*1024)
+
+static int measure(
+  BenchContext& ctx, RunLoop* rl, const std::string& pack,
+  const std::vector<std::vector<uint8_t>>& textures,
+  const std::vector<std::vector<uint8_t>>& buffers)
+{
+  BenchServer server;
+  std::vector<std::string> args;
+  if (!pack.empty())
+    args.push_back("-assets=" + pack);
+  if (!server.start(ctx, args))
+    return 1;
+  BenchDelayProxy proxy;
+  proxy.delay = 0.010;
+  proxy.bandwidth = 20e6;
+  if (!proxy.start(rl, server.dir, server.sockfile)) {
+    perror("proxy");
+    server.stop();
+    return 1;
+  }
+
+  int status = 0;
+  {
+    BenchClient client;
+    AssetUploader uploader;
+    std::vector<wgpu::Texture> tex;
+    std::vector<wgpu::Buffer> buf;
+    std::vector<AssetData> assets;
+    for (const auto& t : textures)
+      assets.push_back({ t.data(), t.size() });
+    for (const auto& b : buffers)
+      assets.push_back({ b.data(), b.size() });
+    std::map<std::string,double> m0, m1;
+    std::string params = pack.empty() ? "server=none" : "server=pack";
+    uint64_t t0, bytes0;
+    bool fenced = false;
+
+    if (!client.connect(rl, proxy.sockfile.c_str()) ||
+        !benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); }))
+    {
+      fprintf(stderr, "client failed to connect\n");
+      status = 1;
+      goto end;
+    }
+
+    // ask about the assets first, as an app would at startup
+    t0 = monotimeNs();
+    if (!uploader.query(client.proto, assets) ||
+        !benchRunLoopUntil(rl, 30.0, [&]() { return uploader.answered(); }))
+    {
+      fprintf(stderr, "no answer to asset query\n");
+      status = 1;
+      goto end;
+    }
+    ctx.result("query_time", (double)(monotimeNs() - t0) / 1e6, "ms", params);
+    if (!server.metrics(&m0)) {
+      status = 1;
+      goto end;
+    }
+
+    // create the objects, then wait for the answer to an empty query, which the server
+    // sends once it has handled everything before it
+    bytes0 = client.proto.bytesOut;
+    t0 = monotimeNs();
+    for (const auto& t : textures) {
+      tex.push_back(uploader.createTexture(
+        client.proto, client.wireClient, client.device, wgpu::TextureFormat::RGBA8Unorm,
+        TEXTURE_SIZE, TEXTURE_SIZE, t.data()));
+    }
+    for (const auto& b : buffers) {
+      buf.push_back(uploader.createBuffer(
+        client.proto, client.device, wgpu::BufferUsage::Vertex, b.data(), b.size()));
+    }
+    client.proto.onAssetQueryReply = [&](const uint8_t*, size_t) { fenced = true; };
+    client.proto.sendAssetQuery(nullptr, 0);
+    if (!benchRunLoopUntil(rl, 60.0, [&]() { return fenced; })) {
+      fprintf(stderr, "server did not handle the uploads\n");
+      status = 1;
+      goto end;
+    }
+    ctx.result("upload_time", (double)(monotimeNs() - t0) / 1e6, "ms", params);
+    ctx.result("bytes_sent", (double)(client.proto.bytesOut - bytes0), "bytes", params);
+    ctx.result("bytes_avoided", (double)uploader.bytesAvoided, "bytes", params);
+    ctx.result("hits", uploader.hits, "count", params);
+    if (!pack.empty() && server.metrics(&m1)) {
+      double uploads = std::max(1.0, m1["server.assets.uploads"] - m0["server.assets.uploads"]);
+      ctx.result("server_upload_per_asset",
+        (m1["server.assets.upload_ns"] - m0["server.assets.upload_ns"]) / 1e3 / uploads,
+        "us", params);
+      if (m1["server.assets.misses"] > m0["server.assets.misses"]) {
+        fprintf(stderr, "server did not find some assets\n");
+        status = 1;
+      }
+    }
+
+  end:
+    tex.clear(); // before the wire client goes away
+    buf.clear();
+    client.close();
+  }
+  proxy.stop();
+  server.stop();
+  return status;
+}
+
+BENCH(assets, "time & bytes to create textures and buffers from assets, with and without -assets") {
+  RunLoop* rl = EV_DEFAULT;
+  uint32_t n = ctx.quick ? 4 : 16;
+  std::vector<std::vector<uint8_t>> textures(n), buffers(n);
+  for (auto& t : textures) {
+    t.resize(TEXTURE_SIZE * TEXTURE_SIZE * 4);
+    for (uint8_t& v : t)
+      v = (uint8_t)ctx.random();
+  }
+  for (auto& b : buffers) {
+    b.resize(BUFFER_SIZE);
+    for (uint8_t& v : b)
+      v = (uint8_t)ctx.random();
+  }
+
+  char tmpl[] = "/tmp/dawn-bench-assets-XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string pack = std::string(tmpl) + "/assets.dpak";
+  std::vector<AssetData> assets;
+  for (const auto& t : textures)
+    assets.push_back({ t.data(), t.size() });
+  for (const auto& b : buffers)
+    assets.push_back({ b.data(), b.size() });
+  int status = 0;
+  if (!assetPackWrite(pack.c_str(), assets)) {
+    perror(pack.c_str());
+    status = 1;
+  } else {
+    status |= measure(ctx, rl, "", textures, buffers);
+    status |= measure(ctx, rl, pack, textures, buffers);
+  }
+  unlink(pack.c_str());
+  rmdir(tmpl);
+  return status;
+}
@@ -0,0 +1,80 @@
+// Submit batching: native queue submits per second and server CPU time per frame
+// with 16 and 64 clients sharing the device, with and without -batch-submits.
+#include "bench.hh"
+#include "metrics.hh" // processRaiseFDLimit
+#include <memory>
+
+static int measure(BenchContext& ctx, bool batch, uint32_t nclients) {
+  BenchServer server;
+  std::vector<std::string> args = { "-maxconns=" + std::to_string(nclients) };
+  if (batch)
+    args.push_back("-batch-submits");
+  if (!server.start(ctx, args))
+    return 1;
+
+  RunLoop* rl = EV_DEFAULT;
+  std::vector<std::unique_ptr<BenchClient>> clients;
+  int status = 0;
+  std::map<std::string,double> m0, m1;
+  double duration = ctx.quick ? 1.0 : 5.0;
+  for (uint32_t i = 0; i < nclients; i++) {
+    clients.emplace_back(new BenchClient());
+    BenchClient& client = *clients.back();
+    client.render = true;
+    client.draws = 10;
+    if (!client.connect(rl, server.sockfile.c_str())) {
+      perror("connect");
+      status = 1;
+      goto end;
+    }
+  }
+  benchRunLoopFor(rl, 1.0); // warm up
+  if (!server.metrics(&m0)) {
+    status = 1;
+    goto end;
+  }
+  benchRunLoopFor(rl, duration);
+  if (!server.metrics(&m1)) {
+    status = 1;
+    goto end;
+  }
+
+  {
+    double frames = 0;
+    for (uint32_t i = 0; i < nclients; i++) {
+      std::string scope = "conn." + std::to_string(i) + ".";
+      frames += m1[scope + "presents"] - m0[scope + "presents"];
+    }
+    if (frames == 0) {
+      fprintf(stderr, "no frames presented\n");
+      status = 1;
+      goto end;
+    }
+    auto delta = [&](const char* k) { return m1[k] - m0[k]; };
+    std::string params = std::string("mode=") + (batch ? "batched" : "direct") +
+                         ",clients=" + std::to_string(nclients);
+    ctx.result("client_submits_per_sec", delta("server.submit.client") / duration, "", params);
+    ctx.result("native_submits_per_sec", delta("server.submit.native") / duration, "", params);
+    ctx.result("native_submit_time_per_frame",
+      delta("server.submit.native_ns") / frames / 1e3, "us", params);
+    ctx.result("server_cpu_per_frame", delta("server.cpu_time") / frames * 1e6, "us", params);
+  }
+
+end:
+  clients.clear();
+  server.stop();
+  return status;
+}
+
+BENCH(batch, "native queue submits & server CPU with many clients, with and without batching") {
+  processRaiseFDLimit(256);
+  std::vector<uint32_t> counts = { 16, 64 };
+  if (ctx.quick)
+    counts = { 16 };
+  int status = 0;
+  for (uint32_t n : counts) {
+    status |= measure(ctx, false, n);
+    status |= measure(ctx, true, n);
+  }
+  return status;
+}
@@ -0,0 +1,132 @@
+// Pipeline compilation stalls: the longest gap between frame signals while a client
+// creates shader-heavy pipelines, with the server compiling them on the runloop (default)
+// vs on compile threads (-compile-threads.) The gap is measured by another, rendering
+// client, which with compile threads has a device of its own and should not wait for
+// the compiles. Measured for untrusted and trusted (-trust=self) clients.
+#include "bench.hh"
+#include "metrics.hh" // monotimeNs
+#include "utils/ComboRenderPipelineDescriptor.h"
+#include "utils/WGPUHelpers.h"
+
+// heavyShader returns a fragment shader with a long unrolled computation, distinct for
+// each seed so that Dawn can't find it in its caches
+static std::string heavyShader(uint32_t seed, uint32_t statements) {
+  std::string s = R"(
+    [[stage(fragment)]] fn main([[builtin(position)]] p : vec4<f32>) -> [[location(0)]] vec4<f32> {
+      var v : vec4<f32> = p * 0.001;
+  )";
+  for (uint32_t i = 0; i < statements; i++) {
+    std::string c = std::to_string((float)((seed * 31 + i) % 997) / 997.0f);
+    s += "      v = fract(v * " + c + " + vec4<f32>(" + c + ", v.x, v.y, 0.5));\n";
+  }
+  s += "      return v;\n    }\n";
+  return s;
+}
+
+static int measure(
+  BenchContext& ctx, RunLoop* rl, uint32_t npipelines, uint32_t threads, bool trusted)
+{
+  BenchServer server;
+  std::vector<std::string> args;
+  args.push_back("-maxconns=2");
+  if (trusted)
+    args.push_back("-trust=self");
+  if (threads > 0)
+    args.push_back("-compile-threads=" + std::to_string(threads));
+  if (!server.start(ctx, args))
+    return 1;
+  int status = 0;
+  {
+    // signals records when the rendering client receives frame signals
+    std::vector<uint64_t> signals;
+    BenchClient renderer;
+    renderer.draws = 10;
+    if (!renderer.connect(rl, server.sockfile.c_str())) {
+      perror("connect");
+      server.stop();
+      return 1;
+    }
+    renderer.proto.onFrame = [&]() {
+      signals.push_back(monotimeNs());
+      if (renderer.ready())
+        renderer.renderFrame();
+    };
+
+    // the heavy client creates pipelines with distinct, long shaders
+    BenchClient heavy;
+    if (!heavy.connect(rl, server.sockfile.c_str()) ||
+        !benchRunLoopUntil(rl, 30.0, [&]() { return heavy.ready(); }))
+    {
+      fprintf(stderr, "heavy client failed to connect\n");
+      server.stop();
+      return 1;
+    }
+    benchRunLoopFor(rl, 0.5); // let frame signals settle
+
+    std::map<std::string,double> m0, m1;
+    std::vector<wgpu::RenderPipeline> pipelines;
+    uint32_t seed = (uint32_t)ctx.random();
+    if (!server.metrics(&m0)) {
+      status = 1;
+    } else {
+      size_t first = signals.size();
+      for (uint32_t i = 0; i < npipelines; i++) {
+        utils::ComboRenderPipelineDescriptor2 desc;
+        desc.vertex.module = utils::CreateShaderModule(heavy.device, R"(
+          [[stage(vertex)]] fn main(
+              [[builtin(vertex_index)]] VertexIndex : u32
+          ) -> [[builtin(position)]] vec4<f32> {
+              return vec4<f32>(f32(VertexIndex % 2u), f32(VertexIndex / 2u), 0.0, 1.0);
+          }
+        )");
+        desc.cFragment.module = utils::CreateShaderModule(
+          heavy.device, heavyShader(seed + i, 400).c_str());
+        desc.cTargets[0].format = wgpu::TextureFormat::BGRA8Unorm;
+        pipelines.push_back(heavy.device.CreateRenderPipeline2(&desc));
+        heavy.proto.Flush();
+      }
+      benchRunLoopUntil(rl, 30.0, [&]() { return heavy.proto.pendingOutput() == 0; });
+      benchRunLoopFor(rl, 1.0);
+      server.metrics(&m1);
+      uint64_t maxGap = 0;
+      for (size_t i = std::max((size_t)1, first); i < signals.size(); i++)
+        maxGap = std::max(maxGap, signals[i] - signals[i - 1]);
+      double jobs = m1["server.compile.jobs"] - m0["server.compile.jobs"];
+      if (signals.size() < first + 2) {
+        fprintf(stderr, "no frame signals were received while pipelines were created\n");
+        status = 1;
+      } else if (threads > 0 && jobs == 0) {
+        fprintf(stderr, "no pipelines were compiled on compile threads\n");
+        status = 1;
+      } else {
+        std::string params = std::string("trusted=") + (trusted ? "1" : "0") +
+                             ",threads=" + std::to_string(threads) +
+                             ",pipelines=" + std::to_string(npipelines);
+        ctx.result("max_frame_signal_gap", (double)maxGap / 1e6, "ms", params);
+        if (jobs > 0) {
+          ctx.result("compile_jobs", jobs, "count", params);
+          ctx.result("compile_per_job",
+            (m1["server.compile.compile_ns"] - m0["server.compile.compile_ns"]) / 1e6 / jobs,
+            "ms", params);
+          ctx.result("compile_latency",
+            (m1["server.compile.latency_ns"] - m0["server.compile.latency_ns"]) / 1e6 / jobs,
+            "ms", params);
+        }
+      }
+    }
+    pipelines.clear(); // before the wire client goes away
+  }
+  server.stop();
+  return status;
+}
+
+BENCH(compile, "frame signal stall while a client compiles pipelines") {
+  RunLoop* rl = EV_DEFAULT;
+  uint32_t npipelines = ctx.quick ? 8 : 32;
+  int status = 0;
+  for (bool trusted : { false, true }) {
+    status |= measure(ctx, rl, npipelines, 0, trusted);
+    status |= measure(ctx, rl, npipelines, 2, trusted);
+  }
+  return status;
+}
@@ -0,0 +1,108 @@
+// Link estimation: the bandwidth and min RTT a client's link estimator (see linkest.hh)
+// arrives at on links shaped by BenchDelayProxy, against the configured ones. The
+// client first sends a little data every frame (idle link, for the RTT), then streams
+// buffer writes as fast as the link takes them (for the bandwidth.)
+#include "bench.hh"
+#include "metrics.hh" // monotimeNs
+#include <math.h>
+
+static int measure(BenchContext& ctx, RunLoop* rl, double bandwidth, double rtt) {
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+  BenchDelayProxy proxy;
+  proxy.delay = rtt / 2;
+  proxy.bandwidth = bandwidth;
+  if (!proxy.start(rl, server.dir, server.sockfile)) {
+    perror("proxy");
+    server.stop();
+    return 1;
+  }
+
+  BenchClient client;
+  int status = 0;
+  std::vector<uint8_t> data(65536);
+  for (uint8_t& b : data)
+    b = (uint8_t)ctx.random();
+  wgpu::BufferDescriptor desc;
+  desc.usage = wgpu::BufferUsage::CopyDst;
+  desc.size = data.size();
+  wgpu::Buffer buffer;
+  wgpu::Queue queue;
+  uint64_t t0, delivered0;
+  double duration = ctx.quick ? 1.0 : 3.0;
+
+  if (!client.connect(rl, proxy.sockfile.c_str())) {
+    perror("connect");
+    status = 1;
+    goto end;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    status = 1;
+    goto end;
+  }
+  buffer = client.device.CreateBuffer(&desc);
+  queue = client.device.GetQueue();
+
+  // idle link: 4 kB every 10 ms
+  t0 = monotimeNs();
+  while ((double)(monotimeNs() - t0) < 0.5e9 && !client.proto.stopped()) {
+    queue.WriteBuffer(buffer, 0, data.data(), 4096);
+    client.proto.Flush();
+    benchRunLoopFor(rl, 0.01);
+  }
+
+  // saturated link: keep more than the link's queue waiting to be sent
+  t0 = monotimeNs();
+  delivered0 = client.proto.link.delivered;
+  while ((double)(monotimeNs() - t0) < duration * 1e9 && !client.proto.stopped()) {
+    while (client.proto.pendingOutput() < proxy.queueLimit * 2) {
+      queue.WriteBuffer(buffer, 0, data.data(), data.size());
+      client.proto.Flush();
+    }
+    ev_run(rl, EVRUN_ONCE);
+  }
+  if (client.proto.stopped() || client.proto.link.bandwidth == 0) {
+    fprintf(stderr, "no link estimate\n");
+    status = 1;
+    goto end;
+  }
+
+  {
+    const LinkEstimator& link = client.proto.link;
+    double seconds = (double)(monotimeNs() - t0) / 1e9;
+    char params[64];
+    snprintf(params, sizeof(params), "bandwidth_mbs=%g,rtt_ms=%g", bandwidth / 1e6, rtt * 1e3);
+    ctx.result("bandwidth_estimate", (double)link.bandwidth / 1e6, "MBps", params);
+    ctx.result("bandwidth_error",
+      fabs((double)link.bandwidth - bandwidth) / bandwidth * 100.0, "%", params);
+    ctx.result("goodput", (double)(link.delivered - delivered0) / seconds / 1e6, "MB/s", params);
+    ctx.result("min_rtt_estimate", (double)link.minRttNs / 1e6, "ms", params);
+    ctx.result("min_rtt_error", fabs((double)link.minRttNs / 1e9 - rtt) * 1e3, "ms", params);
+    ctx.result("srtt", (double)link.srttNs / 1e6, "ms", params);
+    ctx.result("samples", (double)link.samples, "count", params);
+  }
+
+end:
+  buffer = nullptr;
+  queue = nullptr;
+  client.close();
+  proxy.stop();
+  server.stop();
+  return status;
+}
+
+BENCH(link, "link bandwidth & min RTT estimates on shaped links vs the configured ones") {
+  RunLoop* rl = EV_DEFAULT;
+  struct { double bandwidth, rtt; } links[] = {
+    { 2e6, 0.020 }, { 10e6, 0.020 }, { 10e6, 0.060 }, { 40e6, 0.020 },
+  };
+  int status = 0;
+  for (auto& l : links) {
+    if (ctx.quick && l.bandwidth != 10e6)
+      continue;
+    status |= measure(ctx, rl, l.bandwidth, l.rtt);
+  }
+  return status;
+}
@@ -0,0 +1,75 @@
+// Load: aggregate presents per second, frame latency and server CPU time per frame
+// with 1, 8 and 32 rendering clients.
+#include "bench.hh"
+#include "metrics.hh" // processRaiseFDLimit
+#include <memory>
+
+static int measure(BenchContext& ctx, uint32_t nclients) {
+  BenchServer server;
+  if (!server.start(ctx, { "-maxconns=" + std::to_string(nclients) }))
+    return 1;
+
+  RunLoop* rl = EV_DEFAULT;
+  std::vector<std::unique_ptr<BenchClient>> clients;
+  int status = 0;
+  std::map<std::string,double> m0, m1;
+  double duration = ctx.quick ? 1.0 : 3.0;
+  for (uint32_t i = 0; i < nclients; i++) {
+    clients.emplace_back(new BenchClient());
+    BenchClient& client = *clients.back();
+    client.render = true;
+    client.draws = 50 + ctx.random() % 100; // varied but repeatable client costs
+    if (!client.connect(rl, server.sockfile.c_str())) {
+      perror("connect");
+      status = 1;
+      goto end;
+    }
+  }
+  benchRunLoopFor(rl, 1.0); // warm up
+  if (!server.metrics(&m0)) {
+    status = 1;
+    goto end;
+  }
+  benchRunLoopFor(rl, duration);
+  if (!server.metrics(&m1)) {
+    status = 1;
+    goto end;
+  }
+
+  {
+    double frames = 0, latencyNs = 0, dropped = 0;
+    for (uint32_t i = 0; i < nclients; i++) {
+      std::string scope = "conn." + std::to_string(i) + ".";
+      frames += m1[scope + "presents"] - m0[scope + "presents"];
+      latencyNs += m1[scope + "frame_latency_ns"] - m0[scope + "frame_latency_ns"];
+      dropped += m1[scope + "frames_dropped"] - m0[scope + "frames_dropped"];
+    }
+    if (frames == 0) {
+      fprintf(stderr, "no frames presented\n");
+      status = 1;
+      goto end;
+    }
+    std::string params = "clients=" + std::to_string(nclients);
+    ctx.result("presents", frames / duration, "frames/s", params);
+    ctx.result("frame_latency_mean", latencyNs / frames / 1e6, "ms", params);
+    ctx.result("frames_dropped", dropped, "", params);
+    ctx.result("server_cpu_per_frame",
+      (m1["server.cpu_time"] - m0["server.cpu_time"]) / frames * 1e6, "us", params);
+  }
+
+end:
+  clients.clear();
+  server.stop();
+  return status;
+}
+
+BENCH(load, "presents/s, frame latency and server CPU per frame with 1 to 32 clients") {
+  processRaiseFDLimit(128);
+  std::vector<uint32_t> counts = { 1, 8, 32 };
+  if (ctx.quick)
+    counts = { 1, 8 };
+  int status = 0;
+  for (uint32_t n : counts)
+    status |= measure(ctx, n);
+  return status;
+}
@@ -0,0 +1,83 @@
+// Memory-footprint scaling: server RSS, heap and per-structure breakdown with
+// 1, 10, 100 and 1000 connections, idle and under a light workload.
+#include "bench.hh"
+#include "metrics.hh" // processRaiseFDLimit
+#include <memory>
+
+static const char* metricNames[][2] = {
+  // server metric                     result name
+  { "server.mem.rss",                  "rss" },
+  { "server.mem.heap",                 "heap" },
+  { "server.mem.conns_heap_init",      "wire_server_heap" },   // WireServer tables at connect
+  { "server.mem.conns_heap_commands",  "commands_heap" },      // wire & Dawn objects created
+};
+
+static int measure(BenchContext& ctx, bool active) {
+  const char* mode = active ? "active" : "idle";
+  std::vector<size_t> steps = { 1, 10, 100, 1000 };
+  if (ctx.quick)
+    steps = { 1, 10 };
+  size_t maxconns = steps.back();
+  processRaiseFDLimit(maxconns + 64);
+
+  BenchServer server;
+  if (!server.start(ctx, { "-memstats", "-maxconns=" + std::to_string(maxconns) }))
+    return 1;
+
+  RunLoop* rl = EV_DEFAULT;
+  std::map<std::string,double> base;
+  if (!server.metrics(&base)) {
+    server.stop();
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<BenchClient>> clients;
+  int status = 0;
+  for (size_t nconns : steps) {
+    while (clients.size() < nconns) {
+      clients.emplace_back(new BenchClient());
+      BenchClient* c = clients.back().get();
+      c->render = active;
+      if (!c->connect(rl, server.sockfile.c_str())) {
+        perror("connect");
+        status = 1;
+        goto end;
+      }
+    }
+    // wait for all connections to finish their handshake, then let them settle
+    // (active clients render a few frames) before sampling
+    benchRunLoopUntil(rl, 30.0, [&]() {
+      for (auto& c : clients) {
+        if (!c->ready())
+          return false;
+      }
+      return true;
+    });
+    benchRunLoopFor(rl, active ? 1.0 : 0.2);
+
+    std::map<std::string,double> m;
+    if (!server.metrics(&m)) {
+      fprintf(stderr, "failed to read server metrics\n");
+      status = 1;
+      goto end;
+    }
+    std::string params = std::string("mode=") + mode + ",conns=" + std::to_string(nconns);
+    for (auto& mn : metricNames)
+      ctx.result(mn[1], m[mn[0]], "bytes", params);
+    ctx.result("rss_per_conn",
+      (m["server.mem.rss"] - base["server.mem.rss"]) / (double)nconns, "bytes", params);
+    ctx.result("heap_per_conn",
+      (m["server.mem.heap"] - base["server.mem.heap"]) / (double)nconns, "bytes", params);
+    ctx.result("proto_buffers", m["server.mem.proto_buffers"], "bytes", params);
+    ctx.result("conns", m["server.conns"], "count", params);
+  }
+
+end:
+  clients.clear();
+  server.stop();
+  return status;
+}
+
+BENCH(mem, "server memory footprint with 1-1000 idle and active connections") {
+  return measure(ctx, false) | measure(ctx, true);
+}
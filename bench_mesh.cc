@@ -0,0 +1,243 @@
+// Compressed meshes: bytes saved by quantization, reordering and encoding, vertex cache
+// efficiency, decode throughput (scalar vs SSE2) and wire bytes of a raw vs compressed
+// upload of representative meshes.
+#include "bench.hh"
+#include "meshcodec.hh"
+#include "metrics.hh" // monotimeNs
+#include <math.h>
+
+struct TestMesh {
+  const char*           name;
+  std::vector<float>    positions, normals, uvs;
+  std::vector<uint32_t> indices;
+  uint32_t vertexCount() const { return (uint32_t)(positions.size() / 3); }
+};
+
+// makeTerrain makes an n x n vertex height field, as a terrain tile exporter would
+static TestMesh makeTerrain(uint32_t n) {
+  TestMesh m;
+  m.name = "terrain";
+  for (uint32_t y = 0; y < n; y++) {
+    for (uint32_t x = 0; x < n; x++) {
+      float h = sinf((float)x * 0.07f) * cosf((float)y * 0.05f) * 4.0f;
+      m.positions.insert(m.positions.end(), { (float)x, h, (float)y });
+      float nx = -0.28f * cosf((float)x * 0.07f), nz = 0.2f * sinf((float)y * 0.05f);
+      float l = sqrtf(nx * nx + 1.0f + nz * nz);
+      m.normals.insert(m.normals.end(), { nx / l, 1.0f / l, nz / l });
+      m.uvs.insert(m.uvs.end(), { (float)x / (n - 1), (float)y / (n - 1) });
+    }
+  }
+  for (uint32_t y = 0; y + 1 < n; y++) {
+    for (uint32_t x = 0; x + 1 < n; x++) {
+      uint32_t a = y * n + x;
+      m.indices.insert(m.indices.end(), { a, a + n, a + 1, a + 1, a + n, a + n + 1 });
+    }
+  }
+  return m;
+}
+
+// makeSphere makes a UV sphere with the given number of rings and segments
+static TestMesh makeSphere(uint32_t rings, uint32_t segments) {
+  TestMesh m;
+  m.name = "sphere";
+  for (uint32_t r = 0; r <= rings; r++) {
+    float phi = (float)M_PI * r / rings;
+    for (uint32_t s = 0; s <= segments; s++) {
+      float theta = 2.0f * (float)M_PI * s / segments;
+      float x = sinf(phi) * cosf(theta), y = cosf(phi), z = sinf(phi) * sinf(theta);
+      m.positions.insert(m.positions.end(), { x * 10.0f, y * 10.0f, z * 10.0f });
+      m.normals.insert(m.normals.end(), { x, y, z });
+      m.uvs.insert(m.uvs.end(), { (float)s / segments, (float)r / rings });
+    }
+  }
+  for (uint32_t r = 0; r < rings; r++) {
+    for (uint32_t s = 0; s < segments; s++) {
+      uint32_t a = r * (segments + 1) + s, b = a + segments + 1;
+      m.indices.insert(m.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+    }
+  }
+  return m;
+}
+
+// acmr returns the average number of vertex cache misses per triangle of a 16 entry
+// FIFO cache (lower is better; 0.5 is ideal for a regular grid)
+static double acmr(const std::vector<uint32_t>& indices, uint32_t vertexCount) {
+  std::vector<uint32_t> stamp(vertexCount, 0);
+  uint32_t time = 16, misses = 0;
+  for (uint32_t i : indices) {
+    if (time - stamp[i] >= 16) {
+      stamp[i] = ++time;
+      misses++;
+    }
+  }
+  return (double)misses / (double)(indices.size() / 3);
+}
+
+template <typename F>
+static double timeIt(double duration, F fn) {
+  uint64_t t0 = monotimeNs();
+  uint32_t runs = 0;
+  do {
+    fn();
+    runs++;
+  } while ((double)(monotimeNs() - t0) < duration * 1e9);
+  return (double)(monotimeNs() - t0) / 1e9 / runs;
+}
+
+static int measureCPU(BenchContext& ctx, const TestMesh& m) {
+  double duration = ctx.quick ? 0.1 : 1.0;
+  uint32_t nverts = m.vertexCount();
+  std::string params = std::string("mesh=") + m.name + ",vertices=" + std::to_string(nverts) +
+                       ",triangles=" + std::to_string(m.indices.size() / 3);
+
+  std::vector<MeshQuantizedVertex> verts(nverts);
+  MeshQuantization q;
+  meshQuantizeVertices(m.positions.data(), m.normals.data(), m.uvs.data(), nverts, verts.data(), &q);
+  std::vector<uint32_t> indices = m.indices;
+  double acmrBefore = acmr(indices, nverts);
+  uint64_t t0 = monotimeNs();
+  meshOptimizeVertexCache(indices.data(), indices.size(), nverts);
+  nverts = meshOptimizeVertexFetch(
+    verts.data(), nverts, sizeof(MeshQuantizedVertex), indices.data(), indices.size());
+  double optimizeMs = (double)(monotimeNs() - t0) / 1e6;
+  std::vector<uint8_t> vdata, idata;
+  t0 = monotimeNs();
+  meshEncodeVertices(verts.data(), nverts, sizeof(MeshQuantizedVertex), vdata);
+  meshEncodeIndices(indices.data(), indices.size(), idata);
+  double encodeMs = (double)(monotimeNs() - t0) / 1e6;
+
+  uint32_t indexSize = nverts <= 0x10000 ? 2 : 4;
+  size_t rawBytes = m.positions.size() * 4 + m.normals.size() * 4 + m.uvs.size() * 4 +
+                    m.indices.size() * 4;
+  size_t quantizedBytes = (size_t)nverts * sizeof(MeshQuantizedVertex) +
+                          indices.size() * indexSize;
+  size_t encodedBytes = vdata.size() + idata.size();
+  ctx.result("raw_bytes", (double)rawBytes, "bytes", params);
+  ctx.result("quantized_bytes", (double)quantizedBytes, "bytes", params);
+  ctx.result("encoded_bytes", (double)encodedBytes, "bytes", params);
+  ctx.result("bytes_saved", 100.0 * (1.0 - (double)encodedBytes / (double)rawBytes), "%", params);
+  ctx.result("vertex_bytes_per_vertex", (double)vdata.size() / nverts, "bytes", params);
+  ctx.result("index_bytes_per_index", (double)idata.size() / indices.size(), "bytes", params);
+  ctx.result("acmr_before", acmrBefore, "", params);
+  ctx.result("acmr_after", acmr(indices, nverts), "", params);
+  ctx.result("optimize_time", optimizeMs, "ms", params);
+  ctx.result("encode_time", encodeMs, "ms", params);
+
+  std::vector<MeshQuantizedVertex> vout(nverts);
+  std::vector<uint8_t> iout(indices.size() * indexSize);
+  for (bool simd : { false, true }) {
+    bool ok = true;
+    double t = timeIt(duration, [&]() {
+      ok &= meshDecodeVertices(
+        vdata.data(), vdata.size(), nverts, sizeof(MeshQuantizedVertex), vout.data(), simd);
+    });
+    double ti = timeIt(duration, [&]() {
+      ok &= meshDecodeIndices(
+        idata.data(), idata.size(), (uint32_t)indices.size(), indexSize, iout.data(), simd);
+    });
+    if (!ok || memcmp(vout.data(), verts.data(), vout.size() * sizeof(vout[0])) != 0) {
+      fprintf(stderr, "%s: decoded data differs\n", m.name);
+      return 1;
+    }
+    std::string p = params + ",path=" + (simd ? "simd" : "scalar");
+    ctx.result("decode_vertices", (double)nverts * sizeof(MeshQuantizedVertex) / t / 1e9, "GB/s", p);
+    ctx.result("decode_indices", (double)iout.size() / ti / 1e9, "GB/s", p);
+  }
+  return 0;
+}
+
+static int measureUpload(BenchContext& ctx, RunLoop* rl, BenchServer& server,
+                         const TestMesh& m, bool compressed)
+{
+  BenchClient client;
+  if (!client.connect(rl, server.sockfile.c_str())) {
+    perror("connect");
+    return 1;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    return 1;
+  }
+  auto drain = [&]() {
+    client.proto.Flush();
+    return benchRunLoopUntil(rl, 60.0, [&]() { return client.proto.pendingOutput() == 0; });
+  };
+  if (!drain())
+    return 1;
+
+  // interleaved float vertices, as an application would have them
+  uint32_t nverts = m.vertexCount();
+  std::vector<float> verts;
+  for (uint32_t i = 0; i < nverts; i++) {
+    verts.insert(verts.end(), &m.positions[i * 3], &m.positions[i * 3 + 3]);
+    verts.insert(verts.end(), &m.normals[i * 3], &m.normals[i * 3 + 3]);
+    verts.insert(verts.end(), &m.uvs[i * 2], &m.uvs[i * 2 + 2]);
+  }
+  uint32_t stride = 8 * sizeof(float);
+
+  std::map<std::string,double> m0, m1;
+  if (!server.metrics(&m0))
+    return 1;
+  uint64_t bytes0 = client.proto.bytesOut;
+  uint64_t t0 = monotimeNs();
+
+  if (compressed) {
+    CompressedMesh mesh;
+    if (!uploadCompressedMesh(client.proto, client.device, verts.data(), nverts, stride,
+                              m.indices.data(), (uint32_t)m.indices.size(), &mesh))
+    {
+      fprintf(stderr, "uploadCompressedMesh failed\n");
+      return 1;
+    }
+  } else {
+    wgpu::Queue queue = client.device.GetQueue();
+    auto upload = [&](wgpu::BufferUsage usage, const void* data, size_t size) {
+      wgpu::BufferDescriptor desc;
+      desc.usage = usage | wgpu::BufferUsage::CopyDst;
+      desc.size = size;
+      wgpu::Buffer buffer = client.device.CreateBuffer(&desc);
+      // in chunks which fit in a wire command buffer
+      for (size_t offs = 0; offs < size; offs += 65536) {
+        queue.WriteBuffer(buffer, offs, (const char*)data + offs, std::min((size_t)65536, size - offs));
+        client.proto.Flush();
+      }
+    };
+    upload(wgpu::BufferUsage::Vertex, verts.data(), verts.size() * sizeof(float));
+    upload(wgpu::BufferUsage::Index, m.indices.data(), m.indices.size() * 4);
+  }
+  client.renderFrame();
+  if (!drain())
+    return 1;
+  double ms = (double)(monotimeNs() - t0) / 1e6;
+  benchRunLoopFor(rl, 0.1); // let the server read everything
+  if (!server.metrics(&m1))
+    return 1;
+
+  std::string params = std::string("mode=") + (compressed ? "compressed" : "raw") +
+                       ",mesh=" + m.name;
+  ctx.result("wire_bytes", (double)(client.proto.bytesOut - bytes0), "bytes", params);
+  ctx.result("upload_time", ms, "ms", params);
+  if (compressed)
+    ctx.result("server_decode_time", (m1["server.mesh.ns"] - m0["server.mesh.ns"]) / 1e6, "ms", params);
+  return 0;
+}
+
+BENCH(mesh, "compressed vertex & index uploads: bytes saved, decode GB/s, wire bytes") {
+  std::vector<TestMesh> meshes;
+  meshes.push_back(ctx.quick ? makeTerrain(64) : makeTerrain(512));
+  meshes.push_back(ctx.quick ? makeSphere(32, 64) : makeSphere(256, 512));
+  int status = 0;
+  for (const TestMesh& m : meshes)
+    status |= measureCPU(ctx, m);
+
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+  RunLoop* rl = EV_DEFAULT;
+  for (const TestMesh& m : meshes) {
+    status |= measureUpload(ctx, rl, server, m, false);
+    status |= measureUpload(ctx, rl, server, m, true);
+  }
+  server.stop();
+  return status;
+}
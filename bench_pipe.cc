@@ -0,0 +1,94 @@
+// Ring buffer: Pipe copy throughput in and out of memory (small, medium and large
+// chunks, wrapping around the end of the buffer) and to and from a socket.
+#include "bench.hh"
+#include "pipe.hh"
+#include "metrics.hh" // monotimeNs
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <sys/socket.h>
+
+typedef Pipe<1024 * 1024> BenchPipe;
+
+// timeIt returns the average time in seconds of fn over enough runs to take ~duration
+template <typename F>
+static double timeIt(double duration, F fn) {
+  uint64_t t0 = monotimeNs();
+  uint32_t runs = 0;
+  do {
+    fn();
+    runs++;
+  } while ((double)(monotimeNs() - t0) < duration * 1e9);
+  return (double)(monotimeNs() - t0) / 1e9 / runs;
+}
+
+static int measureMemory(BenchContext& ctx, BenchPipe& pipe, size_t chunk, double duration) {
+  std::vector<char> src(chunk), dst(chunk);
+  for (char& c : src)
+    c = (char)ctx.random();
+  pipe.clear();
+  // offset reads from writes so that chunks regularly wrap around the end of the buffer
+  pipe.write(src.data(), std::min(chunk, (size_t)777));
+  uint32_t batch = (uint32_t)std::max((size_t)1, (1024 * 1024) / chunk);
+  bool ok = true;
+  double t = timeIt(duration, [&]() {
+    for (uint32_t i = 0; i < batch; i++) {
+      ok &= pipe.write(src.data(), chunk) == chunk;
+      ok &= pipe.read(dst.data(), chunk) == chunk;
+    }
+  });
+  if (!ok) {
+    fprintf(stderr, "short pipe read or write\n");
+    return 1;
+  }
+  std::string params = "chunk=" + std::to_string(chunk);
+  ctx.result("memory_copy", (double)chunk * batch / t / 1e9, "GB/s", params);
+  return 0;
+}
+
+static int measureSocket(BenchContext& ctx, BenchPipe& pipe, size_t chunk, double duration) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    perror("socketpair");
+    return 1;
+  }
+  for (int fd : fds)
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  std::vector<char> src(chunk);
+  for (char& c : src)
+    c = (char)ctx.random();
+  std::unique_ptr<BenchPipe> in(new BenchPipe());
+  pipe.clear();
+  bool ok = true;
+  double t = timeIt(duration, [&]() {
+    pipe.write(src.data(), chunk);
+    size_t n = 0;
+    while (ok && n < chunk) {
+      ssize_t w = pipe.writeToFD(fds[1], chunk - n);
+      ssize_t r = in->readFromFD(fds[0], in->avail());
+      ok = (w >= 0 || errno == EAGAIN) && (r >= 0 || errno == EAGAIN);
+      n += (size_t)std::max((ssize_t)0, w);
+    }
+    in->clear();
+  });
+  close(fds[0]);
+  close(fds[1]);
+  if (!ok) {
+    perror("socket copy");
+    return 1;
+  }
+  std::string params = "chunk=" + std::to_string(chunk);
+  ctx.result("socket_copy", (double)chunk / t / 1e9, "GB/s", params);
+  return 0;
+}
+
+BENCH(pipe, "ring buffer copy throughput to and from memory and sockets") {
+  double duration = ctx.quick ? 0.1 : 0.5;
+  std::unique_ptr<BenchPipe> pipe(new BenchPipe());
+  int status = 0;
+  for (size_t chunk : { 64, 4096, 65536 })
+    status |= measureMemory(ctx, *pipe, chunk, duration);
+  for (size_t chunk : { 4096, 65536 })
+    status |= measureSocket(ctx, *pipe, chunk, duration);
+  return status;
+}
@@ -0,0 +1,93 @@
+// Render scale: frame time, server CPU time, upscale cost and bytes per frame of a
+// client rendering at several render scales, which the server upscales on present.
+// The headless server does not measure GPU fill cost; pixels_per_frame is the part
+// of it the client saves.
+#include "bench.hh"
+#include "metrics.hh" // monotimeNs
+
+static int measure(BenchContext& ctx, float scale, uint32_t draws) {
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+
+  RunLoop* rl = EV_DEFAULT;
+  BenchClient client;
+  client.render = true;
+  client.draws = draws;
+  client.renderScale = scale;
+  int status = 0;
+  std::map<std::string,double> m0, m1;
+  uint32_t frames0 = 0;
+  uint64_t bytes0 = 0, t0 = 0;
+  if (!client.connect(rl, server.sockfile.c_str())) {
+    perror("connect");
+    status = 1;
+    goto end;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    status = 1;
+    goto end;
+  }
+  benchRunLoopFor(rl, 0.5); // warm up (pipeline creation, render target)
+
+  if (!server.metrics(&m0)) {
+    status = 1;
+    goto end;
+  }
+  frames0 = client.frames;
+  bytes0 = client.proto.bytesOut;
+  t0 = monotimeNs();
+  benchRunLoopFor(rl, ctx.quick ? 1.0 : 5.0);
+  if (!server.metrics(&m1)) {
+    status = 1;
+    goto end;
+  }
+
+  {
+    double frames = (double)(client.frames - frames0);
+    if (frames < 1) {
+      fprintf(stderr, "no frames rendered\n");
+      status = 1;
+      goto end;
+    }
+    // the server's connection is #0
+    double upscales = m1["conn.0.render_scale.upscales"] - m0["conn.0.render_scale.upscales"];
+    if (scale < 1.0f && upscales < 1) {
+      fprintf(stderr, "server did not upscale frames at scale %.2f\n", scale);
+      status = 1;
+      goto end;
+    }
+    char scalestr[16];
+    snprintf(scalestr, sizeof(scalestr), "%.2f", scale);
+    std::string params = std::string("scale=") + scalestr + ",draws=" + std::to_string(draws);
+    double presents = std::max(1.0, m1["conn.0.presents"] - m0["conn.0.presents"]);
+    ctx.result("frame_time", (double)(monotimeNs() - t0) / 1e6 / frames, "ms", params);
+    ctx.result("frame_latency",
+      (m1["conn.0.frame_latency_ns"] - m0["conn.0.frame_latency_ns"]) / 1e6 / presents, "ms",
+      params);
+    ctx.result("cpu_per_frame",
+      (m1["server.cpu_time"] - m0["server.cpu_time"]) * 1e6 / frames, "us", params);
+    ctx.result("upscale_per_frame",
+      (m1["conn.0.render_scale.upscale_ns"] - m0["conn.0.render_scale.upscale_ns"]) / 1e3 /
+      std::max(1.0, upscales), "us", params);
+    ctx.result("bytes_per_frame", (double)(client.proto.bytesOut - bytes0) / frames, "bytes",
+               params);
+    const DawnRemoteProtocol::FramebufferInfo& fb = client.proto.fbinfo();
+    uint32_t s = client.renderTarget.scale();
+    ctx.result("pixels_per_frame",
+      (double)renderScaleSize(fb.width, s) * renderScaleSize(fb.height, s), "pixels", params);
+  }
+
+end:
+  client.close();
+  server.stop();
+  return status;
+}
+
+BENCH(renderscale, "frame time, server CPU & bytes per frame at render scales 1, 0.75, 0.5") {
+  int status = 0;
+  for (float scale : { 1.0f, 0.75f, 0.5f })
+    status |= measure(ctx, scale, 10);
+  return status;
+}
@@ -0,0 +1,167 @@
+// Capture replay: records a rendering client with -capture, then replays the capture
+// as fast as possible to a fresh server and reports frames per second and server CPU
+// time per frame (the server's cost of decoding and executing a session.)
+#include "bench.hh"
+#include "capture.hh"
+#include "metrics.hh" // monotimeNs
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static double sumPresents(const std::map<std::string,double>& m) {
+  double sum = 0;
+  for (auto& kv : m) {
+    const std::string& k = kv.first;
+    if (k.compare(0, 5, "conn.") == 0 && k.size() > 9 &&
+        k.compare(k.size() - 9, 9, ".presents") == 0)
+    {
+      sum += kv.second;
+    }
+  }
+  return sum;
+}
+
+// record runs a client for nframes frames against a server which captures to dir and
+// returns the path of the client's capture (the largest one; the server also captures
+// BenchServer's startup probe), or "" on failure.
+static std::string record(BenchContext& ctx, RunLoop* rl, const std::string& dir,
+                          uint32_t nframes, uint32_t draws)
+{
+  BenchServer server;
+  if (!server.start(ctx, { "-capture=" + dir }))
+    return "";
+  {
+    BenchClient client;
+    client.render = true;
+    client.draws = draws;
+    if (!client.connect(rl, server.sockfile.c_str())) {
+      perror("connect");
+      server.stop();
+      return "";
+    }
+    if (!benchRunLoopUntil(rl, 60.0, [&]() { return client.frames >= nframes; })) {
+      fprintf(stderr, "client rendered %u of %u frames\n", client.frames, nframes);
+      server.stop();
+      return "";
+    }
+    client.render = false;
+    client.proto.Flush();
+    benchRunLoopUntil(rl, 10.0, [&]() { return client.proto.pendingOutput() == 0; });
+  }
+  benchRunLoopFor(rl, 0.2); // let the server close the connection and its capture
+  server.stop();
+
+  std::string path;
+  off_t largest = -1;
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    perror(dir.c_str());
+    return "";
+  }
+  while (struct dirent* e = readdir(d)) {
+    std::string p = dir + "/" + e->d_name;
+    struct stat st;
+    if (strstr(e->d_name, ".dcap") && stat(p.c_str(), &st) == 0 && st.st_size > largest) {
+      largest = st.st_size;
+      path = p;
+    }
+  }
+  closedir(d);
+  return path;
+}
+
+static int replay(BenchContext& ctx, RunLoop* rl, const std::string& file, uint32_t draws) {
+  CaptureReader r;
+  if (!r.open(file.c_str())) {
+    perror(file.c_str());
+    return 1;
+  }
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+  int fd = benchConnectUNIX(server.sockfile.c_str());
+  if (fd < 0) {
+    perror("connect");
+    server.stop();
+    return 1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  DawnRemoteProtocol proto;
+  proto.onDawnBuffer = [](const char* data, size_t len) {}; // server replies are ignored
+  proto.onFrame = []() {};
+  proto.onFramebufferInfo = [](const DawnRemoteProtocol::FramebufferInfo&) {};
+  proto.start(rl, fd);
+  proto.sendHello();
+
+  std::map<std::string,double> m0, m1;
+  int status = 0;
+  uint32_t frames = 0;
+  uint64_t t0 = 0;
+  CaptureRecord rec;
+  if (!server.metrics(&m0)) {
+    status = 1;
+    goto end;
+  }
+  t0 = monotimeNs();
+  while (!proto.stopped() && r.next(&rec)) {
+    if (!captureSend(proto, rec)) {
+      status = 1;
+      break;
+    }
+    if (rec.type == CAPTURE_FRAME)
+      frames++;
+    while (!proto.stopped() && proto.pendingOutput() > 16 * DAWNCMD_MAX)
+      ev_run(rl, EVRUN_ONCE);
+  }
+  if (status == 0 && (r.error() || proto.stopped() || frames == 0)) {
+    fprintf(stderr, "replay of %s failed after %u frames\n", file.c_str(), frames);
+    status = 1;
+  }
+  // done when the server has presented every frame
+  if (status == 0 && !benchRunLoopUntil(rl, 60.0, [&]() {
+    return server.metrics(&m1) && sumPresents(m1) - sumPresents(m0) >= frames;
+  })) {
+    fprintf(stderr, "server presented %.0f of %u frames\n", sumPresents(m1) - sumPresents(m0),
+            frames);
+    status = 1;
+  }
+  if (status == 0) {
+    double seconds = (double)(monotimeNs() - t0) / 1e9;
+    std::string params = "frames=" + std::to_string(frames) + ",draws=" + std::to_string(draws);
+    ctx.result("replay_rate", frames / seconds, "frames/s", params);
+    ctx.result("server_cpu_per_frame",
+      (m1["server.cpu_time"] - m0["server.cpu_time"]) / frames * 1e6, "us", params);
+    struct stat st;
+    if (stat(file.c_str(), &st) == 0)
+      ctx.result("capture_bytes", (double)st.st_size, "bytes", params);
+  }
+end:
+  proto.stop();
+  close(fd);
+  server.stop();
+  return status;
+}
+
+BENCH(replay, "fast replay of a recorded session: frames/s and server CPU per frame") {
+  RunLoop* rl = EV_DEFAULT;
+  char tmpl[] = "/tmp/dawn-bench-capture-XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string dir = tmpl;
+  uint32_t nframes = ctx.quick ? 30 : 300, draws = 100;
+  int status = 1;
+  std::string file = record(ctx, rl, dir, nframes, draws);
+  if (!file.empty())
+    status = replay(ctx, rl, file, draws);
+  if (DIR* d = opendir(dir.c_str())) {
+    while (struct dirent* e = readdir(d))
+      unlink((dir + "/" + e->d_name).c_str());
+    closedir(d);
+  }
+  rmdir(dir.c_str());
+  return status;
+}
@@ -0,0 +1,71 @@
+// Connection setup over a slow link: time from connect to the server's first present
+// at 0 and 50 ms RTT, reserving the swapchain after receiving framebuffer info
+// ("fbinfo") vs sending hello, reservation and the first frame in one flight ("zerortt".)
+#include "bench.hh"
+#include <string.h>
+
+static int measure(BenchContext& ctx, RunLoop* rl, BenchServer& server, const char* sockfile,
+                   double rtt, bool zeroRTT)
+{
+  BenchClient client;
+  client.zeroRTT = zeroRTT;
+  client.render = true;
+  client.draws = 1; // includes pipeline creation in the first frame
+  if (!client.connect(rl, sockfile)) {
+    perror("connect");
+    return 1;
+  }
+  if (zeroRTT)
+    client.renderFrame();
+
+  // the server measures from accept, which the proxy does without delay
+  double firstPresent = 0;
+  for (int i = 0; i < 200 && firstPresent == 0; i++) {
+    benchRunLoopFor(rl, 0.05);
+    std::map<std::string,double> m;
+    if (!server.metrics(&m))
+      break;
+    for (auto& kv : m) {
+      const char* suffix = ".first_present_ns";
+      size_t n = strlen(suffix);
+      if (kv.first.size() > n && kv.first.compare(kv.first.size() - n, n, suffix) == 0)
+        firstPresent = std::max(firstPresent, kv.second);
+    }
+  }
+  client.close();
+  if (firstPresent == 0) {
+    fprintf(stderr, "server did not present a frame\n");
+    return 1;
+  }
+  std::string params = std::string("mode=") + (zeroRTT ? "zerortt" : "fbinfo") +
+                       ",rtt_ms=" + std::to_string((int)(rtt * 1000));
+  ctx.result("time_to_first_frame", firstPresent / 1e6, "ms", params);
+  // let the server notice the disconnect before the next connection
+  benchRunLoopFor(rl, 0.1);
+  return 0;
+}
+
+BENCH(rtt, "time to first frame over a delayed link, with and without zero-RTT setup") {
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+  RunLoop* rl = EV_DEFAULT;
+  int status = 0;
+  for (double rtt : { 0.0, 0.050 }) {
+    BenchDelayProxy proxy;
+    proxy.delay = rtt / 2;
+    if (!proxy.start(rl, server.dir, server.sockfile)) {
+      perror("BenchDelayProxy");
+      status = 1;
+      break;
+    }
+    int runs = ctx.quick ? 1 : 5;
+    for (int i = 0; i < runs; i++) {
+      status |= measure(ctx, rl, server, proxy.sockfile.c_str(), rtt, false);
+      status |= measure(ctx, rl, server, proxy.sockfile.c_str(), rtt, true);
+    }
+    proxy.stop();
+  }
+  server.stop();
+  return status;
+}
@@ -0,0 +1,86 @@
+// Frame-signal phases: frame latency (frame signal to present, measured by the server)
+// with 1 to 64 draw-heavy clients, all signalled at once (-no-stagger) vs staggered.
+#include "bench.hh"
+#include "metrics.hh" // processRaiseFDLimit
+#include <memory>
+
+static int measure(BenchContext& ctx, bool stagger, uint32_t nclients) {
+  BenchServer server;
+  std::vector<std::string> args = { "-maxconns=" + std::to_string(nclients) };
+  if (!stagger)
+    args.push_back("-no-stagger");
+  if (!server.start(ctx, args))
+    return 1;
+
+  RunLoop* rl = EV_DEFAULT;
+  std::vector<std::unique_ptr<BenchClient>> clients;
+  int status = 0;
+  std::map<std::string,double> m0, m1;
+  std::vector<double> latencies; // average per client, ms
+  for (uint32_t i = 0; i < nclients; i++) {
+    clients.emplace_back(new BenchClient());
+    BenchClient& client = *clients.back();
+    client.render = true;
+    client.draws = 200;
+    if (!client.connect(rl, server.sockfile.c_str())) {
+      perror("connect");
+      status = 1;
+      goto end;
+    }
+  }
+  benchRunLoopFor(rl, 1.0); // warm up; lets the scheduler learn client costs
+  if (!server.metrics(&m0)) {
+    status = 1;
+    goto end;
+  }
+  benchRunLoopFor(rl, ctx.quick ? 1.0 : 5.0);
+  if (!server.metrics(&m1)) {
+    status = 1;
+    goto end;
+  }
+
+  // connections are numbered 0..nclients-1
+  for (uint32_t i = 0; i < nclients; i++) {
+    std::string scope = "conn." + std::to_string(i) + ".";
+    double presents = m1[scope + "presents"] - m0[scope + "presents"];
+    double ns = m1[scope + "frame_latency_ns"] - m0[scope + "frame_latency_ns"];
+    if (presents > 0)
+      latencies.push_back(ns / presents / 1e6);
+  }
+  if (latencies.empty()) {
+    fprintf(stderr, "no frames presented\n");
+    status = 1;
+    goto end;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  {
+    std::string params = std::string("mode=") + (stagger ? "staggered" : "same") +
+                         ",clients=" + std::to_string(nclients);
+    double sum = 0;
+    for (double v : latencies)
+      sum += v;
+    ctx.result("frame_latency_mean", sum / latencies.size(), "ms", params);
+    ctx.result("frame_latency_p90_client",
+      latencies[std::min(latencies.size() - 1, latencies.size() * 9 / 10)], "ms", params);
+    ctx.result("frame_latency_max_client", latencies.back(), "ms", params);
+    ctx.result("load", m1["server.frame_sched.load"], "", params);
+  }
+
+end:
+  clients.clear();
+  server.stop();
+  return status;
+}
+
+BENCH(stagger, "frame latency with many clients, signalled at once vs staggered phases") {
+  processRaiseFDLimit(256);
+  std::vector<uint32_t> counts = { 1, 4, 16, 64 };
+  if (ctx.quick)
+    counts = { 1, 4 };
+  int status = 0;
+  for (uint32_t n : counts) {
+    status |= measure(ctx, false, n);
+    status |= measure(ctx, true, n);
+  }
+  return status;
+}
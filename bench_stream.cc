@@ -0,0 +1,71 @@
+// Progressive texture streaming: time and bytes sent until a client's first frame,
+// uploading a texture whole before the first frame vs streaming it (TextureStreamer.)
+#include "bench.hh"
+#include "texturestream.hh"
+#include "metrics.hh" // monotimeNs
+
+static int measure(BenchContext& ctx, RunLoop* rl, const char* sockfile, uint32_t size,
+                   bool stream)
+{
+  BenchClient client;
+  if (!client.connect(rl, sockfile)) {
+    perror("connect");
+    return 1;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    return 1;
+  }
+  auto drain = [&]() {
+    client.proto.Flush();
+    return benchRunLoopUntil(rl, 60.0, [&]() { return client.proto.pendingOutput() == 0; });
+  };
+  if (!drain())
+    return 1;
+
+  std::vector<uint8_t> pixels((size_t)size * size * 4, 0x80);
+  TextureStreamer streamer;
+  wgpu::Queue queue = client.device.GetQueue();
+  uint64_t bytes0 = client.proto.bytesOut;
+  uint64_t t0 = monotimeNs();
+
+  StreamedTexture* t = streamer.create(client.device, size, size, pixels.data(), 1.0f);
+  if (stream) {
+    streamer.update(queue);
+  } else {
+    // upload everything, one command buffer at a time
+    while (!t->complete()) {
+      streamer.update(queue);
+      if (!drain())
+        return 1;
+    }
+  }
+  client.renderFrame();
+  if (!drain())
+    return 1;
+
+  std::string params = std::string("mode=") + (stream ? "stream" : "whole") +
+                       ",size=" + std::to_string(size);
+  ctx.result("time_to_first_frame", (double)(monotimeNs() - t0) / 1e6, "ms", params);
+  ctx.result("bytes_before_first_frame", (double)(client.proto.bytesOut - bytes0), "bytes",
+             params);
+  streamer.destroy(t);
+  return 0;
+}
+
+BENCH(stream, "first-frame latency with a large texture, uploaded whole vs streamed") {
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+  RunLoop* rl = EV_DEFAULT;
+  std::vector<uint32_t> sizes = { 512, 2048, 4096 };
+  if (ctx.quick)
+    sizes = { 256, 1024 };
+  int status = 0;
+  for (uint32_t size : sizes) {
+    status |= measure(ctx, rl, server.sockfile.c_str(), size, false);
+    status |= measure(ctx, rl, server.sockfile.c_str(), size, true);
+  }
+  server.stop();
+  return status;
+}
@@ -0,0 +1,98 @@
+// Disconnect stalls: the longest gap between frame signals seen by a rendering client
+// while another client with many wire objects disconnects, with the server releasing
+// the objects all at once (-teardown-budget=0) vs in slices (default.)
+#include "bench.hh"
+#include "metrics.hh" // monotimeNs
+
+static int measure(BenchContext& ctx, RunLoop* rl, uint32_t nobjects, bool sliced) {
+  BenchServer server;
+  std::vector<std::string> args = { "-maxconns=2" };
+  if (!sliced)
+    args.push_back("-teardown-budget=0");
+  if (!server.start(ctx, args))
+    return 1;
+  int status = 0;
+  {
+    // the renderer records when it receives frame signals
+    BenchClient renderer;
+    std::vector<uint64_t> signals;
+    renderer.draws = 10;
+    if (!renderer.connect(rl, server.sockfile.c_str())) {
+      perror("connect");
+      server.stop();
+      return 1;
+    }
+    renderer.proto.onFrame = [&]() {
+      signals.push_back(monotimeNs());
+      if (renderer.ready())
+        renderer.renderFrame();
+    };
+
+    // the heavy client creates buffers, textures and texture views
+    BenchClient heavy;
+    if (!heavy.connect(rl, server.sockfile.c_str()) ||
+        !benchRunLoopUntil(rl, 30.0, [&]() { return heavy.ready(); }))
+    {
+      fprintf(stderr, "heavy client failed to connect\n");
+      server.stop();
+      return 1;
+    }
+    std::vector<wgpu::Buffer> buffers;
+    std::vector<wgpu::Texture> textures;
+    std::vector<wgpu::TextureView> views;
+    for (uint32_t i = 0; i < nobjects; i += 3) {
+      wgpu::BufferDescriptor bdesc;
+      bdesc.usage = wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst;
+      bdesc.size = 256 + 4 * (ctx.random() % 64);
+      buffers.push_back(heavy.device.CreateBuffer(&bdesc));
+      wgpu::TextureDescriptor tdesc;
+      tdesc.size = { 16, 16, 1 };
+      tdesc.format = wgpu::TextureFormat::RGBA8Unorm;
+      tdesc.usage = wgpu::TextureUsage::Sampled | wgpu::TextureUsage::CopyDst;
+      textures.push_back(heavy.device.CreateTexture(&tdesc));
+      views.push_back(textures.back().CreateView());
+      if (i % 768 == 0) {
+        heavy.proto.Flush();
+        benchRunLoopUntil(rl, 30.0, [&]() { return heavy.proto.pendingOutput() == 0; });
+      }
+    }
+    heavy.proto.Flush();
+    benchRunLoopUntil(rl, 30.0, [&]() { return heavy.proto.pendingOutput() == 0; });
+    benchRunLoopFor(rl, 0.5); // let the server create everything
+
+    std::map<std::string,double> m0, m1;
+    if (!server.metrics(&m0)) {
+      status = 1;
+    } else {
+      size_t first = signals.size();
+      heavy.close();
+      benchRunLoopFor(rl, 1.0);
+      server.metrics(&m1);
+      uint64_t maxGap = 0;
+      for (size_t i = std::max((size_t)1, first); i < signals.size(); i++)
+        maxGap = std::max(maxGap, signals[i] - signals[i - 1]);
+      if (signals.size() < first + 2) {
+        fprintf(stderr, "renderer received no frame signals after the disconnect\n");
+        status = 1;
+      } else {
+        std::string params = std::string("mode=") + (sliced ? "sliced" : "sync") +
+                             ",objects=" + std::to_string(buffers.size() * 3);
+        ctx.result("max_frame_signal_gap", (double)maxGap / 1e6, "ms", params);
+        ctx.result("teardown_max_slice", m1["server.teardown.max_slice_ns"] / 1e6, "ms", params);
+        ctx.result("teardown_released",
+          m1["server.teardown.released"] - m0["server.teardown.released"], "", params);
+      }
+    }
+  }
+  server.stop();
+  return status;
+}
+
+BENCH(teardown, "frame signal stall seen by other clients while a large session is torn down") {
+  RunLoop* rl = EV_DEFAULT;
+  uint32_t nobjects = ctx.quick ? 3000 : 30000;
+  int status = 0;
+  status |= measure(ctx, rl, nobjects, false);
+  status |= measure(ctx, rl, nobjects, true);
+  return status;
+}
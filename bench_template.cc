@@ -0,0 +1,83 @@
+// Command templates: upstream bytes and server CPU time per frame of a client which
+// sends its frames as is vs as instances of a command template.
+#include "bench.hh"
+
+static int measure(BenchContext& ctx, bool useTemplate, uint32_t draws) {
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+
+  RunLoop* rl = EV_DEFAULT;
+  BenchClient client;
+  client.render = true;
+  client.draws = draws;
+  client.useTemplate = useTemplate;
+  int status = 0;
+  std::map<std::string,double> m0, m1;
+  uint32_t frames0 = 0;
+  uint64_t bytes0 = 0;
+  if (!client.connect(rl, server.sockfile.c_str())) {
+    perror("connect");
+    status = 1;
+    goto end;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    status = 1;
+    goto end;
+  }
+  benchRunLoopFor(rl, 0.5); // warm up (pipeline creation, template recording)
+
+  if (!server.metrics(&m0)) {
+    status = 1;
+    goto end;
+  }
+  frames0 = client.frames;
+  bytes0 = client.proto.bytesOut;
+  benchRunLoopFor(rl, ctx.quick ? 1.0 : 5.0);
+  if (!server.metrics(&m1)) {
+    status = 1;
+    goto end;
+  }
+
+  {
+    double frames = (double)(client.frames - frames0);
+    if (frames < 1) {
+      fprintf(stderr, "no frames rendered\n");
+      status = 1;
+      goto end;
+    }
+    if (useTemplate && !client.frameTemplate.recorded()) {
+      fprintf(stderr, "frame template was not recorded\n");
+      status = 1;
+      goto end;
+    }
+    std::string params = std::string("mode=") + (useTemplate ? "template" : "commands") +
+                         ",draws=" + std::to_string(draws);
+    ctx.result("bytes_per_frame", (double)(client.proto.bytesOut - bytes0) / frames, "bytes",
+               params);
+    ctx.result("cpu_per_frame",
+      (m1["server.cpu_time"] - m0["server.cpu_time"]) * 1e6 / frames, "us", params);
+    if (useTemplate) {
+      ctx.result("template_command_bytes", (double)client.frameTemplate.commandSize(), "bytes",
+                 params);
+      // the server's connection is #0
+      ctx.result("instances",
+        m1["conn.0.template.instances"] - m0["conn.0.template.instances"], "count", params);
+    }
+  }
+
+end:
+  client.close();
+  server.stop();
+  return status;
+}
+
+BENCH(template, "upstream bytes & server CPU per frame, commands vs command template") {
+  int status = 0;
+  for (uint32_t draws : { 10u, 100u }) {
+    status |= measure(ctx, false, draws);
+    status |= measure(ctx, true, draws);
+  }
+  return status;
+}
@@ -0,0 +1,94 @@
+// Protocol throughput: wire command bytes per second a client can stream to the server
+// over a UNIX socket, as queue buffer writes of 256 B, 4 kB and 64 kB.
+#include "bench.hh"
+#include "metrics.hh" // monotimeNs
+#include <string.h>
+
+// sumConnMetric sums conn.*.<name> over all connections
+static double sumConnMetric(const std::map<std::string,double>& m, const char* name) {
+  double sum = 0;
+  size_t n = strlen(name);
+  for (auto& kv : m) {
+    const std::string& k = kv.first;
+    if (k.compare(0, 5, "conn.") == 0 && k.size() > n + 1 &&
+        k.compare(k.size() - n, n, name) == 0 && k[k.size() - n - 1] == '.')
+    {
+      sum += kv.second;
+    }
+  }
+  return sum;
+}
+
+static int measure(BenchContext& ctx, RunLoop* rl, BenchServer& server, size_t size) {
+  BenchClient client;
+  if (!client.connect(rl, server.sockfile.c_str())) {
+    perror("connect");
+    return 1;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    return 1;
+  }
+  std::vector<uint8_t> data(size);
+  for (uint8_t& b : data)
+    b = (uint8_t)ctx.random();
+  wgpu::BufferDescriptor desc;
+  desc.usage = wgpu::BufferUsage::CopyDst;
+  desc.size = size;
+  wgpu::Buffer buffer = client.device.CreateBuffer(&desc);
+  wgpu::Queue queue = client.device.GetQueue();
+  client.proto.Flush();
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.proto.pendingOutput() == 0; }))
+    return 1;
+
+  std::map<std::string,double> m0, m1;
+  if (!server.metrics(&m0))
+    return 1;
+  double duration = ctx.quick ? 0.5 : 2.0;
+  uint64_t bytes0 = client.proto.bytesOut, writes = 0;
+  uint64_t t0 = monotimeNs();
+  while ((double)(monotimeNs() - t0) < duration * 1e9) {
+    // up to ~64 kB of commands per flush, and keep the output queue short so that we
+    // measure the server's pace rather than how fast we can buffer
+    for (size_t n = 0; n < 65536; n += size) {
+      queue.WriteBuffer(buffer, 0, data.data(), size);
+      writes++;
+    }
+    client.proto.Flush();
+    while (client.proto.pendingOutput() > 1024 * 1024 && !client.proto.stopped())
+      ev_run(rl, EVRUN_ONCE);
+    ev_run(rl, EVRUN_NOWAIT);
+  }
+  uint64_t bytesSent = client.proto.bytesOut - bytes0;
+  // wait until the server has read and decoded everything
+  bool ok = benchRunLoopUntil(rl, 60.0, [&]() {
+    return server.metrics(&m1) && sumConnMetric(m1, "bytes_in") - sumConnMetric(m0, "bytes_in")
+                                  >= (double)bytesSent;
+  });
+  double seconds = (double)(monotimeNs() - t0) / 1e9;
+  if (!ok || client.proto.stopped()) {
+    fprintf(stderr, "server did not receive all data\n");
+    return 1;
+  }
+  std::string params = "write_size=" + std::to_string(size);
+  ctx.result("wire_throughput", (double)bytesSent / seconds / 1e6, "MB/s", params);
+  ctx.result("writes", (double)writes / seconds, "writes/s", params);
+  ctx.result("server_cpu_per_mb",
+    (m1["server.cpu_time"] - m0["server.cpu_time"]) / ((double)bytesSent / 1e6) * 1e3,
+    "ms", params);
+  client.close();
+  benchRunLoopFor(rl, 0.1); // let the server notice the disconnect
+  return 0;
+}
+
+BENCH(throughput, "wire command throughput over a UNIX socket, by buffer write size") {
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+  RunLoop* rl = EV_DEFAULT;
+  int status = 0;
+  for (size_t size : { 256, 4096, 65536 })
+    status |= measure(ctx, rl, server, size);
+  server.stop();
+  return status;
+}
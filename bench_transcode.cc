@@ -0,0 +1,175 @@
+// Compressed textures: UCT encode and transcode throughput (BC1 scalar vs SSE2, RGBA8,
+// 1 vs N threads) and wire bytes & time to upload a texture raw vs compressed.
+#include "bench.hh"
+#include "texcodec.hh"
+#include "metrics.hh" // monotimeNs
+#include <math.h>
+#include <thread>
+
+// makeImage fills a width x height RGBA8 image with smooth gradients and some noise,
+// which is closer to real textures than a constant color
+static std::vector<uint8_t> makeImage(uint32_t width, uint32_t height) {
+  std::vector<uint8_t> px((size_t)width * height * 4);
+  uint32_t seed = 1;
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      seed = seed * 1664525 + 1013904223;
+      int noise = (int)(seed >> 28) - 8;
+      uint8_t* p = &px[((size_t)y * width + x) * 4];
+      p[0] = (uint8_t)std::min(255, std::max(0, (int)(x * 255 / width) + noise));
+      p[1] = (uint8_t)std::min(255, std::max(0, (int)(y * 255 / height) + noise));
+      p[2] = (uint8_t)(128 + 127 * sinf((float)(x + y) * 0.02f));
+      p[3] = 255;
+    }
+  }
+  return px;
+}
+
+// timeIt returns the average time in seconds of fn over enough runs to take ~duration
+template <typename F>
+static double timeIt(double duration, F fn) {
+  uint64_t t0 = monotimeNs();
+  uint32_t runs = 0;
+  do {
+    fn();
+    runs++;
+  } while ((double)(monotimeNs() - t0) < duration * 1e9);
+  return (double)(monotimeNs() - t0) / 1e9 / runs;
+}
+
+static int measureCPU(BenchContext& ctx) {
+  uint32_t size = ctx.quick ? 512 : 2048;
+  double duration = ctx.quick ? 0.1 : 1.0;
+  std::vector<uint8_t> rgba = makeImage(size, size);
+  std::vector<uint8_t> uct(uctSize(size, size));
+  std::vector<uint8_t> out(uctTargetSize(UCT_TARGET_RGBA8, size, size));
+  double mpix = (double)size * size / 1e6;
+  std::string sizeParam = ",size=" + std::to_string(size);
+
+  double t = timeIt(duration, [&]() { uctEncode(rgba.data(), size, size, uct.data()); });
+  ctx.result("encode", mpix / t, "Mpix/s", "path=scalar" + sizeParam);
+
+  double err = 0;
+  uctTranscode(uct.data(), size, size, UCT_TARGET_RGBA8, out.data());
+  for (size_t i = 0; i < rgba.size(); i++) {
+    if (i % 4 != 3)
+      err += fabs((double)rgba[i] - (double)out[i]);
+  }
+  ctx.result("mean_abs_error", err / ((double)size * size * 3), "", sizeParam.substr(1));
+
+  unsigned nthreads = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+  auto report = [&](const char* target, const char* path, unsigned threads, double t) {
+    std::string params = std::string("target=") + target + ",path=" + path +
+                         ",threads=" + std::to_string(threads) + sizeParam;
+    ctx.result("transcode", mpix / t, "Mpix/s", params);
+    ctx.result("transcode_input", (double)uct.size() / t / 1e9, "GB/s", params);
+  };
+
+  t = timeIt(duration, [&]() {
+    uctTranscodeBC1Scalar(uct.data(), uct.size() / UCT_BLOCK_SIZE, out.data());
+  });
+  report("bc1", "scalar", 1, t);
+  for (unsigned threads : { 1u, nthreads }) {
+    t = timeIt(duration, [&]() {
+      uctTranscode(uct.data(), size, size, UCT_TARGET_BC1, out.data(), threads);
+    });
+    report("bc1", "simd", threads, t);
+  }
+  for (unsigned threads : { 1u, nthreads }) {
+    t = timeIt(duration, [&]() {
+      uctTranscode(uct.data(), size, size, UCT_TARGET_RGBA8, out.data(), threads);
+    });
+    report("rgba8", "scalar", threads, t);
+  }
+  return 0;
+}
+
+static int measureUpload(BenchContext& ctx, RunLoop* rl, BenchServer& server, uint32_t size,
+                         bool compressed)
+{
+  BenchClient client;
+  if (!client.connect(rl, server.sockfile.c_str())) {
+    perror("connect");
+    return 1;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    return 1;
+  }
+  auto drain = [&]() {
+    client.proto.Flush();
+    return benchRunLoopUntil(rl, 60.0, [&]() { return client.proto.pendingOutput() == 0; });
+  };
+  if (!drain())
+    return 1;
+
+  std::vector<uint8_t> rgba = makeImage(size, size);
+  std::map<std::string,double> m0, m1;
+  if (!server.metrics(&m0))
+    return 1;
+  uint64_t bytes0 = client.proto.bytesOut;
+  uint64_t t0 = monotimeNs();
+  wgpu::Texture texture;
+
+  if (compressed) {
+    texture = uploadCompressedTexture(
+      client.proto, client.wireClient, client.device, size, size, rgba.data());
+  } else {
+    wgpu::TextureDescriptor desc;
+    desc.size = { size, size, 1 };
+    desc.format = wgpu::TextureFormat::RGBA8Unorm;
+    desc.usage = wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::Sampled;
+    texture = client.device.CreateTexture(&desc);
+    wgpu::Queue queue = client.device.GetQueue();
+    // in chunks of rows which fit in a wire command buffer
+    uint32_t bytesPerRow = size * 4;
+    uint32_t chunkRows = std::max(1u, (uint32_t)(65536 / bytesPerRow));
+    for (uint32_t row = 0; row < size; row += chunkRows) {
+      uint32_t nrows = std::min(chunkRows, size - row);
+      wgpu::ImageCopyTexture dst;
+      dst.texture = texture;
+      dst.origin = { 0, row, 0 };
+      wgpu::TextureDataLayout layout;
+      layout.bytesPerRow = bytesPerRow;
+      layout.rowsPerImage = nrows;
+      wgpu::Extent3D extent = { size, nrows, 1 };
+      queue.WriteTexture(&dst, &rgba[(size_t)row * bytesPerRow], (size_t)nrows * bytesPerRow,
+                         &layout, &extent);
+      client.proto.Flush();
+    }
+  }
+  client.renderFrame();
+  if (!drain())
+    return 1;
+  double ms = (double)(monotimeNs() - t0) / 1e6;
+  benchRunLoopFor(rl, 0.1); // let the server read everything
+  if (!server.metrics(&m1))
+    return 1;
+
+  std::string params = std::string("mode=") + (compressed ? "uct" : "raw") +
+                       ",size=" + std::to_string(size);
+  ctx.result("wire_bytes", (double)(client.proto.bytesOut - bytes0), "bytes", params);
+  ctx.result("upload_time", ms, "ms", params);
+  if (compressed) {
+    ctx.result("server_transcode_time",
+      (m1["server.transcode.ns"] - m0["server.transcode.ns"]) / 1e6, "ms", params);
+  }
+  return 0;
+}
+
+BENCH(transcode, "UCT texture transcode throughput and upload bytes, raw vs compressed") {
+  int status = measureCPU(ctx);
+  BenchServer server;
+  if (!server.start(ctx, {}))
+    return 1;
+  RunLoop* rl = EV_DEFAULT;
+  std::vector<uint32_t> sizes = { 1024, 2048 };
+  if (ctx.quick)
+    sizes = { 256 };
+  for (uint32_t size : sizes) {
+    status |= measureUpload(ctx, rl, server, size, false);
+    status |= measureUpload(ctx, rl, server, size, true);
+  }
+  server.stop();
+  return status;
+}
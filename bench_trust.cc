@@ -0,0 +1,78 @@
+// Trusted-client fast path: server CPU time and HandleCommands time per frame for a
+// draw-heavy client, with Dawn validation on (default) and off (-trust=self).
+#include "bench.hh"
+
+static int measure(BenchContext& ctx, bool trusted, uint32_t draws) {
+  BenchServer server;
+  std::vector<std::string> args;
+  if (trusted)
+    args.push_back("-trust=self");
+  if (!server.start(ctx, args))
+    return 1;
+
+  RunLoop* rl = EV_DEFAULT;
+  BenchClient client;
+  client.render = true;
+  client.draws = draws;
+  int status = 0;
+  std::map<std::string,double> m0, m1;
+  uint32_t frames0 = 0;
+  if (!client.connect(rl, server.sockfile.c_str())) {
+    perror("connect");
+    status = 1;
+    goto end;
+  }
+  if (!benchRunLoopUntil(rl, 30.0, [&]() { return client.ready(); })) {
+    fprintf(stderr, "client did not become ready\n");
+    status = 1;
+    goto end;
+  }
+  benchRunLoopFor(rl, 0.5); // warm up (pipeline creation etc)
+
+  if (!server.metrics(&m0)) {
+    status = 1;
+    goto end;
+  }
+  frames0 = client.frames;
+  benchRunLoopFor(rl, ctx.quick ? 1.0 : 5.0);
+  if (!server.metrics(&m1)) {
+    status = 1;
+    goto end;
+  }
+
+  {
+    // frames rendered by the client (the server's connection is #0)
+    double frames = (double)(client.frames - frames0);
+    if (frames < 1) {
+      fprintf(stderr, "no frames rendered\n");
+      status = 1;
+      goto end;
+    }
+    std::string params = std::string("trusted=") + (trusted ? "1" : "0") +
+                         ",draws=" + std::to_string(draws);
+    ctx.result("cpu_per_frame",
+      (m1["server.cpu_time"] - m0["server.cpu_time"]) * 1e6 / frames, "us", params);
+    ctx.result("handle_commands_per_frame",
+      (m1["conn.0.handle_commands_ns"] - m0["conn.0.handle_commands_ns"]) / 1e3 / frames,
+      "us", params);
+    ctx.result("frames", frames, "count", params);
+    if (m1["conn.0.trusted"] != (trusted ? 1 : 0)) {
+      fprintf(stderr, "connection trust does not match -trust\n");
+      status = 1;
+    }
+  }
+
+end:
+  client.close();
+  server.stop();
+  return status;
+}
+
+BENCH(trust, "server CPU per frame with and without Dawn validation (-trust)") {
+  int status = 0;
+  for (uint32_t draws : { 100u, 1000u }) {
+    status |= measure(ctx, false, draws);
+    status |= measure(ctx, true, draws);
+  }
+  return status;
+}
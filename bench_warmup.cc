@@ -0,0 +1,145 @@
+// Server warm-up: time from connect to the first present of a client which creates a
+// set of shader modules and pipelines at startup, against a fresh server ("cold") vs
+// one which replayed a capture of an earlier session of that client (-warmup), and
+// the time the warm-up takes.
+#include "bench.hh"
+#include "metrics.hh" // monotimeNs
+#include "utils/ComboRenderPipelineDescriptor.h"
+#include "utils/WGPUHelpers.h"
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+
+// createPipelines creates n render pipelines with distinct shaders, as an application
+// with several materials would at startup
+static std::vector<wgpu::RenderPipeline> createPipelines(const wgpu::Device& device, uint32_t n) {
+  std::vector<wgpu::RenderPipeline> pipelines;
+  for (uint32_t i = 0; i < n; i++) {
+    std::string c = std::to_string((float)i / (float)n);
+    utils::ComboRenderPipelineDescriptor2 desc;
+    desc.vertex.module = utils::CreateShaderModule(device, (R"(
+      [[stage(vertex)]] fn main(
+          [[builtin(vertex_index)]] VertexIndex : u32
+      ) -> [[builtin(position)]] vec4<f32> {
+          let x : f32 = f32(VertexIndex % 2u) * )" + c + R"(;
+          return vec4<f32>(x, f32(VertexIndex / 2u) - 0.5, 0.0, 1.0);
+      }
+    )").c_str());
+    desc.cFragment.module = utils::CreateShaderModule(device, (R"(
+      [[stage(fragment)]] fn main() -> [[location(0)]] vec4<f32> {
+          return vec4<f32>()" + c + R"(, 0.5, 0.7, 1.0);
+      }
+    )").c_str());
+    desc.cTargets[0].format = wgpu::TextureFormat::BGRA8Unorm;
+    pipelines.push_back(device.CreateRenderPipeline2(&desc));
+  }
+  return pipelines;
+}
+
+// firstPresent waits for a connection of server to present and returns the time from
+// its accept to the first present in ms (0 on timeout)
+static double firstPresent(RunLoop* rl, BenchServer& server) {
+  double t = 0;
+  for (int i = 0; i < 400 && t == 0; i++) {
+    benchRunLoopFor(rl, 0.025);
+    std::map<std::string,double> m;
+    if (!server.metrics(&m))
+      break;
+    for (auto& kv : m) {
+      const char* suffix = ".first_present_ns";
+      size_t n = strlen(suffix);
+      if (kv.first.size() > n && kv.first.compare(kv.first.size() - n, n, suffix) == 0)
+        t = std::max(t, kv.second / 1e6);
+    }
+  }
+  return t;
+}
+
+// session connects a client which creates npipelines and renders a frame
+static int session(RunLoop* rl, BenchServer& server, uint32_t npipelines, double* ms) {
+  BenchClient client;
+  if (!client.connect(rl, server.sockfile.c_str())) {
+    perror("connect");
+    return 1;
+  }
+  std::vector<wgpu::RenderPipeline> pipelines = createPipelines(client.device, npipelines);
+  client.renderFrame();
+  *ms = firstPresent(rl, server);
+  pipelines.clear(); // before the wire client goes away
+  client.close();
+  if (*ms == 0) {
+    fprintf(stderr, "server did not present a frame\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int measure(BenchContext& ctx, RunLoop* rl, const std::string& capdir,
+                   uint32_t npipelines, bool warm)
+{
+  std::vector<std::string> args;
+  if (warm)
+    args.push_back("-warmup=" + capdir);
+  BenchServer server;
+  uint64_t t0 = monotimeNs();
+  if (!server.start(ctx, args))
+    return 1;
+  double startMs = (double)(monotimeNs() - t0) / 1e6;
+  double ms = 0;
+  std::map<std::string,double> m;
+  int status = session(rl, server, npipelines, &ms);
+  if (status == 0 && server.metrics(&m)) {
+    std::string params = std::string("mode=") + (warm ? "warm" : "cold") +
+                         ",pipelines=" + std::to_string(npipelines);
+    ctx.result("time_to_first_frame", ms, "ms", params);
+    ctx.result("server_start", startMs, "ms", params);
+    if (warm) {
+      ctx.result("warmup_time", m["server.warmup.ns"] / 1e6, "ms", params);
+      ctx.result("warmup_commands", m["server.warmup.commands"], "count", params);
+      if (m["server.warmup.failed"] > 0) {
+        fprintf(stderr, "%.0f warm-up commands failed\n", m["server.warmup.failed"]);
+        status = 1;
+      }
+    }
+  }
+  server.stop();
+  return status;
+}
+
+BENCH(warmup, "time to first frame of a pipeline-heavy client, cold vs -warmup server") {
+  RunLoop* rl = EV_DEFAULT;
+  char tmpl[] = "/tmp/dawn-bench-warmup-XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string capdir = tmpl;
+  uint32_t npipelines = ctx.quick ? 8 : 64;
+  int status = 0;
+
+  // record a session of the client
+  {
+    BenchServer server;
+    double ms;
+    if (!server.start(ctx, { "-capture=" + capdir }) ||
+        session(rl, server, npipelines, &ms) != 0)
+    {
+      status = 1;
+    }
+    benchRunLoopFor(rl, 0.2); // let the server close the connection and its capture
+    server.stop();
+  }
+  int runs = ctx.quick ? 1 : 3;
+  for (int i = 0; i < runs && status == 0; i++) {
+    status |= measure(ctx, rl, capdir, npipelines, false);
+    status |= measure(ctx, rl, capdir, npipelines, true);
+  }
+
+  if (DIR* d = opendir(capdir.c_str())) {
+    while (struct dirent* e = readdir(d))
+      unlink((capdir + "/" + e->d_name).c_str());
+    closedir(d);
+  }
+  rmdir(capdir.c_str());
+  return status;
+}
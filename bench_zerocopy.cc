@@ -0,0 +1,89 @@
+// Zero-copy sends: CPU time per GB of large command buffers (buffer uploads) sent over
+// TCP by a client, with regular writes vs MSG_ZEROCOPY.
+#include "bench.hh"
+#include "metrics.hh" // processCPUTime
+
+static int upload(BenchContext& ctx, RunLoop* rl, BenchServer& server, int port, bool zerocopy) {
+  BenchClient client;
+  int fd = benchConnectTCP("127.0.0.1", port);
+  if (fd < 0 || !client.connectFD(rl, fd)) {
+    perror("benchConnectTCP");
+    return 1;
+  }
+  if (zerocopy && !client.proto.enableZeroCopy(64 * 1024)) {
+    perror("enableZeroCopy");
+    return 1;
+  }
+
+  const size_t chunk = 64 * 1024;
+  const uint64_t total = (ctx.quick ? 64ull : 1024ull) * 1024 * 1024;
+  std::vector<uint8_t> data(chunk, 0x5a);
+  wgpu::BufferDescriptor desc;
+  desc.size = chunk;
+  desc.usage = wgpu::BufferUsage::CopyDst;
+  wgpu::Buffer buffer = client.device.CreateBuffer(&desc);
+  wgpu::Queue queue = client.device.GetQueue();
+  client.proto.Flush();
+  if (!benchRunLoopUntil(rl, 10.0, [&]() { return client.proto.pendingOutput() == 0; }))
+    return 1;
+
+  std::map<std::string,double> m0, m1;
+  if (!server.metrics(&m0))
+    return 1;
+  uint64_t bytes0 = client.proto.bytesOut;
+  double cpu0 = processCPUTime();
+  uint64_t t0 = monotimeNs();
+  for (uint64_t sent = 0; sent < total; sent += chunk) {
+    queue.WriteBuffer(buffer, 0, data.data(), chunk);
+    if (client.proto.pendingOutput() > 16 * 1024 * 1024) {
+      client.proto.Flush();
+      benchRunLoopUntil(rl, 10.0, [&]() { return client.proto.pendingOutput() < 4*1024*1024; });
+    }
+  }
+  client.proto.Flush();
+  if (!benchRunLoopUntil(rl, 60.0, [&]() { return client.proto.pendingOutput() == 0; }))
+    return 1;
+  double cpu1 = processCPUTime();
+  uint64_t bytes = client.proto.bytesOut - bytes0;
+  std::string key = "conn.0.bytes_in";
+  // wait for the server to have read everything
+  for (int i = 0; i < 1000; i++) {
+    m1.clear();
+    if (!server.metrics(&m1))
+      return 1;
+    if (m1[key] - m0[key] >= (double)bytes)
+      break;
+    benchRunLoopFor(rl, 0.01);
+  }
+  double secs = (double)(monotimeNs() - t0) / 1e9;
+  double gb = (double)bytes / (1024.0 * 1024.0 * 1024.0);
+
+  std::string params = std::string("mode=") + (zerocopy ? "zerocopy" : "copy") +
+                       ",chunk=" + std::to_string(chunk / 1024) + "KB";
+  ctx.result("client_cpu_per_gb", (cpu1 - cpu0) / gb, "s", params);
+  ctx.result("server_cpu_per_gb", (m1["server.cpu_time"] - m0["server.cpu_time"]) / gb, "s",
+             params);
+  ctx.result("throughput", (double)bytes / secs / (1024.0 * 1024.0), "MB/s", params);
+  if (zerocopy) {
+    ctx.result("zero_copy_sends", (double)client.proto.zeroCopySends, "", params);
+    ctx.result("zero_copy_copied", (double)client.proto.zeroCopyCopied, "", params);
+  }
+  return 0;
+}
+
+static int measure(BenchContext& ctx, RunLoop* rl, bool zerocopy) {
+  int port = benchFreeTCPPort();
+  BenchServer server;
+  if (port < 0 || !server.start(ctx, { "-tcp=127.0.0.1:" + std::to_string(port) }))
+    return 1;
+  int status = upload(ctx, rl, server, port, zerocopy);
+  server.stop();
+  return status;
+}
+
+BENCH(zerocopy, "CPU per GB sent over TCP, with and without MSG_ZEROCOPY") {
+  RunLoop* rl = EV_DEFAULT;
+  int status = measure(ctx, rl, false);
+  status |= measure(ctx, rl, true);
+  return status;
+}
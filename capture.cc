@@ -0,0 +1,802 @@
+#include "capture.hh"
+#include "assetpack.hh" // ASSET_BUFFER_LABEL_PREFIX
+#include "meshcodec.hh" // MESH_BUFFER_LABEL_PREFIX
+#include "metrics.hh" // monotimeNs
+#include "protocol.hh" // DAWNCMD_MAX
+
+#include "dawn_wire/ObjectType_autogen.h"
+#include "dawn_wire/WireCmd_autogen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+bool CaptureWriter::open(const char* filename) {
+  close();
+  _f = fopen(filename, "wb");
+  if (_f == nullptr)
+    return false;
+  uint32_t version = CAPTURE_VERSION;
+  if (fwrite("DCAP", 4, 1, _f) != 1 || fwrite(&version, sizeof(version), 1, _f) != 1) {
+    int e = errno;
+    fclose(_f);
+    _f = nullptr;
+    errno = e;
+    return false;
+  }
+  bytes = 4 + sizeof(version);
+  frames = 0;
+  _startNs = monotimeNs();
+  return true;
+}
+
+void CaptureWriter::close() {
+  if (_f) {
+    fclose(_f);
+    _f = nullptr;
+  }
+}
+
+bool CaptureWriter::writeRecord(char type, const void* data, size_t len) {
+  if (_f == nullptr)
+    return false;
+  if (len > UINT32_MAX) {
+    errno = EINVAL;
+    return false;
+  }
+  char hdr[8] = { type, 0, 0, 0 };
+  uint32_t size = (uint32_t)len;
+  memcpy(&hdr[4], &size, sizeof(size));
+  if (fwrite(hdr, sizeof(hdr), 1, _f) != 1 || (len > 0 && fwrite(data, len, 1, _f) != 1))
+    return false;
+  bytes += sizeof(hdr) + len;
+  return true;
+}
+
+bool CaptureWriter::reservation(const dawn_wire::ReservedSwapChain& scr) {
+  uint32_t v[4] = { scr.id, scr.generation, scr.deviceId, scr.deviceGeneration };
+  return writeRecord(CAPTURE_RESERVATION, v, sizeof(v));
+}
+
+bool CaptureWriter::commands(const char* data, size_t len) {
+  return writeRecord(CAPTURE_COMMANDS, data, len);
+}
+
+bool CaptureWriter::texture(
+  const DawnRemoteProtocol::CompressedTextureInfo& info, const char* data, size_t len)
+{
+  uint32_t v[6] = {
+    info.id, info.generation, info.deviceId, info.deviceGeneration, info.width, info.height };
+  std::string payload((const char*)v, sizeof(v));
+  payload.append(data, len);
+  return writeRecord(CAPTURE_TEXTURE, payload.data(), payload.size());
+}
+
+bool CaptureWriter::meshBuffer(
+  const DawnRemoteProtocol::CompressedMeshBufferInfo& info, const char* data, size_t len)
+{
+  uint32_t v[4] = { info.token, info.kind, info.stride, info.count };
+  std::string payload((const char*)v, sizeof(v));
+  payload.append(data, len);
+  return writeRecord(CAPTURE_MESH_BUFFER, payload.data(), payload.size());
+}
+
+bool CaptureWriter::renderScale(const DawnRemoteProtocol::RenderScaleInfo& info) {
+  uint32_t v[5] = { info.id, info.generation, info.deviceId, info.deviceGeneration, info.scale };
+  return writeRecord(CAPTURE_RENDER_SCALE, v, sizeof(v));
+}
+
+bool CaptureWriter::asset(const DawnRemoteProtocol::AssetInfo& info) {
+  uint32_t v[9] = {
+    info.kind, info.token, info.id, info.generation, info.deviceId, info.deviceGeneration,
+    info.width, info.height, info.format };
+  char payload[16 + sizeof(v)];
+  memcpy(&payload[0], &info.asset.hash, 8);
+  memcpy(&payload[8], &info.asset.size, 8);
+  memcpy(&payload[16], v, sizeof(v));
+  return writeRecord(CAPTURE_ASSET, payload, sizeof(payload));
+}
+
+bool CaptureWriter::endFrame() {
+  uint64_t t = monotimeNs() - _startNs;
+  frames++;
+  return writeRecord(CAPTURE_FRAME, &t, sizeof(t));
+}
+
+
+bool CaptureReader::open(const char* filename) {
+  close();
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int e = errno;
+    ::close(fd);
+    errno = e;
+    return false;
+  }
+  size_t size = (size_t)st.st_size;
+  uint32_t version = 0;
+  if (size < 8) {
+    ::close(fd);
+    errno = EINVAL;
+    return false;
+  }
+  void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  memcpy(&version, (const char*)p + 4, sizeof(version));
+  if (memcmp(p, "DCAP", 4) != 0 || version != CAPTURE_VERSION) {
+    munmap(p, size);
+    errno = EINVAL;
+    return false;
+  }
+  madvise(p, size, MADV_SEQUENTIAL);
+  _data = (const char*)p;
+  _size = size;
+  rewind();
+  return true;
+}
+
+void CaptureReader::close() {
+  if (_data) {
+    munmap((void*)_data, _size);
+    _data = nullptr;
+    _size = 0;
+  }
+}
+
+void CaptureReader::rewind() {
+  _offs = 8;
+  _error = false;
+}
+
+bool CaptureReader::next(CaptureRecord* r) {
+  if (_data == nullptr || _offs == _size)
+    return false;
+  uint32_t size;
+  if (_size - _offs < 8) {
+    _error = true;
+    return false;
+  }
+  memcpy(&size, &_data[_offs + 4], sizeof(size));
+  if (_size - _offs - 8 < size) {
+    _error = true;
+    return false;
+  }
+  r->type = _data[_offs];
+  r->data = &_data[_offs + 8];
+  r->size = size;
+  _offs += 8 + size;
+  return true;
+}
+
+
+bool captureSend(DawnRemoteProtocol& proto, const CaptureRecord& rec) {
+  switch (rec.type) {
+    case CAPTURE_RESERVATION: {
+      dawn_wire::ReservedSwapChain scr = {};
+      uint32_t v[4] = {};
+      memcpy(v, rec.data, std::min(rec.size, sizeof(v)));
+      scr.id = v[0];
+      scr.generation = v[1];
+      scr.deviceId = v[2];
+      scr.deviceGeneration = v[3];
+      return proto.sendReservation(scr);
+    }
+    case CAPTURE_COMMANDS:
+      return proto.sendDawnCommands(rec.data, rec.size);
+    case CAPTURE_TEXTURE: {
+      uint32_t v[6] = {};
+      if (rec.size < sizeof(v))
+        return false;
+      memcpy(v, rec.data, sizeof(v));
+      dawn_wire::ReservedTexture t = {};
+      t.id = v[0];
+      t.generation = v[1];
+      t.deviceId = v[2];
+      t.deviceGeneration = v[3];
+      return proto.sendCompressedTexture(t, v[4], v[5], rec.data + sizeof(v), rec.size - sizeof(v));
+    }
+    case CAPTURE_MESH_BUFFER: {
+      uint32_t v[4];
+      if (rec.size < sizeof(v))
+        return false;
+      memcpy(v, rec.data, sizeof(v));
+      DawnRemoteProtocol::CompressedMeshBufferInfo info = { v[0], v[1], v[2], v[3] };
+      return proto.sendCompressedMeshBuffer(info, rec.data + sizeof(v), rec.size - sizeof(v));
+    }
+    case CAPTURE_RENDER_SCALE: {
+      uint32_t v[5];
+      if (rec.size < sizeof(v))
+        return false;
+      memcpy(v, rec.data, sizeof(v));
+      dawn_wire::ReservedTexture t = {};
+      t.id = v[0];
+      t.generation = v[1];
+      t.deviceId = v[2];
+      t.deviceGeneration = v[3];
+      return proto.sendRenderScale(t, v[4]);
+    }
+    case CAPTURE_ASSET: {
+      uint32_t v[9];
+      if (rec.size < 16 + sizeof(v))
+        return false;
+      DawnRemoteProtocol::AssetInfo info;
+      memcpy(&info.asset.hash, rec.data, 8);
+      memcpy(&info.asset.size, rec.data + 8, 8);
+      memcpy(v, rec.data + 16, sizeof(v));
+      info.kind = v[0];
+      info.token = v[1];
+      info.id = v[2];
+      info.generation = v[3];
+      info.deviceId = v[4];
+      info.deviceGeneration = v[5];
+      info.width = v[6];
+      info.height = v[7];
+      info.format = v[8];
+      return proto.sendAsset(info);
+    }
+  }
+  return true;
+}
+
+bool captureForEachCommand(
+  const char* data, size_t len, const std::function<void(const char* cmd, size_t size)>& fn)
+{
+  size_t offs = 0;
+  while (offs < len) {
+    uint64_t cmdsize;
+    if (len - offs < sizeof(cmdsize))
+      return false;
+    memcpy(&cmdsize, &data[offs], sizeof(cmdsize));
+    if (cmdsize < sizeof(cmdsize) || cmdsize > len - offs)
+      return false;
+    fn(&data[offs], (size_t)cmdsize);
+    offs += cmdsize;
+  }
+  return true;
+}
+
+
+namespace {
+
+using dawn_wire::ObjectType;
+using dawn_wire::WireCmd;
+
+
+static inline uint64_t objectKey(ObjectType type, uint32_t id) {
+  return ((uint64_t)type << 32) | id;
+}
+
+// createdType returns the type of object a create command makes, and whether its
+// descriptor may refer to other objects. False if cmd doesn't create a tracked object.
+static bool createdType(WireCmd cmd, ObjectType* type, bool* refs) {
+  *refs = false;
+  switch (cmd) {
+    case WireCmd::DeviceCreateBindGroupLayout: *type = ObjectType::BindGroupLayout; break;
+    case WireCmd::DeviceCreateBuffer:          *type = ObjectType::Buffer; break;
+    case WireCmd::DeviceCreateSampler:         *type = ObjectType::Sampler; break;
+    case WireCmd::DeviceCreateShaderModule:    *type = ObjectType::ShaderModule; break;
+    case WireCmd::DeviceCreateTexture:         *type = ObjectType::Texture; break;
+    default:
+      *refs = true;
+      switch (cmd) {
+        case WireCmd::DeviceCreateBindGroup:       *type = ObjectType::BindGroup; break;
+        case WireCmd::DeviceCreateComputePipeline: *type = ObjectType::ComputePipeline; break;
+        case WireCmd::DeviceCreatePipelineLayout:  *type = ObjectType::PipelineLayout; break;
+        case WireCmd::DeviceCreateRenderPipeline:
+        case WireCmd::DeviceCreateRenderPipeline2: *type = ObjectType::RenderPipeline; break;
+        case WireCmd::TextureCreateView:           *type = ObjectType::TextureView; break;
+        default:
+          return false;
+      }
+  }
+  return true;
+}
+
+// bufferToken finds the token of a buffer created with a mesh or asset label (see
+// meshcodec.hh and assetpack.hh) in a DeviceCreateBuffer command, whose serialized
+// descriptor includes the label. Asset tokens are returned with bit 32 set.
+static bool bufferToken(const char* cmd, size_t size, uint64_t* token) {
+  static const char* prefixes[2] = { MESH_BUFFER_LABEL_PREFIX, ASSET_BUFFER_LABEL_PREFIX };
+  for (uint64_t i = 0; i < 2; i++) {
+    size_t n = strlen(prefixes[i]);
+    const char* p = (const char*)memmem(cmd, size, prefixes[i], n);
+    if (p == nullptr)
+      continue;
+    p += n;
+    uint32_t v = 0;
+    const char* end = cmd + size;
+    const char* d = p;
+    for (; d < end && d - p < 10 && *d >= '0' && *d <= '9'; d++)
+      v = v * 10 + (uint32_t)(*d - '0');
+    if (d == p)
+      continue;
+    *token = (i << 32) | v;
+    return true;
+  }
+  return false;
+}
+
+// AliveIndex finds objects alive at an event (created before and destroyed after it.)
+// take removes the objects it finds, so that finding all of them costs O(n log n).
+struct AliveIndex {
+  struct Entry {
+    uint64_t begin;
+    uint64_t end;
+    size_t   id;
+  };
+  std::vector<Entry>    entries; // sorted by begin
+  std::vector<uint64_t> maxEnd;  // segment tree of the entries' ends (0 once taken)
+
+  void add(uint64_t begin, uint64_t end, size_t id) {
+    assert(entries.empty() || entries.back().begin < begin);
+    entries.push_back({ begin, end, id });
+  }
+
+  void build() {
+    maxEnd.assign(entries.size() * 4, 0);
+    if (!entries.empty())
+      build(1, 0, entries.size());
+  }
+
+  // take calls fn with the id of every object alive at ev which hasn't been taken
+  template <typename F> void take(uint64_t ev, const F& fn) {
+    auto it = std::lower_bound(entries.begin(), entries.end(), ev,
+      [](const Entry& e, uint64_t ev) { return e.begin < ev; });
+    size_t limit = (size_t)(it - entries.begin());
+    if (limit > 0)
+      take(1, 0, entries.size(), limit, ev, fn);
+  }
+
+  // internal
+  uint64_t build(size_t node, size_t lo, size_t hi) {
+    if (hi - lo == 1)
+      return maxEnd[node] = entries[lo].end;
+    size_t mid = (lo + hi) / 2;
+    return maxEnd[node] = std::max(build(node * 2, lo, mid), build(node * 2 + 1, mid, hi));
+  }
+
+  template <typename F>
+  uint64_t take(size_t node, size_t lo, size_t hi, size_t limit, uint64_t ev, const F& fn) {
+    if (lo >= limit || maxEnd[node] <= ev)
+      return maxEnd[node];
+    if (hi - lo == 1) {
+      fn(entries[lo].id);
+      return maxEnd[node] = 0;
+    }
+    size_t mid = (lo + hi) / 2;
+    uint64_t a = take(node * 2, lo, mid, limit, ev, fn);
+    uint64_t b = take(node * 2 + 1, mid, hi, limit, ev, fn);
+    return maxEnd[node] = std::max(a, b);
+  }
+};
+
+#define NO_END UINT64_MAX
+
+struct Slicer {
+  CaptureWriter      w;
+  std::string        pending; // commands not yet written as a 'D' record
+
+  // frame-local objects dropped from the setup, until they are destroyed
+  std::unordered_set<uint64_t> dropped;
+  // dropped encoders and passes which have not been finished or ended
+  std::unordered_set<uint64_t> recording;
+
+  // Objects created before the slice, found by a first pass over the setup (scanning.)
+  // Setup commands kept by keepSetup and texture, mesh buffer and asset records are
+  // numbered in order as events. An object destroyed before the slice is dropped along
+  // with the commands and records made on it, unless something kept may refer to it
+  // (see resolve.)
+  struct Lifetime {
+    uint64_t begin;   // event which created the object
+    uint64_t end;     // event which destroyed it (NO_END if it outlives the setup)
+    bool     texture;
+    bool     refs;    // its create may refer to other objects
+    bool     keep;
+  };
+  std::vector<Lifetime>                lifetimes;
+  std::unordered_map<uint64_t,size_t>  live;   // objectKey -> lifetime
+  std::unordered_map<uint64_t,size_t>  tokens; // buffer token (see bufferToken) -> lifetime
+  std::vector<uint64_t>         anyRefs;       // commands which may refer to any object
+  std::set<uint64_t>            textureWrites; // QueueWriteTexture events not yet kept
+  std::unordered_set<uint64_t>  keptTextureWrites;
+  bool                          scanning = true;
+  uint64_t                      event = 0;
+  size_t                        created = 0; // lifetimes seen again after scanning
+
+  bool flush() {
+    if (pending.empty())
+      return true;
+    bool ok = w.commands(pending.data(), pending.size());
+    pending.clear();
+    return ok;
+  }
+
+  bool add(const char* cmd, size_t size) {
+    if (pending.size() + size > DAWNCMD_MAX && !flush())
+      return false;
+    pending.append(cmd, size);
+    return true;
+  }
+
+  void drop(ObjectType type, const char* cmd, size_t size, bool isRecording) {
+    uint64_t key = objectKey(type, captureCmdU32(cmd, size, CAPTURE_CMD_RESULT_OFFS));
+    dropped.insert(key);
+    if (isRecording)
+      recording.insert(key);
+  }
+
+  bool isRecording(ObjectType type, uint32_t id) const {
+    return recording.count(objectKey(type, id)) != 0;
+  }
+
+  bool endRecording(ObjectType type, uint32_t id) {
+    return recording.erase(objectKey(type, id)) != 0;
+  }
+
+  // keepDestroy returns false for DestroyObject of a dropped object
+  bool keepDestroy(const char* cmd, size_t size) {
+    ObjectType type = (ObjectType)captureCmdU32(cmd, size, CAPTURE_CMD_SELF_OFFS);
+    uint64_t key = objectKey(type, captureCmdU32(cmd, size, CAPTURE_CMD_RESULT_OFFS));
+    recording.erase(key);
+    return dropped.erase(key) == 0;
+  }
+
+  // keepSetup decides if a command of a frame before the slice is kept
+  bool keepSetup(const char* cmd, size_t size) {
+    if (size < CAPTURE_CMD_SELF_OFFS + 4)
+      return true;
+    uint32_t self = captureCmdU32(cmd, size, CAPTURE_CMD_SELF_OFFS);
+    switch ((WireCmd)captureCmdU32(cmd, size, CAPTURE_CMD_ID_OFFS)) {
+      case WireCmd::QueueSubmit:
+      case WireCmd::SwapChainPresent:
+        return false;
+
+      case WireCmd::DeviceCreateCommandEncoder:
+        drop(ObjectType::CommandEncoder, cmd, size, true);
+        return false;
+      case WireCmd::CommandEncoderBeginRenderPass:
+        if (!isRecording(ObjectType::CommandEncoder, self))
+          return true;
+        drop(ObjectType::RenderPassEncoder, cmd, size, true);
+        return false;
+      case WireCmd::CommandEncoderBeginComputePass:
+        if (!isRecording(ObjectType::CommandEncoder, self))
+          return true;
+        drop(ObjectType::ComputePassEncoder, cmd, size, true);
+        return false;
+      case WireCmd::CommandEncoderFinish:
+        if (!endRecording(ObjectType::CommandEncoder, self))
+          return true;
+        drop(ObjectType::CommandBuffer, cmd, size, false);
+        return false;
+      case WireCmd::RenderPassEncoderEndPass:
+        return !endRecording(ObjectType::RenderPassEncoder, self);
+      case WireCmd::ComputePassEncoderEndPass:
+        return !endRecording(ObjectType::ComputePassEncoder, self);
+
+      case WireCmd::DestroyObject:
+        return keepDestroy(cmd, size);
+
+      // commands on other objects, which may be made while an encoder is recording
+      case WireCmd::BufferDestroy:
+      case WireCmd::BufferMapAsync:
+      case WireCmd::BufferUnmap:
+      case WireCmd::DeviceCreateBindGroup:
+      case WireCmd::DeviceCreateBindGroupLayout:
+      case WireCmd::DeviceCreateBuffer:
+      case WireCmd::DeviceCreateComputePipeline:
+      case WireCmd::DeviceCreatePipelineLayout:
+      case WireCmd::DeviceCreateRenderPipeline:
+      case WireCmd::DeviceCreateSampler:
+      case WireCmd::DeviceCreateShaderModule:
+      case WireCmd::DeviceCreateTexture:
+      case WireCmd::QueueWriteBuffer:
+      case WireCmd::QueueWriteTexture:
+      case WireCmd::TextureCreateView:
+      case WireCmd::TextureDestroy:
+        return true;
+
+      default:
+        // anything else made on a dropped encoder or pass is part of its GPU work
+        return !isRecording(ObjectType::CommandEncoder, self) &&
+               !isRecording(ObjectType::RenderPassEncoder, self) &&
+               !isRecording(ObjectType::ComputePassEncoder, self);
+    }
+  }
+
+  // create begins the lifetime of an object made by the current event
+  size_t create(uint64_t key, bool texture, bool refs) {
+    size_t i = created++;
+    if (scanning)
+      lifetimes.push_back({ event, NO_END, texture, refs, false });
+    live[key] = i;
+    return i;
+  }
+
+  bool kept(size_t lifetime) const {
+    return scanning || lifetimes[lifetime].keep;
+  }
+
+  bool keptObject(uint64_t key) const {
+    auto it = live.find(key);
+    return it == live.end() || kept(it->second);
+  }
+
+  bool keptToken(uint64_t token) const {
+    auto it = tokens.find(token);
+    return it == tokens.end() || kept(it->second);
+  }
+
+  // trackCommand follows object lifetimes through a setup command kept by keepSetup.
+  // Once scanning is done it returns false for commands on or making dropped objects.
+  // Commands not handled here are assumed to be able to refer to any object.
+  bool trackCommand(const char* cmd, size_t size) {
+    uint64_t ev = event;
+    bool keep = trackCommand1(cmd, size, ev);
+    event++;
+    return keep;
+  }
+
+  bool trackCommand1(const char* cmd, size_t size, uint64_t ev) {
+    if (size < CAPTURE_CMD_SELF_OFFS + 4)
+      return true;
+    WireCmd id = (WireCmd)captureCmdU32(cmd, size, CAPTURE_CMD_ID_OFFS);
+    uint32_t self = captureCmdU32(cmd, size, CAPTURE_CMD_SELF_OFFS);
+    uint32_t arg = captureCmdU32(cmd, size, CAPTURE_CMD_RESULT_OFFS); // result or 1st arg
+    ObjectType type;
+    bool refs;
+    if (createdType(id, &type, &refs)) {
+      size_t i = create(objectKey(type, arg), type == ObjectType::Texture, refs);
+      uint64_t token;
+      if (id == WireCmd::DeviceCreateBuffer && bufferToken(cmd, size, &token))
+        tokens[token] = i;
+      return kept(i);
+    }
+    switch (id) {
+      case WireCmd::DestroyObject: {
+        auto it = live.find(objectKey((ObjectType)self, arg));
+        if (it == live.end())
+          return true;
+        size_t i = it->second;
+        live.erase(it);
+        if (scanning)
+          lifetimes[i].end = ev;
+        return kept(i);
+      }
+      case WireCmd::BufferDestroy:
+      case WireCmd::BufferMapAsync:
+      case WireCmd::BufferUnmap:
+        return keptObject(objectKey(ObjectType::Buffer, self));
+      case WireCmd::TextureDestroy:
+        return keptObject(objectKey(ObjectType::Texture, self));
+      case WireCmd::QueueWriteBuffer:
+        return keptObject(objectKey(ObjectType::Buffer, arg));
+      case WireCmd::QueueWriteTexture:
+        // the destination texture is part of the serialized arguments; see resolve
+        if (scanning)
+          textureWrites.insert(ev);
+        return scanning || keptTextureWrites.count(ev) != 0;
+      case WireCmd::SwapChainGetCurrentTextureView:
+        return true;
+      default:
+        if (scanning)
+          anyRefs.push_back(ev);
+        return true;
+    }
+  }
+
+  // trackRecord is trackCommand for texture, mesh buffer and asset records of the setup
+  bool trackRecord(const CaptureRecord& rec) {
+    event++;
+    uint32_t v[3] = {};
+    switch (rec.type) {
+      case CAPTURE_TEXTURE:
+        if (rec.size < 4)
+          return true;
+        memcpy(v, rec.data, 4);
+        return kept(create(objectKey(ObjectType::Texture, v[0]), true, false));
+      case CAPTURE_MESH_BUFFER:
+        if (rec.size < 4)
+          return true;
+        memcpy(v, rec.data, 4);
+        return keptToken(v[0]);
+      case CAPTURE_ASSET:
+        if (rec.size < 16 + sizeof(v))
+          return true;
+        memcpy(v, rec.data + 16, sizeof(v)); // kind, token, id
+        if (v[0] == ASSET_TEXTURE)
+          return kept(create(objectKey(ObjectType::Texture, v[2]), true, false));
+        return keptToken((1ull << 32) | v[1]);
+    }
+    return true;
+  }
+
+  // resolve ends scanning and decides which objects destroyed before the slice are kept.
+  // Such an object is kept when, while it existed, something kept may have referred to
+  // it: a command which may refer to any object, the create of an object whose
+  // descriptor may refer to others, or a QueueWriteTexture (for textures.) The texture
+  // a QueueWriteTexture writes to isn't known, so it is dropped only if every texture
+  // which existed at the time is dropped, and otherwise keeps them all.
+  void resolve() {
+    AliveIndex all, textures;
+    std::vector<size_t> work;
+    for (size_t i = 0; i < lifetimes.size(); i++) {
+      Lifetime& l = lifetimes[i];
+      if (l.end == NO_END) {
+        l.keep = true;
+        work.push_back(i);
+      } else {
+        all.add(l.begin, l.end, i);
+        if (l.texture)
+          textures.add(l.begin, l.end, i);
+      }
+    }
+    all.build();
+    textures.build();
+    auto keep = [&](size_t i) {
+      if (!lifetimes[i].keep) {
+        lifetimes[i].keep = true;
+        work.push_back(i);
+      }
+    };
+    for (uint64_t ev : anyRefs)
+      all.take(ev, keep);
+    while (!work.empty()) {
+      Lifetime l = lifetimes[work.back()];
+      work.pop_back();
+      if (l.refs)
+        all.take(l.begin, keep);
+      if (!l.texture)
+        continue;
+      auto it = textureWrites.upper_bound(l.begin);
+      while (it != textureWrites.end() && *it < l.end) {
+        keptTextureWrites.insert(*it);
+        textures.take(*it, keep);
+        it = textureWrites.erase(it);
+      }
+    }
+    scanning = false;
+    event = 0;
+    created = 0;
+    live.clear();
+    tokens.clear();
+    dropped.clear();
+    recording.clear();
+  }
+
+  uint32_t droppedObjects() const {
+    uint32_t n = 0;
+    for (const Lifetime& l : lifetimes)
+      n += !l.keep;
+    return n;
+  }
+
+  // keepSliced decides if a command of a frame in the slice is kept
+  bool keepSliced(const char* cmd, size_t size) {
+    if (size >= CAPTURE_CMD_RESULT_OFFS + 4 &&
+        (WireCmd)captureCmdU32(cmd, size, CAPTURE_CMD_ID_OFFS) == WireCmd::DestroyObject)
+    {
+      return keepDestroy(cmd, size);
+    }
+    return true;
+  }
+};
+
+} // namespace
+
+bool captureSlice(
+  const char* infile, const char* outfile, uint32_t firstFrame, uint32_t endFrame,
+  CaptureSliceStats* stats)
+{
+  CaptureReader r;
+  if (!r.open(infile))
+    return false;
+  Slicer s;
+  CaptureSliceStats st;
+  if (!s.w.open(outfile))
+    return false;
+
+  // first pass: lifetimes of the objects created before the slice
+  uint32_t frame = 0;
+  CaptureRecord rec;
+  bool ok = true;
+  while (ok && frame < firstFrame && r.next(&rec)) {
+    switch (rec.type) {
+      case CAPTURE_TEXTURE:
+      case CAPTURE_MESH_BUFFER:
+      case CAPTURE_ASSET:
+        s.trackRecord(rec);
+        break;
+      case CAPTURE_COMMANDS:
+        ok = captureForEachCommand(rec.data, rec.size, [&](const char* cmd, size_t size) {
+          if (s.keepSetup(cmd, size))
+            s.trackCommand(cmd, size);
+        });
+        break;
+      case CAPTURE_FRAME:
+        frame++;
+        break;
+    }
+  }
+  if (!ok || r.error()) {
+    errno = EINVAL;
+    return false;
+  }
+  s.resolve();
+  st.droppedObjects = s.droppedObjects();
+  r.rewind();
+
+  frame = 0;
+  while (ok && r.next(&rec)) {
+    st.bytesIn += 8 + rec.size;
+    if (rec.type == CAPTURE_FRAME)
+      st.framesIn++;
+    if (frame >= endFrame)
+      continue; // only counting
+    switch (rec.type) {
+      case CAPTURE_TEXTURE:
+      case CAPTURE_MESH_BUFFER:
+      case CAPTURE_ASSET:
+        if (frame < firstFrame && !s.trackRecord(rec)) {
+          st.droppedRecords++;
+          break;
+        }
+        ok = s.flush() && s.w.writeRecord(rec.type, rec.data, rec.size);
+        break;
+      case CAPTURE_RESERVATION:
+      case CAPTURE_RENDER_SCALE:
+        ok = s.flush() && s.w.writeRecord(rec.type, rec.data, rec.size);
+        break;
+      case CAPTURE_COMMANDS: {
+        bool setup = frame < firstFrame;
+        bool whole = captureForEachCommand(rec.data, rec.size, [&](const char* cmd, size_t size) {
+          bool keep = setup ? s.keepSetup(cmd, size) && s.trackCommand(cmd, size) :
+                              s.keepSliced(cmd, size);
+          if (setup)
+            (keep ? st.setupCommands : st.droppedCommands)++;
+          if (keep && ok)
+            ok = s.add(cmd, size);
+        });
+        if (!whole) {
+          errno = EINVAL;
+          ok = false;
+        }
+        break;
+      }
+      case CAPTURE_FRAME:
+        if (frame >= firstFrame) {
+          ok = s.flush() && s.w.writeRecord(rec.type, rec.data, rec.size);
+          st.framesOut++;
+        }
+        frame++;
+        break;
+      default:
+        errno = EINVAL;
+        ok = false;
+    }
+  }
+  if (ok && r.error()) {
+    errno = EINVAL;
+    ok = false;
+  }
+  if (ok)
+    ok = s.flush();
+  st.bytesOut = s.w.bytes;
+  s.w.close();
+  if (stats)
+    *stats = st;
+  return ok;
+}
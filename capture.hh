@@ -0,0 +1,148 @@
+#pragma once
+#include "protocol.hh"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+
+// Captures record the Dawn wire commands a client sends, so that a session can be
+// replayed against a server later (see the dcap program.) The server writes one
+// capture per connection with -capture=<dir>.
+//
+// A capture file is the magic "DCAP", a uint32 version and a sequence of records.
+// Each record is a one byte type, three bytes of padding, a uint32 payload size and
+// the payload. Integers are in host byte order, like the wire commands themselves.
+//
+//   'S'  swapchain reservation: id, generation, deviceId, deviceGeneration (uint32 each)
+//   'D'  wire commands, as received from the client (whole commands)
+//   'T'  compressed texture: id, generation, deviceId, deviceGeneration, width, height
+//        (uint32 each) followed by the UCT data (see texcodec.hh)
+//   'B'  compressed mesh buffer: token, kind, stride, count (uint32 each) followed by the
+//        encoded data (see meshcodec.hh)
+//   'G'  render scale: id, generation, deviceId, deviceGeneration, scale (uint32 each)
+//   'K'  buffer or texture from an asset: hash, size (uint64 each), kind, token, id,
+//        generation, deviceId, deviceGeneration, width, height, format (uint32 each)
+//   'F'  end of frame: the client presented in the preceding commands.
+//        uint64 nanoseconds since capture start
+//
+// Records before the first 'F' belong to frame 0.
+//
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_RESERVATION 'S'
+#define CAPTURE_COMMANDS    'D'
+#define CAPTURE_TEXTURE     'T'
+#define CAPTURE_MESH_BUFFER 'B'
+#define CAPTURE_RENDER_SCALE 'G'
+#define CAPTURE_ASSET       'K'
+#define CAPTURE_FRAME       'F'
+
+struct CaptureWriter {
+  uint64_t bytes = 0;  // bytes written so far
+  uint32_t frames = 0; // frames ended so far
+
+  ~CaptureWriter() { close(); }
+
+  // open creates (or truncates) filename. Returns false with errno set on failure.
+  bool open(const char* filename);
+  void close();
+  bool isOpen() const { return _f != nullptr; }
+
+  bool reservation(const dawn_wire::ReservedSwapChain& scr);
+  bool commands(const char* data, size_t len);
+  bool texture(
+    const DawnRemoteProtocol::CompressedTextureInfo& info, const char* data, size_t len);
+  bool meshBuffer(
+    const DawnRemoteProtocol::CompressedMeshBufferInfo& info, const char* data, size_t len);
+  bool renderScale(const DawnRemoteProtocol::RenderScaleInfo& info);
+  bool asset(const DawnRemoteProtocol::AssetInfo& info);
+  bool endFrame();
+
+  // internal
+  FILE*    _f = nullptr;
+  uint64_t _startNs = 0;
+  bool writeRecord(char type, const void* data, size_t len);
+};
+
+struct CaptureRecord {
+  char        type;
+  const char* data;
+  size_t      size;
+};
+
+// CaptureReader reads a capture file, which is mapped into memory
+struct CaptureReader {
+  ~CaptureReader() { close(); }
+
+  // open maps filename and checks its header. Returns false with errno set on failure.
+  bool open(const char* filename);
+  void close();
+
+  // next reads the next record. Returns false at the end of the file, or when a record
+  // is malformed, in which case error() returns true. r->data points into the mapping.
+  bool next(CaptureRecord* r);
+  bool error() const { return _error; }
+  void rewind();
+
+  // internal
+  const char* _data = nullptr;
+  size_t      _size = 0;
+  size_t      _offs = 0;
+  bool        _error = false;
+};
+
+// captureSend sends a reservation, commands, texture, mesh buffer or render scale record to a server,
+// as the client sent it originally. Frame records send nothing. Returns false if the
+// record is malformed or could not be sent.
+bool captureSend(DawnRemoteProtocol& proto, const CaptureRecord& rec);
+
+// Wire command layout (see dawn_wire/WireCmd_autogen.h): a CmdHeader (uint64 size) and
+// the WireCmd, followed by the command's members. For an object method the first member
+// is the ObjectId of the object ("self"). Methods which take nothing but a descriptor
+// and return an object have the result's ObjectHandle (id, generation) next.
+// DestroyObject has an ObjectType and an ObjectId.
+#define CAPTURE_CMD_ID_OFFS     8
+#define CAPTURE_CMD_SELF_OFFS   12
+#define CAPTURE_CMD_RESULT_OFFS 16
+
+// captureCmdU32 returns the uint32 at offs of a wire command of size bytes (0 if the
+// command is too short)
+static inline uint32_t captureCmdU32(const char* cmd, size_t size, size_t offs) {
+  uint32_t v = 0;
+  if (size >= offs + sizeof(v))
+    memcpy(&v, &cmd[offs], sizeof(v));
+  return v;
+}
+
+// captureForEachCommand calls fn for every wire command in data (a 'D' record payload.)
+// Returns false if data does not consist of whole commands.
+bool captureForEachCommand(
+  const char* data, size_t len, const std::function<void(const char* cmd, size_t size)>& fn);
+
+
+// captureSlice writes the frames [firstFrame, endFrame) of infile to outfile, preceded
+// by the commands from earlier frames which those frames may depend on.
+//
+// Earlier frames keep everything which creates or changes state that outlives a frame
+// (object creation, queue writes, buffer mapping etc.) but drop their GPU work: command
+// encoders and the passes, command buffers and commands made from them, queue submits
+// and presents. Encoder objects are tracked by their wire IDs, so that later commands
+// which release them are dropped too. Everything after endFrame is dropped.
+//
+// Objects which earlier frames create and destroy are dropped too, with the commands
+// and texture, mesh buffer and asset records made on them, unless an object or command
+// which is kept may refer to them (see Slicer::resolve in capture.cc.)
+struct CaptureSliceStats {
+  uint32_t framesIn = 0;        // frames in infile
+  uint32_t framesOut = 0;       // frames in outfile
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+  uint64_t setupCommands = 0;   // commands kept from frames before firstFrame
+  uint64_t droppedCommands = 0; // commands dropped from frames before firstFrame
+  uint32_t droppedObjects = 0;  // objects created & destroyed before firstFrame, dropped
+  uint32_t droppedRecords = 0;  // texture, mesh buffer & asset records of those
+};
+bool captureSlice(
+  const char* infile, const char* outfile, uint32_t firstFrame, uint32_t endFrame,
+  CaptureSliceStats* stats);
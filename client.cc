@@ -13,6 +13,11 @@
 // limitations under the License.
 
 #include "protocol.hh"
+#include "cmdtemplate.hh"
+#include "metrics.hh"
+#include "perfcounters.hh"
+#include "texturestream.hh"
+#include "upscale.hh"
 
 #include "utils/ComboRenderPipelineDescriptor.h"
 #include "utils/WGPUHelpers.h"
@@ -27,6 +32,9 @@
 #include <unistd.h> // pipe
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netdb.h> // getaddrinfo
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <fcntl.h> // F_GETFL, O_NONBLOCK etc
 #include <time.h> // strftime
 
@@ -112,6 +120,40 @@ int connectUNIXSocket(const char* filename) {
   return fd;
 }
 
+// connectTCPSocket connects to addr, which is "<host>:<port>"
+int connectTCPSocket(const char* addr) {
+  const char* port = strrchr(addr, ':');
+  if (port == nullptr) {
+    errno = EINVAL;
+    return -1;
+  }
+  std::string host(addr, port - addr);
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* res;
+  if (getaddrinfo(host.c_str(), port + 1, &hints, &res) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd > -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+      int e = errno;
+      close(fd);
+      errno = e;
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (fd > -1) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
 
 static void printDeviceError(WGPUErrorType errorType, const char* message, void*) {
   const char* errorTypeName = "";
@@ -136,21 +178,84 @@ static void printDeviceError(WGPUErrorType errorType, const char* message, void*
 }
 
 
+static const char* metricsfile = nullptr; // -metrics=<file>
+static uint32_t streamTextureSize = 0;    // -stream-texture=<size>
+static size_t streamBudget = 0;           // -stream-budget=<KB>
+static const char* tcpaddr = nullptr;     // -tcp=<host>:<port>
+static size_t zeroCopyThreshold = 0;      // -zerocopy[=<KB>]
+static bool useTemplate = false;          // -template
+static float renderScale = 1.0f;          // -render-scale=<scale>
+static double stallTimeout = 0;           // -stall-timeout=<sec>
+
+// timers drives per-connection timing (e.g. write-stall detection)
+static TimerWheel timers;
+
+
 struct Connection {
   DawnRemoteProtocol proto;
+  PerfStats          perf;
 
   dawn_wire::WireClient* wireClient = nullptr;
   wgpu::Device           device;
   wgpu::SwapChain        swapchain;
   wgpu::RenderPipeline   pipeline;
 
+  // background image streamed with TextureStreamer (-stream-texture)
+  TextureStreamer        streamer;
+  StreamedTexture*       bgTexture = nullptr;
+  wgpu::RenderPipeline   bgPipeline;
+  wgpu::Sampler          bgSampler;
+  wgpu::BindGroup        bgBindGroup;
+  uint32_t               bgGeneration = 0;
+  uint64_t               streamedBytes = 0;
+
+  // frames sent as instances of a command template (-template)
+  CommandTemplate        frameTemplate;
+  uint32_t               clearColorParam;
+
+  // frames rendered below the framebuffer's size & upscaled by the server (-render-scale)
+  RenderScaleTarget      renderTarget;
+
   dawn_wire::ReservedDevice    deviceReservation;
   dawn_wire::ReservedSwapChain swapchainReservation;
+  bool                         fbinfoReceived = false;
+
+  Connection() {
+    proto.perf = &perf;
+    clearColorParam = frameTemplate.param("clear_color", sizeof(wgpu::Color));
+    metricsRegister(this, [this](MetricsWriter& w) {
+      w.scope("client");
+      w.gauge("cpu_time", processCPUTime());
+      w.counter("bytes_out", proto.bytesOut);
+      if (proto.zeroCopyThreshold > 0) {
+        w.counter("zero_copy.sends", proto.zeroCopySends);
+        w.counter("zero_copy.bytes", proto.zeroCopyBytes);
+        w.counter("zero_copy.copied", proto.zeroCopyCopied);
+      }
+      perf.writeMetrics(w);
+      proto.link.writeMetrics(w);
+      if (frameTemplate.recorded())
+        w.gauge("template.command_bytes", (double)frameTemplate.commandSize());
+      w.gauge("render_scale", (double)renderTarget.scale() / 1000.0);
+      if (bgTexture) {
+        w.counter("texture_stream.bytes", streamedBytes);
+        w.counter("texture_stream.pending_bytes", streamer.pendingBytes());
+        w.counter("texture_stream.resident_mip", bgTexture->residentMip());
+      }
+    });
+  }
 
   ~Connection() {
+    metricsUnregister(this);
     // prevent double free by releasing refs to things that the wireClient owns
     if (wireClient) {
+      if (bgTexture)
+        streamer.destroy(bgTexture);
+      bgBindGroup.Release();
+      bgSampler.Release();
+      bgPipeline.Release();
       pipeline.Release();
+      renderTarget = RenderScaleTarget();
       device.Release();
       swapchain.Release();
       delete wireClient;
@@ -168,23 +273,18 @@ struct Connection {
     DawnProcTable procs = dawn_wire::client::GetProcs();
     procs.deviceSetUncapturedErrorCallback(device.Get(), printDeviceError, nullptr);
     dawnProcSetProcs(&procs);
+  }
 
-    // rsms: no, wait until server sends onFramebufferInfo message
-    //
-    // swapchainReservation = wireClient->ReserveSwapChain(device.Get());
-    // swapchain = wgpu::SwapChain::Acquire(swapchainReservation.swapchain);
-
-    // // tell server what we reserved
-    // proto.sendReservation(swapchainReservation);
-
-    // // These values are hardcoded in the server and must match. In the future we
-    // // could send these as part of the initial handshake.
-    // assert(deviceReservation.id == 1);
-    // assert(deviceReservation.generation == 0);
-    // assert(swapchainReservation.id == 1);
-    // assert(swapchainReservation.generation == 0);
-    // assert(swapchainReservation.deviceId == 1);
-    // assert(swapchainReservation.deviceGeneration == 0);
+  // reserveSwapChain reserves a (new) swapchain and tells the server about it.
+  // The server creates the swapchain with its current framebuffer size, so this does
+  // not need to wait for framebuffer info.
+  void reserveSwapChain() {
+    if (swapchain)
+      wireClient->ReclaimSwapChainReservation(swapchainReservation);
+    swapchainReservation = wireClient->ReserveSwapChain(device.Get());
+    swapchain = wgpu::SwapChain::Acquire(swapchainReservation.swapchain);
+    dlog("sending swapchain reservation to server");
+    proto.sendReservation(swapchainReservation);
   }
 
   void initDawnPipeline() {
@@ -211,16 +311,87 @@ struct Connection {
     pipeline = device.CreateRenderPipeline2(&desc); // global var
   }
 
+  // initBackground creates a size x size image and starts streaming it to the server
+  void initBackground(uint32_t size) {
+    std::vector<uint8_t> pixels((size_t)size * size * 4);
+    for (uint32_t y = 0; y < size; y++) {
+      for (uint32_t x = 0; x < size; x++) {
+        uint8_t* p = &pixels[((size_t)y * size + x) * 4];
+        bool check = ((x / 32) ^ (y / 32)) & 1;
+        p[0] = (uint8_t)(x * 255 / size);
+        p[1] = (uint8_t)(y * 255 / size);
+        p[2] = check ? 160 : 60;
+        p[3] = 255;
+      }
+    }
+    if (streamBudget > 0)
+      streamer.frameBudget = streamBudget;
+    bgTexture = streamer.create(device, size, size, pixels.data(), 1.0f);
+    bgGeneration = bgTexture->generation() - 1; // make bgBindGroup on first frame
+
+    utils::ComboRenderPipelineDescriptor2 desc;
+    desc.vertex.module = utils::CreateShaderModule(device, R"(
+      struct VertexOut {
+        [[builtin(position)]] position : vec4<f32>;
+        [[location(0)]] uv : vec2<f32>;
+      };
+      let corners : array<vec2<f32>, 6> = array<vec2<f32>, 6>(
+          vec2<f32>(0.0, 0.0), vec2<f32>(1.0, 0.0), vec2<f32>(0.0, 1.0),
+          vec2<f32>(0.0, 1.0), vec2<f32>(1.0, 0.0), vec2<f32>(1.0, 1.0)
+      );
+      [[stage(vertex)]] fn main(
+          [[builtin(vertex_index)]] VertexIndex : u32
+      ) -> VertexOut {
+          let c = corners[VertexIndex];
+          var out : VertexOut;
+          out.position = vec4<f32>(c.x * 2.0 - 1.0, 1.0 - c.y * 2.0, 0.0, 1.0);
+          out.uv = c;
+          return out;
+      }
+    )");
+    desc.cFragment.module = utils::CreateShaderModule(device, R"(
+      [[group(0), binding(0)]] var texSampler : sampler;
+      [[group(0), binding(1)]] var tex : texture_2d<f32>;
+      [[stage(fragment)]] fn main(
+          [[location(0)]] uv : vec2<f32>
+      ) -> [[location(0)]] vec4<f32> {
+          return textureSample(tex, texSampler, uv);
+      }
+    )");
+    desc.cTargets[0].format = wgpu::TextureFormat::BGRA8Unorm;
+    bgPipeline = device.CreateRenderPipeline2(&desc);
+
+    wgpu::SamplerDescriptor samplerDesc;
+    samplerDesc.minFilter = wgpu::FilterMode::Linear;
+    samplerDesc.magFilter = wgpu::FilterMode::Linear;
+    samplerDesc.mipmapFilter = wgpu::FilterMode::Linear;
+    bgSampler = device.CreateSampler(&samplerDesc);
+  }
+
+  // start sends hello, swapchain reservation, pipeline creation and the first frame
+  // in one flight, without waiting for the server (zero round trips before the first
+  // frame.) Framebuffer info from the server is applied when it arrives.
   void start(RunLoop* rl, int fd) {
+    proto.timers = &timers;
+    proto.writeStallTimeout = stallTimeout;
+    proto.start(rl, fd);
+    if (zeroCopyThreshold > 0 && !proto.enableZeroCopy(zeroCopyThreshold))
+      dlog("zero-copy sends not supported (%s)", strerror(errno));
     initDawnWire();
+    proto.sendHello();
+    reserveSwapChain();
     initDawnPipeline();
-    proto.start(rl, fd);
+    if (streamTextureSize > 0)
+      initBackground(streamTextureSize);
+    render_frame();
+    perf.endFrame();
   }
 
   uint32_t fc = 0;
   bool animate = true;
 
   void render_frame() {
+    PerfScope ps(&perf, PerfStageRenderFrame);
     fc++;
 
     // #if DEBUG
@@ -236,9 +407,48 @@ struct Connection {
       BLUE  = std::abs(cosf(float(fc*10) / 80));
     }
 
+    // upload more of the background image, and use its finer levels once they are in
+    if (bgTexture) {
+      streamedBytes += streamer.update(device.GetQueue());
+      if (bgTexture->generation() != bgGeneration) {
+        bgGeneration = bgTexture->generation();
+        bgBindGroup = utils::MakeBindGroup(device, bgPipeline.GetBindGroupLayout(0), {
+          {0, bgSampler},
+          {1, bgTexture->view()},
+        });
+      }
+    }
+
+    // the scale is part of a recorded template's commands
+    if (!frameTemplate.recorded())
+      renderTarget.setScale(proto, wireClient, device, renderScale);
+
+    wgpu::Color clearColor = {RED, GREEN, BLUE, 0.0f};
+    // The streamed background changes the frame's commands; other frames only differ in
+    // clear color. The first frame is sent as is, as it is part of start's round trip.
+    if (useTemplate && !bgTexture && fc > 1 && !frameTemplate.recorded()) {
+      if (!frameTemplate.record(proto, [&]() {
+        encode_frame(frameTemplate.placeholder<wgpu::Color>(clearColorParam));
+      })) {
+        dlog("recording frame template failed; sending frames as is");
+        useTemplate = false;
+      }
+    }
+    if (frameTemplate.recorded()) {
+      frameTemplate.set(clearColorParam, clearColor);
+      frameTemplate.instantiate(proto);
+    } else {
+      encode_frame(clearColor);
+    }
+    proto.Flush();
+  }
+
+  // encode_frame encodes and presents a frame. Objects it creates are released when it
+  // returns (as frame templates require.)
+  void encode_frame(const wgpu::Color& clearColor) {
     wgpu::RenderPassColorAttachmentDescriptor colorAttachment;
-    colorAttachment.view = swapchain.GetCurrentTextureView();
-    colorAttachment.clearColor = {RED, GREEN, BLUE, 0.0f};
+    colorAttachment.view = renderTarget.view(swapchain);
+    colorAttachment.clearColor = clearColor;
     colorAttachment.loadOp = wgpu::LoadOp::Clear;
     colorAttachment.storeOp = wgpu::StoreOp::Store;
 
@@ -248,6 +458,12 @@ struct Connection {
 
     wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
     wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&renderPassDesc);
+    renderTarget.setViewport(pass);
+    if (bgTexture) {
+      pass.SetPipeline(bgPipeline);
+      pass.SetBindGroup(0, bgBindGroup);
+      pass.Draw(6);
+    }
     pass.SetPipeline(pipeline);
     pass.Draw(3);
     pass.EndPass();
@@ -256,25 +472,31 @@ struct Connection {
     device.GetQueue().Submit(1, &commands);
 
     swapchain.Present();
-
-    proto.Flush();
   }
 };
 
 
+static void onMetricsTimer(RunLoop* rl, ev_timer* w, int revents) {
+  if (!metricsReport(metricsfile))
+    perror(metricsfile);
+}
+
 void runloop_main(int fd) {
   RunLoop* rl = EV_DEFAULT;
   FDSetNonBlock(fd);
+  timers.start(rl);
 
   Connection conn;
 
   conn.proto.onFrame = [&]() {
     conn.render_frame();
+    conn.perf.endFrame();
   };
 
   conn.proto.onDawnBuffer = [&](const char* data, size_t len) {
     dlog("onDawnBuffer len=%zu", len);
     assert(conn.wireClient != nullptr);
+    PerfScope ps(&conn.perf, PerfStageHandleCommands);
     if (conn.wireClient->HandleCommands(data, len) == nullptr)
       dlog("wireClient->HandleCommands FAILED");
   };
@@ -283,6 +505,12 @@ void runloop_main(int fd) {
     double dpscale = (double)fbinfo.dpscale / 1000.0;
     dlog("onFramebufferInfo %ux%u@%.2f", fbinfo.width, fbinfo.height, dpscale);
 
+    // The first framebuffer info describes the swapchain we reserved in start()
+    if (!conn.fbinfoReceived) {
+      conn.fbinfoReceived = true;
+      return;
+    }
+
     #define ENABLE_FBINFO_WORKAROUND_RESTART
     #ifdef ENABLE_FBINFO_WORKAROUND_RESTART
     // XXX FIXME
@@ -290,40 +518,108 @@ void runloop_main(int fd) {
     // sync and update its swapchain resevation and/or wire client & server, etc.
     // Whenever the server framebuffer changes, drop this connection and restart the client
     // with a new connection.
-    if (conn.swapchain) {
-      conn.proto.stop();
-      return;
-    }
+    conn.proto.stop();
+    return;
     #endif
 
     // [WORK IN PROGRESS] replace/update swapchain
     dlog("reserving new swapchain");
-    if (conn.swapchain) {
-      conn.wireClient->ReclaimSwapChainReservation(conn.swapchainReservation);
-    }
-    conn.swapchainReservation = conn.wireClient->ReserveSwapChain(conn.device.Get());
-    conn.swapchain = wgpu::SwapChain::Acquire(conn.swapchainReservation.swapchain);
-    dlog("sending swapchain reservation to server");
-    conn.proto.sendReservation(conn.swapchainReservation);
+    conn.reserveSwapChain();
   };
 
+  // metrics are reported once per second while connected
+  ev_timer metrics_timer;
+  if (metricsfile) {
+    ev_init(&metrics_timer, onMetricsTimer);
+    metrics_timer.repeat = 1.0;
+    ev_timer_again(rl, &metrics_timer);
+    ev_unref(rl); // don't allow timer to keep runloop alive alone
+  }
+
   conn.start(rl, fd);
   ev_run(rl, 0);
   dlog("exit runloop");
+  timers.stop();
+
+  if (metricsfile) {
+    ev_ref(rl);
+    ev_timer_stop(rl, &metrics_timer);
+  }
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "options:\n"
+    "  -perf             Sample hardware performance counters (Linux perf events)\n"
+    "  -metrics=<file>   Write metrics to <file> every second (\"-\" = stderr)\n"
+    "  -stream-texture=<size>\n"
+    "                    Draw a <size>x<size> background image, streamed progressively\n"
+    "  -stream-budget=<KB>\n"
+    "                    Upload at most <KB> of streamed texture data per frame (default: 64)\n"
+    "  -tcp=<host>:<port>\n"
+    "                    Connect to the server over TCP instead of its UNIX socket\n"
+    "  -zerocopy[=<KB>]  Send writes of at least <KB> (default: 64) with MSG_ZEROCOPY (TCP)\n"
+    "  -template         Record a frame once as a command template and send later frames\n"
+    "                    as its instances (not with -stream-texture)\n"
+    "  -render-scale=<scale>\n"
+    "                    Render frames at <scale> (0.25-1) of the framebuffer size and have\n"
+    "                    the server upscale them (default: 1)\n"
+    "  -stall-timeout=<s>\n"
+    "                    Disconnect if the server doesn't read for <s> seconds (default: 0=never)\n"
+    "  -h, -help         Show help and exit\n",
+    prog);
 }
 
 int main(int argc, const char* argv[]) {
+  bool opt_perf = false;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "-perf") == 0) {
+      opt_perf = true;
+    } else if (strncmp(arg, "-metrics=", 9) == 0) {
+      metricsfile = &arg[9];
+    } else if (strncmp(arg, "-stream-texture=", 16) == 0) {
+      streamTextureSize = (uint32_t)std::max(0, atoi(&arg[16]));
+    } else if (strncmp(arg, "-stream-budget=", 15) == 0) {
+      streamBudget = (size_t)std::max(1, atoi(&arg[15])) * 1024;
+    } else if (strncmp(arg, "-tcp=", 5) == 0) {
+      tcpaddr = &arg[5];
+    } else if (strcmp(arg, "-zerocopy") == 0) {
+      zeroCopyThreshold = 64 * 1024;
+    } else if (strncmp(arg, "-zerocopy=", 10) == 0) {
+      zeroCopyThreshold = (size_t)std::max(1, atoi(&arg[10])) * 1024;
+    } else if (strcmp(arg, "-template") == 0) {
+      useTemplate = true;
+    } else if (strncmp(arg, "-render-scale=", 14) == 0) {
+      renderScale = std::min(1.0f, std::max(0.0f, (float)atof(&arg[14])));
+    } else if (strncmp(arg, "-stall-timeout=", 15) == 0) {
+      stallTimeout = std::max(0.0, atof(&arg[15]));
+    } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0 || strcmp(arg, "--help") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      fprintf(stderr, "%s: unknown option %s (see %s -help)\n", argv[0], arg, argv[0]);
+      return 1;
+    }
+  }
+
+  // perf counters are optional; perfCountersEnable logs why if they are unavailable
+  if (opt_perf)
+    perfCountersEnable();
+
   bool first_retry = true;
   const char* sockfile = "server.sock";
   while (1) {
     if (first_retry) {
-      dlog("connecting to UNIX socket \"%s\" ...", sockfile);
+      dlog("connecting to %s \"%s\" ...", tcpaddr ? "TCP" : "UNIX socket",
+        tcpaddr ? tcpaddr : sockfile);
       first_retry = false;
     }
-    int fd = connectUNIXSocket(sockfile);
+    int fd = tcpaddr ? connectTCPSocket(tcpaddr) : connectUNIXSocket(sockfile);
     if (fd < 0) {
       if (errno != ECONNREFUSED && errno != ENOENT)
-        perror("connectUNIXSocket");
+        perror(tcpaddr ? "connectTCPSocket" : "connectUNIXSocket");
       sleep(1);
       continue;
     }
@@ -0,0 +1,65 @@
+#include "cmdtemplate.hh"
+#include <string.h>
+
+CommandTemplate::CommandTemplate() {
+  static uint32_t nextID = 1;
+  _id = nextID++;
+}
+
+uint32_t CommandTemplate::param(const char* name, size_t size) {
+  // Placeholders are pseudo-random bytes; a run of 8 or more of them is all but certain
+  // not to occur in serialized commands by chance. Shorter parameters are checked for
+  // uniqueness by record like any other.
+  static uint64_t state = 0x9e3779b97f4a7c15ull;
+  assert(!_recorded && size > 0);
+  _names.emplace_back(name);
+  _sizes.push_back((uint32_t)size);
+  _offsets.push_back((uint32_t)_placeholders.size());
+  for (size_t i = 0; i < size; i++) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    _placeholders.push_back((char)((state * 0x2545f4914f6cdd1dull) >> 56));
+  }
+  _values.resize(_placeholders.size());
+  return (uint32_t)_names.size() - 1;
+}
+
+int CommandTemplate::paramIndex(const char* name) const {
+  for (size_t i = 0; i < _names.size(); i++) {
+    if (_names[i] == name)
+      return (int)i;
+  }
+  return -1;
+}
+
+bool CommandTemplate::record(DawnRemoteProtocol& proto, const std::function<void()>& fn) {
+  std::vector<char> commands;
+  proto.beginRecording(&commands);
+  fn();
+  proto.endRecording();
+
+  _recorded = false;
+  _commandSize = commands.size();
+  if (commands.empty() || commands.size() > DAWNCMD_MAX || _names.size() > TEMPLATE_PARAMS_MAX)
+    return false;
+  std::vector<uint32_t> params;
+  for (size_t i = 0; i < _names.size(); i++) {
+    const void* p = placeholder((uint32_t)i);
+    const char* end = commands.data() + commands.size();
+    const char* found = (const char*)memmem(commands.data(), commands.size(), p, _sizes[i]);
+    if (found == nullptr ||
+        memmem(found + 1, (size_t)(end - found - 1), p, _sizes[i]) != nullptr)
+    {
+      return false;
+    }
+    params.push_back((uint32_t)(found - commands.data()));
+    params.push_back(_sizes[i]);
+  }
+  _recorded = proto.sendTemplate(_id, commands, params);
+  return _recorded;
+}
+
+bool CommandTemplate::instantiate(DawnRemoteProtocol& proto) {
+  return _recorded && proto.sendTemplateInstance(_id, _values.data(), _values.size());
+}
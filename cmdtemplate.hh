@@ -0,0 +1,85 @@
+#pragma once
+#include "protocol.hh"
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Command templates. Most frames are the same wire commands with a few different values
+// (a uniform, a clear color, a draw count.) A CommandTemplate records a frame's commands
+// once, registers them with the server, and from then on sends only the template's ID and
+// the values of its parameters, a few dozen bytes per frame. The server patches the
+// values into a copy of the commands and handles it as if the client had sent it.
+//
+// Parameters are declared before recording. While recording, the frame is encoded with
+// each parameter's placeholder (unique bytes) where its value goes; record locates the
+// placeholders in the serialized commands. Recorded commands are not sent; instantiate
+// sends the frame.
+//
+// Every instance reuses the wire IDs of the recorded frame's objects, so:
+//   - objects created by the frame (command encoders, views, ...) must be released within
+//     it (e.g. by going out of scope in fn) and must not be used after it,
+//   - the client should not create other objects after recording (they may be given the
+//     IDs the frame uses); create pipelines, buffers etc before,
+//   - the frame must not use commands with replies (MapAsync, error scopes, ...),
+//   - a template must be recorded again after the swapchain is reserved again.
+//
+// Example:
+//   CommandTemplate t;
+//   uint32_t color = t.param("clear_color", sizeof(wgpu::Color));
+//   t.record(proto, [&]() { renderFrame(t.placeholder<wgpu::Color>(color)); });
+//   ...
+//   t.set(color, wgpu::Color{ r, g, b, 1.0 });
+//   t.instantiate(proto);
+//
+struct CommandTemplate {
+  CommandTemplate();
+
+  // param declares a parameter of size bytes and returns its index.
+  // Must be called before record.
+  uint32_t param(const char* name, size_t size);
+  int paramIndex(const char* name) const; // -1 if there's no such parameter
+
+  // placeholder returns the bytes to encode in place of parameter i while recording
+  const void* placeholder(uint32_t i) const { return &_placeholders[_offsets[i]]; }
+  template <typename T> T placeholder(uint32_t i) const {
+    T v;
+    memcpy(&v, placeholder(i), sizeof(T));
+    return v;
+  }
+
+  // record calls fn, which encodes a frame, and registers the commands it serialized as
+  // this template (replacing any earlier recording.) Returns false if the commands
+  // don't fit in a message, a placeholder was not found exactly once or the template
+  // could not be sent.
+  bool record(DawnRemoteProtocol& proto, const std::function<void()>& fn);
+  bool recorded() const { return _recorded; }
+
+  // set sets the value of parameter i for the following instances
+  void set(uint32_t i, const void* value) {
+    memcpy(&_values[_offsets[i]], value, _sizes[i]);
+  }
+  template <typename T> void set(uint32_t i, const T& value) {
+    assert(sizeof(T) == _sizes[i]);
+    set(i, (const void*)&value);
+  }
+
+  // instantiate sends an instance of the template with the current parameter values
+  bool instantiate(DawnRemoteProtocol& proto);
+
+  uint32_t id() const { return _id; }
+  size_t   commandSize() const { return _commandSize; } // bytes of recorded commands
+
+  // internal
+  uint32_t                 _id;
+  bool                     _recorded = false;
+  size_t                   _commandSize = 0;
+  std::vector<std::string> _names;
+  std::vector<uint32_t>    _sizes;
+  std::vector<uint32_t>    _offsets;      // of each parameter in _placeholders & _values
+  std::vector<char>        _placeholders;
+  std::vector<char>        _values;
+};
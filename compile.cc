@@ -0,0 +1,193 @@
+#include "compile.hh"
+#include "capture.hh"
+#include "metrics.hh" // monotimeNs
+#include "warmup.hh"  // isWarmupCommand
+
+#include "dawn_wire/WireCmd_autogen.h"
+#include <dawn_wire/WireServer.h>
+
+using dawn_wire::WireCmd;
+
+// isCompileCommand returns true for the wire commands which compile shaders
+static bool isCompileCommand(const char* cmd, size_t size) {
+  if (size < CAPTURE_CMD_SELF_OFFS + 4)
+    return false;
+  switch ((WireCmd)captureCmdU32(cmd, size, CAPTURE_CMD_ID_OFFS)) {
+    case WireCmd::DeviceCreateShaderModule:
+    case WireCmd::DeviceCreateRenderPipeline:
+    case WireCmd::DeviceCreateRenderPipeline2:
+    case WireCmd::DeviceCreateComputePipeline:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// nextCommand returns the size of the wire command at data[offs] (0 if malformed)
+static size_t nextCommand(const char* data, size_t len, size_t offs) {
+  uint64_t cmdsize;
+  if (len - offs < sizeof(cmdsize))
+    return 0;
+  memcpy(&cmdsize, &data[offs], sizeof(cmdsize));
+  if (cmdsize < sizeof(cmdsize) || cmdsize > len - offs)
+    return 0;
+  return (size_t)cmdsize;
+}
+
+static void ignoreError(WGPUErrorType type, const char* message, void* userdata) {}
+
+
+void* CompileShadow::Serializer::GetCmdSpace(size_t size) {
+  if (buf.size() < size)
+    buf.resize(size);
+  return buf.data();
+}
+
+CompileShadow::CompileShadow(const DawnProcTable& procs) :
+  _procs(procs),
+  _server(new dawn_wire::WireServer({ .procs = &procs, .serializer = &_serializer }))
+{}
+
+CompileShadow::~CompileShadow() {
+  delete _server;
+}
+
+bool CompileShadow::injectDevice(WGPUDevice device, uint32_t id, uint32_t generation) {
+  if (_server->GetDevice(id, generation) != nullptr)
+    return true;
+  if (!_server->InjectDevice(device, id, generation))
+    return false;
+  _device = device;
+  return true;
+}
+
+size_t CompileShadow::split(const char* data, size_t len, size_t* runEnd) {
+  *runEnd = len;
+  if (_device == nullptr)
+    return len;
+  size_t offs = 0;
+  while (offs < len) {
+    size_t size = nextCommand(data, len, offs);
+    if (size == 0)
+      return len; // malformed; left to the connection's WireServer to reject
+    const char* cmd = &data[offs];
+    if (isCompileCommand(cmd, size))
+      break;
+    if (isWarmupCommand(cmd, size)) {
+      mirrored++;
+      if (_server->HandleCommands(cmd, size) == nullptr)
+        failed++;
+    }
+    offs += size;
+  }
+  if (offs == len)
+    return len;
+  size_t end = offs;
+  while (end < len) {
+    size_t size = nextCommand(data, len, end);
+    if (size == 0 || !isWarmupCommand(&data[end], size))
+      break;
+    end += size;
+  }
+  *runEnd = end;
+  return offs;
+}
+
+uint32_t CompileShadow::compile(const char* cmds, size_t len, uint32_t* nfailed) {
+  _procs.devicePushErrorScope(_device, WGPUErrorFilter_OutOfMemory);
+  _procs.devicePushErrorScope(_device, WGPUErrorFilter_Validation);
+  uint32_t n = 0;
+  *nfailed = 0;
+  for (size_t offs = 0; offs < len; n++) {
+    size_t size = nextCommand(cmds, len, offs);
+    if (size == 0)
+      break;
+    if (_server->HandleCommands(&cmds[offs], size) == nullptr)
+      (*nfailed)++;
+    offs += size;
+  }
+  _procs.devicePopErrorScope(_device, ignoreError, nullptr);
+  _procs.devicePopErrorScope(_device, ignoreError, nullptr);
+  return n;
+}
+
+
+void CompileThreads::start(RunLoop* rl, uint32_t nthreads) {
+  assert(_rl == nullptr);
+  _rl = rl;
+  _stopping = false;
+  ev_async_init(&_async, onAsync);
+  _async.data = this;
+  ev_async_start(rl, &_async);
+  ev_unref(rl); // don't allow the watcher to keep the runloop alive alone
+  for (uint32_t i = 0; i < nthreads; i++)
+    _threads.emplace_back(&CompileThreads::run, this);
+}
+
+void CompileThreads::stop() {
+  if (_rl == nullptr)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(_mu);
+    _stopping = true;
+    _queue.clear();
+  }
+  _cond.notify_all();
+  for (std::thread& t : _threads)
+    t.join();
+  _threads.clear();
+  ev_ref(_rl);
+  ev_async_stop(_rl, &_async);
+  _done.clear();
+  _rl = nullptr;
+}
+
+void CompileThreads::submit(
+  CompileShadow* shadow, DeviceLock* devlock, const char* cmds, size_t len, void* owner)
+{
+  submitted++;
+  {
+    std::lock_guard<std::mutex> lock(_mu);
+    _queue.push_back(
+      { shadow, devlock, std::vector<char>(cmds, cmds + len), owner, monotimeNs(), 0, 0, 0 });
+  }
+  _cond.notify_one();
+}
+
+void CompileThreads::run() {
+  std::unique_lock<std::mutex> lock(_mu);
+  while (true) {
+    _cond.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+    if (_stopping)
+      break;
+    Job job = std::move(_queue.front());
+    _queue.pop_front();
+    lock.unlock();
+    job.lock->lock();
+    uint64_t t0 = monotimeNs();
+    job.commands = job.shadow->compile(job.cmds.data(), job.cmds.size(), &job.failed);
+    job.compileNs = monotimeNs() - t0;
+    job.lock->unlock();
+    lock.lock();
+    _done.push_back(std::move(job));
+    ev_async_send(_rl, &_async);
+  }
+}
+
+void CompileThreads::onAsync(RunLoop* rl, ev_async* w, int revents) {
+  CompileThreads* ct = (CompileThreads*)w->data;
+  std::vector<Job> done;
+  {
+    std::lock_guard<std::mutex> lock(ct->_mu);
+    done.swap(ct->_done);
+  }
+  uint64_t now = monotimeNs();
+  for (const Job& job : done) {
+    ct->commands += job.commands;
+    ct->failed += job.failed;
+    ct->compileNs += job.compileNs;
+    ct->latencyNs += now - job.submitNs;
+    if (ct->onCompiled)
+      ct->onCompiled(job);
+  }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "protocol.hh"
+#include "devicelock.hh"
+#include <dawn/dawn_proc_table.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dawn_wire { class WireServer; }
+
+// CompileShadow mirrors the shader modules, layouts and pipelines of a connection's
+// WireServer, with the same wire IDs, in a WireServer of its own. Creating a client's
+// shader modules and pipelines in the shadow on a compile thread leaves them in Dawn's
+// object caches, so that when the connection's WireServer then creates the same objects
+// on the runloop, they are found there instead of being compiled again.
+//
+// Replies of the shadow are discarded and device errors caught by error scopes; the
+// connection's WireServer reports the same errors to the client when it creates the
+// objects. Objects the shadow does not know about (e.g. bind group layouts a client got
+// from a pipeline) make it fail to create the objects using them, which are then
+// compiled by the connection's WireServer as without the shadow.
+struct CompileShadow {
+  uint64_t mirrored = 0; // layout creation & release commands handled
+  uint64_t failed = 0;   // of those, commands the shadow's WireServer rejected
+
+  CompileShadow(const DawnProcTable& procs);
+  ~CompileShadow();
+
+  // injectDevice makes device known to the shadow. Call before injecting it into the
+  // connection's WireServer, whose device callbacks must be the ones that stay.
+  bool injectDevice(WGPUDevice device, uint32_t id, uint32_t generation);
+
+  // split returns the offset of the first shader module or pipeline creation in the wire
+  // commands data (len if there is none) and sets *runEnd to the end of the creation &
+  // release commands starting there. The layout creations & releases before it are
+  // mirrored. Called on the runloop.
+  size_t split(const char* data, size_t len, size_t* runEnd);
+
+  // compile handles creation & release commands found by split. Called on a compile
+  // thread, with the device's lock held. Returns the number of commands handled
+  // and sets *nfailed to the number of them the shadow's WireServer rejected.
+  uint32_t compile(const char* cmds, size_t len, uint32_t* nfailed);
+
+  // internal
+  struct Serializer : public dawn_wire::CommandSerializer {
+    std::vector<char> buf; // replies are discarded
+    size_t GetMaximumAllocationSize() const override { return DAWNCMD_MAX; }
+    void* GetCmdSpace(size_t size) override;
+    bool Flush() override { return true; }
+  };
+  const DawnProcTable&   _procs;
+  Serializer             _serializer;
+  dawn_wire::WireServer* _server;
+  WGPUDevice             _device = nullptr;
+};
+
+// CompileThreads runs CompileShadow::compile jobs on a pool of threads, so that a heavy
+// shader does not stall the runloop (server -compile-threads=<n>.)
+//
+// Dawn devices are not thread safe. A job is compiled with the lock of its device held
+// (see devicelock.hh.)
+struct CompileThreads {
+  struct Job {
+    CompileShadow*    shadow;
+    DeviceLock*       lock;      // of the shadow's device
+    std::vector<char> cmds;
+    void*             owner;     // opaque value passed back to onCompiled
+    uint64_t          submitNs;  // when submit was called
+    uint64_t          compileNs; // time spent in CompileShadow::compile
+    uint32_t          commands;  // commands compile handled
+    uint32_t          failed;    // of those, commands the shadow rejected
+  };
+
+  // onCompiled is called on the runloop thread after a job has been compiled
+  std::function<void(const Job&)> onCompiled;
+
+  // stats (runloop thread)
+  uint64_t submitted = 0;
+  uint64_t commands = 0;
+  uint64_t failed = 0;
+  uint64_t compileNs = 0; // total time spent compiling
+  uint64_t latencyNs = 0; // total time from submit to onCompiled
+
+  bool started() const { return _rl != nullptr; }
+  void start(RunLoop* rl, uint32_t nthreads);
+  void stop(); // waits for the jobs being compiled, if any; drops queued jobs
+
+  void submit(
+    CompileShadow* shadow, DeviceLock* lock, const char* cmds, size_t len, void* owner);
+
+  // internal
+  RunLoop*                 _rl = nullptr;
+  std::vector<std::thread> _threads;
+  std::mutex               _mu;
+  std::condition_variable  _cond;
+  std::deque<Job>          _queue; // waiting to be compiled
+  std::vector<Job>         _done;  // compiled, waiting for onCompiled
+  bool                     _stopping = false;
+  ev_async                 _async;
+
+  void run();
+  static void onAsync(RunLoop* rl, ev_async* w, int revents);
+};
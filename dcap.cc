@@ -0,0 +1,251 @@
+// dcap inspects, slices and replays wire command captures made with server -capture
+#include "capture.hh"
+#include "metrics.hh"
+#include "protocol.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define errlog(format, ...) \
+  (({ fprintf(stderr, "E " format "\n", ##__VA_ARGS__); fflush(stderr); }))
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+    "usage: %s <command> [options] <file> ...\n"
+    "commands:\n"
+    "  info <file>         Print frame count, sizes and duration of a capture\n"
+    "  slice -frames=<first>:<end> <infile> <outfile>\n"
+    "                      Write frames [first, end) of infile to outfile, with the\n"
+    "                      commands of earlier frames which create objects they use\n"
+    "  replay [-server=<sockfile>] [-fast] <file>\n"
+    "                      Send a capture to a server (default: server.sock) one frame\n"
+    "                      per frame signal, or as fast as possible with -fast\n"
+    "options:\n"
+    "  -h, -help           Show help and exit\n",
+    prog);
+}
+
+static int cmdInfo(const char* filename) {
+  CaptureReader r;
+  if (!r.open(filename)) {
+    errlog("%s: %s", filename, strerror(errno));
+    return 1;
+  }
+  uint64_t commandBytes = 0, commands = 0, maxFrameBytes = 0, frameBytes = 0, endNs = 0;
+  uint32_t frames = 0, reservations = 0, textures = 0, meshBuffers = 0, assets = 0;
+  CaptureRecord rec;
+  while (r.next(&rec)) {
+    switch (rec.type) {
+      case CAPTURE_RESERVATION:
+        reservations++;
+        break;
+      case CAPTURE_TEXTURE:
+        textures++;
+        frameBytes += rec.size;
+        break;
+      case CAPTURE_MESH_BUFFER:
+        meshBuffers++;
+        frameBytes += rec.size;
+        break;
+      case CAPTURE_ASSET:
+        assets++;
+        break;
+      case CAPTURE_COMMANDS:
+        commandBytes += rec.size;
+        frameBytes += rec.size;
+        captureForEachCommand(rec.data, rec.size, [&](const char*, size_t) { commands++; });
+        break;
+      case CAPTURE_FRAME:
+        if (rec.size >= sizeof(endNs))
+          memcpy(&endNs, rec.data, sizeof(endNs));
+        maxFrameBytes = std::max(maxFrameBytes, frameBytes);
+        frameBytes = 0;
+        frames++;
+        break;
+    }
+  }
+  if (r.error()) {
+    errlog("%s: malformed capture", filename);
+    return 1;
+  }
+  printf("frames:          %u\n", frames);
+  printf("duration:        %.3f s\n", (double)endNs / 1e9);
+  printf("reservations:    %u\n", reservations);
+  printf("textures:        %u\n", textures);
+  printf("mesh buffers:    %u\n", meshBuffers);
+  printf("assets:          %u\n", assets);
+  printf("commands:        %llu\n", (unsigned long long)commands);
+  printf("command bytes:   %llu\n", (unsigned long long)commandBytes);
+  printf("max frame bytes: %llu\n", (unsigned long long)maxFrameBytes);
+  if (frameBytes > 0)
+    printf("trailing bytes:  %llu (after the last frame)\n", (unsigned long long)frameBytes);
+  return 0;
+}
+
+static int cmdSlice(uint32_t firstFrame, uint32_t endFrame, const char* infile, const char* outfile) {
+  if (endFrame <= firstFrame) {
+    errlog("empty frame range %u:%u", firstFrame, endFrame);
+    return 1;
+  }
+  CaptureSliceStats st;
+  uint64_t t0 = monotimeNs();
+  if (!captureSlice(infile, outfile, firstFrame, endFrame, &st)) {
+    errlog("slice %s -> %s: %s", infile, outfile, strerror(errno));
+    return 1;
+  }
+  if (st.framesOut < endFrame - firstFrame) {
+    errlog("warning: %s only has %u frames; wrote %u", infile, st.framesIn, st.framesOut);
+  }
+  printf("frames:   %u of %u\n", st.framesOut, st.framesIn);
+  printf("setup:    %llu commands kept, %llu dropped\n",
+    (unsigned long long)st.setupCommands, (unsigned long long)st.droppedCommands);
+  printf("objects:  %u dropped (with %u texture, mesh & asset records)\n",
+    st.droppedObjects, st.droppedRecords);
+  printf("size:     %llu -> %llu bytes (%.1f%%)\n",
+    (unsigned long long)st.bytesIn, (unsigned long long)st.bytesOut,
+    st.bytesIn ? (double)st.bytesOut * 100.0 / (double)st.bytesIn : 0.0);
+  printf("time:     %.3f s\n", (double)(monotimeNs() - t0) / 1e9);
+  return 0;
+}
+
+static int connectUNIXSocket(const char* filename) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(filename) > sizeof(addr.sun_path) - 1) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, filename);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd > -1 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    fd = -1;
+  }
+  return fd;
+}
+
+static int cmdReplay(const char* sockfile, bool fast, const char* filename) {
+  CaptureReader r;
+  if (!r.open(filename)) {
+    errlog("%s: %s", filename, strerror(errno));
+    return 1;
+  }
+  int fd = connectUNIXSocket(sockfile);
+  if (fd < 0) {
+    errlog("%s: %s", sockfile, strerror(errno));
+    return 1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  RunLoop* rl = EV_DEFAULT;
+  DawnRemoteProtocol proto;
+  bool frameSignal = false;
+  proto.onDawnBuffer = [](const char* data, size_t len) {}; // server replies are ignored
+  proto.onFrame = [&]() { frameSignal = true; };
+  proto.onFramebufferInfo = [](const DawnRemoteProtocol::FramebufferInfo&) {};
+  proto.start(rl, fd);
+  proto.sendHello();
+
+  uint32_t frames = 0;
+  uint64_t bytes = 0, t0 = monotimeNs();
+  CaptureRecord rec;
+  bool ok = true;
+  while (ok && !proto.stopped() && r.next(&rec)) {
+    ok = captureSend(proto, rec);
+    switch (rec.type) {
+      case CAPTURE_COMMANDS:
+      case CAPTURE_TEXTURE:
+      case CAPTURE_MESH_BUFFER:
+        bytes += rec.size;
+        break;
+      case CAPTURE_FRAME:
+        frames++;
+        if (!fast) {
+          frameSignal = false;
+          while (!frameSignal && !proto.stopped())
+            ev_run(rl, EVRUN_ONCE);
+        }
+        break;
+    }
+    // don't let the output queue grow beyond a few frames worth of data
+    while (!proto.stopped() && proto.pendingOutput() > 16 * DAWNCMD_MAX)
+      ev_run(rl, EVRUN_ONCE);
+  }
+  while (ok && !proto.stopped() && proto.pendingOutput() > 0)
+    ev_run(rl, EVRUN_ONCE);
+  double seconds = (double)(monotimeNs() - t0) / 1e9;
+  if (proto.stopped() || !ok) {
+    errlog("replay %s: connection closed or failed after %u frames", filename, frames);
+    ok = false;
+  } else if (r.error()) {
+    errlog("%s: malformed capture", filename);
+    ok = false;
+  }
+  proto.stop();
+  close(fd);
+  printf("frames:   %u\n", frames);
+  printf("bytes:    %llu\n", (unsigned long long)bytes);
+  printf("time:     %.3f s (%.1f frames/s)\n", seconds, seconds > 0 ? frames / seconds : 0.0);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char* command = argv[1];
+  const char* sockfile = "server.sock";
+  bool fast = false;
+  uint32_t firstFrame = 0, endFrame = 0;
+  bool haveFrames = false;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0 || strcmp(arg, "--help") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else if (i == 1) {
+      continue; // command
+    } else if (strncmp(arg, "-frames=", 8) == 0) {
+      char* end;
+      firstFrame = (uint32_t)strtoul(&arg[8], &end, 10);
+      if (*end != ':') {
+        errlog("invalid -frames (expected <first>:<end>)");
+        return 1;
+      }
+      endFrame = (uint32_t)strtoul(end + 1, &end, 10);
+      haveFrames = true;
+    } else if (strncmp(arg, "-server=", 8) == 0) {
+      sockfile = &arg[8];
+    } else if (strcmp(arg, "-fast") == 0) {
+      fast = true;
+    } else if (arg[0] == '-') {
+      fprintf(stderr, "%s: unknown option %s (see %s -help)\n", argv[0], arg, argv[0]);
+      return 1;
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  // a disconnecting server must not kill us
+  signal(SIGPIPE, SIG_IGN);
+
+  if (strcmp(command, "info") == 0 && files.size() == 1)
+    return cmdInfo(files[0]);
+  if (strcmp(command, "slice") == 0 && files.size() == 2 && haveFrames)
+    return cmdSlice(firstFrame, endFrame, files[0], files[1]);
+  if (strcmp(command, "replay") == 0 && files.size() == 1)
+    return cmdReplay(sockfile, fast, files[0]);
+  usage(argv[0]);
+  return 1;
+}
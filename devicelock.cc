@@ -0,0 +1,66 @@
+#include "devicelock.hh"
+#include <assert.h>
+#include <algorithm>
+
+void DeviceLock::lock() {
+  _workers++;
+  _mu.lock();
+}
+
+void DeviceLock::unlock() {
+  _mu.unlock();
+  _workers--;
+}
+
+
+void DeviceLocks::start(struct ev_loop* rl) {
+  assert(_rl == nullptr);
+  _rl = rl;
+  ev_prepare_init(&_prepare, onPrepare);
+  _prepare.data = this;
+  ev_prepare_start(rl, &_prepare);
+  ev_unref(rl); // don't allow the watcher to keep the runloop alive alone
+}
+
+void DeviceLocks::stop() {
+  unlockAll();
+  if (_rl) {
+    ev_ref(_rl);
+    ev_prepare_stop(_rl, &_prepare);
+    _rl = nullptr;
+  }
+}
+
+bool DeviceLocks::tryLock(DeviceLock* l) {
+  if (l->_held)
+    return true;
+  // a worker waiting for the lock gets it before the runloop takes it again
+  if (l->_workers.load() > 0 || !l->_mu.try_lock()) {
+    contended++;
+    return false;
+  }
+  l->_held = true;
+  _held.push_back(l);
+  return true;
+}
+
+void DeviceLocks::forget(DeviceLock* l) {
+  auto it = std::find(_held.begin(), _held.end(), l);
+  if (it == _held.end())
+    return;
+  _held.erase(it);
+  l->_held = false;
+  l->_mu.unlock();
+}
+
+void DeviceLocks::unlockAll() {
+  for (DeviceLock* l : _held) {
+    l->_held = false;
+    l->_mu.unlock();
+  }
+  _held.clear();
+}
+
+void DeviceLocks::onPrepare(struct ev_loop* rl, ev_prepare* w, int revents) {
+  ((DeviceLocks*)w->data)->unlockAll();
+}
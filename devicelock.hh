@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// protocol.hh's libev include, repeated here so devicelock.hh stands on its own
+_Pragma("GCC diagnostic push")
+_Pragma("GCC diagnostic ignored \"-Wc++17-compat-mangling\"")
+#include <ev.h>
+_Pragma("GCC diagnostic pop")
+
+// DeviceLock serializes the use of a Dawn device, which is not thread safe, between the
+// runloop and the present & compile threads.
+//
+// A worker thread holds the lock for the duration of a job (lock/unlock.) The runloop
+// never waits for it: DeviceLocks::tryLock takes it for the rest of the runloop
+// iteration, and fails while a worker holds or waits for it, in which case whatever the
+// runloop was going to do with the device waits until the worker's job is done. Locks
+// taken by the runloop are released before it next waits for events.
+struct DeviceLock {
+  // worker threads
+  void lock();
+  void unlock();
+
+  // internal
+  std::mutex       _mu;
+  std::atomic<int> _workers{0}; // worker threads holding or waiting for _mu
+  bool             _held = false; // by the runloop
+};
+
+// DeviceLocks holds the device locks the runloop has taken in the current iteration
+struct DeviceLocks {
+  // stats (runloop thread)
+  uint64_t contended = 0; // tryLock calls which failed
+
+  void start(struct ev_loop* rl);
+  void stop(); // releases all locks
+
+  // tryLock returns true if the runloop holds l, taking it if needed
+  bool tryLock(DeviceLock* l);
+  // forget releases l if the runloop holds it. Call before destroying l.
+  void forget(DeviceLock* l);
+  void unlockAll();
+
+  // internal
+  struct ev_loop*          _rl = nullptr;
+  ev_prepare               _prepare;
+  std::vector<DeviceLock*> _held;
+
+  static void onPrepare(struct ev_loop* rl, ev_prepare* w, int revents);
+};
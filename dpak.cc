@@ -0,0 +1,124 @@
+// dpak makes and lists asset packs (see assetpack.hh) for server -assets
+#include "assetpack.hh"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define errlog(format, ...) \
+  (({ fprintf(stderr, "E " format "\n", ##__VA_ARGS__); fflush(stderr); }))
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+    "usage: %s <command> <file> ...\n"
+    "commands:\n"
+    "  create <outfile> <file> ...\n"
+    "                      Write a pack of the files' contents to outfile\n"
+    "  list <file> ...     Print the hash and size of the assets of packs\n"
+    "  hash <file> ...     Print the hash and size of files, as clients compute them\n"
+    "options:\n"
+    "  -h, -help           Show help and exit\n",
+    prog);
+}
+
+static bool readFile(const char* filename, std::vector<char>* out) {
+  FILE* f = fopen(filename, "rb");
+  if (!f)
+    return false;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out->insert(out->end(), buf, buf + n);
+  bool ok = !ferror(f);
+  fclose(f);
+  if (!ok)
+    errno = EIO;
+  return ok;
+}
+
+static int cmdCreate(const char* outfile, const std::vector<const char*>& files) {
+  std::vector<std::vector<char>> contents(files.size());
+  std::vector<AssetData> assets;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!readFile(files[i], &contents[i])) {
+      errlog("%s: %s", files[i], strerror(errno));
+      return 1;
+    }
+    assets.push_back({ contents[i].data(), contents[i].size() });
+    bytes += contents[i].size();
+  }
+  if (!assetPackWrite(outfile, assets)) {
+    errlog("%s: %s", outfile, strerror(errno));
+    return 1;
+  }
+  printf("%s: %zu files, %llu bytes\n", outfile, assets.size(), (unsigned long long)bytes);
+  return 0;
+}
+
+static int cmdList(const std::vector<const char*>& files) {
+  int status = 0;
+  for (const char* filename : files) {
+    AssetStore store;
+    if (!store.open({ filename })) {
+      status = 1;
+      continue;
+    }
+    std::vector<std::pair<uint64_t,uint64_t>> assets;
+    for (const auto& it : store._index)
+      assets.push_back({ it.first, it.second.size });
+    std::sort(assets.begin(), assets.end());
+    for (const auto& a : assets) {
+      printf("%016llx %12llu %s\n",
+        (unsigned long long)a.first, (unsigned long long)a.second, filename);
+    }
+  }
+  return status;
+}
+
+static int cmdHash(const std::vector<const char*>& files) {
+  for (const char* filename : files) {
+    std::vector<char> data;
+    if (!readFile(filename, &data)) {
+      errlog("%s: %s", filename, strerror(errno));
+      return 1;
+    }
+    printf("%016llx %12zu %s\n",
+      (unsigned long long)assetHash(data.data(), data.size()), data.size(), filename);
+  }
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char* command = argv[1];
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0 || strcmp(arg, "--help") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else if (i == 1) {
+      continue; // command
+    } else if (arg[0] == '-') {
+      fprintf(stderr, "%s: unknown option %s (see %s -help)\n", argv[0], arg, argv[0]);
+      return 1;
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (strcmp(command, "create") == 0 && files.size() >= 2)
+    return cmdCreate(files[0], std::vector<const char*>(files.begin() + 1, files.end()));
+  if (strcmp(command, "list") == 0 && !files.empty())
+    return cmdList(files);
+  if (strcmp(command, "hash") == 0 && !files.empty())
+    return cmdHash(files);
+  usage(argv[0]);
+  return 1;
+}
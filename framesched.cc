@@ -0,0 +1,146 @@
+#include "framesched.hh"
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+// weight of the latest interval in the cost moving average
+#define COST_EWMA_ALPHA 0.2
+
+void FrameScheduler::start(struct ev_loop* rl) {
+  assert(_rl == nullptr);
+  _rl = rl;
+  _periodStart = ev_now(rl);
+  ev_init(&_timer, onTimer);
+  _timer.data = this;
+  _timer.repeat = interval;
+  ev_timer_again(rl, &_timer);
+  ev_unref(rl); // don't allow timer to keep runloop alive alone
+}
+
+void FrameScheduler::stop() {
+  if (_rl == nullptr)
+    return;
+  ev_ref(_rl);
+  ev_timer_stop(_rl, &_timer);
+  _rl = nullptr;
+}
+
+void FrameScheduler::add(void* key) {
+  assert(find(key) == nullptr);
+  // signalled: join at the next interval so that no client is signalled twice in one
+  _entries.push_back({ key, 0.0, 0, 0.0, true });
+}
+
+void FrameScheduler::remove(void* key) {
+  for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+    if (it->key == key) {
+      _entries.erase(it);
+      return;
+    }
+  }
+}
+
+void FrameScheduler::addCost(void* key, uint64_t ns) {
+  Entry* e = find(key);
+  if (e)
+    e->costNs += ns;
+}
+
+double FrameScheduler::phase(void* key) const {
+  const Entry* e = find(key);
+  return e ? e->phase : 0.0;
+}
+
+double FrameScheduler::cost(void* key) const {
+  const Entry* e = find(key);
+  return e ? e->cost : 0.0;
+}
+
+double FrameScheduler::load() const {
+  double total = 0;
+  for (const Entry& e : _entries)
+    total += e.cost;
+  return total / interval;
+}
+
+FrameScheduler::Entry* FrameScheduler::find(void* key) {
+  for (Entry& e : _entries) {
+    if (e.key == key)
+      return &e;
+  }
+  return nullptr;
+}
+
+const FrameScheduler::Entry* FrameScheduler::find(void* key) const {
+  return const_cast<FrameScheduler*>(this)->find(key);
+}
+
+// assignPhases folds the last interval's costs into the averages and lays out the
+// clients' phases for the next interval
+void FrameScheduler::assignPhases() {
+  double total = 0;
+  for (Entry& e : _entries) {
+    e.cost += COST_EWMA_ALPHA * ((double)e.costNs / 1e9 - e.cost);
+    e.costNs = 0;
+    e.signalled = false;
+    total += e.cost;
+  }
+  if (!stagger || _entries.empty()) {
+    for (Entry& e : _entries)
+      e.phase = 0;
+    return;
+  }
+  double scale = 1.0, gap = 0.0;
+  if (total > interval) {
+    scale = interval / total;
+  } else {
+    gap = (interval - total) / (double)_entries.size();
+  }
+  double t = 0;
+  for (Entry& e : _entries) {
+    e.phase = std::min(t, interval);
+    t += e.cost * scale + gap;
+  }
+}
+
+// run signals clients whose phase has come and schedules the timer for the next one
+void FrameScheduler::run() {
+  double now = ev_now(_rl);
+  std::vector<void*> due;
+  while (true) {
+    for (Entry& e : _entries) {
+      if (!e.signalled && _periodStart + e.phase <= now) {
+        e.signalled = true;
+        // when catching up on a late timer, signal each client only once
+        if (std::find(due.begin(), due.end(), e.key) == due.end())
+          due.push_back(e.key);
+      }
+    }
+    if (now < _periodStart + interval)
+      break;
+    // next interval. If we fell behind by more than an interval, skip ahead rather
+    // than signalling clients several times in a row.
+    _periodStart += interval;
+    if (now - _periodStart > interval)
+      _periodStart = now - fmod(now - _periodStart, interval);
+    assignPhases();
+  }
+
+  // onSignal may remove clients
+  for (void* key : due) {
+    if (find(key) && onSignal)
+      onSignal(key);
+  }
+
+  double next = _periodStart + interval;
+  for (const Entry& e : _entries) {
+    if (!e.signalled)
+      next = std::min(next, _periodStart + e.phase);
+  }
+  _timer.repeat = std::max(next - ev_now(_rl), 0.0001);
+  ev_timer_again(_rl, &_timer);
+}
+
+void FrameScheduler::onTimer(struct ev_loop* rl, ev_timer* w, int revents) {
+  ((FrameScheduler*)w->data)->run();
+}
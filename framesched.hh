@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// protocol.hh's libev include, repeated here so framesched.hh stands on its own
+_Pragma("GCC diagnostic push")
+_Pragma("GCC diagnostic ignored \"-Wc++17-compat-mangling\"")
+#include <ev.h>
+_Pragma("GCC diagnostic pop")
+
+// FrameScheduler sends each client its frame signal once per frame interval, at a
+// per-client phase offset within the interval. Signalling every client at the same
+// instant makes all of their command buffers arrive together and queue up behind each
+// other; instead, phases are spread out so that server work is evenly distributed.
+//
+// Each client's execution cost (server time spent on its commands per frame, reported
+// with addCost) is tracked as a moving average. At the start of every interval phases
+// are reassigned in order of registration: each client starts where the previous one's
+// expected work ends, plus an even share of the idle time. When the total cost exceeds
+// the interval, costs are scaled down to fit.
+//
+// Example:
+//   sched.onSignal = [](void* key) { ((Conn*)key)->sendFrameSignal(); };
+//   sched.start(rl);
+//   sched.add(conn);
+//   ...
+//   sched.addCost(conn, nanoseconds spent handling conn's commands);
+//
+struct FrameScheduler {
+  double interval = 1.0 / 60.0; // seconds
+  bool   stagger = true;        // false: signal all clients at phase 0
+
+  // onSignal is called when it's time for the client identified by key to render.
+  // It may remove any client (including key.)
+  std::function<void(void* key)> onSignal;
+
+  void start(struct ev_loop* rl);
+  void stop();
+
+  void add(void* key);
+  void remove(void* key);
+
+  // addCost adds ns of server time spent on key's commands in the current interval
+  void addCost(void* key, uint64_t ns);
+
+  // phase returns key's phase offset in seconds, cost its average cost per frame in
+  // seconds and load the total cost relative to the interval
+  double phase(void* key) const;
+  double cost(void* key) const;
+  double load() const;
+
+  // internal
+  struct Entry {
+    void*    key;
+    double   cost;    // moving average, seconds per interval
+    uint64_t costNs;  // accumulated during the current interval
+    double   phase;   // seconds after _periodStart
+    bool     signalled;
+  };
+  struct ev_loop*    _rl = nullptr;
+  ev_timer           _timer;
+  double             _periodStart = 0;
+  std::vector<Entry> _entries;
+
+  Entry* find(void* key);
+  const Entry* find(void* key) const;
+  void assignPhases();
+  void run();
+  static void onTimer(struct ev_loop* rl, ev_timer* w, int revents);
+};
@@ -0,0 +1,289 @@
+#include "hud.hh"
+#include "utils/ComboRenderPipelineDescriptor.h"
+#include "utils/WGPUHelpers.h"
+#include <string.h>
+#include <algorithm>
+
+// Font cell size in font pixels. Glyphs are 5x7 with a 1px margin to the left & top
+// and 1px below, so that lines of text do not touch.
+#define HUD_CELL_W 6
+#define HUD_CELL_H 9
+#define HUD_MARGIN 8 // distance from the top-left corner of the framebuffer, in pixels
+
+#define HUD_STR(x) HUD_STR1(x)
+#define HUD_STR1(x) #x
+
+// font5x7 holds glyphs for ASCII 0x20-0x7E as 5 columns each, top row in bit 0
+static const uint8_t font5x7[95][5] = {
+  { 0x00, 0x00, 0x00, 0x00, 0x00 }, // 0x20
+  { 0x00, 0x00, 0x5f, 0x00, 0x00 }, // !
+  { 0x00, 0x07, 0x00, 0x07, 0x00 }, // "
+  { 0x14, 0x7f, 0x14, 0x7f, 0x14 }, // #
+  { 0x24, 0x2a, 0x7f, 0x2a, 0x12 }, // $
+  { 0x23, 0x13, 0x08, 0x64, 0x62 }, // %
+  { 0x36, 0x49, 0x55, 0x22, 0x50 }, // &
+  { 0x00, 0x05, 0x03, 0x00, 0x00 }, // '
+  { 0x00, 0x1c, 0x22, 0x41, 0x00 }, // (
+  { 0x00, 0x41, 0x22, 0x1c, 0x00 }, // )
+  { 0x14, 0x08, 0x3e, 0x08, 0x14 }, // *
+  { 0x08, 0x08, 0x3e, 0x08, 0x08 }, // +
+  { 0x00, 0x50, 0x30, 0x00, 0x00 }, // ,
+  { 0x08, 0x08, 0x08, 0x08, 0x08 }, // -
+  { 0x00, 0x60, 0x60, 0x00, 0x00 }, // .
+  { 0x20, 0x10, 0x08, 0x04, 0x02 }, // /
+  { 0x3e, 0x51, 0x49, 0x45, 0x3e }, // 0
+  { 0x00, 0x42, 0x7f, 0x40, 0x00 }, // 1
+  { 0x42, 0x61, 0x51, 0x49, 0x46 }, // 2
+  { 0x21, 0x41, 0x45, 0x4b, 0x31 }, // 3
+  { 0x18, 0x14, 0x12, 0x7f, 0x10 }, // 4
+  { 0x27, 0x45, 0x45, 0x45, 0x39 }, // 5
+  { 0x3c, 0x4a, 0x49, 0x49, 0x30 }, // 6
+  { 0x01, 0x71, 0x09, 0x05, 0x03 }, // 7
+  { 0x36, 0x49, 0x49, 0x49, 0x36 }, // 8
+  { 0x06, 0x49, 0x49, 0x29, 0x1e }, // 9
+  { 0x00, 0x36, 0x36, 0x00, 0x00 }, // :
+  { 0x00, 0x56, 0x36, 0x00, 0x00 }, // ;
+  { 0x08, 0x14, 0x22, 0x41, 0x00 }, // <
+  { 0x14, 0x14, 0x14, 0x14, 0x14 }, // =
+  { 0x00, 0x41, 0x22, 0x14, 0x08 }, // >
+  { 0x02, 0x01, 0x51, 0x09, 0x06 }, // ?
+  { 0x32, 0x49, 0x79, 0x41, 0x3e }, // @
+  { 0x7e, 0x11, 0x11, 0x11, 0x7e }, // A
+  { 0x7f, 0x49, 0x49, 0x49, 0x36 }, // B
+  { 0x3e, 0x41, 0x41, 0x41, 0x22 }, // C
+  { 0x7f, 0x41, 0x41, 0x22, 0x1c }, // D
+  { 0x7f, 0x49, 0x49, 0x49, 0x41 }, // E
+  { 0x7f, 0x09, 0x09, 0x09, 0x01 }, // F
+  { 0x3e, 0x41, 0x49, 0x49, 0x7a }, // G
+  { 0x7f, 0x08, 0x08, 0x08, 0x7f }, // H
+  { 0x00, 0x41, 0x7f, 0x41, 0x00 }, // I
+  { 0x20, 0x40, 0x41, 0x3f, 0x01 }, // J
+  { 0x7f, 0x08, 0x14, 0x22, 0x41 }, // K
+  { 0x7f, 0x40, 0x40, 0x40, 0x40 }, // L
+  { 0x7f, 0x02, 0x0c, 0x02, 0x7f }, // M
+  { 0x7f, 0x04, 0x08, 0x10, 0x7f }, // N
+  { 0x3e, 0x41, 0x41, 0x41, 0x3e }, // O
+  { 0x7f, 0x09, 0x09, 0x09, 0x06 }, // P
+  { 0x3e, 0x41, 0x51, 0x21, 0x5e }, // Q
+  { 0x7f, 0x09, 0x19, 0x29, 0x46 }, // R
+  { 0x46, 0x49, 0x49, 0x49, 0x31 }, // S
+  { 0x01, 0x01, 0x7f, 0x01, 0x01 }, // T
+  { 0x3f, 0x40, 0x40, 0x40, 0x3f }, // U
+  { 0x1f, 0x20, 0x40, 0x20, 0x1f }, // V
+  { 0x3f, 0x40, 0x38, 0x40, 0x3f }, // W
+  { 0x63, 0x14, 0x08, 0x14, 0x63 }, // X
+  { 0x07, 0x08, 0x70, 0x08, 0x07 }, // Y
+  { 0x61, 0x51, 0x49, 0x45, 0x43 }, // Z
+  { 0x00, 0x7f, 0x41, 0x41, 0x00 }, // [
+  { 0x02, 0x04, 0x08, 0x10, 0x20 }, // 0x5C
+  { 0x00, 0x41, 0x41, 0x7f, 0x00 }, // ]
+  { 0x04, 0x02, 0x01, 0x02, 0x04 }, // ^
+  { 0x40, 0x40, 0x40, 0x40, 0x40 }, // _
+  { 0x00, 0x01, 0x02, 0x04, 0x00 }, // `
+  { 0x20, 0x54, 0x54, 0x54, 0x78 }, // a
+  { 0x7f, 0x48, 0x44, 0x44, 0x38 }, // b
+  { 0x38, 0x44, 0x44, 0x44, 0x20 }, // c
+  { 0x38, 0x44, 0x44, 0x48, 0x7f }, // d
+  { 0x38, 0x54, 0x54, 0x54, 0x18 }, // e
+  { 0x08, 0x7e, 0x09, 0x01, 0x02 }, // f
+  { 0x0c, 0x52, 0x52, 0x52, 0x3e }, // g
+  { 0x7f, 0x08, 0x04, 0x04, 0x78 }, // h
+  { 0x00, 0x44, 0x7d, 0x40, 0x00 }, // i
+  { 0x20, 0x40, 0x44, 0x3d, 0x00 }, // j
+  { 0x7f, 0x10, 0x28, 0x44, 0x00 }, // k
+  { 0x00, 0x41, 0x7f, 0x40, 0x00 }, // l
+  { 0x7c, 0x04, 0x18, 0x04, 0x78 }, // m
+  { 0x7c, 0x08, 0x04, 0x04, 0x78 }, // n
+  { 0x38, 0x44, 0x44, 0x44, 0x38 }, // o
+  { 0x7c, 0x14, 0x14, 0x14, 0x08 }, // p
+  { 0x08, 0x14, 0x14, 0x18, 0x7c }, // q
+  { 0x7c, 0x08, 0x04, 0x04, 0x08 }, // r
+  { 0x48, 0x54, 0x54, 0x54, 0x20 }, // s
+  { 0x04, 0x3f, 0x44, 0x40, 0x20 }, // t
+  { 0x3c, 0x40, 0x40, 0x20, 0x7c }, // u
+  { 0x1c, 0x20, 0x40, 0x20, 0x1c }, // v
+  { 0x3c, 0x40, 0x30, 0x40, 0x3c }, // w
+  { 0x44, 0x28, 0x10, 0x28, 0x44 }, // x
+  { 0x0c, 0x50, 0x50, 0x50, 0x3c }, // y
+  { 0x44, 0x64, 0x54, 0x4c, 0x44 }, // z
+  { 0x00, 0x08, 0x36, 0x41, 0x00 }, // {
+  { 0x00, 0x00, 0x7f, 0x00, 0x00 }, // |
+  { 0x00, 0x41, 0x36, 0x08, 0x00 }, // }
+  { 0x08, 0x04, 0x08, 0x10, 0x08 }, // ~
+};
+
+// kVertexShader places a quad per character instance
+static const char* kVertexShader =
+  "let cellSize : vec2<f32> = vec2<f32>(" HUD_STR(HUD_CELL_W) ".0, " HUD_STR(HUD_CELL_H) ".0);\n"
+  "let margin : vec2<f32> = vec2<f32>(" HUD_STR(HUD_MARGIN) ".0, " HUD_STR(HUD_MARGIN) ".0);\n"
+  R"(
+  [[block]] struct Params {
+    viewport : vec2<f32>;
+    scale    : f32;
+  };
+  [[group(0), binding(0)]] var<uniform> params : Params;
+
+  struct VertexOut {
+    [[builtin(position)]] position : vec4<f32>;
+    [[location(0)]] cell  : vec2<f32>; // position within the glyph cell, in font pixels
+    [[location(1)]] glyph : f32;
+  };
+
+  let corners : array<vec2<f32>, 6> = array<vec2<f32>, 6>(
+    vec2<f32>(0.0, 0.0), vec2<f32>(1.0, 0.0), vec2<f32>(0.0, 1.0),
+    vec2<f32>(0.0, 1.0), vec2<f32>(1.0, 0.0), vec2<f32>(1.0, 1.0)
+  );
+
+  [[stage(vertex)]] fn main(
+    [[builtin(vertex_index)]] VertexIndex : u32,
+    [[location(0)]] packed : u32
+  ) -> VertexOut {
+    let corner = corners[VertexIndex];
+    let colrow = vec2<f32>(f32(packed & 0xffu), f32((packed >> 8u) & 0xffu));
+    let px = (colrow + corner) * cellSize * params.scale + margin;
+    var out : VertexOut;
+    out.position = vec4<f32>(
+      px.x / params.viewport.x * 2.0 - 1.0,
+      1.0 - px.y / params.viewport.y * 2.0,
+      0.0, 1.0);
+    out.cell = corner * cellSize;
+    out.glyph = f32(packed >> 16u);
+    return out;
+  }
+)";
+
+// kFragmentShader looks up the font pixel of a glyph cell. The font is 2 words per
+// glyph: columns 0-3 in the bytes of the first word and column 4 in the second.
+static const char* kFragmentShader = R"(
+  [[block]] struct Font {
+    words : array<vec4<u32>, 48>;
+  };
+  [[group(0), binding(1)]] var<uniform> font : Font;
+
+  [[stage(fragment)]] fn main(
+    [[location(0)]] cell  : vec2<f32>,
+    [[location(1)]] glyph : f32
+  ) -> [[location(0)]] vec4<f32> {
+    let x = u32(cell.x);
+    let y = u32(cell.y);
+    if (x >= 1u && x <= 5u && y >= 1u && y <= 7u) {
+      let col = x - 1u;
+      let w = u32(glyph + 0.5) * 2u + col / 4u;
+      let bits = (font.words[w / 4u][w % 4u] >> ((col % 4u) * 8u)) & 0xffu;
+      if (((bits >> (y - 1u)) & 1u) != 0u) {
+        return vec4<f32>(1.0, 1.0, 1.0, 1.0);
+      }
+    }
+    return vec4<f32>(0.0, 0.0, 0.0, 0.6);
+  }
+)";
+
+
+void Hud::init(const wgpu::Device& device) {
+  _device = device;
+
+  utils::ComboRenderPipelineDescriptor2 desc;
+  desc.vertex.module = utils::CreateShaderModule(device, kVertexShader);
+  desc.vertex.bufferCount = 1;
+  desc.cBuffers[0].arrayStride = sizeof(uint32_t);
+  desc.cBuffers[0].stepMode = wgpu::InputStepMode::Instance;
+  desc.cBuffers[0].attributeCount = 1;
+  desc.cBuffers[0].attributes = &desc.cAttributes[0];
+  desc.cAttributes[0].format = wgpu::VertexFormat::Uint32;
+  desc.cAttributes[0].offset = 0;
+  desc.cAttributes[0].shaderLocation = 0;
+  desc.cFragment.module = utils::CreateShaderModule(device, kFragmentShader);
+  desc.cTargets[0].format = format;
+  desc.cBlends[0].color.srcFactor = wgpu::BlendFactor::SrcAlpha;
+  desc.cBlends[0].color.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
+  desc.cTargets[0].blend = &desc.cBlends[0];
+  _pipeline = device.CreateRenderPipeline2(&desc);
+
+  // font: 8 bytes per glyph (5 columns + padding) for 96 glyphs (0x7F is blank)
+  uint8_t font[96 * 8] = {};
+  for (size_t g = 0; g < 95; g++)
+    memcpy(&font[g * 8], font5x7[g], 5);
+  _font = utils::CreateBufferFromData(device, font, sizeof(font), wgpu::BufferUsage::Uniform);
+
+  wgpu::BufferDescriptor paramsDesc;
+  paramsDesc.size = 16; // vec2<f32> + f32, padded
+  paramsDesc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
+  _params = device.CreateBuffer(&paramsDesc);
+  _paramsWidth = 0;
+  _paramsHeight = 0;
+
+  _bindGroup = utils::MakeBindGroup(device, _pipeline.GetBindGroupLayout(0), {
+    {0, _params},
+    {1, _font},
+  });
+
+  _instances = nullptr;
+  _instancesCap = 0;
+  _dirty = true;
+}
+
+void Hud::setText(const std::string& text) {
+  _chars.clear();
+  uint32_t col = 0, row = 0;
+  for (char c : text) {
+    if (c == '\n') {
+      col = 0;
+      row++;
+      continue;
+    }
+    if (col > 0xff || row > 0xff)
+      continue;
+    uint32_t glyph = (c >= 0x20 && c < 0x7f) ? (uint32_t)(c - 0x20) : (uint32_t)('?' - 0x20);
+    _chars.push_back(col | (row << 8) | (glyph << 16));
+    col++;
+  }
+  _dirty = true;
+}
+
+void Hud::draw(
+  const wgpu::Device& device, const wgpu::SwapChain& swapchain, uint32_t width, uint32_t height)
+{
+  if (_device.Get() != device.Get())
+    init(device);
+  if (_chars.empty())
+    return;
+  wgpu::Queue queue = device.GetQueue();
+
+  if (width != _paramsWidth || height != _paramsHeight) {
+    float params[4] = { (float)width, (float)height, (float)scale, 0.0f };
+    queue.WriteBuffer(_params, 0, params, sizeof(params));
+    _paramsWidth = width;
+    _paramsHeight = height;
+  }
+
+  if (_dirty) {
+    if (_instancesCap < _chars.size()) {
+      _instancesCap = std::max(_chars.size(), (size_t)256);
+      wgpu::BufferDescriptor desc;
+      desc.size = _instancesCap * sizeof(uint32_t);
+      desc.usage = wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst;
+      _instances = device.CreateBuffer(&desc);
+    }
+    queue.WriteBuffer(_instances, 0, _chars.data(), _chars.size() * sizeof(uint32_t));
+    _dirty = false;
+  }
+
+  wgpu::RenderPassColorAttachmentDescriptor colorAttachment;
+  colorAttachment.view = swapchain.GetCurrentTextureView();
+  colorAttachment.loadOp = wgpu::LoadOp::Load;
+  colorAttachment.storeOp = wgpu::StoreOp::Store;
+
+  wgpu::RenderPassDescriptor renderPassDesc;
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorAttachment;
+
+  wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+  wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&renderPassDesc);
+  pass.SetPipeline(_pipeline);
+  pass.SetBindGroup(0, _bindGroup);
+  pass.SetVertexBuffer(0, _instances);
+  pass.Draw(6, (uint32_t)_chars.size());
+  pass.EndPass();
+  wgpu::CommandBuffer commands = encoder.Finish();
+  queue.Submit(1, &commands);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <dawn/webgpu_cpp.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Hud draws lines of text on top of a swapchain's current texture, using a built-in
+// 5x7 bitmap font. Text is drawn as one instanced draw call (a quad per character,
+// the font lives in a uniform buffer) in a render pass which loads the existing
+// content, so it is meant to be called after the client has rendered its frame
+// and before the swapchain is presented.
+//
+// The instance buffer is only written when the text changes.
+//
+// Example:
+//   hud.setText("60 fps\n1.2 MB/s");
+//   hud.draw(device, swapchain, width, height);
+//   swapchain.Present();
+//
+struct Hud {
+  uint32_t            scale = 2; // pixels per font pixel
+  wgpu::TextureFormat format = wgpu::TextureFormat::BGRA8Unorm; // of the swapchain
+
+  // setText sets the text to draw. Lines are separated by '\n'; characters outside
+  // of printable ASCII are drawn as '?'.
+  void setText(const std::string& text);
+
+  // draw encodes and submits a render pass which draws the text onto the current
+  // texture of swapchain. width & height are the size of the swapchain in pixels.
+  void draw(
+    const wgpu::Device& device, const wgpu::SwapChain& swapchain, uint32_t width, uint32_t height);
+
+  // internal
+  wgpu::Device         _device;
+  wgpu::RenderPipeline _pipeline;
+  wgpu::Buffer         _params;    // viewport & scale
+  wgpu::Buffer         _font;
+  wgpu::Buffer         _instances; // one uint32 per character: col | row<<8 | glyph<<16
+  wgpu::BindGroup      _bindGroup;
+  size_t               _instancesCap = 0;
+  std::vector<uint32_t> _chars;
+  bool                 _dirty = false;
+  uint32_t             _paramsWidth = 0, _paramsHeight = 0;
+
+  void init(const wgpu::Device& device);
+};
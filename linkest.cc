@@ -0,0 +1,56 @@
+#include "linkest.hh"
+#include "metrics.hh"
+#include <algorithm>
+
+void LinkEstimator::probeSent(Probe* p, uint64_t nowNs, bool appLimited_) const {
+  p->sentNs = nowNs;
+  p->delivered = delivered;
+  p->deliveredNs = _deliveredNs;
+  p->firstSentNs = _firstSentNs;
+  p->appLimited = appLimited_;
+}
+
+void LinkEstimator::probeAcked(const Probe& p, uint64_t nowNs) {
+  if (p.sentNs == 0 || nowNs < p.sentNs || p.offset < delivered)
+    return; // not written yet as far as we know, or acked out of order
+  samples++;
+
+  uint64_t rtt = std::max((uint64_t)1, nowNs - p.sentNs);
+  minRttNs = _rttFilter.update((uint64_t)(LINK_MIN_RTT_WINDOW * 1e9), nowNs, rtt);
+  srttNs = srttNs == 0 ? rtt : srttNs - srttNs / 8 + rtt / 8;
+
+  // a round trip ends when a probe written after the previous one ended is acked
+  if (p.delivered >= _roundDelivered) {
+    rounds++;
+    _roundDelivered = p.offset;
+  }
+
+  delivered = p.offset;
+  _deliveredNs = nowNs;
+  _firstSentNs = p.sentNs;
+  if (p.deliveredNs == 0)
+    return; // the first probe only starts the delivery clock
+
+  uint64_t interval = std::max(nowNs - p.deliveredNs, p.sentNs - p.firstSentNs);
+  if (interval == 0 || p.offset == p.delivered)
+    return;
+  rate = (uint64_t)((double)(p.offset - p.delivered) * 1e9 / (double)interval);
+  if (p.appLimited) {
+    appLimited++;
+    if (rate < bandwidth)
+      return; // says nothing about the link, only about the sender
+  }
+  bandwidth = _bwFilter.update(LINK_BW_WINDOW_ROUNDS, rounds, rate);
+}
+
+void LinkEstimator::writeMetrics(MetricsWriter& w) const {
+  if (samples == 0)
+    return;
+  w.gauge("link.bandwidth", (double)bandwidth);
+  w.gauge("link.min_rtt_us", (double)minRttNs / 1e3);
+  w.gauge("link.srtt_us", (double)srttNs / 1e3);
+  w.gauge("link.bdp", (double)bdp());
+  w.counter("link.rounds", rounds);
+  w.counter("link.samples", samples);
+  w.counter("link.app_limited", appLimited);
+}
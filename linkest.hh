@@ -0,0 +1,127 @@
+#pragma once
+#include <stdint.h>
+
+struct MetricsWriter;
+
+// LinkEstimator estimates the bottleneck bandwidth and round-trip time of one direction
+// of a connection, the way BBR does: from delivery rate samples taken when the peer
+// acknowledges data, and RTT samples of the same acknowledgements.
+//
+// DawnRemoteProtocol drives it with probes: every so often while it is sending, it
+// queues a probe message behind its output (see LINK_PROBE_INTERVAL_MIN.) When the
+// probe has been written the delivery state is recorded in it (probeSent), and when
+// the peer's acknowledgement arrives, which it sends as soon as it has read the probe
+// and thus everything before it, the probe yields a sample (probeAcked):
+//
+//   rtt  = now - probe.sentNs
+//   rate = (probe.offset - probe.delivered) / max(now - probe.deliveredNs,
+//                                                 probe.sentNs - probe.firstSentNs)
+//
+// i.e. the bytes delivered since the acknowledgement which preceded the probe's send,
+// over the longer of the send and ack intervals (so that neither burst of sends nor
+// of acks inflates the rate.) Samples taken while the sender ran out of data to send
+// are "application limited": they can only raise the bandwidth estimate.
+//
+// bandwidth is the max of the rate samples over the last LINK_BW_WINDOW_ROUNDS round
+// trips, minRttNs the min RTT over the last LINK_MIN_RTT_WINDOW seconds and srttNs a
+// smoothed RTT (1/8 gain) which includes queueing delay. All are 0 until measured.
+//
+// Example:
+//   const LinkEstimator& link = proto.link;
+//   if (link.bandwidth > 0 && link.bdp() < 256*1024) ...
+//
+#define LINK_BW_WINDOW_ROUNDS 10
+#define LINK_MIN_RTT_WINDOW   10.0 /* seconds */
+
+// MinMaxFilter tracks the max (or min, with Less) of samples over a sliding window of
+// time or rounds, in O(1) space: the best, second best and third best samples of
+// successive sub-windows (Kathleen Nichols' algorithm, as in Linux's win_minmax.)
+template<bool Less>
+struct MinMaxFilter {
+  struct Sample {
+    uint64_t t; // time or round
+    uint64_t v;
+  };
+  Sample s[3] = {};
+
+  uint64_t get() const { return s[0].v; }
+  void reset(uint64_t t, uint64_t v) { s[0] = s[1] = s[2] = { t, v }; }
+
+  // update adds sample v at t and returns the current best over [t - window, t]
+  uint64_t update(uint64_t window, uint64_t t, uint64_t v) {
+    Sample n = { t, v };
+    if (s[0].v == 0 || better(v, s[0].v) || t - s[2].t > window) {
+      reset(t, v); // new best, or nothing in the window
+      return get();
+    }
+    if (better(v, s[1].v)) {
+      s[2] = s[1] = n;
+    } else if (better(v, s[2].v)) {
+      s[2] = n;
+    }
+    // expire the best once it's older than the window; age the others into it
+    uint64_t dt = t - s[0].t;
+    if (dt > window) {
+      s[0] = s[1];
+      s[1] = s[2];
+      s[2] = n;
+      if (t - s[0].t > window) {
+        s[0] = s[1];
+        s[1] = s[2];
+        s[2] = n;
+      }
+    } else if (s[1].t == s[0].t && dt > window / 4) {
+      s[2] = s[1] = n; // a quarter of the window has passed without a second best
+    } else if (s[2].t == s[1].t && dt > window / 2) {
+      s[2] = n; // half of the window has passed without a third best
+    }
+    return get();
+  }
+
+  static bool better(uint64_t a, uint64_t b) { return Less ? a <= b : a >= b; }
+};
+
+struct LinkEstimator {
+  // estimates
+  uint64_t bandwidth = 0; // bottleneck bandwidth in bytes/s
+  uint64_t minRttNs = 0;  // round-trip propagation time
+  uint64_t srttNs = 0;    // smoothed round-trip time
+  uint64_t rate = 0;      // the latest delivery rate sample in bytes/s
+
+  // counters
+  uint64_t rounds = 0;        // round trips (see LINK_BW_WINDOW_ROUNDS)
+  uint64_t samples = 0;       // probes acknowledged
+  uint64_t appLimited = 0;    // of those, application limited rate samples
+  uint64_t delivered = 0;     // bytes the peer has acknowledged
+
+  // bdp returns the bandwidth-delay product in bytes (0 until both are known)
+  uint64_t bdp() const { return (uint64_t)((double)bandwidth * (double)minRttNs / 1e9); }
+
+  // Probe is the delivery state at the time a probe was written
+  struct Probe {
+    uint64_t offset;      // bytes written up to and including the probe
+    uint64_t sentNs;      // when the probe was written (0 = not yet)
+    uint64_t delivered;   // bytes acknowledged when it was written
+    uint64_t deliveredNs; // when those were acknowledged (0 = nothing yet)
+    uint64_t firstSentNs; // when the probe which acknowledged them was written
+    bool     appLimited;  // the sender ran out of data since the previous probe
+  };
+
+  // probeSent records the delivery state in p, which was written at nowNs
+  void probeSent(Probe* p, uint64_t nowNs, bool appLimited) const;
+
+  // probeAcked takes the samples of a probe acknowledged at nowNs
+  void probeAcked(const Probe& p, uint64_t nowNs);
+
+  void reset() { *this = LinkEstimator(); }
+
+  // writeMetrics writes the estimates as link.* metrics
+  void writeMetrics(MetricsWriter& w) const;
+
+  // internal
+  uint64_t                _deliveredNs = 0;
+  uint64_t                _firstSentNs = 0;
+  uint64_t                _roundDelivered = 0; // a probe sent at this is the next round
+  MinMaxFilter<false>     _bwFilter;           // over rounds
+  MinMaxFilter<true>      _rttFilter;          // over ns
+};
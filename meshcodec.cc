@@ -0,0 +1,625 @@
+#include "meshcodec.hh"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+// Encoded vertices are blocks of MESH_BLOCK vertices (the last one padded with zero
+// deltas.) Each block starts with a 2-bit width code per channel (uint16 of a vertex),
+// 4 per byte, followed by the zigzag deltas of each channel in turn: 0, 1 or 2 bytes
+// per value (code 0, 1 or 2.)
+//
+// Encoded indices are blocks of MESH_BLOCK indices, in groups of 4 blocks which start
+// with a byte of 2-bit width codes, one per block: 0 (all values 0), 1 (a mask byte,
+// the low byte of each value, then the high byte of the values whose mask bit is set),
+// 2 or 4 (bytes per value.) Each value is the zigzag coded distance of the index from `next`, the lowest index not
+// yet used; 0 uses (and advances) next. After meshOptimizeVertexFetch every index is
+// either next or a vertex used recently, so most values fit in one byte.
+#define MESH_BLOCK 8
+
+// vertex cache size assumed by meshOptimizeVertexCache
+#define MESH_CACHE_SIZE 32
+
+static inline uint16_t zigzag16(uint16_t d) {
+  return (uint16_t)((d << 1) ^ (uint16_t)((int16_t)d >> 15));
+}
+static inline uint16_t unzigzag16(uint16_t z) {
+  return (uint16_t)((z >> 1) ^ (uint16_t)(0 - (z & 1)));
+}
+static inline uint32_t zigzag32(uint32_t d) {
+  return (d << 1) ^ (uint32_t)((int32_t)d >> 31);
+}
+static inline uint32_t unzigzag32(uint32_t z) {
+  return (z >> 1) ^ (0 - (z & 1));
+}
+
+static uint16_t floatToHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, 4);
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t fexp = (x >> 23) & 0xff;
+  uint32_t mant = x & 0x7fffff;
+  if (fexp == 0xff)
+    return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0)); // inf or nan
+  int32_t exp = (int32_t)fexp - 127 + 15;
+  if (exp <= 0)
+    return (uint16_t)sign; // too small for a normal half; flush to zero
+  if (exp >= 31)
+    return (uint16_t)(sign | 0x7c00);
+  uint32_t h = sign | ((uint32_t)exp << 10) | (mant >> 13);
+  uint32_t rest = mant & 0x1fff; // round to nearest even
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+    h++;
+  return (uint16_t)h;
+}
+
+void meshQuantizeVertices(
+  const float* positions, const float* normals, const float* uvs, uint32_t count,
+  MeshQuantizedVertex* out, MeshQuantization* q)
+{
+  float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+  for (uint32_t i = 0; i < count; i++) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], positions[i * 3 + c]);
+      hi[c] = std::max(hi[c], positions[i * 3 + c]);
+    }
+  }
+  for (int c = 0; c < 3; c++) {
+    q->offset[c] = count ? lo[c] : 0.0f;
+    q->scale[c] = count ? (hi[c] - lo[c]) / 65535.0f : 0.0f;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    MeshQuantizedVertex& v = out[i];
+    for (int c = 0; c < 3; c++) {
+      float u = q->scale[c] > 0 ? (positions[i * 3 + c] - q->offset[c]) / q->scale[c] : 0.0f;
+      v.position[c] = (uint16_t)std::min(65535.0f, std::max(0.0f, u + 0.5f));
+      float n = normals ? normals[i * 3 + c] : 0.0f;
+      v.normal[c] = (int8_t)lrintf(std::min(1.0f, std::max(-1.0f, n)) * 127.0f);
+    }
+    v.position[3] = 0;
+    v.normal[3] = 0;
+    v.uv[0] = floatToHalf(uvs ? uvs[i * 2] : 0.0f);
+    v.uv[1] = floatToHalf(uvs ? uvs[i * 2 + 1] : 0.0f);
+  }
+}
+
+
+// vertexScore is the score of a vertex in Forsyth's algorithm: vertices recently used
+// (but not by the last triangle, which the cache handles anyway) and vertices with few
+// remaining triangles score higher.
+static float vertexScore(int cachePos, uint32_t remaining) {
+  if (remaining == 0)
+    return -1.0f;
+  float s = 0.0f;
+  if (cachePos >= 0) {
+    if (cachePos < 3) {
+      s = 0.75f;
+    } else {
+      s = powf(1.0f - (float)(cachePos - 3) / (MESH_CACHE_SIZE - 3), 1.5f);
+    }
+  }
+  return s + 2.0f / sqrtf((float)remaining);
+}
+
+void meshOptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount) {
+  size_t ntris = indexCount / 3;
+  if (ntris < 2)
+    return;
+
+  // triangles using each vertex: adj[adjOffs[v] .. adjOffs[v] + remaining[v]]
+  std::vector<uint32_t> remaining(vertexCount, 0), adjOffs(vertexCount + 1, 0);
+  for (size_t i = 0; i < ntris * 3; i++) {
+    assert(indices[i] < vertexCount);
+    remaining[indices[i]]++;
+  }
+  for (uint32_t v = 0; v < vertexCount; v++)
+    adjOffs[v + 1] = adjOffs[v] + remaining[v];
+  std::vector<uint32_t> adj(ntris * 3), fill(adjOffs.begin(), adjOffs.end() - 1);
+  for (size_t t = 0; t < ntris; t++) {
+    for (int k = 0; k < 3; k++)
+      adj[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+  }
+
+  std::vector<int>   cachePos(vertexCount, -1);
+  std::vector<float> vscore(vertexCount), tscore(ntris, 0.0f);
+  std::vector<bool>  added(ntris, false);
+  for (uint32_t v = 0; v < vertexCount; v++)
+    vscore[v] = vertexScore(-1, remaining[v]);
+  size_t best = 0;
+  for (size_t t = 0; t < ntris; t++) {
+    tscore[t] = vscore[indices[t*3]] + vscore[indices[t*3 + 1]] + vscore[indices[t*3 + 2]];
+    if (tscore[t] > tscore[best])
+      best = t;
+  }
+
+  std::vector<uint32_t> out(ntris * 3), cache, nextCache;
+  cache.reserve(MESH_CACHE_SIZE + 3);
+  nextCache.reserve(MESH_CACHE_SIZE + 3);
+  size_t cursor = 0; // next triangle in input order to consider after a dead end
+  for (size_t n = 0; n < ntris; n++) {
+    if (best == (size_t)-1) {
+      while (added[cursor])
+        cursor++;
+      best = cursor;
+    }
+    const uint32_t* tri = &indices[best * 3];
+    memcpy(&out[n * 3], tri, 3 * sizeof(uint32_t));
+    added[best] = true;
+
+    // remove the triangle from its vertices' lists
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = tri[k];
+      uint32_t* list = &adj[adjOffs[v]];
+      for (uint32_t i = 0; i < remaining[v]; i++) {
+        if (list[i] == best) {
+          list[i] = list[remaining[v] - 1];
+          break;
+        }
+      }
+      remaining[v]--;
+    }
+
+    // move the triangle's vertices to the front of the cache
+    nextCache.assign(tri, tri + 3);
+    for (uint32_t v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2])
+        nextCache.push_back(v);
+    }
+    for (size_t i = MESH_CACHE_SIZE; i < nextCache.size(); i++) {
+      cachePos[nextCache[i]] = -1;
+      vscore[nextCache[i]] = vertexScore(-1, remaining[nextCache[i]]);
+    }
+    nextCache.resize(std::min(nextCache.size(), (size_t)MESH_CACHE_SIZE));
+    cache.swap(nextCache);
+    for (size_t i = 0; i < cache.size(); i++) {
+      cachePos[cache[i]] = (int)i;
+      vscore[cache[i]] = vertexScore((int)i, remaining[cache[i]]);
+    }
+
+    // the next triangle is the best one using a vertex in the cache
+    best = (size_t)-1;
+    float bestScore = -1.0f;
+    for (uint32_t v : cache) {
+      const uint32_t* list = &adj[adjOffs[v]];
+      for (uint32_t i = 0; i < remaining[v]; i++) {
+        uint32_t t = list[i];
+        float s = vscore[indices[t*3]] + vscore[indices[t*3 + 1]] + vscore[indices[t*3 + 2]];
+        if (s > bestScore) {
+          bestScore = s;
+          best = t;
+        }
+      }
+    }
+  }
+  memcpy(indices, out.data(), ntris * 3 * sizeof(uint32_t));
+}
+
+uint32_t meshOptimizeVertexFetch(
+  void* vertices, uint32_t vertexCount, uint32_t stride, uint32_t* indices, size_t indexCount)
+{
+  std::vector<uint32_t> remap(vertexCount, ~0u);
+  std::vector<uint8_t> tmp((size_t)vertexCount * stride);
+  const uint8_t* src = (const uint8_t*)vertices;
+  uint32_t next = 0;
+  for (size_t i = 0; i < indexCount; i++) {
+    uint32_t v = indices[i];
+    assert(v < vertexCount);
+    if (remap[v] == ~0u) {
+      remap[v] = next;
+      memcpy(&tmp[(size_t)next * stride], &src[(size_t)v * stride], stride);
+      next++;
+    }
+    indices[i] = remap[v];
+  }
+  memcpy(vertices, tmp.data(), (size_t)next * stride);
+  return next;
+}
+
+
+void meshEncodeVertices(
+  const void* vertices, uint32_t count, uint32_t stride, std::vector<uint8_t>& out)
+{
+  assert(stride % 2 == 0 && stride <= MESH_MAX_STRIDE);
+  uint32_t nchan = stride / 2;
+  uint16_t prev[MESH_MAX_STRIDE / 2] = {};
+  uint16_t z[MESH_BLOCK];
+  const uint8_t* src = (const uint8_t*)vertices;
+  for (uint32_t base = 0; base < count; base += MESH_BLOCK) {
+    uint32_t n = std::min((uint32_t)MESH_BLOCK, count - base);
+    size_t hdr = out.size();
+    out.resize(hdr + (nchan + 3) / 4, 0);
+    for (uint32_t c = 0; c < nchan; c++) {
+      uint16_t maxz = 0;
+      for (uint32_t i = 0; i < MESH_BLOCK; i++) {
+        z[i] = 0;
+        if (i < n) {
+          uint16_t v;
+          memcpy(&v, &src[(size_t)(base + i) * stride + c * 2], 2);
+          z[i] = zigzag16((uint16_t)(v - prev[c]));
+          prev[c] = v;
+        }
+        maxz = std::max(maxz, z[i]);
+      }
+      uint8_t w = maxz == 0 ? 0 : maxz < 256 ? 1 : 2;
+      out[hdr + c / 4] |= w << ((c % 4) * 2);
+      for (uint32_t i = 0; w > 0 && i < MESH_BLOCK; i++) {
+        out.push_back((uint8_t)z[i]);
+        if (w == 2)
+          out.push_back((uint8_t)(z[i] >> 8));
+      }
+    }
+  }
+}
+
+void meshEncodeIndices(const uint32_t* indices, size_t count, std::vector<uint8_t>& out) {
+  uint32_t next = 0;
+  uint32_t z[MESH_BLOCK];
+  size_t hdr = 0;
+  for (size_t base = 0, block = 0; base < count; base += MESH_BLOCK, block++) {
+    size_t n = std::min((size_t)MESH_BLOCK, count - base);
+    if (block % 4 == 0) {
+      hdr = out.size();
+      out.push_back(0);
+    }
+    uint32_t maxz = 0;
+    for (size_t i = 0; i < MESH_BLOCK; i++) {
+      z[i] = 0;
+      if (i < n) {
+        z[i] = zigzag32(next - indices[base + i]);
+        if (z[i] == 0)
+          next++;
+      }
+      maxz = std::max(maxz, z[i]);
+    }
+    uint8_t mask = 0;
+    for (size_t i = 0; i < MESH_BLOCK; i++)
+      mask |= (z[i] > 0xff) << i;
+    // width 1 (with high bytes) unless that is larger than width 2
+    uint8_t w = maxz == 0 ? 0 : maxz > 0xffff ? 3 : __builtin_popcount(mask) < 7 ? 1 : 2;
+    out[hdr] |= w << ((block % 4) * 2);
+    if (w == 1) {
+      out.push_back(mask);
+      for (size_t i = 0; i < MESH_BLOCK; i++)
+        out.push_back((uint8_t)z[i]);
+      for (size_t i = 0; i < MESH_BLOCK; i++) {
+        if (mask & (1 << i))
+          out.push_back((uint8_t)(z[i] >> 8));
+      }
+    } else {
+      size_t bytes = w == 3 ? 4 : w;
+      for (size_t i = 0; i < MESH_BLOCK; i++) {
+        for (size_t b = 0; b < bytes; b++)
+          out.push_back((uint8_t)(z[i] >> (b * 8)));
+      }
+    }
+  }
+}
+
+// indexBlockSize returns the size of a block of width w (p points to its first byte)
+static inline size_t indexBlockSize(const uint8_t* p, const uint8_t* end, uint32_t w) {
+  switch (w) {
+    case 0:  return 0;
+    case 1:  return p < end ? 1 + MESH_BLOCK + __builtin_popcount(*p) : 1;
+    case 2:  return 2 * MESH_BLOCK;
+    default: return 4 * MESH_BLOCK;
+  }
+}
+
+
+// decodeVertexBlockScalar decodes one block of vertices into dst (MESH_BLOCK * stride
+// bytes) and returns the position after it in src, or null if src is too short
+static const uint8_t* decodeVertexBlockScalar(
+  const uint8_t* p, const uint8_t* end, uint32_t nchan, uint16_t* prev, uint8_t* dst)
+{
+  const uint8_t* hdr = p;
+  p += (nchan + 3) / 4;
+  if (p > end)
+    return nullptr;
+  uint32_t stride = nchan * 2;
+  for (uint32_t c = 0; c < nchan; c++) {
+    uint32_t w = (hdr[c / 4] >> ((c % 4) * 2)) & 3;
+    if (w == 3 || p + w * MESH_BLOCK > end)
+      return nullptr;
+    for (uint32_t i = 0; i < MESH_BLOCK; i++) {
+      uint16_t z = 0;
+      if (w == 1) {
+        z = p[i];
+      } else if (w == 2) {
+        z = (uint16_t)(p[i * 2] | (p[i * 2 + 1] << 8));
+      }
+      prev[c] = (uint16_t)(prev[c] + unzigzag16(z));
+      memcpy(&dst[i * stride + c * 2], &prev[c], 2);
+    }
+    p += w * MESH_BLOCK;
+  }
+  return p;
+}
+
+#if defined(__SSE2__)
+// transpose8x16 transposes 8 rows of 8 uint16s
+static inline void transpose8x16(__m128i r[8]) {
+  __m128i t0 = _mm_unpacklo_epi16(r[0], r[1]), t1 = _mm_unpackhi_epi16(r[0], r[1]);
+  __m128i t2 = _mm_unpacklo_epi16(r[2], r[3]), t3 = _mm_unpackhi_epi16(r[2], r[3]);
+  __m128i t4 = _mm_unpacklo_epi16(r[4], r[5]), t5 = _mm_unpackhi_epi16(r[4], r[5]);
+  __m128i t6 = _mm_unpacklo_epi16(r[6], r[7]), t7 = _mm_unpackhi_epi16(r[6], r[7]);
+  __m128i u0 = _mm_unpacklo_epi32(t0, t2), u1 = _mm_unpackhi_epi32(t0, t2);
+  __m128i u2 = _mm_unpacklo_epi32(t1, t3), u3 = _mm_unpackhi_epi32(t1, t3);
+  __m128i u4 = _mm_unpacklo_epi32(t4, t6), u5 = _mm_unpackhi_epi32(t4, t6);
+  __m128i u6 = _mm_unpacklo_epi32(t5, t7), u7 = _mm_unpackhi_epi32(t5, t7);
+  r[0] = _mm_unpacklo_epi64(u0, u4);
+  r[1] = _mm_unpackhi_epi64(u0, u4);
+  r[2] = _mm_unpacklo_epi64(u1, u5);
+  r[3] = _mm_unpackhi_epi64(u1, u5);
+  r[4] = _mm_unpacklo_epi64(u2, u6);
+  r[5] = _mm_unpackhi_epi64(u2, u6);
+  r[6] = _mm_unpacklo_epi64(u3, u7);
+  r[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+// decodeVertexBlockSSE2 is decodeVertexBlockScalar with each channel's 8 values decoded
+// and prefix-summed in one register, then transposed into vertices 8 channels at a time
+static const uint8_t* decodeVertexBlockSSE2(
+  const uint8_t* p, const uint8_t* end, uint32_t nchan, uint16_t* prev, uint8_t* dst)
+{
+  const uint8_t* hdr = p;
+  p += (nchan + 3) / 4;
+  if (p > end)
+    return nullptr;
+  uint32_t stride = nchan * 2;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1);
+  __m128i col[8];
+  for (uint32_t c0 = 0; c0 < nchan; c0 += 8) {
+    uint32_t ncol = std::min(8u, nchan - c0);
+    for (uint32_t j = 0; j < ncol; j++) {
+      uint32_t c = c0 + j;
+      uint32_t w = (hdr[c / 4] >> ((c % 4) * 2)) & 3;
+      if (w == 3 || p + w * MESH_BLOCK > end)
+        return nullptr;
+      if (w == 0) {
+        col[j] = _mm_set1_epi16((short)prev[c]);
+        continue;
+      }
+      __m128i z = w == 1 ?
+        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), zero) :
+        _mm_loadu_si128((const __m128i*)p);
+      p += w * MESH_BLOCK;
+      __m128i d = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(zero, _mm_and_si128(z, one)));
+      d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+      d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+      d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+      d = _mm_add_epi16(d, _mm_set1_epi16((short)prev[c]));
+      prev[c] = (uint16_t)_mm_extract_epi16(d, 7);
+      col[j] = d;
+    }
+    if (ncol == 8) {
+      transpose8x16(col);
+      for (uint32_t i = 0; i < MESH_BLOCK; i++)
+        _mm_storeu_si128((__m128i*)&dst[i * stride + c0 * 2], col[i]);
+    } else {
+      uint16_t v[8];
+      for (uint32_t j = 0; j < ncol; j++) {
+        _mm_storeu_si128((__m128i*)v, col[j]);
+        for (uint32_t i = 0; i < MESH_BLOCK; i++)
+          memcpy(&dst[i * stride + (c0 + j) * 2], &v[i], 2);
+      }
+    }
+  }
+  return p;
+}
+#endif
+
+bool meshDecodeVertices(
+  const uint8_t* src, size_t len, uint32_t count, uint32_t stride, void* dst, bool simd)
+{
+  if (stride == 0 || stride % 2 != 0 || stride > MESH_MAX_STRIDE)
+    return false;
+  uint32_t nchan = stride / 2;
+  uint16_t prev[MESH_MAX_STRIDE / 2] = {};
+  uint8_t tmp[MESH_BLOCK * MESH_MAX_STRIDE];
+  const uint8_t* p = src;
+  const uint8_t* end = src + len;
+  uint8_t* out = (uint8_t*)dst;
+  auto decodeBlock = decodeVertexBlockScalar;
+#if defined(__SSE2__)
+  if (simd)
+    decodeBlock = decodeVertexBlockSSE2;
+#endif
+  for (uint32_t base = 0; base < count; base += MESH_BLOCK) {
+    uint32_t n = std::min((uint32_t)MESH_BLOCK, count - base);
+    uint8_t* blockDst = n == MESH_BLOCK ? &out[(size_t)base * stride] : tmp;
+    p = decodeBlock(p, end, nchan, prev, blockDst);
+    if (!p)
+      return false;
+    if (n < MESH_BLOCK)
+      memcpy(&out[(size_t)base * stride], tmp, (size_t)n * stride);
+  }
+  return p == end;
+}
+
+// decodeIndexBlockScalar decodes one block of indices into dst (MESH_BLOCK uint32s)
+static void decodeIndexBlockScalar(const uint8_t* p, uint32_t w, uint32_t* next, uint32_t* dst) {
+  const uint8_t* high = p + 1 + MESH_BLOCK;
+  for (uint32_t i = 0; i < MESH_BLOCK; i++) {
+    uint32_t z = 0;
+    switch (w) {
+      case 1:
+        z = p[1 + i];
+        if (p[0] & (1 << i))
+          z |= (uint32_t)*high++ << 8;
+        break;
+      case 2: z = (uint32_t)p[i*2] | (uint32_t)p[i*2 + 1] << 8; break;
+      case 3: memcpy(&z, &p[i*4], 4); break;
+    }
+    if (z == 0) {
+      dst[i] = (*next)++;
+    } else {
+      dst[i] = *next - unzigzag32(z);
+    }
+  }
+}
+
+#if defined(__SSE2__)
+// decodeIndexBlockSSE2 decodes one block of indices into two registers of 4 indices.
+// Each lane's next is the block's next plus the number of zero values in lanes before
+// it (an exclusive prefix sum.)
+static inline void decodeIndexBlockSSE2(
+  const uint8_t* p, uint32_t w, uint32_t* next, __m128i* d0, __m128i* d1)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i z0 = zero, z1 = zero;
+  if (w == 1 || w == 2) {
+    __m128i x;
+    if (w == 1) {
+      x = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + 1)), zero);
+      if (p[0] != 0) {
+        // patch in the high bytes (a few per block at most)
+        uint16_t v[MESH_BLOCK];
+        _mm_storeu_si128((__m128i*)v, x);
+        const uint8_t* high = p + 1 + MESH_BLOCK;
+        for (uint32_t m = p[0]; m != 0; m &= m - 1)
+          v[__builtin_ctz(m)] |= (uint16_t)(*high++ << 8);
+        x = _mm_loadu_si128((const __m128i*)v);
+      }
+    } else {
+      x = _mm_loadu_si128((const __m128i*)p);
+    }
+    z0 = _mm_unpacklo_epi16(x, zero);
+    z1 = _mm_unpackhi_epi16(x, zero);
+  } else if (w == 3) {
+    z0 = _mm_loadu_si128((const __m128i*)p);
+    z1 = _mm_loadu_si128((const __m128i*)(p + 16));
+  }
+  __m128i a = _mm_xor_si128(_mm_srli_epi32(z0, 1), _mm_sub_epi32(zero, _mm_and_si128(z0, one)));
+  __m128i b = _mm_xor_si128(_mm_srli_epi32(z1, 1), _mm_sub_epi32(zero, _mm_and_si128(z1, one)));
+  __m128i na = _mm_sub_epi32(zero, _mm_cmpeq_epi32(z0, zero)); // 1 where new
+  __m128i nb = _mm_sub_epi32(zero, _mm_cmpeq_epi32(z1, zero));
+  __m128i sa = _mm_add_epi32(na, _mm_slli_si128(na, 4)); // inclusive prefix sums
+  sa = _mm_add_epi32(sa, _mm_slli_si128(sa, 8));
+  __m128i sb = _mm_add_epi32(nb, _mm_slli_si128(nb, 4));
+  sb = _mm_add_epi32(sb, _mm_slli_si128(sb, 8));
+  sb = _mm_add_epi32(sb, _mm_shuffle_epi32(sa, 0xFF));
+  __m128i base = _mm_set1_epi32((int)*next);
+  *d0 = _mm_sub_epi32(_mm_add_epi32(base, _mm_sub_epi32(sa, na)), a);
+  *d1 = _mm_sub_epi32(_mm_add_epi32(base, _mm_sub_epi32(sb, nb)), b);
+  *next += (uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(sb, 0xFF));
+}
+#endif
+
+bool meshDecodeIndices(
+  const uint8_t* src, size_t len, uint32_t count, uint32_t indexSize, void* dst, bool simd)
+{
+  if (indexSize != 2 && indexSize != 4)
+    return false;
+  const uint8_t* p = src;
+  const uint8_t* end = src + len;
+  uint8_t* out = (uint8_t*)dst;
+  uint32_t next = 0;
+  uint8_t hdr = 0;
+  uint32_t tmp[MESH_BLOCK];
+  for (uint32_t base = 0, block = 0; base < count; base += MESH_BLOCK, block++) {
+    if (block % 4 == 0) {
+      if (p >= end)
+        return false;
+      hdr = *p++;
+    }
+    uint32_t w = (hdr >> ((block % 4) * 2)) & 3;
+    size_t bytes = indexBlockSize(p, end, w);
+    if (p + bytes > end)
+      return false;
+    uint32_t n = std::min((uint32_t)MESH_BLOCK, count - base);
+    uint8_t* blockDst = &out[(size_t)base * indexSize];
+#if defined(__SSE2__)
+    if (simd) {
+      __m128i d0, d1;
+      decodeIndexBlockSSE2(p, w, &next, &d0, &d1);
+      p += bytes;
+      if (indexSize == 2) {
+        // sign-extend the low 16 bits so that packs keeps them as they are
+        __m128i v = _mm_packs_epi32(
+          _mm_srai_epi32(_mm_slli_epi32(d0, 16), 16), _mm_srai_epi32(_mm_slli_epi32(d1, 16), 16));
+        if (n == MESH_BLOCK) {
+          _mm_storeu_si128((__m128i*)blockDst, v);
+        } else {
+          _mm_storeu_si128((__m128i*)tmp, v);
+          memcpy(blockDst, tmp, n * 2);
+        }
+      } else if (n == MESH_BLOCK) {
+        _mm_storeu_si128((__m128i*)blockDst, d0);
+        _mm_storeu_si128((__m128i*)(blockDst + 16), d1);
+      } else {
+        _mm_storeu_si128((__m128i*)tmp, d0);
+        _mm_storeu_si128((__m128i*)(tmp + 4), d1);
+        memcpy(blockDst, tmp, n * 4);
+      }
+      continue;
+    }
+#endif
+    decodeIndexBlockScalar(p, w, &next, tmp);
+    p += bytes;
+    if (indexSize == 4) {
+      memcpy(blockDst, tmp, n * 4);
+    } else {
+      for (uint32_t i = 0; i < n; i++) {
+        uint16_t v = (uint16_t)tmp[i];
+        memcpy(&blockDst[i * 2], &v, 2);
+      }
+    }
+  }
+  return p == end;
+}
+
+
+static wgpu::Buffer createMeshBuffer(
+  const wgpu::Device& device, wgpu::BufferUsage usage, size_t size, uint32_t token)
+{
+  char label[64];
+  snprintf(label, sizeof(label), MESH_BUFFER_LABEL_PREFIX "%u", token);
+  wgpu::BufferDescriptor desc;
+  desc.label = label;
+  desc.usage = usage | wgpu::BufferUsage::CopyDst;
+  desc.size = (size + 3) & ~(size_t)3; // mapped at creation by the server
+  return device.CreateBuffer(&desc);
+}
+
+bool uploadCompressedMesh(
+  DawnRemoteProtocol& proto, const wgpu::Device& device,
+  const void* vertices, uint32_t vertexCount, uint32_t stride,
+  const uint32_t* indices, uint32_t indexCount, CompressedMesh* out)
+{
+  static uint32_t nextToken = 1;
+  if (stride == 0 || stride % 2 != 0 || stride > MESH_MAX_STRIDE || indexCount == 0)
+    return false;
+
+  std::vector<uint8_t> verts((const uint8_t*)vertices,
+                             (const uint8_t*)vertices + (size_t)vertexCount * stride);
+  std::vector<uint32_t> idx(indices, indices + indexCount);
+  meshOptimizeVertexCache(idx.data(), idx.size(), vertexCount);
+  uint32_t nverts = meshOptimizeVertexFetch(verts.data(), vertexCount, stride, idx.data(), idx.size());
+  uint32_t indexSize = nverts <= 0x10000 ? 2 : 4;
+
+  std::vector<uint8_t> vdata, idata;
+  meshEncodeVertices(verts.data(), nverts, stride, vdata);
+  meshEncodeIndices(idx.data(), idx.size(), idata);
+
+  DawnRemoteProtocol::CompressedMeshBufferInfo vinfo = {
+    nextToken++, MESH_BUFFER_VERTICES, stride, nverts };
+  DawnRemoteProtocol::CompressedMeshBufferInfo iinfo = {
+    nextToken++, MESH_BUFFER_INDICES, indexSize, indexCount };
+  out->vertexBuffer = createMeshBuffer(
+    device, wgpu::BufferUsage::Vertex, (size_t)nverts * stride, vinfo.token);
+  out->indexBuffer = createMeshBuffer(
+    device, wgpu::BufferUsage::Index, (size_t)indexCount * indexSize, iinfo.token);
+  out->indexFormat = indexSize == 2 ? wgpu::IndexFormat::Uint16 : wgpu::IndexFormat::Uint32;
+  out->vertexCount = nverts;
+  out->indexCount = indexCount;
+  out->rawBytes = (size_t)vertexCount * stride + (size_t)indexCount * 4;
+  out->encodedBytes = vdata.size() + idata.size();
+  return proto.sendCompressedMeshBuffer(vinfo, vdata.data(), vdata.size()) &&
+         proto.sendCompressedMeshBuffer(iinfo, idata.data(), idata.size());
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "protocol.hh"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Compressed mesh uploads. Instead of writing vertex and index data to buffers as is,
+// clients can use uploadCompressedMesh, which
+//
+//   1. reorders triangles for the GPU's post-transform vertex cache and vertices in
+//      the order triangles first use them (better cache hit rates, and neighbouring
+//      vertices and indices become similar),
+//   2. delta codes vertices (per 16-bit channel, from the previous vertex) and indices
+//      (from the previous index), zigzag codes the deltas and packs each block of
+//      8 values in 0, 1 or 2 bytes per value (0, 1, 2 or 4 for indices),
+//   3. sends the result with DawnRemoteProtocol::sendCompressedMeshBuffer.
+//
+// The server decodes the data (SSE2 where available) straight into the mapped memory
+// of the destination buffer, which it created mapped for this purpose.
+// Quantizing vertices first (meshQuantizeVertices) halves their size again and makes
+// the deltas smaller.
+//
+// Example:
+//   CompressedMesh mesh;
+//   uploadCompressedMesh(proto, device, verts, nverts, sizeof(Vertex), indices, nindices,
+//                        &mesh);
+//   pass.SetVertexBuffer(0, mesh.vertexBuffer);
+//   pass.SetIndexBuffer(mesh.indexBuffer, mesh.indexFormat);
+//   pass.DrawIndexed(mesh.indexCount);
+//
+
+enum MeshBufferKind {
+  MESH_BUFFER_VERTICES = 0,
+  MESH_BUFFER_INDICES  = 1,
+};
+
+// Buffers which the server should decode compressed data into are created with a label
+// of MESH_BUFFER_LABEL_PREFIX followed by a token (decimal) which identifies them in
+// sendCompressedMeshBuffer.
+#define MESH_BUFFER_LABEL_PREFIX "dawn-remote:mesh:"
+
+// MeshQuantizedVertex is a 16 byte vertex made by meshQuantizeVertices from float
+// positions, normals and texture coordinates (32 bytes). Vertex formats:
+//   position  Unorm16x4  (xyz within the mesh bounds; see MeshQuantization)
+//   normal    Snorm8x4
+//   uv        Float16x2
+struct MeshQuantizedVertex {
+  uint16_t position[4];
+  int8_t   normal[4];
+  uint16_t uv[2];
+};
+
+// MeshQuantization maps quantized positions back to model space:
+// position = offset + unorm * scale
+struct MeshQuantization {
+  float offset[3];
+  float scale[3];
+};
+
+// meshQuantizeVertices quantizes count vertices. normals and uvs may be null.
+void meshQuantizeVertices(
+  const float* positions, const float* normals, const float* uvs, uint32_t count,
+  MeshQuantizedVertex* out, MeshQuantization* q);
+
+// meshOptimizeVertexCache reorders the triangles of an indexed triangle list for a
+// post-transform vertex cache (Forsyth's algorithm)
+void meshOptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+
+// meshOptimizeVertexFetch reorders vertices (stride bytes each) in the order indices
+// first use them and remaps indices. Unused vertices are dropped; returns the new
+// vertex count.
+uint32_t meshOptimizeVertexFetch(
+  void* vertices, uint32_t vertexCount, uint32_t stride, uint32_t* indices, size_t indexCount);
+
+// meshEncodeVertices & meshEncodeIndices append encoded data to out.
+// stride must be a multiple of 2 and at most MESH_MAX_STRIDE.
+#define MESH_MAX_STRIDE 256
+void meshEncodeVertices(
+  const void* vertices, uint32_t count, uint32_t stride, std::vector<uint8_t>& out);
+void meshEncodeIndices(const uint32_t* indices, size_t count, std::vector<uint8_t>& out);
+
+// meshDecodeVertices & meshDecodeIndices decode len bytes of src into dst, count
+// vertices of stride bytes or count indices of indexSize (2 or 4) bytes. Return false if
+// src is malformed. simd=false forces the portable path (for comparison in benchmarks.)
+bool meshDecodeVertices(
+  const uint8_t* src, size_t len, uint32_t count, uint32_t stride, void* dst,
+  bool simd = true);
+bool meshDecodeIndices(
+  const uint8_t* src, size_t len, uint32_t count, uint32_t indexSize, void* dst,
+  bool simd = true);
+
+// CompressedMesh describes a mesh uploaded with uploadCompressedMesh
+struct CompressedMesh {
+  wgpu::Buffer      vertexBuffer;
+  wgpu::Buffer      indexBuffer;
+  wgpu::IndexFormat indexFormat = wgpu::IndexFormat::Uint32;
+  uint32_t          vertexCount = 0; // after dropping unused vertices
+  uint32_t          indexCount = 0;
+  size_t            rawBytes = 0;     // size of the vertex and index data as given
+  size_t            encodedBytes = 0; // size of the data sent
+};
+
+// uploadCompressedMesh (client) creates a vertex buffer (usage Vertex | CopyDst) and
+// an index buffer (Index | CopyDst, Uint16 if possible) for an indexed triangle list
+// and sends their contents compressed. Triangles and vertices are reordered (see
+// above); the buffers can be used by commands made right after the call.
+// Returns false if stride is not supported or the data could not be sent.
+bool uploadCompressedMesh(
+  DawnRemoteProtocol& proto, const wgpu::Device& device,
+  const void* vertices, uint32_t vertexCount, uint32_t stride,
+  const uint32_t* indices, uint32_t indexCount, CompressedMesh* out);
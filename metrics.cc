@@ -0,0 +1,137 @@
+#include "metrics.hh"
+#include <stdarg.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h> // getrusage, setrlimit
+
+#if defined(__APPLE__)
+  #include <mach/mach.h>
+  #include <malloc/malloc.h>
+#elif defined(__linux__)
+  #include <malloc.h>
+#endif
+
+static std::vector<std::pair<const void*,MetricsSource>> sources;
+
+
+void MetricsWriter::scope(const char* format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(_scope, sizeof(_scope), format, ap);
+  va_end(ap);
+}
+
+void MetricsWriter::counter(const char* name, uint64_t value) {
+  fprintf(_f, "%s%s%s %llu\n", _scope, _scope[0] ? "." : "", name, (unsigned long long)value);
+}
+
+void MetricsWriter::gauge(const char* name, double value) {
+  fprintf(_f, "%s%s%s %.6g\n", _scope, _scope[0] ? "." : "", name, value);
+}
+
+
+void metricsRegister(const void* key, MetricsSource fn) {
+  metricsUnregister(key);
+  sources.emplace_back(key, std::move(fn));
+}
+
+void metricsUnregister(const void* key) {
+  for (auto it = sources.begin(); it != sources.end(); ++it) {
+    if (it->first == key) {
+      sources.erase(it);
+      return;
+    }
+  }
+}
+
+bool metricsReport(const char* path) {
+  bool isStderr = strcmp(path, "-") == 0;
+  std::string tmppath = std::string(path) + ".tmp";
+  FILE* f = isStderr ? stderr : fopen(tmppath.c_str(), "w");
+  if (f == nullptr)
+    return false;
+  MetricsWriter w(f);
+  for (auto& s : sources) {
+    w._scope[0] = 0;
+    s.second(w);
+  }
+  if (isStderr) {
+    fflush(f);
+    return true;
+  }
+  if (fclose(f) != 0)
+    return false;
+  return rename(tmppath.c_str(), path) == 0;
+}
+
+
+int64_t processHeapInUse() {
+  #if defined(__APPLE__)
+    malloc_statistics_t st;
+    malloc_zone_statistics(nullptr, &st);
+    return (int64_t)st.size_in_use;
+  #elif defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return (int64_t)(mi.uordblks + mi.hblkhd);
+  #elif defined(__GLIBC__)
+    struct mallinfo mi = mallinfo(); // 32-bit fields; wraps above 4GB
+    return (int64_t)(unsigned)mi.uordblks + (int64_t)(unsigned)mi.hblkhd;
+  #else
+    return 0;
+  #endif
+}
+
+bool processMemory(ProcessMemory* m) {
+  m->heapInUse = (uint64_t)processHeapInUse();
+  #if defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count)
+        != KERN_SUCCESS)
+    {
+      return false;
+    }
+    m->rss = info.resident_size;
+    return true;
+  #elif defined(__linux__)
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == nullptr)
+      return false;
+    unsigned long long size = 0, resident = 0;
+    int n = fscanf(f, "%llu %llu", &size, &resident);
+    fclose(f);
+    if (n != 2)
+      return false;
+    m->rss = resident * (uint64_t)sysconf(_SC_PAGESIZE);
+    return true;
+  #else
+    return false;
+  #endif
+}
+
+double processCPUTime() {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0)
+    return 0;
+  return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+         (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+void processRaiseFDLimit(size_t n) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur >= n)
+    return;
+  rl.rlim_cur = ((rlim_t)n < rl.rlim_max) ? (rlim_t)n : rl.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+    perror("setrlimit");
+}
+
+uint64_t monotimeNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
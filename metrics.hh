@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+
+// MetricsWriter formats metrics as lines of text "<scope>.<name> <value>", e.g.
+//   conn.3.bytes_in 102400
+//   conn.3.perf.handle_commands.ipc 1.84
+struct MetricsWriter {
+  FILE* _f;
+  char  _scope[64] = {0};
+
+  MetricsWriter(FILE* f) : _f(f) {}
+
+  void scope(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  void counter(const char* name, uint64_t value);
+  void gauge(const char* name, double value);
+};
+
+typedef std::function<void(MetricsWriter&)> MetricsSource;
+
+// metricsRegister adds a source of metrics which is invoked on every report.
+// key identifies the source for metricsUnregister (usually the owner's this pointer.)
+void metricsRegister(const void* key, MetricsSource fn);
+void metricsUnregister(const void* key);
+
+// metricsReport writes all registered metrics to the file at path.
+// The file is written atomically (to path.tmp which is then renamed to path.)
+// If path is "-", metrics are written to stderr.
+bool metricsReport(const char* path);
+
+// ProcessMemory describes the memory usage of the calling process
+struct ProcessMemory {
+  uint64_t rss = 0;       // resident set size in bytes
+  uint64_t heapInUse = 0; // bytes allocated with malloc and not yet freed
+};
+
+bool processMemory(ProcessMemory* m);
+
+// processHeapInUse returns the number of bytes currently allocated with malloc.
+// Cheap enough to call around individual operations to attribute heap growth to them.
+int64_t processHeapInUse();
+
+// processCPUTime returns user and system CPU time consumed by the process, in seconds
+double processCPUTime();
+
+// processRaiseFDLimit makes sure we can have at least n open file descriptors
+void processRaiseFDLimit(size_t n);
+
+// monotimeNs returns a monotonic timestamp in nanoseconds
+uint64_t monotimeNs();
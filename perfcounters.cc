@@ -0,0 +1,188 @@
+#include "perfcounters.hh"
+#include "metrics.hh"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+#endif
+
+#define DLOG_PREFIX "[perf] "
+
+#ifdef DEBUG
+  #define dlog(format, ...) ({ \
+    fprintf(stderr, DLOG_PREFIX format " \e[2m(%s %d)\e[0m\n", \
+      ##__VA_ARGS__, __FUNCTION__, __LINE__); \
+    fflush(stderr); \
+  })
+#else
+  #define dlog(...) do{}while(0)
+#endif
+
+static const char* stageNames[PerfStage_COUNT] = {
+  "handle_commands",
+  "render_frame",
+  "pipe_copy",
+  "hud",
+};
+
+// Counters are opened as one group so that a single read(2) returns all of them
+// sampled at the same instant. Not all hosts support all events (e.g. VMs often lack
+// cache-miss events); index maps each PerfSample field to its slot in the group
+// or -1 if that counter could not be opened.
+static struct {
+  bool enabled = false;
+  bool tried = false;
+  int  leader = -1;
+  int  nfds = 0;
+  int  fds[4] = {-1, -1, -1, -1};
+  int  index[4] = {-1, -1, -1, -1}; // cycles, instructions, cacheMisses, branchMisses
+} pc;
+
+#if defined(__linux__)
+
+static int perfOpen(uint32_t type, uint64_t config, int groupfd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = groupfd == -1 ? 1 : 0; // leader starts disabled; enabled below
+  attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return (int)syscall(__NR_perf_event_open, &attr, 0 /*this thread*/, -1 /*any cpu*/,
+                      groupfd, 0);
+}
+
+bool perfCountersEnable() {
+  if (pc.tried)
+    return pc.enabled;
+  pc.tried = true;
+
+  struct { uint32_t type; uint64_t config; } events[4] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  };
+
+  for (int i = 0; i < 4; i++) {
+    int fd = perfOpen(events[i].type, events[i].config, pc.leader);
+    if (fd < 0) {
+      if (i == 0) {
+        fprintf(stderr, "perf counters unavailable: perf_event_open: %s\n", strerror(errno));
+        return false;
+      }
+      dlog("counter #%d unavailable: %s", i, strerror(errno));
+      continue;
+    }
+    if (pc.leader == -1)
+      pc.leader = fd;
+    pc.index[i] = pc.nfds;
+    pc.fds[pc.nfds++] = fd;
+  }
+
+  ioctl(pc.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(pc.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  pc.enabled = true;
+  dlog("enabled %d counters", pc.nfds);
+  return true;
+}
+
+bool perfCountersRead(PerfSample* s) {
+  uint64_t buf[1 + 4]; // { nr, values[nr] }
+  ssize_t n = ::read(pc.leader, buf, sizeof(buf));
+  if (n < (ssize_t)sizeof(uint64_t) || buf[0] != (uint64_t)pc.nfds)
+    return false;
+  const uint64_t* v = &buf[1];
+  s->cycles       = pc.index[0] < 0 ? 0 : v[pc.index[0]];
+  s->instructions = pc.index[1] < 0 ? 0 : v[pc.index[1]];
+  s->cacheMisses  = pc.index[2] < 0 ? 0 : v[pc.index[2]];
+  s->branchMisses = pc.index[3] < 0 ? 0 : v[pc.index[3]];
+  return true;
+}
+
+#else /* !__linux__ */
+
+bool perfCountersEnable() {
+  if (!pc.tried) {
+    pc.tried = true;
+    fprintf(stderr, "perf counters unavailable: not supported on this platform\n");
+  }
+  return false;
+}
+
+bool perfCountersRead(PerfSample* s) {
+  return false;
+}
+
+#endif /* __linux__ */
+
+bool perfCountersEnabled() {
+  return pc.enabled;
+}
+
+
+PerfScope::~PerfScope() {
+  PerfSample end;
+  if (_stats == nullptr || !perfCountersRead(&end))
+    return;
+  PerfSample d;
+  d.cycles       = end.cycles - _start.cycles;
+  d.instructions = end.instructions - _start.instructions;
+  d.cacheMisses  = end.cacheMisses - _start.cacheMisses;
+  d.branchMisses = end.branchMisses - _start.branchMisses;
+  PerfStageStats& st = _stats->stages[_stage];
+  st.total.add(d);
+  st.frame.add(d);
+  st.count++;
+}
+
+
+void PerfStats::endFrame() {
+  for (auto& st : stages) {
+    st.lastFrame = st.frame;
+    st.frame = PerfSample();
+  }
+  frames++;
+}
+
+void PerfStats::writeMetrics(MetricsWriter& w) const {
+  if (!pc.enabled)
+    return;
+  char name[64];
+  for (int i = 0; i < PerfStage_COUNT; i++) {
+    const PerfStageStats& st = stages[i];
+    if (st.count == 0)
+      continue;
+    #define M(field, fieldname) \
+      snprintf(name, sizeof(name), "perf.%s." fieldname, stageNames[i]); \
+      w.counter(name, st.total.field); \
+      snprintf(name, sizeof(name), "perf.%s.frame." fieldname, stageNames[i]); \
+      w.counter(name, st.lastFrame.field);
+    M(cycles, "cycles")
+    M(instructions, "instructions")
+    M(cacheMisses, "cache_misses")
+    M(branchMisses, "branch_misses")
+    #undef M
+    snprintf(name, sizeof(name), "perf.%s.count", stageNames[i]);
+    w.counter(name, st.count);
+    if (st.total.cycles > 0) {
+      snprintf(name, sizeof(name), "perf.%s.ipc", stageNames[i]);
+      w.gauge(name, (double)st.total.instructions / (double)st.total.cycles);
+    }
+    if (st.total.instructions > 0) {
+      // misses per thousand instructions
+      snprintf(name, sizeof(name), "perf.%s.cache_mpki", stageNames[i]);
+      w.gauge(name, (double)st.total.cacheMisses * 1000.0 / (double)st.total.instructions);
+      snprintf(name, sizeof(name), "perf.%s.branch_mpki", stageNames[i]);
+      w.gauge(name, (double)st.total.branchMisses * 1000.0 / (double)st.total.instructions);
+    }
+  }
+  w.counter("perf.frames", frames);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+
+struct MetricsWriter;
+
+// Optional hardware performance counters (Linux perf_event_open) for hot stages.
+//
+// Counting is off unless perfCountersEnable() is called and succeeds.
+// In environments where perf events are unavailable (containers, restrictive
+// perf_event_paranoid, non-Linux hosts) perfCountersEnable returns false and
+// PerfScope becomes a no-op, so call sites never need to check.
+
+enum PerfStage {
+  PerfStageHandleCommands, // WireServer/WireClient HandleCommands
+  PerfStageRenderFrame,    // client render_frame
+  PerfStagePipeCopy,       // copying between Pipe buffers and file descriptors
+  PerfStageHud,            // server HUD overlay
+  PerfStage_COUNT,
+};
+
+// PerfSample holds counter values. Counters the host does not support stay 0.
+struct PerfSample {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cacheMisses = 0;
+  uint64_t branchMisses = 0;
+
+  void add(const PerfSample& s) {
+    cycles += s.cycles;
+    instructions += s.instructions;
+    cacheMisses += s.cacheMisses;
+    branchMisses += s.branchMisses;
+  }
+};
+
+struct PerfStageStats {
+  PerfSample total;     // since start
+  PerfSample frame;     // accumulating for the current frame
+  PerfSample lastFrame; // the most recently completed frame
+  uint64_t   count = 0; // number of times the stage was entered
+};
+
+// PerfStats aggregates counters per stage, per frame, for one owner (e.g. a connection.)
+struct PerfStats {
+  PerfStageStats stages[PerfStage_COUNT];
+  uint64_t       frames = 0;
+
+  // endFrame closes the current frame of all stages
+  void endFrame();
+  void writeMetrics(MetricsWriter& w) const;
+};
+
+// perfCountersEnable opens the counters for the calling thread.
+// Returns false (and logs why, once) if perf events are not available.
+bool perfCountersEnable();
+bool perfCountersEnabled();
+bool perfCountersRead(PerfSample* s);
+
+// PerfScope measures the counters from construction until destruction and adds the
+// delta to stats. A null stats pointer or disabled counters makes this a no-op.
+struct PerfScope {
+  PerfStats* _stats;
+  PerfStage  _stage;
+  PerfSample _start;
+
+  PerfScope(PerfStats* stats, PerfStage stage) : _stats(stats), _stage(stage) {
+    if (_stats && !(perfCountersEnabled() && perfCountersRead(&_start)))
+      _stats = nullptr;
+  }
+  ~PerfScope();
+};
@@ -0,0 +1,86 @@
+#include "present.hh"
+#include "metrics.hh" // monotimeNs
+
+void PresentThread::start(RunLoop* rl, PresentFn present) {
+  assert(_rl == nullptr);
+  _rl = rl;
+  _present = present;
+  _stopping = false;
+  ev_async_init(&_async, onAsync);
+  _async.data = this;
+  ev_async_start(rl, &_async);
+  ev_unref(rl); // don't allow the watcher to keep the runloop alive alone
+  _thread = std::thread(&PresentThread::run, this);
+}
+
+std::vector<PresentThread::Job> PresentThread::stop() {
+  std::vector<Job> dropped;
+  if (_rl == nullptr)
+    return dropped;
+  {
+    std::lock_guard<std::mutex> lock(_mu);
+    _stopping = true;
+  }
+  _cond.notify_one();
+  _thread.join();
+  ev_ref(_rl);
+  ev_async_stop(_rl, &_async);
+  _done.clear();
+  dropped.assign(_queue.begin(), _queue.end());
+  _queue.clear();
+  _rl = nullptr;
+  return dropped;
+}
+
+bool PresentThread::submit(WGPUSwapChain swapchain, DeviceLock* devlock, void* owner) {
+  submitted++;
+  {
+    std::lock_guard<std::mutex> lock(_mu);
+    for (const Job& job : _queue) {
+      if (job.swapchain == swapchain) {
+        // the queued present will show this frame; it was drawn into the same texture
+        superseded++;
+        return false;
+      }
+    }
+    _queue.push_back({ swapchain, devlock, owner, monotimeNs(), 0 });
+  }
+  _cond.notify_one();
+  return true;
+}
+
+void PresentThread::run() {
+  std::unique_lock<std::mutex> lock(_mu);
+  while (true) {
+    _cond.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+    if (_stopping)
+      break;
+    Job job = _queue.front();
+    _queue.pop_front();
+    lock.unlock();
+    job.lock->lock();
+    uint64_t t0 = monotimeNs();
+    _present(job.swapchain);
+    job.presentNs = monotimeNs() - t0;
+    job.lock->unlock();
+    lock.lock();
+    _done.push_back(job);
+    ev_async_send(_rl, &_async);
+  }
+}
+
+void PresentThread::onAsync(RunLoop* rl, ev_async* w, int revents) {
+  PresentThread* pt = (PresentThread*)w->data;
+  std::vector<Job> done;
+  {
+    std::lock_guard<std::mutex> lock(pt->_mu);
+    done.swap(pt->_done);
+  }
+  uint64_t now = monotimeNs();
+  for (const Job& job : done) {
+    pt->presentNs += job.presentNs;
+    pt->latencyNs += now - job.submitNs;
+    if (pt->onPresented)
+      pt->onPresented(job);
+  }
+}
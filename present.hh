@@ -0,0 +1,66 @@
+#pragma once
+#include "protocol.hh"
+#include "devicelock.hh"
+#include <dawn/webgpu.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// PresentThread presents swapchains on a dedicated thread so that waiting for vsync
+// (or whatever else the driver does in present) never blocks the runloop.
+//
+// Dawn devices are not thread safe. A job is presented with the lock of its swapchain's
+// device held (see devicelock.hh), so the runloop only has to wait for the device if it
+// needs it while the present is being made.
+//
+// Latest wins: a present submitted while one of the same swapchain is still queued
+// takes its place rather than being queued as well. The jobs of presents which are
+// queued are handed back to onPresented once presented (or returned by stop), so the
+// caller can release what it holds for them.
+struct PresentThread {
+  // PresentFn presents the swapchain and releases the reference submit was given
+  typedef void(*PresentFn)(WGPUSwapChain swapchain);
+
+  struct Job {
+    WGPUSwapChain swapchain;
+    DeviceLock*   lock;      // of the swapchain's device
+    void*         owner;     // opaque value passed back to onPresented
+    uint64_t      submitNs;  // when submit was called
+    uint64_t      presentNs; // time spent in PresentFn
+  };
+
+  // onPresented is called on the runloop thread after a job has been presented
+  std::function<void(const Job&)> onPresented;
+
+  // stats (runloop thread)
+  uint64_t submitted = 0;
+  uint64_t superseded = 0; // presents which took the place of a queued one
+  uint64_t presentNs = 0; // total time spent in PresentFn
+  uint64_t latencyNs = 0; // total time from submit to onPresented
+
+  void start(RunLoop* rl, PresentFn present);
+  // stop waits for the job being presented, if any, and returns the jobs which were
+  // never presented. Their swapchains still hold the references submit was given.
+  std::vector<Job> stop();
+
+  // submit queues a present of swapchain, which holds a reference for PresentFn to
+  // release. Returns false if a queued present of swapchain was superseded instead, in
+  // which case the caller releases the reference and no job is added.
+  bool submit(WGPUSwapChain swapchain, DeviceLock* lock, void* owner);
+
+  // internal
+  RunLoop*                _rl = nullptr;
+  PresentFn               _present = nullptr;
+  std::thread             _thread;
+  std::mutex              _mu;
+  std::condition_variable _cond;
+  std::deque<Job>         _queue; // waiting to be presented
+  std::vector<Job>        _done;  // presented, waiting for onPresented
+  bool                    _stopping = false;
+  ev_async                _async;
+
+  void run();
+  static void onAsync(RunLoop* rl, ev_async* w, int revents);
+};
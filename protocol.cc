@@ -1,5 +1,6 @@
 #include "protocol.hh"
 #include "debug.hh"
+#include "metrics.hh" // monotimeNs
 
 #include <cstdio>
 #include <errno.h>
@@ -8,6 +9,29 @@
 #include <sys/un.h>
 #include <fcntl.h> // F_GETFL, O_NONBLOCK etc
 #include <ctype.h> // isprint
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h> // writev
+#include <arpa/inet.h> // htonl, ntohl
+#include <netinet/in.h>
+#if defined(__linux__)
+  #include <linux/errqueue.h> // sock_extended_err
+#endif
+
+// MSG_ZEROCOPY is Linux 4.14+
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+  #define HAVE_ZEROCOPY
+  #ifndef SO_ZEROCOPY
+    #define SO_ZEROCOPY 60
+  #endif
+  #ifndef SO_EE_ORIGIN_ZEROCOPY
+    #define SO_EE_ORIGIN_ZEROCOPY 5
+  #endif
+  #ifndef SO_EE_CODE_ZEROCOPY_COPIED
+    #define SO_EE_CODE_ZEROCOPY_COPIED 1
+  #endif
+#endif
 
 
 #define DLOG_PREFIX "[proto] "
@@ -50,13 +74,40 @@
 // message        = metaMsg | frameMsg | dawncmdMsg
 // frameInfoMsg   = "I" <TODO DATA>
 // frameSignalMsg = "F"
+// helloMsg       = "H" version
 // reservationMsg = "R" <TODO DATA>
+// textureMsg     = "T" id generation deviceId deviceGeneration width height size <data>
+// meshBufferMsg  = "B" token kind stride count size <data>
+// renderScaleMsg = "S" id generation deviceId deviceGeneration scale
+// probeMsg       = "P" seq
+// assetQueryMsg  = "Q" size <(hash size){n} uint64s in big-endian order>
+// assetReplyMsg  = "V" size <found{n} bytes>
+// assetMsg       = "K" kind token id generation deviceId deviceGeneration width height
+//                      format hashHi hashLo sizeHi sizeLo
+// probeAckMsg    = "A" seq
+// templateMsg    = "C" id nparams size <params> <commands>
+// instanceMsg    = "X" id size <values>
 // dawncmdMsg     = "D" size
 // size           = <uint32 in big-endian order>
+// version        = <uint32 in big-endian order>
+// id ... sizeLo  = <uint32 in big-endian order>
+// seq            = <uint32 in big-endian order>
+// params         = (offset length){nparams} <uint32s in big-endian order>
 //
 #define MSGT_FB_INFO       'I' /* Framebuffer info */
 #define MSGT_FRAME_SIGNAL  'F' /* Frame signal */
+#define MSGT_HELLO         'H' /* Client hello */
 #define MSGT_RESERVATION   'R' /* Device and Swapchain reservations */
+#define MSGT_TEXTURE       'T' /* Compressed texture */
+#define MSGT_MESH_BUFFER   'B' /* Compressed vertex or index buffer */
+#define MSGT_RENDER_SCALE  'S' /* Render target & scale */
+#define MSGT_PROBE         'P' /* Link probe */
+#define MSGT_PROBE_ACK     'A' /* Link probe acknowledgement */
+#define MSGT_ASSET_QUERY   'Q' /* Asset query */
+#define MSGT_ASSET_REPLY   'V' /* Asset query reply */
+#define MSGT_ASSET         'K' /* Buffer or texture from an asset */
+#define MSGT_TEMPLATE      'C' /* Command template */
+#define MSGT_INSTANCE      'X' /* Command template instance */
 #define MSGT_DAWNCMD       'D' /* Dawn command buffer */
 
 // FB_INFO_SIZE is the number of bytes occupied by encoded framebuffer info
@@ -64,6 +115,26 @@
 
 #define RESERVATION_SIZE (sizeof(dawn_wire::ReservedDevice) + sizeof(dawn_wire::ReservedSwapChain))
 
+#define HELLO_SIZE 4
+
+#define TEXTURE_MSG_HEADER_SIZE (7*4) /* excluding type byte */
+#define MESH_MSG_HEADER_SIZE    (5*4) /* excluding type byte */
+#define RENDER_SCALE_SIZE       (5*4) /* excluding type byte */
+#define PROBE_SIZE              4     /* excluding type byte */
+#define ASSET_QUERY_HEADER_SIZE 4     /* excluding type byte */
+#define ASSET_SIZE              (13*4) /* excluding type byte */
+#define TEMPLATE_MSG_HEADER_SIZE (3*4) /* excluding type byte */
+#define INSTANCE_MSG_HEADER_SIZE (2*4) /* excluding type byte */
+
+// Max number of free command buffers kept per connection
+#define CMDBUF_POOL_MAX 2
+
+// Max number of segments written with one writev call
+#define WRITEV_MAX 16
+
+// Max number of bytes read by one readInput with drainInput
+#define INPUT_DRAIN_MAX (4*1024*1024)
+
 
 // encodeDawnCmdHeader writes a MSGT_DAWNCMD header of DAWNCMD_MSG_HEADER_SIZE bytes to dst.
 static void encodeDawnCmdHeader(char* dst, uint32_t dawncmdlen) {
@@ -121,24 +192,231 @@ bool DawnRemoteProtocol::sendFramebufferInfo(const FramebufferInfo& info) {
   return true;
 }
 
+bool DawnRemoteProtocol::sendHello() {
+  char tmp[HELLO_SIZE+1];
+  tmp[0] = MSGT_HELLO;
+  *((uint32_t*)&tmp[1]) = htonl(PROTOCOL_VERSION);
+  return pushMsg(tmp, sizeof(tmp));
+}
+
 bool DawnRemoteProtocol::sendReservation(const dawn_wire::ReservedSwapChain& scr) {
   char tmp[RESERVATION_SIZE+1];
-  if (_wbuf.avail() < sizeof(tmp)) {
-    trace("not enough buffer space in _wbuf");
+  encodeReservation(tmp, scr);
+  return pushMsg(tmp, sizeof(tmp));
+}
+
+bool DawnRemoteProtocol::sendRenderScale(const dawn_wire::ReservedTexture& target, uint32_t scale) {
+  uint32_t v[5] = { target.id, target.generation, target.deviceId, target.deviceGeneration, scale };
+  char tmp[RENDER_SCALE_SIZE+1];
+  tmp[0] = MSGT_RENDER_SCALE;
+  for (int i = 0; i < 5; i++)
+    *((uint32_t*)&tmp[1 + i*4]) = htonl(v[i]);
+  return pushMsg(tmp, sizeof(tmp));
+}
+
+bool DawnRemoteProtocol::sendAssetQuery(const AssetRef* assets, size_t n) {
+  if (n > ASSET_QUERY_MAX)
     return false;
+  std::vector<uint32_t> data(n * 4);
+  for (size_t i = 0; i < n; i++) {
+    data[i*4 + 0] = htonl((uint32_t)(assets[i].hash >> 32));
+    data[i*4 + 1] = htonl((uint32_t)assets[i].hash);
+    data[i*4 + 2] = htonl((uint32_t)(assets[i].size >> 32));
+    data[i*4 + 3] = htonl((uint32_t)assets[i].size);
   }
-  encodeReservation(tmp, scr);
-  _wbuf.write(tmp, sizeof(tmp));
+  uint32_t hdr[1] = { (uint32_t)(n * 16) };
+  return pushBlobMsg(MSGT_ASSET_QUERY, hdr, 1, data.data(), n * 16);
+}
+
+bool DawnRemoteProtocol::sendAssetQueryReply(const uint8_t* found, size_t n) {
+  if (n > ASSET_QUERY_MAX)
+    return false;
+  uint32_t hdr[1] = { (uint32_t)n };
+  return pushBlobMsg(MSGT_ASSET_REPLY, hdr, 1, found, n);
+}
+
+bool DawnRemoteProtocol::sendAsset(const AssetInfo& info) {
+  uint32_t v[13] = {
+    info.kind, info.token, info.id, info.generation, info.deviceId, info.deviceGeneration,
+    info.width, info.height, info.format,
+    (uint32_t)(info.asset.hash >> 32), (uint32_t)info.asset.hash,
+    (uint32_t)(info.asset.size >> 32), (uint32_t)info.asset.size };
+  char tmp[ASSET_SIZE+1];
+  tmp[0] = MSGT_ASSET;
+  for (int i = 0; i < 13; i++)
+    *((uint32_t*)&tmp[1 + i*4]) = htonl(v[i]);
+  return pushMsg(tmp, sizeof(tmp));
+}
+
+bool DawnRemoteProtocol::sendCompressedTexture(
+  const dawn_wire::ReservedTexture& r, uint32_t width, uint32_t height,
+  const void* data, size_t len)
+{
+  if (len > TEXTURE_MSG_MAX)
+    return false;
+  uint32_t hdr[7] = {
+    r.id, r.generation, r.deviceId, r.deviceGeneration, width, height, (uint32_t)len };
+  return pushBlobMsg(MSGT_TEXTURE, hdr, 7, data, len);
+}
+
+bool DawnRemoteProtocol::sendCompressedMeshBuffer(
+  const CompressedMeshBufferInfo& info, const void* data, size_t len)
+{
+  if (len > MESH_MSG_MAX)
+    return false;
+  uint32_t hdr[5] = { info.token, info.kind, info.stride, info.count, (uint32_t)len };
+  return pushBlobMsg(MSGT_MESH_BUFFER, hdr, 5, data, len);
+}
+
+bool DawnRemoteProtocol::sendTemplate(
+  uint32_t id, const std::vector<char>& commands, const std::vector<uint32_t>& params)
+{
+  if (commands.size() > DAWNCMD_MAX || params.size() % 2 != 0 ||
+      params.size() / 2 > TEMPLATE_PARAMS_MAX)
+  {
+    return false;
+  }
+  std::vector<char> data(params.size() * 4 + commands.size());
+  for (size_t i = 0; i < params.size(); i++) {
+    uint32_t v = htonl(params[i]);
+    memcpy(&data[i*4], &v, 4);
+  }
+  memcpy(&data[params.size() * 4], commands.data(), commands.size());
+  uint32_t hdr[3] = { id, (uint32_t)params.size() / 2, (uint32_t)data.size() };
+  return pushBlobMsg(MSGT_TEMPLATE, hdr, 3, data.data(), data.size());
+}
+
+bool DawnRemoteProtocol::sendTemplateInstance(uint32_t id, const void* values, size_t len) {
+  if (len > DAWNCMD_MAX)
+    return false;
+  uint32_t hdr[2] = { id, (uint32_t)len };
+  return pushBlobMsg(MSGT_INSTANCE, hdr, 2, values, len);
+}
+
+void DawnRemoteProtocol::beginRecording(std::vector<char>* out) {
+  Flush(); // send what was serialized before
+  _recording = out;
+}
+
+void DawnRemoteProtocol::endRecording() {
+  Flush();
+  _recording = nullptr;
+}
+
+// addTemplate parses and stores a template message's data: the parameter table
+// followed by the commands. Returns false if it is malformed.
+bool DawnRemoteProtocol::addTemplate(uint32_t id, uint32_t nparams, const char* data, size_t len) {
+  if (nparams > TEMPLATE_PARAMS_MAX || len < (size_t)nparams * 8 ||
+      len - (size_t)nparams * 8 > DAWNCMD_MAX)
+  {
+    return false;
+  }
+  if (_templates.size() >= TEMPLATE_MAX && _templates.find(id) == _templates.end())
+    return false;
+  CommandTemplateData t;
+  t.params.resize((size_t)nparams * 2);
+  for (size_t i = 0; i < t.params.size(); i++) {
+    memcpy(&t.params[i], &data[i*4], 4);
+    t.params[i] = ntohl(t.params[i]);
+  }
+  t.commands.assign(data + (size_t)nparams * 8, data + len);
+
+  // commands must be whole, and parameters must not overlap their size fields
+  std::vector<size_t> starts;
+  for (size_t offs = 0; offs < t.commands.size(); ) {
+    uint64_t cmdsize;
+    if (t.commands.size() - offs < sizeof(cmdsize))
+      return false;
+    memcpy(&cmdsize, &t.commands[offs], sizeof(cmdsize));
+    if (cmdsize < sizeof(cmdsize) || cmdsize > t.commands.size() - offs)
+      return false;
+    starts.push_back(offs);
+    offs += cmdsize;
+  }
+  t.paramSize = 0;
+  for (size_t i = 0; i < t.params.size(); i += 2) {
+    uint32_t offs = t.params[i], size = t.params[i + 1];
+    if (size == 0 || offs > t.commands.size() || size > t.commands.size() - offs)
+      return false;
+    for (size_t start : starts) {
+      if (offs < start + sizeof(uint64_t) && start < (size_t)offs + size)
+        return false;
+    }
+    t.paramSize += size;
+  }
+  _templates[id] = std::move(t);
+  return true;
+}
+
+// handleTemplateInstance patches values into a copy of template id's commands and
+// passes them to onDawnBuffer. Returns false if there's no such template or values
+// does not match its parameters.
+bool DawnRemoteProtocol::handleTemplateInstance(uint32_t id, const char* values, size_t len) {
+  auto it = _templates.find(id);
+  if (it == _templates.end() || it->second.paramSize != len)
+    return false;
+  const CommandTemplateData& t = it->second;
+  _templateTmp.assign(t.commands.begin(), t.commands.end());
+  for (size_t i = 0; i < t.params.size(); i += 2) {
+    memcpy(&_templateTmp[t.params[i]], values, t.params[i + 1]);
+    values += t.params[i + 1];
+  }
+  templateInstances++;
+  templateBytes += _templateTmp.size();
+  onDawnBuffer(_templateTmp.data(), _templateTmp.size());
+  return true;
+}
+
+// pushBlobMsg queues a message of nhdr big-endian uint32s followed by len bytes of data
+// (the last header field being len) on _outq, like pushMsg
+bool DawnRemoteProtocol::pushBlobMsg(
+  char type, const uint32_t* hdr, int nhdr, const void* data, size_t len)
+{
+  Flush();
+  size_t hdrlen = 1 + (size_t)nhdr * 4;
+  char* msg = (char*)malloc(hdrlen + len);
+  if (msg == nullptr)
+    return false;
+  msg[0] = type;
+  for (int i = 0; i < nhdr; i++) {
+    uint32_t v = htonl(hdr[i]);
+    memcpy(&msg[1 + i*4], &v, 4);
+  }
+  memcpy(&msg[hdrlen], data, len);
+  pushSegment(msg, hdrlen + len, nullptr, [msg]() { free(msg); });
+  probeLink();
+  setNeedsWriteFlush();
+  return true;
+}
+
+// pushMsg queues a copy of msg on _outq, after any wire commands serialized so far.
+// _wbuf can't be used for messages which must be ordered with command data since it
+// is written after _outq.
+bool DawnRemoteProtocol::pushMsg(const char* msg, size_t len) {
+  Flush();
+  char* copy = (char*)malloc(len);
+  if (copy == nullptr)
+    return false;
+  memcpy(copy, msg, len);
+  pushSegment(copy, len, nullptr, [copy]() { free(copy); });
   setNeedsWriteFlush();
   return true;
 }
 
 
+// deviceReady returns true if a message which uses the device can be handled now,
+// otherwise it holds input (see acquireDevice)
+bool DawnRemoteProtocol::deviceReady() {
+  if (!acquireDevice || acquireDevice())
+    return true;
+  holdInput();
+  return false;
+}
 
 bool DawnRemoteProtocol::maybeReadIncomingDawnCmd() {
   assert(_dawnCmdRLen > 0);
   assert(_dawnCmdRLen <= DAWNCMD_MAX);
-  if (_rbuf.len() < _dawnCmdRLen)
+  if (_rbuf.len() < _dawnCmdRLen || !deviceReady())
     return false;
 
   // onDawnBuffer expects a contiguous memory segment; attempt to simply reference
@@ -148,128 +426,475 @@ bool DawnRemoteProtocol::maybeReadIncomingDawnCmd() {
   if (buf == nullptr) {
     // copy into temporary buffer
     trace("copy into temporary buffer _dawntmp");
+    PerfScope ps(perf, PerfStagePipeCopy);
     _rbuf.read(_dawntmp, _dawnCmdRLen);
     buf = _dawntmp;
   }
-  onDawnBuffer(buf, _dawnCmdRLen);
+  uint32_t len = _dawnCmdRLen;
   _dawnCmdRLen = 0;
+  onDawnBuffer(buf, len);
   return true;
 }
 
-// readMsg reads a protocol message from the read buffer (_rbuf)
-bool DawnRemoteProtocol::readMsg() {
-  char tmp[MAX(MAX(DAWNCMD_MSG_HEADER_SIZE, FB_INFO_SIZE), RESERVATION_SIZE) + 1];
-  while (_rbuf.len() > 0) {
-    switch (_rbuf.at(0)) {
-
-    case MSGT_FB_INFO: {
-      trace("MSGT_FB_INFO");
-      _rbuf.read(tmp, FB_INFO_SIZE + 1);
-      decodeFramebufferInfo(tmp, &_fbinfo);
-      onFramebufferInfo(_fbinfo);
-      break;
+// readBlobData moves the data of a texture, mesh buffer, template, instance or asset
+// query message
+// from _rbuf to _blobData and handles it once all of it has been read.
+// Returns false if more is needed, or if the message uses the device and that is not
+// ready (see acquireDevice.)
+bool DawnRemoteProtocol::readBlobData() {
+  size_t n = MIN((size_t)_blobRLen, _rbuf.len());
+  if (n > 0) {
+    size_t offs = _blobData.size();
+    _blobData.resize(offs + n);
+    _rbuf.read(&_blobData[offs], n);
+    _blobRLen -= (uint32_t)n;
+  }
+  if (_blobRLen > 0)
+    return false;
+  bool usesDevice =
+    _blobType == MSGT_TEXTURE || _blobType == MSGT_MESH_BUFFER || _blobType == MSGT_INSTANCE;
+  if (usesDevice && !deviceReady())
+    return false;
+  if (_blobType == MSGT_TEXTURE && onCompressedTexture) {
+    onCompressedTexture(_texInfo, _blobData.data(), _blobData.size());
+  } else if (_blobType == MSGT_MESH_BUFFER && onCompressedMeshBuffer) {
+    onCompressedMeshBuffer(_meshInfo, _blobData.data(), _blobData.size());
+  } else if (_blobType == MSGT_TEMPLATE) {
+    if (!addTemplate(_templateHdr[0], _templateHdr[1], _blobData.data(), _blobData.size())) {
+      errlog("invalid command template %u", _templateHdr[0]);
+      stop();
     }
-
-    case MSGT_RESERVATION: {
-      trace("MSGT_RESERVATION");
-      _rbuf.read(tmp, RESERVATION_SIZE + 1);
-      dawn_wire::ReservedSwapChain scr;
-      decodeReservation(tmp, &scr);
-      onSwapchainReservation(scr);
-      break;
+  } else if (_blobType == MSGT_INSTANCE) {
+    if (!handleTemplateInstance(_templateHdr[0], _blobData.data(), _blobData.size())) {
+      errlog("invalid instance of command template %u", _templateHdr[0]);
+      stop();
     }
-
-    case MSGT_FRAME_SIGNAL: {
-      trace("MSGT_FRAME_SIGNAL");
-      _rbuf.discard(1);
-      if (_dawnout.flushlen == 0) {
-        onFrame(); // user callback
-      } else {
-        // a new frame started before we had a chance to finish writing the last frame
-        dlog("WARNING: new frame while still writing old frame; skipping this frame");
-      }
-      break;
+  } else if (_blobType == MSGT_ASSET_QUERY && onAssetQuery) {
+    size_t n = _blobData.size() / 16;
+    std::vector<AssetRef> assets(n);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t v[4];
+      memcpy(v, &_blobData[i*16], 16);
+      assets[i].hash = ((uint64_t)ntohl(v[0]) << 32) | ntohl(v[1]);
+      assets[i].size = ((uint64_t)ntohl(v[2]) << 32) | ntohl(v[3]);
     }
+    onAssetQuery(assets.data(), n);
+  } else if (_blobType == MSGT_ASSET_REPLY && onAssetQueryReply) {
+    onAssetQueryReply((const uint8_t*)_blobData.data(), _blobData.size());
+  }
+  // keep small buffers; template instances arrive every frame
+  if (_blobData.capacity() > 65536) {
+    std::vector<char>().swap(_blobData);
+  } else {
+    _blobData.clear();
+  }
+  _blobType = 0;
+  return true;
+}
 
-    case MSGT_DAWNCMD: {
-      trace("MSGT_DAWNCMD _rbuf.len() = %zu, _rbuf[0] = 0x%02X", _rbuf.len(), _rbuf.at(0));
-      if (_rbuf.len() >= DAWNCMD_MSG_HEADER_SIZE) {
-        _rbuf.read(tmp, DAWNCMD_MSG_HEADER_SIZE);
-        decodeDawnCmdHeader(tmp, &_dawnCmdRLen);
-        trace("start reading dawn command buffer of size %u", _dawnCmdRLen);
-        maybeReadIncomingDawnCmd();
-      }
-      break;
+static const char* blobMsgName(char type) {
+  switch (type) {
+    case MSGT_TEXTURE:     return "texture";
+    case MSGT_MESH_BUFFER: return "mesh buffer";
+    case MSGT_TEMPLATE:    return "command template";
+    case MSGT_INSTANCE:    return "command template instance";
+    case MSGT_ASSET_QUERY: return "asset query";
+    case MSGT_ASSET_REPLY: return "asset query reply";
+  }
+  return "message";
+}
+
+// readBlobHeader reads the nhdr big-endian uint32s of a message followed by data
+// (texture, mesh buffer, command template, instance or asset query) into v and starts
+// reading its data (v[nhdr-1] bytes.) Returns false if the data is larger than limit,
+// in which case the connection is stopped.
+bool DawnRemoteProtocol::readBlobHeader(uint32_t* v, int nhdr, uint32_t limit) {
+  char tmp[1 + 8*4];
+  assert(nhdr <= 8);
+  _rbuf.read(tmp, 1 + nhdr*4);
+  for (int i = 0; i < nhdr; i++) {
+    memcpy(&v[i], &tmp[1 + i*4], 4);
+    v[i] = ntohl(v[i]);
+  }
+  uint32_t size = v[nhdr - 1];
+  if (size > limit) {
+    errlog("%s too large (%u bytes)", blobMsgName(tmp[0]), size);
+    stop();
+    return false;
+  }
+  _blobType = tmp[0];
+  _blobRLen = size;
+  _blobData.reserve(size);
+  return true;
+}
+
+// readMsg reads one protocol message from the read buffer (_rbuf).
+// Returns 1 if a message was read, 0 if _rbuf does not yet hold a complete message
+// and -1 if the message is invalid (in which case the connection is stopped.)
+int DawnRemoteProtocol::readMsg() {
+  char tmp[MAX(MAX(MAX(MAX(DAWNCMD_MSG_HEADER_SIZE, FB_INFO_SIZE), RESERVATION_SIZE),
+                   RENDER_SCALE_SIZE), ASSET_SIZE) + 1];
+  switch (_rbuf.at(0)) {
+
+  case MSGT_HELLO: {
+    trace("MSGT_HELLO");
+    if (_rbuf.len() < HELLO_SIZE + 1)
+      return 0;
+    _rbuf.read(tmp, HELLO_SIZE + 1);
+    if (onHello)
+      onHello(ntohl(*((uint32_t*)&tmp[1])));
+    return 1;
+  }
+
+  case MSGT_FB_INFO: {
+    trace("MSGT_FB_INFO");
+    if (_rbuf.len() < FB_INFO_SIZE + 1)
+      return 0;
+    _rbuf.read(tmp, FB_INFO_SIZE + 1);
+    decodeFramebufferInfo(tmp, &_fbinfo);
+    onFramebufferInfo(_fbinfo);
+    return 1;
+  }
+
+  case MSGT_RESERVATION: {
+    trace("MSGT_RESERVATION");
+    if (_rbuf.len() < RESERVATION_SIZE + 1 || !deviceReady())
+      return 0;
+    _rbuf.read(tmp, RESERVATION_SIZE + 1);
+    dawn_wire::ReservedSwapChain scr;
+    decodeReservation(tmp, &scr);
+    onSwapchainReservation(scr);
+    return 1;
+  }
+
+  case MSGT_TEXTURE: {
+    trace("MSGT_TEXTURE");
+    if (_rbuf.len() < TEXTURE_MSG_HEADER_SIZE + 1)
+      return 0;
+    uint32_t v[7];
+    if (!readBlobHeader(v, 7, TEXTURE_MSG_MAX))
+      return -1;
+    _texInfo = { v[0], v[1], v[2], v[3], v[4], v[5] };
+    if (_blobRLen == 0)
+      readBlobData();
+    return 1;
+  }
+
+  case MSGT_MESH_BUFFER: {
+    trace("MSGT_MESH_BUFFER");
+    if (_rbuf.len() < MESH_MSG_HEADER_SIZE + 1)
+      return 0;
+    uint32_t v[5];
+    if (!readBlobHeader(v, 5, MESH_MSG_MAX))
+      return -1;
+    _meshInfo = { v[0], v[1], v[2], v[3] };
+    if (_blobRLen == 0)
+      readBlobData();
+    return 1;
+  }
+
+  case MSGT_PROBE: {
+    trace("MSGT_PROBE");
+    if (_rbuf.len() < PROBE_SIZE + 1)
+      return 0;
+    // everything sent before the probe has been received; acknowledge it right away
+    // (see writeAcks)
+    _rbuf.read(tmp, PROBE_SIZE + 1);
+    tmp[0] = MSGT_PROBE_ACK;
+    _acks.append(tmp, PROBE_SIZE + 1);
+    setNeedsWriteFlush();
+    return 1;
+  }
+
+  case MSGT_PROBE_ACK: {
+    trace("MSGT_PROBE_ACK");
+    if (_rbuf.len() < PROBE_SIZE + 1)
+      return 0;
+    _rbuf.read(tmp, PROBE_SIZE + 1);
+    probeAcked(ntohl(*((uint32_t*)&tmp[1])));
+    return 1;
+  }
+
+  case MSGT_RENDER_SCALE: {
+    trace("MSGT_RENDER_SCALE");
+    if (_rbuf.len() < RENDER_SCALE_SIZE + 1 || !deviceReady())
+      return 0;
+    _rbuf.read(tmp, RENDER_SCALE_SIZE + 1);
+    uint32_t v[5];
+    for (int i = 0; i < 5; i++)
+      v[i] = ntohl(*((uint32_t*)&tmp[1 + i*4]));
+    if (onRenderScale)
+      onRenderScale({ v[0], v[1], v[2], v[3], v[4] });
+    return 1;
+  }
+
+  case MSGT_ASSET_QUERY:
+  case MSGT_ASSET_REPLY: {
+    trace("MSGT_ASSET_QUERY/REPLY");
+    if (_rbuf.len() < ASSET_QUERY_HEADER_SIZE + 1)
+      return 0;
+    bool query = _rbuf.at(0) == MSGT_ASSET_QUERY;
+    uint32_t v[1];
+    if (!readBlobHeader(v, 1, query ? ASSET_QUERY_MAX * 16 : ASSET_QUERY_MAX))
+      return -1;
+    if (_blobRLen == 0)
+      readBlobData();
+    return 1;
+  }
+
+  case MSGT_ASSET: {
+    trace("MSGT_ASSET");
+    if (_rbuf.len() < ASSET_SIZE + 1 || !deviceReady())
+      return 0;
+    _rbuf.read(tmp, ASSET_SIZE + 1);
+    uint32_t v[13];
+    for (int i = 0; i < 13; i++)
+      v[i] = ntohl(*((uint32_t*)&tmp[1 + i*4]));
+    AssetInfo info;
+    info.kind = v[0];
+    info.token = v[1];
+    info.id = v[2];
+    info.generation = v[3];
+    info.deviceId = v[4];
+    info.deviceGeneration = v[5];
+    info.width = v[6];
+    info.height = v[7];
+    info.format = v[8];
+    info.asset.hash = ((uint64_t)v[9] << 32) | v[10];
+    info.asset.size = ((uint64_t)v[11] << 32) | v[12];
+    if (onAsset)
+      onAsset(info);
+    return 1;
+  }
+
+  case MSGT_TEMPLATE: {
+    trace("MSGT_TEMPLATE");
+    if (_rbuf.len() < TEMPLATE_MSG_HEADER_SIZE + 1)
+      return 0;
+    uint32_t v[3];
+    if (!readBlobHeader(v, 3, DAWNCMD_MAX + TEMPLATE_PARAMS_MAX * 8))
+      return -1;
+    _templateHdr[0] = v[0];
+    _templateHdr[1] = v[1];
+    if (_blobRLen == 0)
+      readBlobData();
+    return 1;
+  }
+
+  case MSGT_INSTANCE: {
+    trace("MSGT_INSTANCE");
+    if (_rbuf.len() < INSTANCE_MSG_HEADER_SIZE + 1)
+      return 0;
+    uint32_t v[2];
+    if (!readBlobHeader(v, 2, DAWNCMD_MAX))
+      return -1;
+    _templateHdr[0] = v[0];
+    if (_blobRLen == 0)
+      readBlobData();
+    return 1;
+  }
+
+  case MSGT_FRAME_SIGNAL: {
+    trace("MSGT_FRAME_SIGNAL");
+    _rbuf.discard(1);
+    if (_outqBytes == 0) {
+      onFrame(); // user callback
+    } else {
+      // a new frame started before we had a chance to finish writing the last frame
+      dlog("WARNING: new frame while still writing old frame; skipping this frame");
     }
+    return 1;
+  }
 
-    default: {
-      // unexpected/corrupt message data
-      char c = _rbuf.at(0);
-      errlog("unexpected message (first byte: '%c' 0x%02x, rbuf.len(): %zu)", c, c, _rbuf.len());
-      trace("closing connection");
+  case MSGT_DAWNCMD: {
+    trace("MSGT_DAWNCMD _rbuf.len() = %zu, _rbuf[0] = 0x%02X", _rbuf.len(), _rbuf.at(0));
+    if (_rbuf.len() < DAWNCMD_MSG_HEADER_SIZE)
+      return 0;
+    _rbuf.read(tmp, DAWNCMD_MSG_HEADER_SIZE);
+    decodeDawnCmdHeader(tmp, &_dawnCmdRLen);
+    if (_dawnCmdRLen > DAWNCMD_MAX) {
+      errlog("dawn command buffer too large (%u bytes)", _dawnCmdRLen);
       stop();
-      return false;
+      return -1;
     }
-    } // switch
-  } // while
+    trace("start reading dawn command buffer of size %u", _dawnCmdRLen);
+    return 1;
+  }
 
-  return true;
+  default: {
+    // unexpected/corrupt message data
+    char c = _rbuf.at(0);
+    errlog("unexpected message (first byte: '%c' 0x%02x, rbuf.len(): %zu)", c, c, _rbuf.len());
+    trace("closing connection");
+    stop();
+    return -1;
+  }
+  } // switch
 }
 
-static void DawnRemoteProtocol_doIO(RunLoop* rl, ev_io* w, int revents) {
-  DawnRemoteProtocol* p = (DawnRemoteProtocol*)w->data;
-  p->doIO(revents);
+// handleInput handles messages in _rbuf until it runs out of complete messages,
+// input is held or the connection is stopped
+void DawnRemoteProtocol::handleInput() {
+  while (!_inputHeld && _rl != nullptr) {
+    if (_dawnCmdRLen > 0) {
+      if (!maybeReadIncomingDawnCmd())
+        break;
+    } else if (_blobType != 0) {
+      if (!readBlobData())
+        break;
+    } else if (_rbuf.len() == 0 || readMsg() < 1) {
+      break;
+    }
+  }
 }
 
-void DawnRemoteProtocol::doIO(int revents) {
-  // dlog("onConnIO %s %s",
-  //   revents & EV_READ ? "EV_READ" : "",
-  //   revents & EV_WRITE ? "EV_WRITE" : "");
-
-  if (revents & EV_READ) {
-    // read into _rbuf
-    ssize_t n = _rbuf.readFromFD(_io.fd, _rbuf.cap()) > 0;
+// readInput handles the messages in _rbuf and what one read from the socket adds to
+// them, or with drainInput everything the socket has (up to INPUT_DRAIN_MAX bytes),
+// then calls onInputProcessed. Returns false if the connection was stopped.
+bool DawnRemoteProtocol::readInput() {
+  handleInput();
+  size_t total = 0;
+  while (!_inputHeld && _rl != nullptr && _rbuf.avail() > 0) {
+    ssize_t n;
+    {
+      PerfScope ps(perf, PerfStagePipeCopy);
+      n = _rbuf.readFromFD(_io.fd, _rbuf.cap());
+    }
     if (n <= 0) {
       if (n < 0) {
         if (errno == EAGAIN)
-          return;
+          break;
         perror("read");
       }
       trace("EOF");
       stop();
-      return;
+      return false;
     }
     trace("read %zd bytes into _rbuf; _rbuf.len() = %zu", n, _rbuf.len());
-    if (_dawnCmdRLen > 0) {
-      trace("maybeReadIncomingDawnCmd");
-      maybeReadIncomingDawnCmd();
+    bytesIn += (uint64_t)n;
+    total += (size_t)n;
+    if (timers && idleTimeout > 0)
+      timers->arm(&_idleTimer, idleTimeout);
+    handleInput();
+    if (!drainInput || total >= INPUT_DRAIN_MAX)
+      break;
+  }
+  if (_rl == nullptr)
+    return false;
+  if (onInputProcessed && !_inputHeld)
+    onInputProcessed();
+  return true;
+}
+
+void DawnRemoteProtocol::holdInput() {
+  if (_inputHeld)
+    return;
+  trace("hold input");
+  _inputHeld = true;
+  if (_rl != nullptr)
+    setEvents(_io.events & ~EV_READ);
+}
+
+void DawnRemoteProtocol::resumeInput() {
+  if (!_inputHeld)
+    return;
+  trace("resume input");
+  _inputHeld = false;
+  if (_rl != nullptr) {
+    setEvents(_io.events | EV_READ);
+    if (drainInput) {
+      readInput();
     } else {
-      if (!readMsg())
-        return;
+      handleInput();
+      if (onInputProcessed && !_inputHeld && _rl != nullptr)
+        onInputProcessed();
     }
   }
+}
+
+void DawnRemoteProtocol::setEvents(int events) {
+  ev_io_stop(_rl, &_io);
+  ev_io_modify(&_io, events);
+  ev_io_start(_rl, &_io);
+}
+
+static void DawnRemoteProtocol_doIO(RunLoop* rl, ev_io* w, int revents) {
+  DawnRemoteProtocol* p = (DawnRemoteProtocol*)w->data;
+  p->doIO(revents);
+}
+
+void DawnRemoteProtocol::doIO(int revents) {
+  // dlog("onConnIO %s %s",
+  //   revents & EV_READ ? "EV_READ" : "",
+  //   revents & EV_WRITE ? "EV_WRITE" : "");
+
+  // zero-copy completions are signalled as socket errors, which wake up both
+  // EV_READ and EV_WRITE watchers
+  if (_zcSeq != _zcDone)
+    readZeroCopyCompletions();
+
+  if ((revents & EV_READ) && !readInput())
+    return;
 
   if (revents & EV_WRITE) {
 
-    // if we are flushing Dawn command data, do that before draining _wbuf
-    if (_dawnout.flushlen != 0) {
-      assert(_dawnout.flushlen > _dawnout.flushoffs);
-      uint32_t len = _dawnout.flushlen - _dawnout.flushoffs;
-      trace("_dawnout flush [offs=%u, len=%u]", _dawnout.flushoffs, len);
-      ssize_t n = ::write(_io.fd, &_dawnout.flushbuf[_dawnout.flushoffs], len);
+    if (!_acks.empty() && !writeAcks())
+      return;
+
+    // write queued Dawn command data before draining _wbuf
+    while (_outqSent < _outq.size()) {
+      struct iovec iov[WRITEV_MAX];
+      int iovcnt = 0;
+      size_t len = 0;
+      size_t offs = _outqOffs;
+      auto end = _outq.end();
+      for (auto it = _outq.begin() + _outqSent; it != end && iovcnt < WRITEV_MAX; ++it) {
+        iov[iovcnt].iov_base = (void*)(it->data + offs);
+        iov[iovcnt].iov_len = it->len - offs;
+        len += iov[iovcnt].iov_len;
+        iovcnt++;
+        offs = 0;
+      }
+      trace("_outq flush [segments=%d, len=%zu]", iovcnt, len);
+      ssize_t n;
+      bool zc = zeroCopyThreshold > 0 && len >= zeroCopyThreshold;
+      {
+        PerfScope ps(perf, PerfStagePipeCopy);
+        #ifdef HAVE_ZEROCOPY
+        if (zc) {
+          struct msghdr msg = {};
+          msg.msg_iov = iov;
+          msg.msg_iovlen = iovcnt;
+          n = ::sendmsg(_io.fd, &msg, MSG_ZEROCOPY);
+          if (n < 0 && errno == ENOBUFS) {
+            // out of optmem for pinning pages; send this one the regular way
+            zc = false;
+            n = ::writev(_io.fd, iov, iovcnt);
+          }
+        } else
+        #endif
+        n = ::writev(_io.fd, iov, iovcnt);
+      }
       if (n < 1) {
-        if (n < 0 && errno != EAGAIN)
+        if (n < 0 && errno != EAGAIN) {
           perror("write");
+          stop();
+        }
         return;
       }
-      _dawnout.flushoffs += (uint32_t)n;
-      if (_dawnout.flushlen == _dawnout.flushoffs) {
-        trace("_dawnout flush done");
-        _dawnout.flushlen = 0;
-      } else {
-        // we weren't able to write all of _dawnout.flushbuf; return and wait for more EV_WRITE
-        trace("_dawnout flush more");
-        assert(_dawnout.flushoffs < _dawnout.flushlen);
+      bytesOut += (uint64_t)n;
+      if (timers && writeStallTimeout > 0)
+        timers->arm(&_stallTimer, writeStallTimeout);
+      uint32_t zcSeq = 0;
+      if (zc) {
+        zcSeq = _zcSeq++;
+        zeroCopySends++;
+        zeroCopyBytes += (uint64_t)n;
+      }
+      consumeOutput((size_t)n, zc, zcSeq);
+      if ((size_t)n < len) {
+        // we weren't able to write everything; return and wait for more EV_WRITE
+        trace("_outq flush more");
         return;
       }
     }
@@ -277,123 +902,459 @@ void DawnRemoteProtocol::doIO(int revents) {
     // drain _wbuf
     size_t nbyte = _wbuf.len();
     if (nbyte > 0) {
-      ssize_t z = _wbuf.writeToFD(_io.fd, nbyte);
+      ssize_t z;
+      {
+        PerfScope ps(perf, PerfStagePipeCopy);
+        z = _wbuf.writeToFD(_io.fd, nbyte);
+      }
       if (z < 0 && errno != EAGAIN) {
         perror("write");
         stop();
         return;
       }
+      if (z > 0) {
+        bytesOut += (uint64_t)z;
+        _wbufMid = _wbuf.len() > 0;
+        if (timers && writeStallTimeout > 0)
+          timers->arm(&_stallTimer, writeStallTimeout);
+      }
     }
 
     // stop requesting EV_WRITE if there's nothing waiting to be written
-    if (_wbuf.len() == 0) {
-      ev_io_stop(_rl, &_io);
-      ev_io_modify(&_io, _io.events & ~EV_WRITE);
-      ev_io_start(_rl, &_io);
+    if (_wbuf.len() == 0 && _acks.empty()) {
+      _outputIdle = true;
+      setEvents(_io.events & ~EV_WRITE);
+      if (timers)
+        timers->cancel(&_stallTimer);
+    }
+  }
+}
+
+// writeAcks writes probe acks at the next message boundary, ahead of queued output, so
+// that the peer's RTT samples don't include our send backlog. Returns false if doIO
+// should wait for the next EV_WRITE (or the connection was stopped.)
+bool DawnRemoteProtocol::writeAcks() {
+  if (_outqOffs > 0 || _outqMid || _wbufMid)
+    return true; // in the middle of a message; acks go out after it
+  ssize_t n;
+  {
+    PerfScope ps(perf, PerfStagePipeCopy);
+    n = ::write(_io.fd, _acks.data(), _acks.size());
+  }
+  if (n < 1) {
+    if (n < 0 && errno != EAGAIN) {
+      perror("write");
+      stop();
     }
+    return false;
   }
+  bytesOut += (uint64_t)n;
+  _acks.erase(0, (size_t)n);
+  return _acks.empty();
+}
+
+static void DawnRemoteProtocol_onIdleTimeout(WheelTimer* t, void* data) {
+  DawnRemoteProtocol* p = (DawnRemoteProtocol*)data;
+  errlog("nothing received from peer for %.1fs; closing connection", p->idleTimeout);
+  p->stop();
+}
+
+static void DawnRemoteProtocol_onStallTimeout(WheelTimer* t, void* data) {
+  DawnRemoteProtocol* p = (DawnRemoteProtocol*)data;
+  errlog("peer has not accepted data for %.1fs; closing connection", p->writeStallTimeout);
+  p->stop();
 }
 
 void DawnRemoteProtocol::start(RunLoop* rl, int fd) {
   trace("START");
   _rbuf.clear();
   _wbuf.clear();
+  // release segments kept by stop for zero-copy sends on a previous socket
+  clearOutput();
+  _zcSeq = 0;
+  _zcDone = 0;
+  _zcRanges.clear();
   #ifdef DEBUG
   _rbuf._debugname = "rbuf";
   _wbuf._debugname = "wbuf";
   #endif
 
+  link.reset();
+  _probes.clear();
+  _probeNs = 0;
+  _outputIdle = true;
+  _acks.clear();
+  _outqMid = false;
+  _wbufMid = false;
+
   _rl = rl;
   _io.data = (void*)this;
-  ev_io_init(&_io, DawnRemoteProtocol_doIO, fd, EV_READ);
+  ev_io_init(&_io, DawnRemoteProtocol_doIO, fd, _inputHeld ? 0 : EV_READ);
   ev_io_start(rl, &_io);
+
+  _idleTimer.init(DawnRemoteProtocol_onIdleTimeout, this);
+  _stallTimer.init(DawnRemoteProtocol_onStallTimeout, this);
+  if (timers && idleTimeout > 0)
+    timers->arm(&_idleTimer, idleTimeout);
+}
+
+DawnRemoteProtocol::~DawnRemoteProtocol() {
+  clearOutput();
+  free(_cmdbuf);
+  for (char* buf : _bufpool)
+    free(buf);
+}
+
+size_t DawnRemoteProtocol::bufferBytes() const {
+  size_t n = _bufpool.size() + (_cmdbuf ? 1 : 0);
+  for (const OutSegment& seg : _outq) {
+    if (seg.buf)
+      n++;
+  }
+  return n * DAWNCMD_BUFSIZE;
 }
 
 void DawnRemoteProtocol::stop() {
   trace("STOP");
-  // reset _dawnout
-  _dawnout.writelen = DAWNCMD_MSG_HEADER_SIZE;
-  _dawnout.flushlen = 0;
+  // drop pending output. The kernel may still send from the memory of segments awaiting
+  // zero-copy completion, so make closing the socket reset the connection (discarding
+  // queued data) instead of sending the rest, and keep those segments until the socket
+  // is gone (see start and the destructor, which run after the caller closed the fd.)
+  if (_zcSeq != _zcDone && _rl != nullptr) {
+    struct linger lg = { 1, 0 };
+    if (setsockopt(_io.fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg)) != 0)
+      perror("setsockopt SO_LINGER");
+  }
+  dropOutput();
+  _cmdlen = DAWNCMD_MSG_HEADER_SIZE;
+  _blobRLen = 0;
+  _blobType = 0;
+  std::vector<char>().swap(_blobData);
+  _templates.clear();
+  _recording = nullptr;
+  _probes.clear();
   // unsubscribe from IO events
   if (_rl != nullptr) {
     ev_io_stop(_rl, &_io);
     _rl = nullptr;
   }
+  if (timers) {
+    timers->cancel(&_idleTimer);
+    timers->cancel(&_stallTimer);
+  }
 }
 
 void DawnRemoteProtocol::setNeedsWriteFlush2() {
   if (_rl != nullptr) {
-    ev_io_stop(_rl, &_io);
-    ev_io_modify(&_io, _io.events | EV_WRITE);
-    ev_io_start(_rl, &_io);
+    setEvents(_io.events | EV_WRITE);
+    if (timers && writeStallTimeout > 0)
+      timers->arm(&_stallTimer, writeStallTimeout);
   }
 }
 
+char* DawnRemoteProtocol::allocCmdBuf() {
+  if (!_bufpool.empty()) {
+    char* buf = _bufpool.back();
+    _bufpool.pop_back();
+    return buf;
+  }
+  return (char*)malloc(DAWNCMD_BUFSIZE);
+}
+
+void DawnRemoteProtocol::pushSegment(
+  const char* data, size_t len, char* buf, std::function<void()> release)
+{
+  _outq.emplace_back();
+  OutSegment& seg = _outq.back();
+  seg.data = data;
+  seg.len = len;
+  seg.buf = buf;
+  seg.release = std::move(release);
+  seg.zc = false;
+  seg.probe = false;
+  seg.more = false;
+  _outqBytes += len;
+}
+
+// probeLink queues a link probe behind the output queued so far, unless one was
+// queued recently or too many await acknowledgement
+void DawnRemoteProtocol::probeLink() {
+  if (!linkProbes || _rl == nullptr || _recording || _probes.size() >= LINK_PROBES_MAX)
+    return;
+  uint64_t now = monotimeNs();
+  if (now - _probeNs < std::max((uint64_t)LINK_PROBE_INTERVAL_MIN, link.minRttNs / 4))
+    return;
+  _probeNs = now;
+  uint32_t seq = _probeSeq++;
+  pushSegment(nullptr, PROBE_SIZE + 1, nullptr, nullptr);
+  OutSegment& seg = _outq.back();
+  seg.hdr[0] = MSGT_PROBE;
+  *((uint32_t*)&seg.hdr[1]) = htonl(seq);
+  seg.data = seg.hdr;
+  seg.probe = true;
+  LinkEstimator::Probe p = {};
+  p.offset = bytesOut + _outqBytes;
+  _probes.emplace_back(seq, p);
+}
+
+// probeWritten records the delivery state in a probe which has been written
+void DawnRemoteProtocol::probeWritten(const OutSegment& seg) {
+  uint32_t seq = ntohl(*((const uint32_t*)&seg.hdr[1]));
+  for (auto& sp : _probes) {
+    if (sp.first == seq) {
+      link.probeSent(&sp.second, monotimeNs(), _outputIdle);
+      _outputIdle = false;
+      return;
+    }
+  }
+}
+
+// probeAcked takes the samples of an acknowledged probe. Acknowledgements come in
+// order, so probes before it will not be acknowledged.
+void DawnRemoteProtocol::probeAcked(uint32_t seq) {
+  while (!_probes.empty()) {
+    auto sp = _probes.front();
+    _probes.pop_front();
+    if (sp.first == seq) {
+      link.probeAcked(sp.second, monotimeNs());
+      return;
+    }
+  }
+}
+
+// consumeOutput marks nbyte bytes of _outq as written, by a zero-copy send with
+// sequence number zcSeq if zc is true, and releases what can be released
+void DawnRemoteProtocol::consumeOutput(size_t nbyte, bool zc, uint32_t zcSeq) {
+  while (nbyte > 0) {
+    assert(_outqSent < _outq.size());
+    OutSegment& seg = _outq[_outqSent];
+    if (zc) {
+      seg.zc = true;
+      seg.zcSeq = zcSeq;
+    }
+    size_t rem = seg.len - _outqOffs;
+    if (nbyte < rem) {
+      _outqOffs += nbyte;
+      _outqBytes -= nbyte;
+      break;
+    }
+    nbyte -= rem;
+    _outqBytes -= rem;
+    _outqOffs = 0;
+    _outqSent++;
+    _outqMid = seg.more;
+    if (seg.probe)
+      probeWritten(seg);
+  }
+  releaseOutput();
+}
+
+// releaseOutput recycles or releases written segments which the kernel is done with
+void DawnRemoteProtocol::releaseOutput() {
+  while (_outqSent > 0) {
+    OutSegment& seg = _outq.front();
+    if (seg.zc && (int32_t)(seg.zcSeq - _zcDone) >= 0)
+      return; // zero-copy send not yet completed
+    if (seg.buf) {
+      if (_bufpool.size() < CMDBUF_POOL_MAX) {
+        _bufpool.push_back(seg.buf);
+      } else {
+        free(seg.buf);
+      }
+    }
+    auto release = std::move(seg.release);
+    _outq.pop_front();
+    _outqSent--;
+    if (release)
+      release();
+  }
+}
+
+// dropOutput gives up on unwritten output. Segments awaiting zero-copy completion stay.
+void DawnRemoteProtocol::dropOutput() {
+  _outqSent = _outq.size();
+  _outqOffs = 0;
+  _outqBytes = 0;
+  releaseOutput();
+}
+
+// clearOutput releases all of _outq, including segments awaiting zero-copy completion
+void DawnRemoteProtocol::clearOutput() {
+  for (OutSegment& seg : _outq)
+    seg.zc = false;
+  dropOutput();
+}
+
+bool DawnRemoteProtocol::enableZeroCopy(size_t threshold) {
+  #ifdef HAVE_ZEROCOPY
+  int one = 1;
+  if (setsockopt(_io.fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0)
+    return false;
+  zeroCopyThreshold = std::max(threshold, (size_t)1);
+  return true;
+  #else
+  errno = ENOTSUP;
+  return false;
+  #endif
+}
+
+// readZeroCopyCompletions reads zero-copy completion notifications from the socket's
+// error queue and releases the segments they cover
+void DawnRemoteProtocol::readZeroCopyCompletions() {
+  #ifdef HAVE_ZEROCOPY
+  while (true) {
+    char control[128];
+    struct msghdr msg = {};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(_io.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break; // EAGAIN: no more notifications
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      auto ee = (const struct sock_extended_err*)CMSG_DATA(cm);
+      if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      // sends ee_info...ee_data (inclusive) have completed
+      if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        zeroCopyCopied += ee->ee_data - ee->ee_info + 1;
+      _zcRanges.emplace_back(ee->ee_info, ee->ee_data);
+    }
+  }
+  // advance _zcDone over completed ranges (normally in order, but don't rely on it)
+  for (size_t i = 0; i < _zcRanges.size(); ) {
+    auto r = _zcRanges[i];
+    if ((int32_t)(r.first - _zcDone) <= 0) {
+      if ((int32_t)(r.second - _zcDone) >= 0)
+        _zcDone = r.second + 1;
+      _zcRanges.erase(_zcRanges.begin() + i);
+      i = 0;
+    } else {
+      i++;
+    }
+  }
+  releaseOutput();
+  #endif
+}
+
 void* DawnRemoteProtocol::GetCmdSpace(size_t size) {
   trace("GetCmdSpace %zu", size);
   assert(size <= DAWNCMD_MAX);
-  if (sizeof(_dawnout.writebuf) - size < _dawnout.writelen) {
-    dlog("GetCmdSpace FAILED (not enough space)");
-    return nullptr; // not enough space
+  if (_cmdbuf != nullptr && DAWNCMD_BUFSIZE - _cmdlen < size)
+    Flush(); // queue what we have and start a new buffer
+  if (_cmdbuf == nullptr) {
+    _cmdbuf = allocCmdBuf();
+    if (_cmdbuf == nullptr) {
+      dlog("GetCmdSpace FAILED (out of memory)");
+      return nullptr;
+    }
   }
-  char* result = &_dawnout.writebuf[_dawnout.writelen];
-  _dawnout.writelen += size;
+  char* result = &_cmdbuf[_cmdlen];
+  _cmdlen += size;
   return result;
 }
 
 bool DawnRemoteProtocol::Flush() {
-  trace("flush dawn command data %u", _dawnout.writelen);
-  assert(_dawnout.flushlen == 0 /* is done flushing previous buffer */);
-  if (_dawnout.writelen > DAWNCMD_MSG_HEADER_SIZE) {
-    // write header (preallocated at writebuf[0..DAWNCMD_MSG_HEADER_SIZE])
-    encodeDawnCmdHeader(_dawnout.writebuf, _dawnout.writelen - DAWNCMD_MSG_HEADER_SIZE);
+  trace("flush dawn command data %u", _cmdlen);
+  if (_recording) {
+    if (_cmdbuf && _cmdlen > DAWNCMD_MSG_HEADER_SIZE)
+      _recording->insert(_recording->end(), &_cmdbuf[DAWNCMD_MSG_HEADER_SIZE], &_cmdbuf[_cmdlen]);
+    _cmdlen = DAWNCMD_MSG_HEADER_SIZE;
+    return true;
+  }
+  if (_cmdlen > DAWNCMD_MSG_HEADER_SIZE) {
+    // write header (preallocated at _cmdbuf[0..DAWNCMD_MSG_HEADER_SIZE])
+    encodeDawnCmdHeader(_cmdbuf, _cmdlen - DAWNCMD_MSG_HEADER_SIZE);
 
     #ifdef DEBUG_TRACE_PROTOCOL
     { // log buffer
-      char* buf = (char*)malloc(_dawnout.writelen*5);
-      ssize_t n = debugFmtBytes(buf, _dawnout.writelen*5, _dawnout.writebuf, _dawnout.writelen);
+      char* buf = (char*)malloc(_cmdlen*5);
+      ssize_t n = debugFmtBytes(buf, _cmdlen*5, _cmdbuf, _cmdlen);
       if (n != -1)
-        trace("data to be sent out: %u\n\"%s\"", _dawnout.writelen, buf);
+        trace("data to be sent out: %u\n\"%s\"", _cmdlen, buf);
       free(buf);
     }
     #endif /* DEBUG_TRACE_PROTOCOL */
 
-    // swap buffers
-    char* buf1 = _dawnout.flushbuf;
-    _dawnout.flushbuf = _dawnout.writebuf;
-    _dawnout.writebuf = buf1;
-
-    // setup flush state
-    _dawnout.flushlen = _dawnout.writelen;
-    _dawnout.flushoffs = 0;
+    pushSegment(_cmdbuf, _cmdlen, _cmdbuf, nullptr);
+    _cmdbuf = nullptr;
+    _cmdlen = DAWNCMD_MSG_HEADER_SIZE;
+    probeLink();
     setNeedsWriteFlush();
+  }
+  return true;
+}
 
-    // reset write
-    _dawnout.writelen = DAWNCMD_MSG_HEADER_SIZE;
-  } else {
-    assert(_dawnout.writelen == DAWNCMD_MSG_HEADER_SIZE);
+bool DawnRemoteProtocol::sendDawnCommands(
+  const char* data, size_t len, std::function<void()> release)
+{
+  // find message boundaries. Each wire command starts with its size as a uint64.
+  std::vector<size_t> ends;
+  size_t start = 0, offs = 0;
+  while (offs < len) {
+    uint64_t cmdsize;
+    if (len - offs < sizeof(cmdsize))
+      return false;
+    memcpy(&cmdsize, &data[offs], sizeof(cmdsize));
+    if (cmdsize < sizeof(cmdsize) || cmdsize > DAWNCMD_MAX || cmdsize > len - offs)
+      return false;
+    if (offs + cmdsize - start > DAWNCMD_MAX) {
+      ends.push_back(offs);
+      start = offs;
+    }
+    offs += cmdsize;
   }
+  if (len > 0)
+    ends.push_back(len);
+  if (ends.empty()) {
+    if (release)
+      release();
+    return true;
+  }
+
+  // wire client output produced so far goes first
+  Flush();
+
+  start = 0;
+  for (size_t i = 0; i < ends.size(); i++) {
+    size_t msglen = ends[i] - start;
+    pushSegment(nullptr, DAWNCMD_MSG_HEADER_SIZE, nullptr, nullptr);
+    OutSegment& hdr = _outq.back();
+    encodeDawnCmdHeader(hdr.hdr, (uint32_t)msglen);
+    hdr.data = hdr.hdr;
+    hdr.more = true;
+    bool last = i == ends.size() - 1;
+    pushSegment(&data[start], msglen, nullptr, last ? std::move(release) : nullptr);
+    start = ends[i];
+  }
+  probeLink();
+  setNeedsWriteFlush();
   return true;
 }
 
-// bool DawnRemoteProtocol::sendDawnCommands(const char* src, size_t nbyte) {
-//   size_t needbytes = nbyte + DAWNCMD_MSG_HEADER_SIZE;
-//   // proto buffer must be at least the size of the dawn command buffer + header
-//   // to be able to succeed at all.
-//   assert(_wbuf.cap() >= needbytes);
-//   // if there's no room, ask the caller to try again later
-//   if (_wbuf.avail() < needbytes) {
-//     trace("not enough buffer space for dawn command buffer");
-//     return false;
-//   }
-//   // write header: "D" <HEXBYTE>{8}
-//   assert(nbyte <= 0xFFFFFFFF);
-//   char buf[DAWNCMD_MSG_HEADER_SIZE];
-//   encodeDawnCmdHeader(buf, (uint32_t)nbyte);
-//   _wbuf.write(buf, DAWNCMD_MSG_HEADER_SIZE);
-//   // not checking result from _wbuf.write as we already checked _wbuf.avail()
-//   size_t n = _wbuf.write(src, nbyte);
-//   assert(n == nbyte);
-//   setNeedsWriteFlush();
-//   return true;
-// }
+bool DawnRemoteProtocol::sendDawnCommandsFile(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  size_t len = (size_t)st.st_size;
+  if (len == 0) {
+    ::close(fd);
+    return true;
+  }
+  void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  if (!sendDawnCommands((const char*)p, len, [p, len]() { munmap(p, len); })) {
+    munmap(p, len);
+    errno = EINVAL;
+    return false;
+  }
+  return true;
+}
@@ -4,6 +4,10 @@
 #include <functional>
 #include <limits>
 #include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <dawn_wire/Wire.h>
 #include <dawn_wire/WireClient.h>
@@ -15,6 +19,9 @@
   #define DEBUG_TRACE_PIPE
 #endif
 #include "pipe.hh"
+#include "perfcounters.hh"
+#include "timerwheel.hh"
+#include "linkest.hh"
 
 // silence "mangled name of 'ev_set_allocator' will change in C++17"
 _Pragma("GCC diagnostic push")
@@ -29,6 +36,51 @@ typedef struct ev_loop RunLoop;
 #define DAWNCMD_MAX             (4096*32)
 #define DAWNCMD_BUFSIZE         (DAWNCMD_MAX + DAWNCMD_MSG_HEADER_SIZE)
 
+// PROTOCOL_VERSION is sent by clients in their hello message. It is bumped whenever
+// the set of messages changes:
+//   1  hello
+//   2  compressed textures ("T")
+//   3  compressed vertex & index buffers ("B")
+//   4  command templates & instances ("C", "X")
+//   5  render scale ("S")
+//   6  link probes & acks ("P", "A")
+//   7  assets & asset queries ("K", "Q", "V")
+// The server accepts clients from PROTOCOL_VERSION_MIN up to its own version, and only
+// sends probes to clients of PROTOCOL_VERSION_PROBES or later.
+#define PROTOCOL_VERSION        7
+#define PROTOCOL_VERSION_MIN    1
+#define PROTOCOL_VERSION_PROBES 6
+
+// TEXTURE_MSG_MAX is the largest compressed texture a client may send
+#define TEXTURE_MSG_MAX (64*1024*1024)
+
+// MESH_MSG_MAX is the largest compressed vertex or index buffer a client may send
+#define MESH_MSG_MAX (64*1024*1024)
+
+// ASSET_QUERY_MAX is the largest number of assets a client may ask about at once
+// (see sendAssetQuery)
+#define ASSET_QUERY_MAX 4096
+
+// Limits of command templates (see cmdtemplate.hh): number of templates per connection
+// and parameters per template. Template commands and parameter values are at most
+// DAWNCMD_MAX bytes.
+#define TEMPLATE_MAX        64
+#define TEMPLATE_PARAMS_MAX 64
+
+// Link probes (see DawnRemoteProtocol::link): a probe is queued behind output at most
+// every LINK_PROBE_INTERVAL_MIN ns or a quarter of the min RTT, whichever is longer,
+// with at most LINK_PROBES_MAX awaiting acknowledgement.
+#define LINK_PROBE_INTERVAL_MIN 1000000
+#define LINK_PROBES_MAX         32
+
+// Render scales (see sendRenderScale) are in 1/1000 (1000 = full size) and at least
+// RENDER_SCALE_MIN. renderScaleSize returns the size in pixels of a framebuffer
+// dimension at a scale; client and server must agree on it.
+#define RENDER_SCALE_MIN 250
+inline uint32_t renderScaleSize(uint32_t size, uint32_t scale) {
+  return std::max(1u, (uint32_t)(((uint64_t)size * scale + 500) / 1000));
+}
+
 struct DawnRemoteProtocol : public dawn_wire::CommandSerializer {
   struct FramebufferInfo {
     wgpu::TextureFormat textureFormat;
@@ -37,22 +89,95 @@ struct DawnRemoteProtocol : public dawn_wire::CommandSerializer {
     uint16_t dpscale; // 1dp = Npx (10x percent; 0% = 0, 100% = 1000, 250% = 2500 ...)
   };
 
+  // CompressedTextureInfo describes a texture sent with sendCompressedTexture
+  struct CompressedTextureInfo {
+    uint32_t id, generation, deviceId, deviceGeneration; // texture reservation
+    uint32_t width, height;
+  };
+
+  // CompressedMeshBufferInfo describes a buffer sent with sendCompressedMeshBuffer
+  struct CompressedMeshBufferInfo {
+    uint32_t token;  // from the label of the destination buffer (see meshcodec.hh)
+    uint32_t kind;   // MeshBufferKind
+    uint32_t stride; // bytes per vertex, or per index (2 or 4)
+    uint32_t count;  // number of vertices or indices
+  };
+
+  // RenderScaleInfo describes a render target & scale sent with sendRenderScale
+  struct RenderScaleInfo {
+    uint32_t id, generation, deviceId, deviceGeneration; // render target reservation
+    uint32_t scale;
+  };
+
+  // AssetRef identifies an asset of an asset pack (see assetpack.hh)
+  struct AssetRef {
+    uint64_t hash; // assetHash of the data
+    uint64_t size;
+  };
+
+  // AssetInfo describes a buffer or texture sent with sendAsset
+  struct AssetInfo {
+    AssetRef asset;
+    uint32_t kind;  // AssetKind
+    uint32_t token; // buffers: from the label of the destination buffer
+    uint32_t id, generation, deviceId, deviceGeneration; // textures: texture reservation
+    uint32_t width, height, format; // textures: size and WGPUTextureFormat
+  };
+
   Pipe<DAWNCMD_BUFSIZE + 8> _rbuf; // incoming data (extra space for pipe impl)
-  Pipe<4096>                _wbuf; // outgoing data (in addition to _dawnout)
+  Pipe<4096>                _wbuf; // outgoing data (in addition to _outq)
 
-  RunLoop* _rl;
+  RunLoop* _rl = nullptr;
   ev_io    _io;
   uint32_t _dawnCmdRLen = 0; // reamining nbytes to read as dawn command buffer
+  // compressed texture or mesh buffer being read (_blobType is its message type)
+  uint32_t _blobRLen = 0;    // remaining nbytes to read
+  char     _blobType = 0;
+  std::vector<char>        _blobData; // data read so far
+  CompressedTextureInfo    _texInfo;
+  CompressedMeshBufferInfo _meshInfo;
+  uint32_t                 _templateHdr[2]; // id & nparams of a template message
+
+  // command templates registered by the client, by ID (server)
+  struct CommandTemplateData {
+    std::vector<char>     commands;
+    std::vector<uint32_t> params;    // offset & size in commands of each parameter
+    uint32_t              paramSize; // sum of parameter sizes
+  };
+  std::unordered_map<uint32_t,CommandTemplateData> _templates;
+  std::vector<char> _templateTmp; // commands of the instance being handled
+  std::vector<char>* _recording = nullptr; // see beginRecording
+  bool     _inputHeld = false;
+
+  // Outgoing Dawn command data is a queue of segments which are written in order,
+  // ahead of _wbuf. Wire client output is serialized into a pooled buffer (_cmdbuf)
+  // which Flush moves to the queue. sendDawnCommands queues the caller's memory as is.
+  // Written segments stay at the front of the queue until they can be released, which
+  // is right away unless they were sent with MSG_ZEROCOPY.
+  struct OutSegment {
+    const char*           data;
+    size_t                len;
+    char*                 buf;     // pooled buffer to recycle once written (or null)
+    std::function<void()> release; // called once written or dropped (or null)
+    char                  hdr[DAWNCMD_MSG_HEADER_SIZE]; // storage for message headers
+    bool                  probe;   // a link probe (in hdr)
+    bool                  more;    // the message continues in the next segment
+    bool                  zc;      // (partly) sent with MSG_ZEROCOPY
+    uint32_t              zcSeq;   // zero-copy sequence number of the last such send
+  };
+  std::deque<OutSegment> _outq;
+  size_t                 _outqSent = 0;  // number of written segments at the front of _outq
+  size_t                 _outqOffs = 0;  // bytes of _outq[_outqSent] already written
+  size_t                 _outqBytes = 0; // bytes in _outq not yet written
+  bool                   _outqMid = false; // _outq was written up to the middle of a message
+  char*                  _cmdbuf = nullptr; // buffer used for GetCmdSpace
+  uint32_t               _cmdlen = DAWNCMD_MSG_HEADER_SIZE; // length of _cmdbuf
+  std::vector<char*>     _bufpool; // free command buffers
 
-  // _dawnout is the dawn command buffer for outgoing Dawn command data
-  struct {
-    char     bufs[2][DAWNCMD_BUFSIZE];
-    char*    writebuf = bufs[0]; // buffer used for GetCmdSpace
-    uint32_t writelen = DAWNCMD_MSG_HEADER_SIZE; // length of writebuf
-    char*    flushbuf = bufs[1]; // buffer being written to _io.fd
-    uint32_t flushlen = 0; // length of flushbuf (>0 when flushing)
-    uint32_t flushoffs = 0; // start offset of flushbuf
-  } _dawnout;
+  // zero-copy send completion tracking (see zeroCopyThreshold)
+  uint32_t _zcSeq = 0;  // sequence number of the next zero-copy send
+  uint32_t _zcDone = 0; // all zero-copy sends before this one have completed
+  std::vector<std::pair<uint32_t,uint32_t>> _zcRanges; // completed after a gap
 
   // _dawntmp is used for temporary storage of incoming dawn command buffers
   // in the case that they span across Pipe boundaries.
@@ -61,32 +186,191 @@ struct DawnRemoteProtocol : public dawn_wire::CommandSerializer {
   // framebuffer info (only used by client)
   FramebufferInfo _fbinfo;
 
+  // bytes read from and written to the file descriptor
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+
+  // link estimates the bandwidth and RTT of the direction we send in, from probes
+  // which the peer acknowledges (see linkest.hh.) Both ends probe while they send;
+  // with linkProbes off this end does not (it still acknowledges the peer's probes.)
+  // The server turns it on once the client's hello says it understands probes.
+  LinkEstimator link;
+  bool          linkProbes = true;
+  std::deque<std::pair<uint32_t,LinkEstimator::Probe>> _probes; // awaiting ack, by seq
+  uint32_t      _probeSeq = 0;
+  uint64_t      _probeNs = 0;        // when the last probe was queued
+  bool          _outputIdle = true;  // all output was written since the last probe
+  std::string   _acks;               // acks of the peer's probes, not yet written
+  bool          _wbufMid = false;    // _wbuf was written up to the middle of a message
+
+  // command template instances handled and the command bytes they expanded to (server)
+  uint64_t templateInstances = 0;
+  uint64_t templateBytes = 0;
+
+  // perf receives hardware counter samples for Pipe copy paths (may be null)
+  PerfStats* perf = nullptr;
+
+  // Zero-copy sends (Linux MSG_ZEROCOPY, TCP only.) Writes of at least
+  // zeroCopyThreshold bytes of Dawn command data are made with MSG_ZEROCOPY, and the
+  // segments written stay queued (buffers are not recycled, release is not called)
+  // until the kernel reports on the socket's error queue that it is done with them.
+  // Zero-copy only pays off for large writes; the kernel falls back to copying when
+  // it has to (counted in zeroCopyCopied.)
+  size_t   zeroCopyThreshold = 0; // 0 = off (set by enableZeroCopy)
+  uint64_t zeroCopySends = 0;     // sendmsg calls made with MSG_ZEROCOPY
+  uint64_t zeroCopyBytes = 0;     // bytes written by those calls
+  uint64_t zeroCopyCopied = 0;    // zero-copy sends the kernel completed by copying
+
+  // enableZeroCopy turns on zero-copy sends for writes of at least threshold bytes.
+  // Call after start. Returns false if the socket does not support it.
+  bool enableZeroCopy(size_t threshold);
+
+  // Per-connection timers run on a shared TimerWheel (set before calling start.)
+  // When a timeout expires the connection is stopped, as if the peer had disconnected.
+  TimerWheel* timers = nullptr;
+  double      idleTimeout = 0;       // stop if nothing is received for this long (0 = never)
+  double      writeStallTimeout = 0; // stop if pending output makes no progress for this long
+  WheelTimer  _idleTimer;
+  WheelTimer  _stallTimer;
+
   // callbacks, client and server
   std::function<void(const char* data, size_t len)> onDawnBuffer;
+  // onInputProcessed is called when the messages read so far have been handled, as far
+  // as they are complete, unless input is held
+  std::function<void()> onInputProcessed;
+  // With drainInput, the socket is read until it has no more input (or a few MB have
+  // been read) before onInputProcessed is called, rather than once per EV_READ
+  bool drainInput = false;
+  // acquireDevice, if set, is called before a message which uses the device is handled
+  // (Dawn commands, template instances, compressed textures & mesh buffers, assets,
+  // render scales and swapchain reservations.) When it returns false, input is held
+  // from that message on, until resumeInput is called.
+  std::function<bool()> acquireDevice;
 
   // callbacks, client only
   std::function<void()> onFrame; // server is ready for a new frame
   // onFramebufferInfo is called whenever the underlying framebuffer changes.
   // The argument provided is the same as returned by the fbinfo() method.
   std::function<void(const FramebufferInfo& fbinfo)> onFramebufferInfo;
+  // onAssetQueryReply is called with the answer to a sendAssetQuery: for each asset
+  // queried, in order, 1 if the server has it and 0 if not
+  std::function<void(const uint8_t* found, size_t n)> onAssetQueryReply;
 
   // callbacks, server only
+  // onHello is called when the client has sent its hello message
+  std::function<void(uint32_t version)> onHello;
   // onSwapchainReservation is called when the client has made a swapchain reservation.
   std::function<void(const dawn_wire::ReservedSwapChain&)> onSwapchainReservation;
+  // onCompressedTexture is called with a texture sent by the client (UCT data)
+  std::function<void(const CompressedTextureInfo&, const char* data, size_t len)>
+    onCompressedTexture;
+  // onCompressedMeshBuffer is called with a vertex or index buffer sent by the client
+  std::function<void(const CompressedMeshBufferInfo&, const char* data, size_t len)>
+    onCompressedMeshBuffer;
+  // onRenderScale is called when the client has set its render scale
+  std::function<void(const RenderScaleInfo&)> onRenderScale;
+  // onAssetQuery is called when the client asks which of n assets the server has;
+  // answer with sendAssetQueryReply
+  std::function<void(const AssetRef* assets, size_t n)> onAssetQuery;
+  // onAsset is called when the client wants a buffer or texture made from an asset
+  std::function<void(const AssetInfo&)> onAsset;
+
+  ~DawnRemoteProtocol();
 
   int fd() const { return _io.fd; }
 
+  // number of bytes received but not yet handled, and waiting to be sent
+  size_t pendingInput() const { return _rbuf.len(); }
+  size_t pendingOutput() const {
+    return _wbuf.len() + _outqBytes + (_cmdlen - DAWNCMD_MSG_HEADER_SIZE);
+  }
+  // bufferBytes returns the size of heap-allocated command buffers
+  size_t bufferBytes() const;
+
   // client only
   const FramebufferInfo& fbinfo() const { return _fbinfo; }
 
   void start(RunLoop* rl, int fd);
-  void stop();
+  void stop(); // the caller closes the fd afterwards
   bool stopped() const { return _rl == nullptr; }
 
+  // holdInput stops reading and handling incoming messages until resumeInput is called.
+  // Messages already in the read buffer are kept; the peer is throttled by the socket.
+  void holdInput();
+  void resumeInput();
+  bool inputHeld() const { return _inputHeld; }
+
   bool sendFrameSignal();
   bool sendFramebufferInfo(const FramebufferInfo& info);
+
+  // sendHello and sendReservation are ordered with Dawn command data: the server sees
+  // them before any wire commands serialized after the call. This lets a client send
+  // hello, reservation and its first commands in one flight without waiting for the
+  // server's framebuffer info.
+  bool sendHello();
   bool sendReservation(const dawn_wire::ReservedSwapChain& scr);
-  // bool sendDawnCommands(const char* src, size_t nbyte);
+
+  // sendCompressedTexture sends a UCT image (see texcodec.hh) of width x height pixels
+  // for the server to transcode into a GPU-native format and upload into a texture it
+  // creates for the reservation. Ordered with Dawn command data like sendReservation.
+  // data is copied.
+  bool sendCompressedTexture(
+    const dawn_wire::ReservedTexture& r, uint32_t width, uint32_t height,
+    const void* data, size_t len);
+
+  // sendCompressedMeshBuffer sends vertex or index data encoded with meshEncodeVertices
+  // or meshEncodeIndices (see meshcodec.hh) for the server to decode into the buffer
+  // created with the label meshBufferLabel(info.token). Ordered with Dawn command data
+  // like sendReservation; the buffer must have been created before the call. data is
+  // copied.
+  bool sendCompressedMeshBuffer(const CompressedMeshBufferInfo& info, const void* data, size_t len);
+
+  // sendRenderScale makes the client render frames presented after it at scale (see
+  // RENDER_SCALE_MIN) into target, a texture reservation for which the server creates a
+  // render target of its framebuffer size. The client renders into the top-left
+  // renderScaleSize(width, scale) x renderScaleSize(height, scale) pixels of it; on
+  // present, the server upscales them to the swapchain. At scale 1000 the client renders
+  // into the swapchain again. Ordered with Dawn command data like sendReservation. Use
+  // RenderScaleTarget (upscale.hh) rather than this.
+  bool sendRenderScale(const dawn_wire::ReservedTexture& target, uint32_t scale);
+
+  // sendAssetQuery asks the server which of n (at most ASSET_QUERY_MAX) assets it has in
+  // its asset store. The server answers queries in order (onAssetQueryReply.)
+  // sendAssetQueryReply is the server's answer, one byte per asset queried.
+  // sendAsset makes the server fill the buffer created with the label
+  // ASSET_BUFFER_LABEL_PREFIX + info.token, or create a texture for the reservation,
+  // from an asset of its store. Ordered with Dawn command data like sendReservation; the
+  // buffer must have been created before the call. Use AssetUploader (assetupload.hh)
+  // rather than these.
+  bool sendAssetQuery(const AssetRef* assets, size_t n);
+  bool sendAssetQueryReply(const uint8_t* found, size_t n);
+  bool sendAsset(const AssetInfo& info);
+
+  // sendTemplate registers command template id with the server, replacing any earlier
+  // one with that id. commands are whole wire commands (see beginRecording) and params
+  // the offset and size of each parameter in them. sendTemplateInstance makes the
+  // server handle a copy of the template's commands with values (the parameters in
+  // order) patched in, as if they had been sent. Both are ordered with Dawn command
+  // data like sendReservation. Use CommandTemplate (cmdtemplate.hh) rather than these.
+  bool sendTemplate(uint32_t id, const std::vector<char>& commands,
+                    const std::vector<uint32_t>& params);
+  bool sendTemplateInstance(uint32_t id, const void* values, size_t len);
+
+  // beginRecording makes wire commands serialized from now on be appended to out
+  // instead of being sent, until endRecording. No other messages may be sent meanwhile.
+  void beginRecording(std::vector<char>* out);
+  void endRecording();
+
+  // sendDawnCommands queues pre-serialized wire commands, after any wire client output
+  // produced so far. data must hold whole commands; it is sent as messages of at most
+  // DAWNCMD_MAX bytes, split at command boundaries. data is not copied and must stay
+  // valid until release is called (once written, or when the connection stops.)
+  // Returns false if data is not a sequence of commands no larger than DAWNCMD_MAX, in
+  // which case nothing is queued and release is not called.
+  bool sendDawnCommands(const char* data, size_t len, std::function<void()> release = nullptr);
+
+  // sendDawnCommandsFile maps a file of pre-serialized wire commands and queues it
+  bool sendDawnCommandsFile(const char* filename);
 
   // dawn_wire::CommandSerializer
   size_t GetMaximumAllocationSize() const override { return DAWNCMD_MAX; }
@@ -100,7 +384,28 @@ struct DawnRemoteProtocol : public dawn_wire::CommandSerializer {
       setNeedsWriteFlush2();
   }
   void setNeedsWriteFlush2();
+  void pushSegment(const char* data, size_t len, char* buf, std::function<void()> release);
+  bool pushMsg(const char* msg, size_t len);
+  void consumeOutput(size_t nbyte, bool zc, uint32_t zcSeq);
+  void probeLink();
+  void probeWritten(const OutSegment& seg);
+  void probeAcked(uint32_t seq);
+  bool writeAcks();
+  void releaseOutput();
+  void dropOutput();
+  void clearOutput();
+  void readZeroCopyCompletions();
+  char* allocCmdBuf();
   void doIO(int revents);
-  bool readMsg();
+  int  readMsg();
+  void handleInput();
+  bool readInput();
+  void setEvents(int events);
   bool maybeReadIncomingDawnCmd();
+  bool deviceReady();
+  bool pushBlobMsg(char type, const uint32_t* hdr, int nhdr, const void* data, size_t len);
+  bool readBlobHeader(uint32_t* v, int nhdr, uint32_t limit);
+  bool readBlobData();
+  bool addTemplate(uint32_t id, uint32_t nparams, const char* data, size_t len);
+  bool handleTemplateInstance(uint32_t id, const char* values, size_t len);
 };
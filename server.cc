@@ -13,6 +13,21 @@
 // limitations under the License.
 
 #include "protocol.hh"
+#include "metrics.hh"
+#include "perfcounters.hh"
+#include "hud.hh"
+#include "present.hh"
+#include "devicelock.hh"
+#include "framesched.hh"
+#include "capture.hh"
+#include "advisor.hh"
+#include "texcodec.hh"
+#include "meshcodec.hh"
+#include "teardown.hh"
+#include "warmup.hh"
+#include "upscale.hh"
+#include "compile.hh"
+#include "assetpack.hh"
 
 #include "utils/GLFWUtils.h"
 #include "GLFW/glfw3.h"
@@ -21,14 +36,21 @@
 #include <dawn/dawn_proc.h>
 #include <dawn_wire/WireServer.h>
 #include <dawn_native/DawnNative.h>
+#include <dawn_native/NullBackend.h>
 
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <unistd.h> // pipe
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netdb.h> // getaddrinfo
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <fcntl.h> // F_GETFL, O_NONBLOCK etc
 
 #define DLOG_PREFIX "\e[1;34m[server]\e[0m "
@@ -109,12 +131,144 @@ int createUNIXSocketServer(const char* filename) {
   return fd;
 }
 
+// createTCPSocketServer listens on addr, which is "<port>" (all interfaces) or
+// "<host>:<port>"
+int createTCPSocketServer(const char* addr) {
+  std::string host;
+  const char* port = strrchr(addr, ':');
+  if (port) {
+    host.assign(addr, port - addr);
+    port++;
+  } else {
+    port = addr;
+  }
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo* res;
+  int err = getaddrinfo(host.empty() ? nullptr : host.c_str(), port, &hints, &res);
+  if (err != 0) {
+    errlog("%s: %s", addr, gai_strerror(err));
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1 || listen(fd, 16) == -1) {
+      int e = errno;
+      close(fd);
+      errno = e;
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
 
 const char* sockfile = "server.sock";
+const char* tcpaddr = nullptr;     // -tcp=[<host>:]<port>: also accept TCP connections
+static size_t zeroCopyThreshold = 0; // -zerocopy[=<KB>]: MSG_ZEROCOPY for large writes
+const char* metricsfile = nullptr; // -metrics=<file>
+static bool     headless = false;  // -headless: no window; Null backend
+static bool     memstats = false;  // -memstats: attribute heap growth to connections
+static uint32_t maxconns = 1;      // -maxconns=<n>: beyond this, oldest connection is closed
+static double   idleTimeout = 0;   // -idle-timeout=<sec>: close clients that send nothing
+static double   stallTimeout = 0;  // -stall-timeout=<sec>: close clients that don't read
+const char* captureDir = nullptr;  // -capture=<dir>: record clients' wire commands
+static bool     advisorEnabled = false; // -advisor: warn about slow client patterns
+
+// Compressed textures sent by clients are transcoded to transcodeTarget (-transcode=),
+// which falls back to RGBA8 when the adapter lacks BC texture compression
+static UctTarget            transcodeTarget = UCT_TARGET_BC1;
+static unsigned             transcodeThreads = 1;
+static std::vector<uint8_t> transcodeBuf;
+static uint64_t             transcodeTextures = 0;
+static uint64_t             transcodeBytesIn = 0;  // UCT bytes received
+static uint64_t             transcodeBytesOut = 0; // bytes uploaded after transcoding
+static uint64_t             transcodeNs = 0;
+
+// compressed vertex & index buffers decoded (see meshcodec.hh)
+static uint64_t meshBuffers = 0;
+static uint64_t meshBytesIn = 0;  // encoded bytes received
+static uint64_t meshBytesOut = 0; // bytes decoded into buffers
+static uint64_t meshNs = 0;
+
+// timers drives all per-connection timing (a single libev timer for all connections)
+static TimerWheel timers;
+
+// Trust policy (-trust=self|<uid>[,<uid>...]): clients whose UNIX socket peer credentials
+// match are trusted and get a device with Dawn validation turned off, and a window of
+// their own (see Conn::openDevice.)
+static bool                  trustSelf = false;
+static std::vector<uid_t>    trustUids;
+
+// Native presents run on presenter unless -sync-present is set. A device is "lent" from
+// the time a present or compile job using it is submitted until the job is done
+// (lentDevices has an entry per job.) Worker threads use a device with its DeviceLock
+// held, which the runloop takes where it uses the device (deviceLocks.tryLock.) A
+// connection which needs its device while a worker has it waits, with its input held,
+// until the job is done (see Conn::acquireDevice); the others go on.
+static bool                    syncPresent = false;
+static PresentThread           presenter;
+static std::vector<WGPUDevice> lentDevices;
+static DeviceLocks             deviceLocks;
+static DeviceLock              sharedDeviceLock; // of the global device
+
+static bool deviceLent(WGPUDevice d) {
+  return std::find(lentDevices.begin(), lentDevices.end(), d) != lentDevices.end();
+}
+
+// Shader modules & pipelines are compiled on compileThreads when -compile-threads=<n> is
+// set (see Conn::handleCommands.) Like a present, a compile job has its device's lock,
+// which on the global device would make every client sharing it wait for the whole
+// compile. So with compile threads every connection has a device of its own (see
+// Conn::openDevice) and a compile only holds back the connection compiling.
+static uint32_t       compileThreadCount = 0;
+static CompileThreads compileThreads;
+
+// Dawn objects of closed connections are released a slice per runloop iteration
+// (-teardown-budget=<ms>; 0 = all at once, when the connection is deleted.) Objects of
+// the global device wait while a worker thread has its lock.
+static TeardownQueue teardown;
+static double        teardownBudget = 0.001;
+
+// -warmup=<path>: creation commands of recorded sessions replayed before accepting clients
+static Warmup                   warmup;
+static std::vector<std::string> warmupPaths;
+
+// -assets=<path>: asset packs clients can have buffers & textures made from (assetpack.hh)
+static AssetStore               assetStore;
+static std::vector<std::string> assetPaths;
+static uint64_t                 assetsQueried = 0;     // assets clients asked about
+static uint64_t                 assetsFound = 0;       // of those, assets in assetStore
+static uint64_t                 assetUploads = 0;      // buffers & textures made from assets
+static uint64_t                 assetMisses = 0;       // of those, left empty (not found)
+static uint64_t                 assetBytesAvoided = 0; // bytes uploaded from the packs
+static uint64_t                 assetUploadNs = 0;
+
+// frameScheduler sends frame signals, spreading clients across the frame interval
+// (-no-stagger: signal all clients at once)
+static FrameScheduler frameScheduler;
+
+// HUD overlay (-hud, toggled with the H key)
+static bool hudEnabled = false;
+static Hud  hud; // for the shared device
+
+// upscaling of frames rendered at a render scale below 1 (see sendRenderScale)
+static Upscaler upscaler; // for the shared device
+
 static GLFWwindow* window = nullptr;
 static std::unique_ptr<dawn_native::Instance> instance;
 
 DawnProcTable        nativeProcs;
+DawnProcTable        serverProcs; // nativeProcs with hooks, used by WireServer
 dawn_native::Adapter backendAdapter;
 wgpu::Device         device;
 wgpu::Surface        surface;
@@ -129,36 +283,428 @@ DawnRemoteProtocol::FramebufferInfo framebufferInfo = {
 };
 
 void createDawnSwapChain();
+wgpu::Device createDawnDeviceWithToggles(const std::vector<const char*>& toggles);
+wgpu::SwapChain createDawnSwapChainFor(
+  const wgpu::Device& device, const wgpu::Surface& surface,
+  const DawnRemoteProtocol::FramebufferInfo& fb);
+GLFWwindow* createWindow(const char* title, DawnRemoteProtocol::FramebufferInfo* fb);
+void updateFramebufferInfo(
+  GLFWwindow* w, DawnRemoteProtocol::FramebufferInfo* fb, uint32_t width, uint32_t height);
+
+struct Conn;
+static Conn* currentConn = nullptr; // connection in HandleCommands
+static void lendDevice(WGPUDevice d);
+static void presentSwapChain(WGPUSwapChain sc, DeviceLock* lock, WGPUDevice dev);
+static void deferPresent(Conn* c, WGPUSwapChain sc);
+static void submitCommands(
+  Conn* c, WGPUQueue queue, uint32_t count, WGPUCommandBuffer const* commands);
+static bool batchSubmits = false; // -batch-submits
+static bool catchUp = false;      // -catch-up: present the newest of the frames read
 
 // Conn is a connection to a client
 struct Conn {
   uint32_t              id;
   DawnRemoteProtocol    _proto;
   dawn_wire::WireServer _wireServer;
+  PerfStats             _perf;
+
+  // Trusted connections, and all connections with -compile-threads, have their own
+  // device (created with validation turned off if trusted) and a swapchain for that
+  // device. A surface presents the swapchain of one device only, so the swapchain is on
+  // a window of the connection's own (unless headless.) Other connections share the
+  // global ones.
+  bool            trusted = false;
+  wgpu::Device    _device;
+  wgpu::SwapChain _swapchain;
+  GLFWwindow*     _window = nullptr;
+  wgpu::Surface   _surface;
+  ev_timer        _resizeTimer; // debounces resizes of _window
+
+  // framebuffer info of _window
+  DawnRemoteProtocol::FramebufferInfo _framebufferInfo = framebufferInfo;
+
+  Hud             _hud; // for _device
+  Upscaler        _upscaler; // for _device
+  DeviceLock      _deviceLock; // for _device
+
+  // true while input is held until the device can be had (see acquireDevice)
+  bool _waitingForDevice = false;
+
+  // time spent in HandleCommands
+  uint64_t _handleCommandsNs = 0;
+
+  // frame stats
+  uint64_t _startNs = 0;           // when the connection was accepted
+  uint64_t _firstPresentNs = 0;    // time from accept to the first present (0 = none yet)
+  uint64_t _presents = 0;
+  uint64_t _framesDropped = 0;     // frame signals not answered by a present before the next
+  uint64_t _frameSignalNs = 0;     // when the unanswered frame signal was sent (0 = none)
+  uint64_t _frameLatencyNs = 0;    // sum of frame signal -> present times
+  uint64_t _frameLatencyCount = 0;
+  uint64_t _hudDrawNs = 0;
+  uint64_t _hudDraws = 0;
+
+  // present requested by the client but not yet submitted. Deferred until all input
+  // received so far has been handled, so that only the latest frame of a backlog is
+  // presented.
+  WGPUSwapChain _pendingPresent = nullptr;
+  uint32_t      _pendingFrames = 0; // frames handled since the last submitPresent
+  uint64_t      _presentsSkipped = 0;
+
+  // -catch-up: input handled in one go which held more than one frame, and the
+  // presents skipped in it
+  uint64_t      _catchUps = 0;
+  uint64_t      _presentsCoalesced = 0;
+
+  // -compile-threads: the shadow compiled in, and the commands to hand to _wireServer
+  // once the job compiling the first of them is done
+  std::unique_ptr<CompileShadow> _compileShadow;
+  std::vector<char>              _compileRest;
+  size_t                         _compileLen = 0; // of _compileRest, compiled by the job
+  uint64_t                       _compiles = 0;
+  bool                           _compiling = false; // a job is using _compileShadow
+
+  // true while the batch holds queue submits made by this connection (-batch-submits)
+  bool _submitsDeferred = false;
+
+  CaptureWriter _capture; // -capture
+  Advisor       _advisor; // -advisor
+
+  // buffers created mapped for compressed mesh data or assets, by token, until the
+  // data arrives
+  struct MappedBuffer {
+    WGPUBuffer buffer;
+    uint64_t   size;
+  };
+  std::unordered_map<uint32_t,MappedBuffer> _meshBuffers;
+  std::unordered_map<uint32_t,MappedBuffer> _assetBuffers;
+
+  // render target for frames rendered at a render scale below 1 (sendRenderScale),
+  // upscaled to the swapchain when the client presents
+  wgpu::Texture _renderTarget;
+  uint32_t      _renderTargetId = 0, _renderTargetGeneration = 0;
+  uint32_t      _renderTargetWidth = 0, _renderTargetHeight = 0;
+  uint32_t      _renderScale = 1000;
+  uint64_t      _upscales = 0;
+  uint64_t      _upscaleNs = 0;
+
+  // counters at the previous HUD update, for computing rates
+  struct {
+    uint64_t presents, bytesIn, bytesOut, frameLatencyNs, frameLatencyCount;
+  } _hudPrev = {};
+
+  // memory attribution (-memstats)
+  int64_t _heapInit = 0;     // heap allocated by constructing the Conn (WireServer tables)
+  int64_t _heapCommands = 0; // net heap growth during HandleCommands (wire objects & Dawn objects)
 
   Conn(uint32_t id_) :
     id(id_),
-    _wireServer({ .procs = &nativeProcs, .serializer = &_proto })
+    _wireServer({ .procs = &serverProcs, .serializer = &_proto })
   {
+    _proto.perf = &_perf;
+
     _proto.onDawnBuffer = [this](const char* data, size_t len) {
       // dlog("onDawnBuffer len=%zu", len);
       assert(data != nullptr);
-      if (_wireServer.HandleCommands(data, len) == nullptr)
-        dlog("onDawnBuffer: _wireServer.HandleCommands FAILED");
-      if (!_proto.Flush())
-        dlog("_proto.Flush() FAILED");
+      if (_capture.isOpen() && !_capture.commands(data, len))
+        stopCapture();
+      handleDawnBuffer(data, len, 0);
+    };
+
+    _proto.acquireDevice = [this]() { return acquireDevice(); };
+
+    ev_init(&_resizeTimer, onResizeTimer);
+    _resizeTimer.repeat = 0.100;
+    _resizeTimer.data = this;
+
+    _proto.drainInput = catchUp;
+    _proto.onInputProcessed = [this]() {
+      if (_pendingPresent) {
+        if (!acquireDevice()) {
+          _proto.holdInput(); // called again once resumed
+          return;
+        }
+        if (catchUp && _pendingFrames > 1) {
+          _catchUps++;
+          _presentsCoalesced += _pendingFrames - 1;
+        }
+        uint64_t start = monotimeNs();
+        submitPresent();
+        frameScheduler.addCost(this, monotimeNs() - start);
+      }
     };
 
     _proto.onSwapchainReservation = [this](const dawn_wire::ReservedSwapChain& scr) {
       this->onSwapchainReservation(scr);
     };
 
+    _advisor.onWarning = [this](const char* msg) {
+      fprintf(stderr, "W client #%u: %s\n", id, msg);
+      fflush(stderr);
+    };
+
+    _proto.onCompressedTexture = [this](
+      const DawnRemoteProtocol::CompressedTextureInfo& info, const char* data, size_t len)
+    {
+      if (_capture.isOpen() && !_capture.texture(info, data, len))
+        stopCapture();
+      onCompressedTexture(info, data, len);
+    };
+
+    _proto.onCompressedMeshBuffer = [this](
+      const DawnRemoteProtocol::CompressedMeshBufferInfo& info, const char* data, size_t len)
+    {
+      if (_capture.isOpen() && !_capture.meshBuffer(info, data, len))
+        stopCapture();
+      onCompressedMeshBuffer(info, data, len);
+    };
+
+    _proto.onRenderScale = [this](const DawnRemoteProtocol::RenderScaleInfo& info) {
+      if (_capture.isOpen() && !_capture.renderScale(info))
+        stopCapture();
+      onRenderScale(info);
+    };
+
+    _proto.onAssetQuery = [this](const DawnRemoteProtocol::AssetRef* assets, size_t n) {
+      onAssetQuery(assets, n);
+    };
+
+    _proto.onAsset = [this](const DawnRemoteProtocol::AssetInfo& info) {
+      if (_capture.isOpen() && !_capture.asset(info))
+        stopCapture();
+      onAsset(info);
+    };
+
+    _proto.linkProbes = false; // until the client's hello says it knows them
+    _proto.onHello = [this](uint32_t version) {
+      if (version < PROTOCOL_VERSION_MIN || version > PROTOCOL_VERSION) {
+        errlog("client #%u: unsupported protocol version %u", id, version);
+        _proto.stop(); // closed by the next sendFrameSignal
+        return;
+      }
+      _proto.linkProbes = version >= PROTOCOL_VERSION_PROBES;
+    };
+
     // Hardcoded generation and IDs need to match what's produced by the client
     // or be sent over through the wire.
     //_wireServer.InjectDevice(device.Get(), 1, 0);
     //_wireServer.InjectSwapChain(swapchain.Get(), 1, 0, 1, 0);
     // kangz: Maybe we should inject the surface instead and just let the client
     // create its swapchain??
+
+    metricsRegister(this, [this](MetricsWriter& w) {
+      w.scope("conn.%u", id);
+      w.counter("trusted", trusted);
+      w.counter("frames", _perf.frames);
+      w.counter("handle_commands_ns", _handleCommandsNs);
+      w.counter("presents", _presents);
+      w.counter("first_present_ns", _firstPresentNs);
+      w.gauge("frame_phase_us", frameScheduler.phase(this) * 1e6);
+      w.gauge("frame_cost_us", frameScheduler.cost(this) * 1e6);
+      w.counter("frames_dropped", _framesDropped);
+      w.counter("frame_latency_ns", _frameLatencyNs);
+      w.counter("bytes_in", _proto.bytesIn);
+      w.counter("bytes_out", _proto.bytesOut);
+      _proto.link.writeMetrics(w);
+      if (_proto.zeroCopyThreshold > 0) {
+        w.counter("zero_copy.sends", _proto.zeroCopySends);
+        w.counter("zero_copy.bytes", _proto.zeroCopyBytes);
+        w.counter("zero_copy.copied", _proto.zeroCopyCopied);
+      }
+      if (_proto.templateInstances > 0) {
+        w.counter("template.instances", _proto.templateInstances);
+        w.counter("template.bytes", _proto.templateBytes);
+      }
+      w.gauge("render_scale", (double)_renderScale / 1000.0);
+      if (_upscales > 0) {
+        w.counter("render_scale.upscales", _upscales);
+        w.counter("render_scale.upscale_ns", _upscaleNs);
+      }
+      w.counter("hud_draw_ns", _hudDrawNs);
+      w.counter("presents_skipped", _presentsSkipped);
+      w.counter("presents_coalesced", _presentsCoalesced);
+      w.counter("catch_ups", _catchUps);
+      if (_compileShadow) {
+        w.counter("compile.jobs", _compiles);
+        w.counter("compile.mirrored", _compileShadow->mirrored);
+        w.counter("compile.mirror_failed", _compileShadow->failed);
+      }
+      if (_capture.isOpen())
+        w.counter("capture_bytes", _capture.bytes);
+      if (advisorEnabled) {
+        w.counter("advisor.pipelines_created", _advisor.pipelinesCreated);
+        w.counter("advisor.writes", _advisor.writes);
+        w.counter("advisor.write_bytes", _advisor.writeBytes);
+        w.counter("advisor.redundant_writes", _advisor.redundantWrites);
+        w.counter("advisor.redundant_write_bytes", _advisor.redundantWriteBytes);
+        w.counter("advisor.submits", _advisor.submits);
+        w.counter("advisor.command_buffers", _advisor.commandBuffers);
+        for (int k = 0; k < Advisor::KindCount; k++) {
+          w.counter(
+            (std::string("advisor.warnings.") + Advisor::kindName((Advisor::Kind)k)).c_str(),
+            _advisor.warnings[k]);
+        }
+      }
+      _perf.writeMetrics(w);
+      if (memstats) {
+        w.counter("mem.heap_init", (uint64_t)std::max((int64_t)0, _heapInit));
+        w.counter("mem.heap_commands", (uint64_t)std::max((int64_t)0, _heapCommands));
+      }
+    });
+  }
+
+  ~Conn() {
+    deviceLocks.forget(&_deviceLock);
+    ev_timer_stop(EV_DEFAULT, &_resizeTimer);
+    metricsUnregister(this);
+    frameScheduler.remove(this);
+    if (_pendingPresent)
+      nativeProcs.swapChainRelease(_pendingPresent);
+    for (auto* buffers : { &_meshBuffers, &_assetBuffers }) {
+      for (auto& it : *buffers) {
+        nativeProcs.bufferUnmap(it.second.buffer);
+        nativeProcs.bufferRelease(it.second.buffer);
+      }
+    }
+  }
+
+  WGPUDevice dawnDevice() const {
+    return ownDevice() ? _device.Get() : device.Get();
+  }
+
+  bool ownDevice() const {
+    return _device.Get() != nullptr;
+  }
+
+  const DawnRemoteProtocol::FramebufferInfo& fbinfo() const {
+    return _window ? _framebufferInfo : framebufferInfo;
+  }
+
+  // openDevice creates the connection's own device, and its window & swapchain.
+  // Returns false if the window could not be created.
+  bool openDevice() {
+    std::vector<const char*> toggles;
+    if (trusted)
+      toggles.push_back("skip_validation");
+    _device = createDawnDeviceWithToggles(toggles);
+    if (!headless) {
+      std::string title = "hello-wire #" + std::to_string(id);
+      _window = createWindow(title.c_str(), &_framebufferInfo);
+      if (!_window)
+        return false;
+      glfwSetWindowUserPointer(_window, this);
+      _surface = utils::CreateSurfaceForWindow(instance->Get(), _window);
+    }
+    _swapchain = createDawnSwapChainFor(_device, _surface, fbinfo());
+    return true;
+  }
+
+  // onFramebufferResize is called when _window's framebuffer has changed size. As for
+  // the main window, the swapchain is recreated once resizing has settled.
+  void onFramebufferResize(uint32_t width, uint32_t height) {
+    updateFramebufferInfo(_window, &_framebufferInfo, width, height);
+    ev_timer_again(EV_DEFAULT, &_resizeTimer);
+  }
+
+  static void onResizeTimer(RunLoop* rl, ev_timer* w, int revents) {
+    Conn* c = (Conn*)w->data;
+    if (deviceLent(c->_device.Get()) || !c->lockDevice())
+      return; // the swapchain is being presented; the timer repeats
+    ev_timer_stop(rl, w);
+    c->_swapchain = createDawnSwapChainFor(c->_device, c->_surface, c->_framebufferInfo);
+    c->sendFramebufferInfo();
+  }
+
+  DeviceLock* deviceLock() {
+    return ownDevice() ? &_deviceLock : &sharedDeviceLock;
+  }
+
+  bool lockDevice() {
+    return deviceLocks.tryLock(deviceLock());
+  }
+
+  // acquireDevice is called before handling input which uses the device. If a worker
+  // thread has it, the connection waits until the worker's job is done (resume.)
+  bool acquireDevice() {
+    if (!lockDevice()) {
+      _waitingForDevice = true;
+      return false;
+    }
+    return true;
+  }
+
+  // resume is called when a compile job of the connection is done, and when a job of
+  // any device is done while the connection is waiting for its device. Commands held
+  // back for the compile job are handled, then input is resumed, unless the device is
+  // still not to be had or the commands started another compile job.
+  void resume() {
+    _waitingForDevice = false;
+    if (_compiling)
+      return; // resumed once compiled
+    if (!_compileRest.empty()) {
+      if (!lockDevice()) {
+        _waitingForDevice = true;
+        return;
+      }
+      std::vector<char> rest;
+      rest.swap(_compileRest);
+      handleDawnBuffer(rest.data(), rest.size(), _compileLen);
+      if (_compiling)
+        return;
+    }
+    _proto.resumeInput();
+  }
+
+  // inUse returns true while a worker thread may use what deleting the connection
+  // releases: its compile shadow, or its own device & swapchain
+  bool inUse() const {
+    return _compiling || (ownDevice() && deviceLent(_device.Get()));
+  }
+
+  // handleDawnBuffer handles wire commands, the first compiledLen bytes of which have
+  // been compiled on a compile thread already
+  void handleDawnBuffer(const char* data, size_t len, size_t compiledLen) {
+    uint64_t start = monotimeNs();
+    {
+      PerfScope ps(&_perf, PerfStageHandleCommands);
+      int64_t heap0 = memstats ? processHeapInUse() : 0;
+      uint64_t t0 = monotimeNs();
+      currentConn = this;
+      handleCommands(data, len, compiledLen);
+      currentConn = nullptr;
+      _handleCommandsNs += monotimeNs() - t0;
+      if (memstats)
+        _heapCommands += processHeapInUse() - heap0;
+    }
+    if (!_proto.Flush())
+      dlog("_proto.Flush() FAILED");
+    frameScheduler.addCost(this, monotimeNs() - start);
+  }
+
+  // handleCommands hands wire commands to _wireServer. With -compile-threads, commands
+  // from the first shader module or pipeline creation after compiledLen on are held
+  // back: the creations are compiled
+  // in _compileShadow on a compile thread, and the held back commands handled once that
+  // is done (resume), when _wireServer finds the objects in Dawn's caches. Meanwhile
+  // input of this connection is held.
+  void handleCommands(const char* data, size_t len, size_t compiledLen) {
+    size_t end = len, runEnd = len;
+    if (_compileShadow) {
+      end = compiledLen +
+            _compileShadow->split(&data[compiledLen], len - compiledLen, &runEnd);
+      runEnd += compiledLen;
+    }
+    if (end > 0 && _wireServer.HandleCommands(data, end) == nullptr)
+      dlog("handleCommands: _wireServer.HandleCommands FAILED");
+    if (end == len)
+      return;
+    _compileRest.assign(&data[end], &data[len]);
+    _compileLen = runEnd - end;
+    _compiles++;
+    _compiling = true;
+    compileThreads.submit(_compileShadow.get(), deviceLock(), &data[end], _compileLen, this);
+    lendDevice(dawnDevice());
+    _proto.holdInput();
   }
 
   void onSwapchainReservation(const dawn_wire::ReservedSwapChain& scr) {
@@ -175,8 +721,21 @@ struct Conn {
     // };
     // swapchain = device.CreateSwapChain(surface, &desc); // global var
 
+    WGPUDevice dev = dawnDevice();
+    WGPUSwapChain sc = ownDevice() ? _swapchain.Get() : swapchain.Get();
+
+    if (_capture.isOpen() && !_capture.reservation(scr))
+      stopCapture();
+
     if (_wireServer.GetDevice(scr.deviceId, scr.deviceGeneration) == nullptr) {
-      if (_wireServer.InjectDevice(device.Get(), scr.deviceId, scr.deviceGeneration)) {
+      if (compileThreads.started() && ownDevice()) {
+        // before _wireServer, so that the device's callbacks are those of _wireServer
+        if (!_compileShadow)
+          _compileShadow.reset(new CompileShadow(nativeProcs));
+        if (!_compileShadow->injectDevice(dev, scr.deviceId, scr.deviceGeneration))
+          dlog("onSwapchainReservation _compileShadow->injectDevice FAILED");
+      }
+      if (_wireServer.InjectDevice(dev, scr.deviceId, scr.deviceGeneration)) {
         dlog("onSwapchainReservation _wireServer.InjectDevice OK");
       } else {
         dlog("onSwapchainReservation _wireServer.InjectDevice FAILED");
@@ -184,7 +743,7 @@ struct Conn {
     }
 
     if (_wireServer.InjectSwapChain(
-           swapchain.Get(), scr.id, scr.generation, scr.deviceId, scr.deviceGeneration))
+           sc, scr.id, scr.generation, scr.deviceId, scr.deviceGeneration))
     {
       dlog("onSwapchainReservation _wireServer.InjectSwapChain OK");
       // createDawnSwapChain();
@@ -206,15 +765,332 @@ struct Conn {
     // }
   }
 
+  // onCompressedTexture creates a texture for the client's texture reservation and
+  // uploads the transcoded UCT image into it
+  void onCompressedTexture(
+    const DawnRemoteProtocol::CompressedTextureInfo& info, const char* data, size_t len)
+  {
+    uint32_t w = info.width, h = info.height;
+    if (w == 0 || h == 0 || w % 4 != 0 || h % 4 != 0 || w > 16384 || h > 16384 ||
+        len != uctSize(w, h))
+    {
+      errlog("client #%u: invalid compressed texture (%ux%u, %zu bytes)", id, w, h, len);
+      return;
+    }
+    uint64_t t0 = monotimeNs();
+    WGPUDevice dev = dawnDevice();
+
+    WGPUTextureDescriptor desc = {};
+    desc.usage = WGPUTextureUsage_Sampled | WGPUTextureUsage_CopyDst | WGPUTextureUsage_CopySrc;
+    desc.dimension = WGPUTextureDimension_2D;
+    desc.size = { w, h, 1 };
+    desc.format = transcodeTarget == UCT_TARGET_BC1 ?
+      WGPUTextureFormat_BC1RGBAUnorm : WGPUTextureFormat_RGBA8Unorm;
+    desc.mipLevelCount = 1;
+    desc.sampleCount = 1;
+    WGPUTexture texture = nativeProcs.deviceCreateTexture(dev, &desc);
+
+    size_t size = uctTargetSize(transcodeTarget, w, h);
+    if (transcodeBuf.size() < size)
+      transcodeBuf.resize(size);
+    uctTranscode(
+      (const uint8_t*)data, w, h, transcodeTarget, transcodeBuf.data(), transcodeThreads);
+
+    WGPUImageCopyTexture dst = {};
+    dst.texture = texture;
+    dst.aspect = WGPUTextureAspect_All;
+    WGPUTextureDataLayout layout = {};
+    layout.bytesPerRow = uctTargetBytesPerRow(transcodeTarget, w);
+    layout.rowsPerImage = transcodeTarget == UCT_TARGET_BC1 ? h / 4 : h; // rows of blocks
+    WGPUExtent3D extent = { w, h, 1 };
+    WGPUQueue queue = nativeProcs.deviceGetQueue(dev);
+    nativeProcs.queueWriteTexture(queue, &dst, transcodeBuf.data(), size, &layout, &extent);
+    nativeProcs.queueRelease(queue);
+
+    if (!_wireServer.InjectTexture(
+          texture, info.id, info.generation, info.deviceId, info.deviceGeneration))
+    {
+      errlog("client #%u: InjectTexture failed", id);
+    }
+    nativeProcs.textureRelease(texture); // the wire server holds a reference
+
+    transcodeTextures++;
+    transcodeBytesIn += len;
+    transcodeBytesOut += size;
+    transcodeNs += monotimeNs() - t0;
+  }
+
+  // onRenderScale creates a render target of the framebuffer's size for the client's
+  // texture reservation, unless it has one for it already, and sets the scale frames
+  // presented from now on were rendered at
+  void onRenderScale(const DawnRemoteProtocol::RenderScaleInfo& info) {
+    if (info.scale < RENDER_SCALE_MIN || info.scale > 1000) {
+      errlog("client #%u: invalid render scale %u", id, info.scale);
+      return;
+    }
+    if (!_renderTarget || info.id != _renderTargetId ||
+        info.generation != _renderTargetGeneration)
+    {
+      WGPUTextureDescriptor desc = {};
+      desc.usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_Sampled;
+      desc.dimension = WGPUTextureDimension_2D;
+      desc.size = { fbinfo().width, fbinfo().height, 1 };
+      desc.format = (WGPUTextureFormat)fbinfo().textureFormat;
+      desc.mipLevelCount = 1;
+      desc.sampleCount = 1;
+      WGPUTexture texture = nativeProcs.deviceCreateTexture(dawnDevice(), &desc);
+      if (!_wireServer.InjectTexture(
+            texture, info.id, info.generation, info.deviceId, info.deviceGeneration))
+      {
+        errlog("client #%u: InjectTexture failed", id);
+        nativeProcs.textureRelease(texture);
+        return;
+      }
+      _renderTarget = wgpu::Texture::Acquire(texture); // the wire server holds another
+      _renderTargetId = info.id;
+      _renderTargetGeneration = info.generation;
+      _renderTargetWidth = fbinfo().width;
+      _renderTargetHeight = fbinfo().height;
+    }
+    _renderScale = info.scale;
+  }
+
+  // upscale submits a render pass which draws the part of the render target the
+  // client rendered the presented frame into over all of sc
+  void upscale(WGPUSwapChain sc) {
+    uint64_t t0 = monotimeNs();
+    Upscaler& u = ownDevice() ? _upscaler : upscaler;
+    u.format = fbinfo().textureFormat;
+    wgpu::CommandBuffer commands = u.encode(
+      ownDevice() ? _device : device, _renderTarget, _renderTargetWidth, _renderTargetHeight,
+      renderScaleSize(_renderTargetWidth, _renderScale),
+      renderScaleSize(_renderTargetHeight, _renderScale),
+      wgpu::SwapChain(sc));
+    WGPUCommandBuffer cb = commands.Get();
+    WGPUQueue queue = nativeProcs.deviceGetQueue(dawnDevice());
+    submitCommands(this, queue, 1, &cb);
+    nativeProcs.queueRelease(queue);
+    _upscales++;
+    _upscaleNs += monotimeNs() - t0;
+  }
+
+  // addMappedBuffer is called when the client creates a buffer for compressed mesh data
+  // or an asset, which serverDeviceCreateBuffer has created mapped
+  void addMappedBuffer(
+    std::unordered_map<uint32_t,MappedBuffer>& buffers, uint32_t token, WGPUBuffer buffer,
+    uint64_t size)
+  {
+    nativeProcs.bufferReference(buffer);
+    auto it = buffers.find(token);
+    if (it != buffers.end()) {
+      nativeProcs.bufferUnmap(it->second.buffer);
+      nativeProcs.bufferRelease(it->second.buffer);
+    }
+    buffers[token] = { buffer, size };
+  }
+
+  // onCompressedMeshBuffer decodes vertex or index data into the mapped buffer made
+  // for the token, then unmaps it for use by the client's commands
+  void onCompressedMeshBuffer(
+    const DawnRemoteProtocol::CompressedMeshBufferInfo& info, const char* data, size_t len)
+  {
+    auto it = _meshBuffers.find(info.token);
+    if (it == _meshBuffers.end()) {
+      errlog("client #%u: compressed mesh buffer for unknown token %u", id, info.token);
+      return;
+    }
+    MappedBuffer mb = it->second;
+    _meshBuffers.erase(it);
+    uint64_t t0 = monotimeNs();
+    size_t size = (size_t)info.count * info.stride;
+    void* dst = size <= mb.size ? nativeProcs.bufferGetMappedRange(mb.buffer, 0, mb.size) : nullptr;
+    bool ok = false;
+    if (dst && info.kind == MESH_BUFFER_VERTICES) {
+      ok = meshDecodeVertices((const uint8_t*)data, len, info.count, info.stride, dst);
+    } else if (dst && info.kind == MESH_BUFFER_INDICES) {
+      ok = meshDecodeIndices((const uint8_t*)data, len, info.count, info.stride, dst);
+    }
+    if (!ok) {
+      errlog("client #%u: invalid compressed mesh buffer (kind %u, %u x %u bytes)",
+        id, info.kind, info.count, info.stride);
+    }
+    nativeProcs.bufferUnmap(mb.buffer);
+    nativeProcs.bufferRelease(mb.buffer);
+    meshBuffers++;
+    meshBytesIn += len;
+    meshBytesOut += ok ? size : 0;
+    meshNs += monotimeNs() - t0;
+  }
+
+  // onAssetQuery tells the client which of the assets it asked about are in assetStore
+  void onAssetQuery(const DawnRemoteProtocol::AssetRef* assets, size_t n) {
+    std::vector<uint8_t> found(n);
+    for (size_t i = 0; i < n; i++) {
+      found[i] = assetStore.find(assets[i].hash, assets[i].size) != nullptr;
+      assetsFound += found[i];
+    }
+    assetsQueried += n;
+    _proto.sendAssetQueryReply(found.data(), n);
+  }
+
+  // onAsset uploads an asset of assetStore straight from its mapping into the mapped
+  // buffer made for the token, or into a texture it creates for the client's texture
+  // reservation. Assets not in the store leave the buffer or texture empty.
+  void onAsset(const DawnRemoteProtocol::AssetInfo& info) {
+    uint64_t t0 = monotimeNs();
+    const AssetStore::Asset* a = assetStore.find(info.asset.hash, info.asset.size);
+    if (info.kind == ASSET_BUFFER) {
+      auto it = _assetBuffers.find(info.token);
+      if (it == _assetBuffers.end()) {
+        errlog("client #%u: asset for unknown buffer token %u", id, info.token);
+        return;
+      }
+      MappedBuffer mb = it->second;
+      _assetBuffers.erase(it);
+      if (a && a->size <= mb.size) {
+        void* dst = nativeProcs.bufferGetMappedRange(mb.buffer, 0, mb.size);
+        if (dst)
+          memcpy(dst, a->data, a->size);
+      } else {
+        a = nullptr;
+      }
+      nativeProcs.bufferUnmap(mb.buffer);
+      nativeProcs.bufferRelease(mb.buffer);
+    } else if (info.kind == ASSET_TEXTURE) {
+      WGPUTextureFormat format = (WGPUTextureFormat)info.format;
+      size_t size = assetTextureSize(format, info.width, info.height);
+      if (size == 0) {
+        errlog("client #%u: invalid asset texture (%ux%u, format %u)",
+          id, info.width, info.height, info.format);
+        return;
+      }
+      WGPUDevice dev = dawnDevice();
+      WGPUTextureDescriptor desc = {};
+      desc.usage = WGPUTextureUsage_Sampled | WGPUTextureUsage_CopyDst | WGPUTextureUsage_CopySrc;
+      desc.dimension = WGPUTextureDimension_2D;
+      desc.size = { info.width, info.height, 1 };
+      desc.format = format;
+      desc.mipLevelCount = 1;
+      desc.sampleCount = 1;
+      WGPUTexture texture = nativeProcs.deviceCreateTexture(dev, &desc);
+      if (a && a->size == size) {
+        WGPUImageCopyTexture dst = {};
+        dst.texture = texture;
+        dst.aspect = WGPUTextureAspect_All;
+        WGPUTextureDataLayout layout = {};
+        layout.bytesPerRow = assetTextureBytesPerRow(format, info.width);
+        layout.rowsPerImage = (uint32_t)(size / layout.bytesPerRow); // rows of blocks
+        WGPUExtent3D extent = { info.width, info.height, 1 };
+        WGPUQueue queue = nativeProcs.deviceGetQueue(dev);
+        nativeProcs.queueWriteTexture(queue, &dst, a->data, size, &layout, &extent);
+        nativeProcs.queueRelease(queue);
+      } else {
+        a = nullptr;
+      }
+      if (!_wireServer.InjectTexture(
+            texture, info.id, info.generation, info.deviceId, info.deviceGeneration))
+      {
+        errlog("client #%u: InjectTexture failed", id);
+      }
+      nativeProcs.textureRelease(texture); // the wire server holds a reference
+    } else {
+      errlog("client #%u: invalid asset kind %u", id, info.kind);
+      return;
+    }
+    if (!a) {
+      errlog("client #%u: asset %016llx (%llu bytes) not found", id,
+        (unsigned long long)info.asset.hash, (unsigned long long)info.asset.size);
+      assetMisses++;
+    } else {
+      assetBytesAvoided += a->size;
+    }
+    assetUploads++;
+    assetUploadNs += monotimeNs() - t0;
+  }
+
   void start(RunLoop* rl, int fd) {
+    _proto.timers = &timers;
+    // trusted clients are not policed for being idle or not reading
+    _proto.idleTimeout = trusted ? 0 : idleTimeout;
+    _proto.writeStallTimeout = trusted ? 0 : stallTimeout;
+    _startNs = monotimeNs();
     _proto.start(rl, fd);
+    frameScheduler.add(this);
+    if (captureDir) {
+      std::string filename = std::string(captureDir) + "/conn-" + std::to_string(id) + ".dcap";
+      if (_capture.open(filename.c_str())) {
+        dlog("client #%u: capturing to %s", id, filename.c_str());
+      } else {
+        errlog("%s: %s", filename.c_str(), strerror(errno));
+      }
+    }
+  }
+
+  void stopCapture() {
+    errlog("client #%u: capture write failed: %s", id, strerror(errno));
+    _capture.close();
   }
 
   bool sendFramebufferInfo() {
     if (_proto.stopped())
       return false;
     dlog("sending framebuffer info to client #%u", this->id);
-    return _proto.sendFramebufferInfo(framebufferInfo);
+    return _proto.sendFramebufferInfo(fbinfo());
+  }
+
+  // onPresent is called when the client presents its swapchain
+  void onPresent(WGPUSwapChain sc) {
+    if (_presents++ == 0)
+      _firstPresentNs = monotimeNs() - _startNs;
+    if (_capture.isOpen() && !_capture.endFrame())
+      stopCapture();
+    if (advisorEnabled)
+      _advisor.endFrame();
+    if (_frameSignalNs != 0) {
+      _frameLatencyNs += monotimeNs() - _frameSignalNs;
+      _frameLatencyCount++;
+      _frameSignalNs = 0;
+    }
+    // submitted now, after the frame's commands and before the next frame's
+    if (_renderTarget && _renderScale < 1000)
+      upscale(sc);
+    // latest wins: a frame which is followed by another one before it was submitted
+    // is not presented (the next frame draws over the same swapchain texture.)
+    nativeProcs.swapChainReference(sc);
+    if (_pendingPresent) {
+      nativeProcs.swapChainRelease(_pendingPresent);
+      _presentsSkipped++;
+    }
+    _pendingPresent = sc;
+    _pendingFrames++;
+  }
+
+  // submitPresent draws the HUD on top of the pending frame and presents it
+  void submitPresent() {
+    WGPUSwapChain sc = _pendingPresent;
+    _pendingPresent = nullptr;
+    _pendingFrames = 0;
+    if (batchSubmits && !ownDevice()) {
+      // presented with the batch, after this frame's submits
+      deferPresent(this, sc);
+      return;
+    }
+    drawHud(sc);
+    presentSwapChain(sc, deviceLock(), dawnDevice());
+  }
+
+  void drawHud(WGPUSwapChain sc) {
+    if (hudEnabled) {
+      PerfScope ps(&_perf, PerfStageHud);
+      uint64_t t0 = monotimeNs();
+      if (ownDevice()) {
+        _hud.draw(_device, wgpu::SwapChain(sc), fbinfo().width, fbinfo().height);
+      } else {
+        hud.draw(device, wgpu::SwapChain(sc), fbinfo().width, fbinfo().height);
+      }
+      _hudDrawNs += monotimeNs() - t0;
+      _hudDraws++;
+    }
   }
 
   bool sendFrameSignal() {
@@ -222,6 +1098,10 @@ struct Conn {
       close();
       return false;
     }
+    uint64_t now = monotimeNs();
+    if (_frameSignalNs != 0)
+      _framesDropped++; // client did not present a frame for the previous signal
+    _frameSignalNs = now;
     // send FRAME message to client
     if (!_proto.sendFrameSignal()) {
       dlog("_proto.sendFrameSignal FAILED");
@@ -234,16 +1114,358 @@ struct Conn {
   void close();
 };
 
-Conn* conn0 = nullptr;
+// conns holds all open connections, oldest first
+static std::vector<Conn*> conns;
+
+// closingConns holds closed connections which are in use by a worker thread (see
+// Conn::inUse) or whose device's lock could not be had, until a job is done
+static std::vector<Conn*> closingConns;
+
+// presentAndRelease is the PresentFn of presenter
+static void presentAndRelease(WGPUSwapChain sc) {
+  nativeProcs.swapChainPresent(sc);
+  nativeProcs.swapChainRelease(sc);
+}
+
+// presentSwapChain presents sc (which holds a reference for us) and releases it. The
+// device is lent once per present queued; a present which supersedes a queued one
+// (latest wins) does not lend it again.
+static void presentSwapChain(WGPUSwapChain sc, DeviceLock* lock, WGPUDevice dev) {
+  if (syncPresent) {
+    presentAndRelease(sc);
+    return;
+  }
+  if (presenter.submit(sc, lock, dev)) {
+    lendDevice(dev);
+  } else {
+    nativeProcs.swapChainRelease(sc); // the queued present holds another reference
+  }
+}
+
+// Submit batching (-batch-submits[=<ms>]). Queue submits made by connections sharing
+// the global device are deferred and issued as one native submit when the batch window
+// ends, in the order they were made, followed by a single present of the shared
+// swapchain. (Clients sharing the swapchain draw over each other, so only the last
+// frame of a batch would be visible anyway.) Operations which must see earlier submits
+// (queue writes, buffer mapping, destroying resources) first issue the deferred submits
+// if the calling connection has any in the batch.
+//
+// Dawn validates a submit as a whole: an invalid command buffer from one client makes
+// the batched submit fail for all clients in it. Only use this with cooperating clients.
+static double   batchWindow = 1.0 / 60.0;
+static ev_timer batchTimer;
+static WGPUQueue batchQueue = nullptr;
+static std::vector<WGPUCommandBuffer> batchCommands;
+static WGPUSwapChain batchPresent = nullptr;     // holds a reference
+static Conn*    batchPresentConn = nullptr;      // who made batchPresent (null if closed)
+static uint64_t batchPresentsSkipped = 0;
+static uint64_t submitsClient = 0; // Queue::Submit calls made by clients
+static uint64_t submitsNative = 0; // native submits made on their behalf
+static uint64_t submitsNs = 0;     // time spent in those native submits
+
+static void onBatchTimer(RunLoop* rl, ev_timer* w, int revents);
+
+static void startBatchTimer() {
+  if (!ev_is_active(&batchTimer)) {
+    ev_timer_init(&batchTimer, onBatchTimer, batchWindow, 0.0);
+    ev_timer_start(EV_DEFAULT, &batchTimer);
+  }
+}
+
+// flushSubmits issues deferred submits as one native submit
+static void flushSubmits() {
+  if (!batchCommands.empty()) {
+    uint64_t t0 = monotimeNs();
+    nativeProcs.queueSubmit(batchQueue, (uint32_t)batchCommands.size(), batchCommands.data());
+    submitsNs += monotimeNs() - t0;
+    submitsNative++;
+    for (WGPUCommandBuffer cb : batchCommands)
+      nativeProcs.commandBufferRelease(cb);
+    batchCommands.clear();
+  }
+  for (Conn* c : conns)
+    c->_submitsDeferred = false;
+}
+
+// flushBatch ends the batch window: submits, then presents
+static void flushBatch() {
+  flushSubmits();
+  if (batchPresent) {
+    WGPUSwapChain sc = batchPresent;
+    batchPresent = nullptr;
+    if (batchPresentConn)
+      batchPresentConn->drawHud(sc);
+    batchPresentConn = nullptr;
+    presentSwapChain(sc, &sharedDeviceLock, device.Get());
+  }
+}
+
+static void onBatchTimer(RunLoop* rl, ev_timer* w, int revents) {
+  if (!deviceLocks.tryLock(&sharedDeviceLock)) {
+    // a worker thread has the device
+    ev_timer_set(w, 0.001, 0.0);
+    ev_timer_start(rl, w);
+    return;
+  }
+  flushBatch();
+}
+
+static void deferPresent(Conn* c, WGPUSwapChain sc) {
+  if (batchPresent) {
+    nativeProcs.swapChainRelease(batchPresent);
+    batchPresentsSkipped++;
+  }
+  batchPresent = sc;
+  batchPresentConn = c;
+  startBatchTimer();
+}
+
+// flushForCurrentConn issues deferred submits if the connection whose commands are
+// being handled has any
+static inline void flushForCurrentConn() {
+  if (currentConn && currentConn->_submitsDeferred)
+    flushSubmits();
+}
+
+// serverDeviceCreateBuffer creates buffers which are labelled for compressed mesh data
+// (see meshcodec.hh) or an asset (see assetpack.hh) mapped, for onCompressedMeshBuffer or
+// onAsset to fill
+static WGPUBuffer serverDeviceCreateBuffer(WGPUDevice device, WGPUBufferDescriptor const* desc) {
+  static const size_t meshPrefixLen = strlen(MESH_BUFFER_LABEL_PREFIX);
+  static const size_t assetPrefixLen = strlen(ASSET_BUFFER_LABEL_PREFIX);
+  size_t prefixLen = 0;
+  if (currentConn && desc->label && !desc->mappedAtCreation && desc->size % 4 == 0) {
+    if (strncmp(desc->label, MESH_BUFFER_LABEL_PREFIX, meshPrefixLen) == 0) {
+      prefixLen = meshPrefixLen;
+    } else if (strncmp(desc->label, ASSET_BUFFER_LABEL_PREFIX, assetPrefixLen) == 0) {
+      prefixLen = assetPrefixLen;
+    }
+  }
+  if (prefixLen == 0)
+    return nativeProcs.deviceCreateBuffer(device, desc);
+  WGPUBufferDescriptor d = *desc;
+  d.mappedAtCreation = true;
+  WGPUBuffer buffer = nativeProcs.deviceCreateBuffer(device, &d);
+  uint32_t token = (uint32_t)strtoul(&desc->label[prefixLen], nullptr, 10);
+  currentConn->addMappedBuffer(
+    prefixLen == meshPrefixLen ? currentConn->_meshBuffers : currentConn->_assetBuffers,
+    token, buffer, d.size);
+  return buffer;
+}
+
+// submitCommands submits commands of connection c (null if none), batched with those of
+// other connections with -batch-submits
+static void submitCommands(
+  Conn* c, WGPUQueue queue, uint32_t count, WGPUCommandBuffer const* commands)
+{
+  if (!batchSubmits || !c || c->ownDevice()) {
+    uint64_t t0 = monotimeNs();
+    nativeProcs.queueSubmit(queue, count, commands);
+    submitsNs += monotimeNs() - t0;
+    submitsNative++;
+    return;
+  }
+  if (queue != batchQueue) {
+    flushSubmits();
+    batchQueue = queue;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    nativeProcs.commandBufferReference(commands[i]);
+    batchCommands.push_back(commands[i]);
+  }
+  c->_submitsDeferred = true;
+  startBatchTimer();
+}
+
+// serverQueueSubmit is queueSubmit of serverProcs
+static void serverQueueSubmit(WGPUQueue queue, uint32_t count, WGPUCommandBuffer const* commands) {
+  submitsClient++;
+  if (advisorEnabled && currentConn)
+    currentConn->_advisor.submitted(count);
+  submitCommands(currentConn, queue, count, commands);
+}
+
+static void serverQueueWriteBuffer(
+  WGPUQueue queue, WGPUBuffer buffer, uint64_t offset, void const* data, size_t size)
+{
+  flushForCurrentConn();
+  if (advisorEnabled && currentConn)
+    currentConn->_advisor.bufferWritten(buffer, offset, data, size);
+  nativeProcs.queueWriteBuffer(queue, buffer, offset, data, size);
+}
+
+static void serverQueueWriteTexture(
+  WGPUQueue queue, WGPUImageCopyTexture const* destination, void const* data, size_t dataSize,
+  WGPUTextureDataLayout const* dataLayout, WGPUExtent3D const* writeSize)
+{
+  flushForCurrentConn();
+  if (advisorEnabled && currentConn) {
+    currentConn->_advisor.textureWritten(
+      destination->texture, destination->mipLevel,
+      destination->origin.x, destination->origin.y, destination->origin.z, data, dataSize);
+  }
+  nativeProcs.queueWriteTexture(queue, destination, data, dataSize, dataLayout, writeSize);
+}
+
+static void serverBufferMapAsync(
+  WGPUBuffer buffer, WGPUMapModeFlags mode, size_t offset, size_t size,
+  WGPUBufferMapCallback callback, void* userdata)
+{
+  flushForCurrentConn();
+  nativeProcs.bufferMapAsync(buffer, mode, offset, size, callback, userdata);
+}
+
+static void serverBufferDestroy(WGPUBuffer buffer) {
+  flushForCurrentConn();
+  nativeProcs.bufferDestroy(buffer);
+}
+
+static void serverTextureDestroy(WGPUTexture texture) {
+  flushForCurrentConn();
+  nativeProcs.textureDestroy(texture);
+}
+
+// pipeline creation is only hooked for the advisor
+static WGPURenderPipeline serverDeviceCreateRenderPipeline(
+  WGPUDevice device, WGPURenderPipelineDescriptor const* descriptor)
+{
+  if (currentConn)
+    currentConn->_advisor.pipelineCreated();
+  return nativeProcs.deviceCreateRenderPipeline(device, descriptor);
+}
+
+static WGPURenderPipeline serverDeviceCreateRenderPipeline2(
+  WGPUDevice device, WGPURenderPipelineDescriptor2 const* descriptor)
+{
+  if (currentConn)
+    currentConn->_advisor.pipelineCreated();
+  return nativeProcs.deviceCreateRenderPipeline2(device, descriptor);
+}
+
+static WGPUComputePipeline serverDeviceCreateComputePipeline(
+  WGPUDevice device, WGPUComputePipelineDescriptor const* descriptor)
+{
+  if (currentConn)
+    currentConn->_advisor.pipelineCreated();
+  return nativeProcs.deviceCreateComputePipeline(device, descriptor);
+}
+
+// Release hooks of serverProcs: while a closing connection's WireServer is deleted
+// (see destroyConn), its releases are queued in teardown instead of made right away.
+// The advisor forgets the upload regions of released objects, whose addresses may be
+// reused by the next object created.
+#define TEARDOWN_RELEASE_HOOK(Type, release) \
+  static void serverRelease##Type(WGPU##Type obj) { \
+    if (advisorEnabled && currentConn) \
+      currentConn->_advisor.released(obj); \
+    if (teardown.deferring()) { \
+      teardown.push([](void* o) { nativeProcs.release((WGPU##Type)o); }, obj); \
+    } else { \
+      nativeProcs.release(obj); \
+    } \
+  }
+#define TEARDOWN_RELEASE_HOOKS(_) \
+  _(BindGroup, bindGroupRelease) \
+  _(BindGroupLayout, bindGroupLayoutRelease) \
+  _(Buffer, bufferRelease) \
+  _(CommandBuffer, commandBufferRelease) \
+  _(CommandEncoder, commandEncoderRelease) \
+  _(ComputePipeline, computePipelineRelease) \
+  _(PipelineLayout, pipelineLayoutRelease) \
+  _(QuerySet, querySetRelease) \
+  _(RenderBundle, renderBundleRelease) \
+  _(RenderPipeline, renderPipelineRelease) \
+  _(Sampler, samplerRelease) \
+  _(ShaderModule, shaderModuleRelease) \
+  _(Texture, textureRelease) \
+  _(TextureView, textureViewRelease)
+TEARDOWN_RELEASE_HOOKS(TEARDOWN_RELEASE_HOOK)
+
+// destroyConn deletes a closed connection, deferring the release of its objects
+static void destroyConn(Conn* c) {
+  GLFWwindow* w = c->_window; // outlives the connection's surface & swapchain
+  if (teardownBudget <= 0) {
+    delete c;
+  } else {
+    teardown.beginDefer(c->dawnDevice());
+    delete c;
+    teardown.endDefer();
+  }
+  if (w)
+    glfwDestroyWindow(w);
+}
+
+// serverSwapChainPresent is swapChainPresent of serverProcs. The native present is
+// made later by Conn::submitPresent.
+static void serverSwapChainPresent(WGPUSwapChain swapchain) {
+  if (currentConn) {
+    currentConn->onPresent(swapchain);
+  } else {
+    nativeProcs.swapChainPresent(swapchain);
+  }
+}
 
 void Conn::close() {
   _proto.stop();
   if (_proto.fd() != -1)
     ::close(_proto.fd());
-  if (this == conn0) {
-    conn0 = nullptr;
-    delete this;
+  auto it = std::find(conns.begin(), conns.end(), this);
+  if (it != conns.end()) {
+    conns.erase(it);
+    frameScheduler.remove(this);
+    if (batchPresentConn == this)
+      batchPresentConn = nullptr;
+    // WireServer releases its objects when deleted, which must wait for the device
+    if (inUse() || !lockDevice()) {
+      closingConns.push_back(this);
+    } else {
+      destroyConn(this);
+    }
+  }
+}
+
+// lendDevice records a job using d, submitted to a worker thread
+static void lendDevice(WGPUDevice d) {
+  lentDevices.push_back(d);
+}
+
+// returnDevice ends a lend of d when its job is done. Closed connections no longer in
+// use are deleted, and connections waiting for a device try again.
+static void returnDevice(WGPUDevice d) {
+  auto it = std::find(lentDevices.begin(), lentDevices.end(), d);
+  assert(it != lentDevices.end());
+  lentDevices.erase(it);
+  teardown.resume();
+  for (size_t i = 0; i < closingConns.size(); ) {
+    Conn* c = closingConns[i];
+    if (!c->inUse() && c->lockDevice()) {
+      closingConns.erase(closingConns.begin() + i);
+      destroyConn(c);
+    } else {
+      i++;
+    }
   }
+  // copy since resuming input may close connections
+  std::vector<Conn*> v = conns;
+  for (Conn* c : v) {
+    if (c->_waitingForDevice)
+      c->resume();
+  }
+}
+
+// onPresented is called when the present thread is done with a swapchain
+static void onPresented(const PresentThread::Job& job) {
+  returnDevice((WGPUDevice)job.owner);
+}
+
+// onCompiled is called when a compile thread is done with a connection's commands. The
+// connection then handles the commands it held back (see Conn::resume.)
+static void onCompiled(const CompileThreads::Job& job) {
+  Conn* c = (Conn*)job.owner;
+  c->_compiling = false;
+  returnDevice(c->dawnDevice()); // deletes c if it was closed
+  if (std::find(conns.begin(), conns.end(), c) != conns.end())
+    c->resume();
 }
 
 // backendType
@@ -323,29 +1545,40 @@ void logAvailableAdapters(dawn_native::Instance* instance) {
   }
 }
 
-// updates values of the global variable framebufferInfo
-void updateFramebufferInfo(uint32_t width, uint32_t height) {
-  framebufferInfo.width = width;
-  framebufferInfo.height = height;
+// updates values of fb, the framebuffer info of window w
+void updateFramebufferInfo(
+  GLFWwindow* w, DawnRemoteProtocol::FramebufferInfo* fb, uint32_t width, uint32_t height)
+{
+  fb->width = width;
+  fb->height = height;
   float xscale, yscale;
-  glfwGetWindowContentScale(window, &xscale, &yscale);
-  framebufferInfo.dpscale = (uint16_t)std::min((double)0xFFFF, (double)xscale * 1000.0);
+  glfwGetWindowContentScale(w, &xscale, &yscale);
+  fb->dpscale = (uint16_t)std::min((double)0xFFFF, (double)xscale * 1000.0);
 }
 
 void onWindowFramebufferResizeTimer(RunLoop* rl, ev_timer* w, int revents) {
   // dlog("onWindowFramebufferResizeTimer");
+  if (deviceLent(device.Get()) || !deviceLocks.tryLock(&sharedDeviceLock))
+    return; // a swapchain on the surface is being presented; the timer repeats
   ev_timer_stop(rl, w);
   createDawnSwapChain();
-  if (conn0)
-    conn0->sendFramebufferInfo();
+  for (Conn* c : conns) {
+    if (!c->ownDevice()) // connections with own devices have windows of their own
+      c->sendFramebufferInfo();
+  }
 }
 
 // onWindowFramebufferResize is called when a window's framebuffer has changed size.
 // width & height are in pixels (the framebuffer size)
-void onWindowFramebufferResize(GLFWwindow* window, int width, int height) {
+void onWindowFramebufferResize(GLFWwindow* w, int width, int height) {
   // dlog("onWindowFramebufferResize width=%d, height=%d", width, height);
 
-  updateFramebufferInfo((uint32_t)width, (uint32_t)height);
+  Conn* c = (Conn*)glfwGetWindowUserPointer(w);
+  if (c) {
+    c->onFramebufferResize((uint32_t)width, (uint32_t)height);
+    return;
+  }
+  updateFramebufferInfo(window, &framebufferInfo, (uint32_t)width, (uint32_t)height);
 
   static ev_timer debounce_timer;
   static bool debounce_timer_init = false;
@@ -367,6 +1600,30 @@ void onWindowResize(GLFWwindow* window, int width, int height) {
   // dlog("onWindowResize width=%d, height=%d", width, height);
 }
 
+// onKey is called when a key is pressed or released while the window has focus
+void onKey(GLFWwindow* window, int key, int scancode, int action, int mods) {
+  if (key == GLFW_KEY_H && action == GLFW_PRESS)
+    hudEnabled = !hudEnabled;
+}
+
+// createWindow opens a window of fb's size and updates fb with its actual framebuffer
+// size. The window's user pointer is the Conn it belongs to (null for the main window.)
+GLFWwindow* createWindow(const char* title, DawnRemoteProtocol::FramebufferInfo* fb) {
+  GLFWwindow* w = glfwCreateWindow(fb->width, fb->height, title, /*monitor*/nullptr, nullptr);
+  if (!w)
+    return nullptr;
+
+  // get actual framebuffer size
+  int width, height;
+  glfwGetFramebufferSize(w, &width, &height);
+  updateFramebufferInfo(w, fb, (uint32_t)width, (uint32_t)height);
+
+  glfwSetFramebufferSizeCallback(w, onWindowFramebufferResize);
+  glfwSetWindowSizeCallback(w, onWindowResize);
+  glfwSetKeyCallback(w, onKey);
+  return w;
+}
+
 void createOSWindow() {
   assert(window == nullptr);
 
@@ -377,25 +1634,17 @@ void createOSWindow() {
   // Setup the correct hints for GLFW for backends.
   utils::SetupGLFWWindowHintsForBackend(backendType);
   glfwWindowHint(GLFW_COCOA_RETINA_FRAMEBUFFER, GLFW_FALSE);
-  window = glfwCreateWindow(
-    framebufferInfo.width,
-    framebufferInfo.height,
-    "hello-wire",
-    /*monitor*/nullptr,
-    nullptr);
-
-  if (!window)
-    return;
-
-  // get actual framebuffer size
-  int width, height;
-  glfwGetFramebufferSize(window, &width, &height);
-  updateFramebufferInfo((uint32_t)width, (uint32_t)height);
+  window = createWindow("hello-wire", &framebufferInfo);
+}
 
-  // Note: We can use glfwSetWindowUserPointer and glfwGetWindowUserPointer to attach
-  // some custom state to a GLFW window.
-  glfwSetFramebufferSizeCallback(window, onWindowFramebufferResize);
-  glfwSetWindowSizeCallback(window, onWindowResize);
+// closeWindowedConns closes connections whose own window the user has closed
+static void closeWindowedConns() {
+  // copy since closing removes connections
+  std::vector<Conn*> v = conns;
+  for (Conn* c : v) {
+    if (c->_window && glfwWindowShouldClose(c->_window))
+      c->close();
+  }
 }
 
 void createDawnDevice() {
@@ -421,28 +1670,114 @@ void createDawnDevice() {
     backendAdapter = *adapterIt; // global var
   }
 
+  if (transcodeTarget == UCT_TARGET_BC1) {
+    bool bc = false;
+    for (const char* ext : backendAdapter.GetSupportedExtensions())
+      bc = bc || strcmp(ext, "texture_compression_bc") == 0;
+    if (!bc) {
+      dlog("adapter lacks BC texture compression; transcoding textures to RGBA8");
+      transcodeTarget = UCT_TARGET_RGBA8;
+    }
+  }
+  transcodeThreads = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+
   // Set up the native procs for the global proctable (so calling
   // wgpu::Object::Foo calls into that proc) but also keep it around
   // so we can give it to the wire server.
   nativeProcs = dawn_native::GetProcs(); // global var
   dawnProcSetProcs(&nativeProcs);
+  serverProcs = nativeProcs;
+  serverProcs.swapChainPresent = serverSwapChainPresent;
+  serverProcs.queueSubmit = serverQueueSubmit;
+  serverProcs.deviceCreateBuffer = serverDeviceCreateBuffer;
+  serverProcs.queueWriteBuffer = serverQueueWriteBuffer;
+  serverProcs.queueWriteTexture = serverQueueWriteTexture;
+  serverProcs.bufferMapAsync = serverBufferMapAsync;
+  serverProcs.bufferDestroy = serverBufferDestroy;
+  serverProcs.textureDestroy = serverTextureDestroy;
+  if (advisorEnabled) {
+    serverProcs.deviceCreateRenderPipeline = serverDeviceCreateRenderPipeline;
+    serverProcs.deviceCreateRenderPipeline2 = serverDeviceCreateRenderPipeline2;
+    serverProcs.deviceCreateComputePipeline = serverDeviceCreateComputePipeline;
+  }
+  #define _(Type, release) serverProcs.release = serverRelease##Type;
+  TEARDOWN_RELEASE_HOOKS(_)
+  #undef _
 
-  device = wgpu::Device::Acquire(backendAdapter.CreateDevice());// global var
+  device = createDawnDeviceWithToggles({}); // global var
+}
 
+wgpu::Device createDawnDeviceWithToggles(const std::vector<const char*>& toggles) {
+  dawn_native::DeviceDescriptor desc;
+  desc.forceEnabledToggles = toggles;
+  if (transcodeTarget == UCT_TARGET_BC1)
+    desc.requiredExtensions.push_back("texture_compression_bc");
+  wgpu::Device d = wgpu::Device::Acquire(backendAdapter.CreateDevice(&desc));
   // hook up error reporting
-  device.SetUncapturedErrorCallback(PrintDeviceError, nullptr);
+  d.SetUncapturedErrorCallback(PrintDeviceError, nullptr);
+  return d;
 }
 
 void createDawnSwapChain() {
-  surface = utils::CreateSurfaceForWindow(instance->Get(), window); // global var
+  if (!headless)
+    surface = utils::CreateSurfaceForWindow(instance->Get(), window); // global var
+  swapchain = createDawnSwapChainFor(device, surface, framebufferInfo); // global var
+}
+
+// createDawnSwapChainFor creates a swapchain of device for surface, of fb's size.
+// Note that a surface only presents the swapchain most recently created for it.
+wgpu::SwapChain createDawnSwapChainFor(
+  const wgpu::Device& device, const wgpu::Surface& surface,
+  const DawnRemoteProtocol::FramebufferInfo& fb)
+{
+  if (headless) {
+    // The Null backend's swapchain implementation discards presented frames
+    static DawnSwapChainImplementation nullSwapChainImpl =
+      dawn_native::null::CreateNativeSwapChainImpl();
+    wgpu::SwapChainDescriptor desc;
+    desc.implementation = reinterpret_cast<uint64_t>(&nullSwapChainImpl);
+    wgpu::SwapChain sc = device.CreateSwapChain(nullptr, &desc);
+    sc.Configure(fb.textureFormat, fb.textureUsage, fb.width, fb.height);
+    return sc;
+  }
   wgpu::SwapChainDescriptor desc = {
-    .format = framebufferInfo.textureFormat,
-    .usage  = framebufferInfo.textureUsage,
-    .width  = framebufferInfo.width,
-    .height = framebufferInfo.height,
+    .format = fb.textureFormat,
+    .usage  = fb.textureUsage,
+    .width  = fb.width,
+    .height = fb.height,
     .presentMode = wgpu::PresentMode::Mailbox,
   };
-  swapchain = device.CreateSwapChain(surface, &desc); // global var
+  return device.CreateSwapChain(surface, &desc);
+}
+
+// isTrustedPeer checks the peer credentials of a UNIX socket against the trust policy
+static bool isTrustedPeer(int fd) {
+  if (!trustSelf && trustUids.empty())
+    return false;
+  // peer credentials are only meaningful for UNIX sockets; TCP clients are never trusted
+  struct sockaddr_storage ss;
+  socklen_t sslen = sizeof(ss);
+  if (getsockname(fd, (struct sockaddr*)&ss, &sslen) != 0 || ss.ss_family != AF_UNIX)
+    return false;
+  uid_t uid;
+  #if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+      perror("getsockopt SO_PEERCRED");
+      return false;
+    }
+    uid = cred.uid;
+  #else
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) != 0) {
+      perror("getpeereid");
+      return false;
+    }
+  #endif
+  if (trustSelf && uid == geteuid())
+    return true;
+  return std::find(trustUids.begin(), trustUids.end(), uid) != trustUids.end();
 }
 
 // onServerIO is called when a new connection is awaiting accept
@@ -455,17 +1790,33 @@ static void onServerIO(RunLoop* rl, ev_io* w, int revents) {
     return;
   }
   FDSetNonBlock(fd);
+  if (tcpaddr) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails for UNIX sockets
+  }
 
-  if (conn0 != nullptr) {
-    dlog("second client connected; closing older client (last in wins)");
-    conn0->close();
+  if (conns.size() >= maxconns) {
+    dlog("too many clients connected; closing oldest client (last in wins)");
+    conns.front()->close();
   }
 
   static uint32_t connIdGen = 0;
-  conn0 = new Conn(connIdGen++);
-  dlog("client #%u connected on fd %d", conn0->id, fd);
-  conn0->start(rl, fd);
-  conn0->sendFramebufferInfo();
+  int64_t heap0 = memstats ? processHeapInUse() : 0;
+  Conn* conn = new Conn(connIdGen++);
+  if (memstats)
+    conn->_heapInit = processHeapInUse() - heap0;
+  conns.push_back(conn);
+  conn->trusted = isTrustedPeer(fd);
+  dlog("client #%u connected on fd %d%s", conn->id, fd, conn->trusted ? " (trusted)" : "");
+  conn->start(rl, fd);
+  if ((conn->trusted || compileThreads.started()) && !conn->openDevice()) {
+    errlog("client #%u: failed to open a window", conn->id);
+    conn->close();
+    return;
+  }
+  if (zeroCopyThreshold > 0 && !conn->_proto.enableZeroCopy(zeroCopyThreshold))
+    dlog("client #%u: zero-copy sends not supported (%s)", conn->id, strerror(errno));
+  conn->sendFramebufferInfo();
 }
 
 void onPollTimeout(RunLoop* rl, ev_timer* w, int revents) {
@@ -473,18 +1824,322 @@ void onPollTimeout(RunLoop* rl, ev_timer* w, int revents) {
   ev_timer_again(rl, w);
 }
 
-void onFrameTimer(RunLoop* rl, ev_timer* w, int revents) {
-  if (conn0) {
-    if (!conn0->sendFrameSignal()) {
-      // connection closed
-      delete conn0;
-      conn0 = nullptr;
+// onFrameSignal is called by frameScheduler when it's time for a client to render.
+// sendFrameSignal closes (and removes) connections which are gone.
+static void onFrameSignal(void* key) {
+  Conn* c = (Conn*)key;
+  c->_perf.endFrame();
+  c->sendFrameSignal();
+}
+
+// fmtBytes formats a byte count in a short human-readable form
+static const char* fmtBytes(char* buf, size_t bufsize, double n) {
+  if (n < 1024) {
+    snprintf(buf, bufsize, "%.0fB", n);
+  } else if (n < 1024*1024) {
+    snprintf(buf, bufsize, "%.1fK", n / 1024);
+  } else {
+    snprintf(buf, bufsize, "%.1fM", n / (1024*1024));
+  }
+  return buf;
+}
+
+// onHudTimer updates the HUD text with rates over the time since the last update
+void onHudTimer(RunLoop* rl, ev_timer* w, int revents) {
+  if (!hudEnabled)
+    return;
+  double dt = w->repeat;
+  uint64_t hudDrawNs = 0, hudDraws = 0;
+  for (Conn* c : conns) {
+    hudDrawNs += c->_hudDrawNs;
+    hudDraws += c->_hudDraws;
+  }
+  std::string text;
+  char line[256], b1[16], b2[16], b3[16], b4[16];
+  snprintf(line, sizeof(line), "%zu clients  hud %.3fms/frame\n",
+    conns.size(), hudDraws ? (double)hudDrawNs / (double)hudDraws / 1e6 : 0.0);
+  text += line;
+  for (Conn* c : conns) {
+    auto& prev = c->_hudPrev;
+    uint64_t nlat = c->_frameLatencyCount - prev.frameLatencyCount;
+    snprintf(line, sizeof(line),
+      "#%-3u%s %3.0f fps  lat %5.1fms  in %6s/s  out %6s/s  q %s/%s  drop %llu\n",
+      c->id, c->trusted ? "*" : " ",
+      (double)(c->_presents - prev.presents) / dt,
+      nlat ? (double)(c->_frameLatencyNs - prev.frameLatencyNs) / (double)nlat / 1e6 : 0.0,
+      fmtBytes(b1, sizeof(b1), (double)(c->_proto.bytesIn - prev.bytesIn) / dt),
+      fmtBytes(b2, sizeof(b2), (double)(c->_proto.bytesOut - prev.bytesOut) / dt),
+      fmtBytes(b3, sizeof(b3), (double)c->_proto.pendingInput()),
+      fmtBytes(b4, sizeof(b4), (double)c->_proto.pendingOutput()),
+      (unsigned long long)c->_framesDropped);
+    text += line;
+    prev.presents = c->_presents;
+    prev.bytesIn = c->_proto.bytesIn;
+    prev.bytesOut = c->_proto.bytesOut;
+    prev.frameLatencyNs = c->_frameLatencyNs;
+    prev.frameLatencyCount = c->_frameLatencyCount;
+  }
+  hud.setText(text);
+  for (Conn* c : conns) {
+    if (c->ownDevice())
+      c->_hud.setText(text);
+  }
+}
+
+void onMetricsTimer(RunLoop* rl, ev_timer* w, int revents) {
+  if (!metricsReport(metricsfile))
+    perror(metricsfile);
+}
+
+void onMetricsSignal(RunLoop* rl, ev_signal* w, int revents) {
+  if (!metricsReport(metricsfile))
+    perror(metricsfile);
+}
+
+static bool quit = false;
+
+void onQuitSignal(RunLoop* rl, ev_signal* w, int revents) {
+  quit = true;
+  ev_break(rl, EVBREAK_ALL);
+}
+
+// writeServerMetrics reports process-wide memory usage and its breakdown
+static void writeServerMetrics(MetricsWriter& w) {
+  w.scope("server");
+  w.counter("conns", conns.size());
+  ProcessMemory m;
+  if (processMemory(&m)) {
+    w.counter("mem.rss", m.rss);
+    w.counter("mem.heap", m.heapInUse);
+  }
+  w.gauge("cpu_time", processCPUTime());
+  w.gauge("frame_sched.load", frameScheduler.load());
+  w.counter("submit.client", submitsClient);
+  w.counter("submit.native", submitsNative);
+  w.counter("submit.native_ns", submitsNs);
+  w.counter("submit.presents_skipped", batchPresentsSkipped);
+  w.counter("transcode.textures", transcodeTextures);
+  w.counter("transcode.bytes_in", transcodeBytesIn);
+  w.counter("transcode.bytes_out", transcodeBytesOut);
+  w.counter("mesh.buffers", meshBuffers);
+  w.counter("mesh.bytes_in", meshBytesIn);
+  w.counter("mesh.bytes_out", meshBytesOut);
+  w.counter("mesh.ns", meshNs);
+  w.counter("transcode.ns", transcodeNs);
+  w.counter("teardown.pending", teardown.pending());
+  w.counter("teardown.released", teardown.released);
+  w.counter("teardown.slices", teardown.slices);
+  w.counter("teardown.ns", teardown.ns);
+  w.counter("teardown.max_slice_ns", teardown.maxSliceNs);
+  if (!assetPaths.empty()) {
+    w.counter("assets.packs", assetStore.packs);
+    w.counter("assets.assets", assetStore.assets);
+    w.counter("assets.mapped_bytes", assetStore.bytes);
+  }
+  w.counter("assets.queried", assetsQueried);
+  w.counter("assets.found", assetsFound);
+  w.counter("assets.uploads", assetUploads);
+  w.counter("assets.misses", assetMisses);
+  w.counter("assets.bytes_avoided", assetBytesAvoided);
+  w.counter("assets.upload_ns", assetUploadNs);
+  if (!warmupPaths.empty()) {
+    w.counter("warmup.captures", warmup.captures);
+    w.counter("warmup.commands", warmup.commands);
+    w.counter("warmup.failed", warmup.failed);
+    w.counter("warmup.ns", warmup.ns);
+  }
+  w.counter("present.submitted", presenter.submitted);
+  w.counter("present.superseded", presenter.superseded);
+  w.counter("present.present_ns", presenter.presentNs);
+  w.counter("present.latency_ns", presenter.latencyNs);
+  w.counter("device_lock.contended", deviceLocks.contended);
+  if (compileThreads.started()) {
+    w.counter("compile.jobs", compileThreads.submitted);
+    w.counter("compile.commands", compileThreads.commands);
+    w.counter("compile.failed", compileThreads.failed);
+    w.counter("compile.compile_ns", compileThreads.compileNs);
+    w.counter("compile.latency_ns", compileThreads.latencyNs);
+  }
+  // fixed-size per-connection state, dominated by DawnRemoteProtocol buffers
+  w.counter("mem.conn_size", sizeof(Conn));
+  w.counter("mem.proto_size", sizeof(DawnRemoteProtocol));
+  w.counter("mem.wire_server_size", sizeof(dawn_wire::WireServer));
+  size_t protoBuffers = 0;
+  for (Conn* c : conns)
+    protoBuffers += sizeof(DawnRemoteProtocol) + c->_proto.bufferBytes();
+  w.counter("mem.proto_buffers", protoBuffers);
+  if (memstats) {
+    int64_t heapInit = 0, heapCommands = 0;
+    for (Conn* c : conns) {
+      heapInit += c->_heapInit;
+      heapCommands += c->_heapCommands;
     }
+    w.counter("mem.conns_heap_init", (uint64_t)std::max((int64_t)0, heapInit));
+    w.counter("mem.conns_heap_commands", (uint64_t)std::max((int64_t)0, heapCommands));
   }
-  ev_timer_again(rl, w);
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "options:\n"
+    "  -perf               Sample hardware performance counters (Linux perf events)\n"
+    "  -metrics=<file>     Write metrics to <file> every second and on SIGUSR1 (\"-\" = stderr)\n"
+    "  -memstats           Attribute heap growth to connections (reported as metrics)\n"
+    "  -maxconns=<n>       Serve up to <n> clients at once (default 1; last in wins)\n"
+    "  -headless           Don't open a window; render with the Null backend\n"
+    "  -idle-timeout=<s>   Close untrusted clients which send nothing for <s> seconds (default: never)\n"
+    "  -stall-timeout=<s>  Close untrusted clients which don't read for <s> seconds (default: 0=never)\n"
+    "  -trust=<who>        Skip Dawn validation for trusted clients, which get a window each.\n"
+    "                      <who> is \"self\" (clients running as our user) or a\n"
+    "                      comma-separated list of uids\n"
+    "  -hud                Show performance HUD (toggle with the H key)\n"
+    "  -sync-present       Present on the runloop thread instead of a present thread\n"
+    "  -compile-threads=<n>\n"
+    "                      Compile shader modules and pipelines on <n> threads instead of\n"
+    "                      the runloop thread (default: 0). Every client gets a device and\n"
+    "                      window of its own\n"
+    "  -no-stagger         Send all clients their frame signal at the same time\n"
+    "  -catch-up           Read all input a client has sent before presenting, so that of\n"
+    "                      frames which queued up while the server was behind only the\n"
+    "                      newest is presented\n"
+    "  -batch-submits[=<ms>]\n"
+    "                      Issue queue submits of clients sharing the device as one native\n"
+    "                      submit per <ms> (default: one frame)\n"
+    "  -tcp=[<host>:]<port>\n"
+    "                      Also accept clients over TCP\n"
+    "  -zerocopy[=<KB>]    Send writes of at least <KB> (default: 64) with MSG_ZEROCOPY (TCP)\n"
+    "  -capture=<dir>      Record each client's wire commands to <dir>/conn-<id>.dcap\n"
+    "  -transcode=<fmt>    Format compressed client textures are transcoded to: bc1\n"
+    "                      (default, if supported) or rgba8\n"
+    "  -advisor            Warn about slow client patterns (pipelines created every frame,\n"
+    "                      unchanged re-uploads, many small submits)\n"
+    "  -teardown-budget=<ms>\n"
+    "                      Release the objects of disconnected clients in slices of <ms>\n"
+    "                      per runloop iteration (default: 1; 0 = all at once)\n"
+    "  -warmup=<path>      Before accepting clients, create the shader modules, layouts and\n"
+    "                      pipelines of the captures at <path> (a .dcap file or a directory\n"
+    "                      of them; may be given more than once)\n"
+    "  -assets=<path>      Let clients create buffers & textures from the assets of the packs\n"
+    "                      at <path> (a .dpak file or a directory of them; may be given\n"
+    "                      more than once)\n"
+    "  -h, -help           Show help and exit\n",
+    prog);
 }
 
 int main(int argc, const char* argv[]) {
+  bool opt_perf = false;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "-perf") == 0) {
+      opt_perf = true;
+    } else if (strncmp(arg, "-metrics=", 9) == 0) {
+      metricsfile = &arg[9];
+    } else if (strcmp(arg, "-memstats") == 0) {
+      memstats = true;
+    } else if (strncmp(arg, "-maxconns=", 10) == 0) {
+      maxconns = (uint32_t)std::max(1, atoi(&arg[10]));
+    } else if (strcmp(arg, "-headless") == 0) {
+      headless = true;
+    } else if (strcmp(arg, "-hud") == 0) {
+      hudEnabled = true;
+    } else if (strcmp(arg, "-sync-present") == 0) {
+      syncPresent = true;
+    } else if (strncmp(arg, "-compile-threads=", 17) == 0) {
+      compileThreadCount = (uint32_t)std::max(0, std::min(64, atoi(&arg[17])));
+    } else if (strcmp(arg, "-no-stagger") == 0) {
+      frameScheduler.stagger = false;
+    } else if (strcmp(arg, "-catch-up") == 0) {
+      catchUp = true;
+    } else if (strcmp(arg, "-batch-submits") == 0) {
+      batchSubmits = true;
+    } else if (strncmp(arg, "-batch-submits=", 15) == 0) {
+      batchSubmits = true;
+      batchWindow = std::max(0.0, atof(&arg[15]) / 1000.0);
+    } else if (strncmp(arg, "-transcode=", 11) == 0) {
+      if (strcmp(&arg[11], "bc1") == 0) {
+        transcodeTarget = UCT_TARGET_BC1;
+      } else if (strcmp(&arg[11], "rgba8") == 0) {
+        transcodeTarget = UCT_TARGET_RGBA8;
+      } else {
+        fprintf(stderr, "%s: invalid -transcode format %s (see %s -help)\n",
+          argv[0], &arg[11], argv[0]);
+        return 1;
+      }
+    } else if (strcmp(arg, "-advisor") == 0) {
+      advisorEnabled = true;
+    } else if (strncmp(arg, "-capture=", 9) == 0) {
+      captureDir = &arg[9];
+    } else if (strncmp(arg, "-tcp=", 5) == 0) {
+      tcpaddr = &arg[5];
+    } else if (strcmp(arg, "-zerocopy") == 0) {
+      zeroCopyThreshold = 64 * 1024;
+    } else if (strncmp(arg, "-zerocopy=", 10) == 0) {
+      zeroCopyThreshold = (size_t)std::max(1, atoi(&arg[10])) * 1024;
+    } else if (strncmp(arg, "-idle-timeout=", 14) == 0) {
+      idleTimeout = atof(&arg[14]);
+    } else if (strncmp(arg, "-stall-timeout=", 15) == 0) {
+      stallTimeout = atof(&arg[15]);
+    } else if (strncmp(arg, "-warmup=", 8) == 0) {
+      warmupPaths.push_back(&arg[8]);
+    } else if (strncmp(arg, "-assets=", 8) == 0) {
+      assetPaths.push_back(&arg[8]);
+    } else if (strncmp(arg, "-teardown-budget=", 17) == 0) {
+      teardownBudget = atof(&arg[17]) / 1000.0;
+    } else if (strncmp(arg, "-trust=", 7) == 0) {
+      for (const char* p = &arg[7]; *p; ) {
+        if (strncmp(p, "self", 4) == 0) {
+          trustSelf = true;
+          p += 4;
+        } else {
+          char* end;
+          trustUids.push_back((uid_t)strtoul(p, &end, 10));
+          if (end == p) {
+            fprintf(stderr, "%s: invalid -trust value %s\n", argv[0], &arg[7]);
+            return 1;
+          }
+          p = end;
+        }
+        if (*p == ',')
+          p++;
+      }
+    } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0 || strcmp(arg, "--help") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      fprintf(stderr, "%s: unknown option %s (see %s -help)\n", argv[0], arg, argv[0]);
+      return 1;
+    }
+  }
+
+  // perf counters are optional; perfCountersEnable logs why if they are unavailable
+  if (opt_perf)
+    perfCountersEnable();
+
+  if (headless)
+    backendType = wgpu::BackendType::Null;
+  processRaiseFDLimit((size_t)maxconns + 64);
+
+  if (!headless)
+    createOSWindow();
+  createDawnDevice();
+  createDawnSwapChain();
+
+  // Warm up before the socket exists, so that the first clients find warm caches.
+  // Trusted clients get their own devices and are not warmed up for.
+  if (!warmupPaths.empty()) {
+    warmup.run(warmupPaths, device.Get(), nativeProcs);
+    dlog("warm-up: %u captures, %llu commands (%llu failed) in %.1f ms",
+      warmup.captures, (unsigned long long)warmup.commands,
+      (unsigned long long)warmup.failed, (double)warmup.ns / 1e6);
+  }
+
+  if (!assetPaths.empty()) {
+    assetStore.open(assetPaths);
+    dlog("assets: %u packs, %llu assets, %.1f MB mapped", assetStore.packs,
+      (unsigned long long)assetStore.assets, (double)assetStore.bytes / 1e6);
+  }
+
   dlog("starting UNIX socket server \"%s\"", sockfile);
   int fd = createUNIXSocketServer(sockfile);
   if (fd < 0) {
@@ -492,11 +2147,17 @@ int main(int argc, const char* argv[]) {
     return 1;
   }
 
-  createOSWindow();
-  createDawnDevice();
-  createDawnSwapChain();
-
   RunLoop* rl = EV_DEFAULT;
+  timers.start(rl);
+  deviceLocks.start(rl);
+  if (!syncPresent) {
+    presenter.onPresented = onPresented;
+    presenter.start(rl, presentAndRelease);
+  }
+  if (compileThreadCount > 0) {
+    compileThreads.onCompiled = onCompiled;
+    compileThreads.start(rl, compileThreadCount);
+  }
 
   // register I/O callback for the socket file descriptor
   FDSetNonBlock(fd);
@@ -504,12 +2165,31 @@ int main(int argc, const char* argv[]) {
   ev_io_init(&server_fd_watcher, onServerIO, fd, EV_READ);
   ev_io_start(rl, &server_fd_watcher);
 
-  // use a timer to drive client rendering
-  ev_timer frame_timer;
-  ev_init(&frame_timer, onFrameTimer);
-  frame_timer.repeat = 1.0 / 60.0;
-  ev_timer_again(rl, &frame_timer);
-  ev_unref(rl); // don't allow timer to keep runloop alive alone
+  ev_io tcp_fd_watcher;
+  int tcpfd = -1;
+  if (tcpaddr) {
+    dlog("starting TCP server \"%s\"", tcpaddr);
+    tcpfd = createTCPSocketServer(tcpaddr);
+    if (tcpfd < 0) {
+      perror("createTCPSocketServer");
+      return 1;
+    }
+    FDSetNonBlock(tcpfd);
+    ev_io_init(&tcp_fd_watcher, onServerIO, tcpfd, EV_READ);
+    ev_io_start(rl, &tcp_fd_watcher);
+  }
+
+  // objects of closed connections are released in slices
+  teardown.budget = teardownBudget;
+  // (devices of deleted connections are no longer used by worker threads)
+  teardown.canRelease = [](void* owner) {
+    return owner != device.Get() || deviceLocks.tryLock(&sharedDeviceLock);
+  };
+  teardown.start(rl);
+
+  // frame signals drive client rendering
+  frameScheduler.onSignal = onFrameSignal;
+  frameScheduler.start(rl);
 
   // use a timer to drive the runloop so we can call glfwPollEvents often enough
   ev_timer timer;
@@ -518,17 +2198,77 @@ int main(int argc, const char* argv[]) {
   ev_timer_again(rl, &timer);
   ev_unref(rl); // don't allow timer to keep runloop alive alone
 
-  while (!glfwWindowShouldClose(window)) {
-    //double t1 = glfwGetTime(); // measure time for stats
-    glfwPollEvents(); // check for OS events
-    ev_run(rl, EVRUN_ONCE); // poll for I/O events
+  // HUD text is updated twice per second
+  ev_timer hud_timer;
+  ev_init(&hud_timer, onHudTimer);
+  hud_timer.repeat = 0.5;
+  ev_timer_again(rl, &hud_timer);
+  ev_unref(rl);
+
+  // metrics are reported periodically and on demand (SIGUSR1)
+  ev_timer metrics_timer;
+  ev_signal metrics_signal;
+  if (metricsfile) {
+    ev_init(&metrics_timer, onMetricsTimer);
+    metrics_timer.repeat = 1.0;
+    ev_timer_again(rl, &metrics_timer);
+    ev_unref(rl);
+    ev_signal_init(&metrics_signal, onMetricsSignal, SIGUSR1);
+    ev_signal_start(rl, &metrics_signal);
+    ev_unref(rl);
+    metricsRegister(&conns, writeServerMetrics);
+  }
+
+  // exit cleanly on SIGINT & SIGTERM (removes the socket file)
+  ev_signal sigint_watcher, sigterm_watcher;
+  ev_signal_init(&sigint_watcher, onQuitSignal, SIGINT);
+  ev_signal_init(&sigterm_watcher, onQuitSignal, SIGTERM);
+  ev_signal_start(rl, &sigint_watcher);
+  ev_signal_start(rl, &sigterm_watcher);
+  ev_unref(rl);
+  ev_unref(rl);
+
+  if (headless) {
+    while (!quit)
+      ev_run(rl, EVRUN_ONCE); // poll for I/O events
+  } else {
+    while (!quit && !glfwWindowShouldClose(window)) {
+      //double t1 = glfwGetTime(); // measure time for stats
+      glfwPollEvents(); // check for OS events
+      closeWindowedConns();
+      ev_run(rl, EVRUN_ONCE); // poll for I/O events
+    }
   }
 
   dlog("exit");
-  if (conn0)
-    conn0->close();
+  frameScheduler.stop();
+  for (const PresentThread::Job& job : presenter.stop())
+    nativeProcs.swapChainRelease(job.swapchain);
+  compileThreads.stop();
+  ev_timer_stop(rl, &batchTimer);
+  for (WGPUCommandBuffer cb : batchCommands)
+    nativeProcs.commandBufferRelease(cb);
+  batchCommands.clear();
+  if (batchPresent)
+    nativeProcs.swapChainRelease(batchPresent);
+  lentDevices.clear(); // jobs dropped by stop are never returned
+  while (!conns.empty())
+    conns.back()->close();
+  for (Conn* c : closingConns)
+    destroyConn(c);
+  closingConns.clear();
+  teardown.stop();
+  deviceLocks.stop();
+  warmup.release();
+  assetStore.close();
+  timers.stop();
   ev_io_stop(rl, &server_fd_watcher);
+  if (tcpfd > -1) {
+    ev_io_stop(rl, &tcp_fd_watcher);
+    close(tcpfd);
+  }
   ev_timer_stop(rl, &timer);
+  ev_timer_stop(rl, &hud_timer);
   close(fd);
   unlink(sockfile);
   return 0;
@@ -0,0 +1,98 @@
+#include "teardown.hh"
+#include "metrics.hh" // monotimeNs
+#include <assert.h>
+
+// objects released between checking the clock
+#define TEARDOWN_BATCH 16
+
+void TeardownQueue::start(struct ev_loop* rl) {
+  assert(_rl == nullptr);
+  _rl = rl;
+  ev_check_init(&_check, onCheck);
+  _check.data = this;
+  ev_idle_init(&_idle, onIdle);
+  _idle.data = this;
+  ev_check_start(rl, &_check);
+  ev_unref(rl); // don't allow the watcher to keep runloop alive alone
+}
+
+void TeardownQueue::stop() {
+  if (_rl) {
+    ev_ref(_rl);
+    ev_check_stop(_rl, &_check);
+    ev_idle_stop(_rl, &_idle);
+    _rl = nullptr;
+  }
+  auto canRelease_ = canRelease;
+  canRelease = nullptr; // nothing is in use anymore
+  run(0);
+  canRelease = canRelease_;
+}
+
+void TeardownQueue::beginDefer(void* owner) {
+  assert(!_deferring);
+  _deferring = true;
+  _owner = owner;
+}
+
+void TeardownQueue::endDefer() {
+  _deferring = false;
+  _owner = nullptr;
+  update();
+}
+
+void TeardownQueue::push(ReleaseFn fn, void* obj) {
+  _q.push_back({ _owner, fn, obj });
+}
+
+size_t TeardownQueue::run(double budget) {
+  if (_q.empty())
+    return 0;
+  uint64_t start = monotimeNs();
+  uint64_t deadline = budget > 0 ? start + (uint64_t)(budget * 1e9) : UINT64_MAX;
+  size_t n = 0;
+  while (!_q.empty()) {
+    Entry e = _q.front();
+    if (canRelease && !canRelease(e.owner))
+      break; // keep the order in which objects were released
+    _q.pop_front();
+    e.fn(e.obj);
+    if (++n % TEARDOWN_BATCH == 0 && monotimeNs() >= deadline)
+      break;
+  }
+  uint64_t t = monotimeNs() - start;
+  if (n > 0) {
+    released += n;
+    slices++;
+    ns += t;
+    maxSliceNs = std::max(maxSliceNs, t);
+  }
+  update();
+  return n;
+}
+
+void TeardownQueue::resume() {
+  update();
+}
+
+// update keeps the loop from blocking only while the head of the queue can be released.
+// Otherwise the loop would spin until it can; resume restarts it.
+void TeardownQueue::update() {
+  if (_rl == nullptr)
+    return;
+  if (_q.empty() || (canRelease && !canRelease(_q.front().owner))) {
+    ev_idle_stop(_rl, &_idle);
+  } else if (!ev_is_active(&_idle)) {
+    ev_idle_start(_rl, &_idle);
+  }
+}
+
+void TeardownQueue::onCheck(struct ev_loop* rl, ev_check* w, int revents) {
+  TeardownQueue* q = (TeardownQueue*)w->data;
+  q->run(q->budget);
+}
+
+void TeardownQueue::onIdle(struct ev_loop* rl, ev_idle* w, int revents) {
+  // nothing to do; an active idle watcher makes the loop poll without blocking, so
+  // that onCheck runs again right away
+}
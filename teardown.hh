@@ -0,0 +1,76 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <functional>
+
+// protocol.hh's libev include, repeated here so teardown.hh stands on its own
+_Pragma("GCC diagnostic push")
+_Pragma("GCC diagnostic ignored \"-Wc++17-compat-mangling\"")
+#include <ev.h>
+_Pragma("GCC diagnostic pop")
+
+// TeardownQueue spreads the release of a closed connection's Dawn objects over many
+// runloop iterations. A client with tens of thousands of wire objects would otherwise
+// stall every other connection while its WireServer releases all of them at once.
+//
+// Between beginDefer and endDefer, release hooks in the server's proc table push
+// objects here instead of releasing them. Every runloop iteration then releases queued
+// objects, oldest first, for up to `budget` seconds. Objects are released on the
+// runloop's thread, like all other Dawn calls.
+//
+// Example:
+//   teardown.start(rl);
+//   ...
+//   teardown.beginDefer(device);
+//   delete conn; // WireServer destructor calls the release hooks
+//   teardown.endDefer();
+//
+struct TeardownQueue {
+  typedef void(*ReleaseFn)(void* obj);
+
+  double budget = 0.001; // seconds of releases per runloop iteration
+
+  // canRelease returns false while objects of owner must not be released yet, e.g.
+  // while owner (a device) is used by another thread. May be null.
+  std::function<bool(void* owner)> canRelease;
+
+  // resume must be called when canRelease may have become true for an owner
+  void resume();
+
+  void start(struct ev_loop* rl);
+  void stop(); // releases everything still queued
+
+  void beginDefer(void* owner);
+  void endDefer();
+  bool deferring() const { return _deferring; }
+  void push(ReleaseFn fn, void* obj);
+
+  // run releases queued objects for up to budget seconds (0 = all of them.)
+  // Returns the number of objects released.
+  size_t run(double budget);
+  size_t pending() const { return _q.size(); }
+
+  // stats
+  uint64_t released = 0;   // objects released from the queue
+  uint64_t slices = 0;     // calls to run which released objects
+  uint64_t ns = 0;         // time spent releasing
+  uint64_t maxSliceNs = 0; // longest run
+
+  // internal
+  struct Entry {
+    void*     owner;
+    ReleaseFn fn;
+    void*     obj;
+  };
+  struct ev_loop*   _rl = nullptr;
+  ev_check          _check;
+  ev_idle           _idle; // keeps the loop from blocking while objects are queued
+  std::deque<Entry> _q;
+  void*             _owner = nullptr;
+  bool              _deferring = false;
+
+  void update();
+  static void onCheck(struct ev_loop* rl, ev_check* w, int revents);
+  static void onIdle(struct ev_loop* rl, ev_idle* w, int revents);
+};
@@ -0,0 +1,221 @@
+#include "texcodec.hh"
+#include <dawn_wire/WireClient.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+// images with fewer block rows than this per thread are transcoded on fewer threads
+#define UCT_MIN_ROWS_PER_THREAD 64
+
+size_t uctTargetSize(UctTarget target, uint32_t width, uint32_t height) {
+  if (target == UCT_TARGET_BC1)
+    return uctSize(width, height);
+  return (size_t)width * height * 4;
+}
+
+uint32_t uctTargetBytesPerRow(UctTarget target, uint32_t width) {
+  if (target == UCT_TARGET_BC1)
+    return (width / 4) * UCT_BLOCK_SIZE;
+  return width * 4;
+}
+
+static inline uint16_t pack565(int r, int g, int b) {
+  return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+static inline void unpack565(uint16_t c, int rgb[3]) {
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+// palette computes the four colors of a block from its endpoints
+static inline void palette(uint16_t c0, uint16_t c1, int p[4][3]) {
+  unpack565(c0, p[0]);
+  unpack565(c1, p[1]);
+  for (int c = 0; c < 3; c++) {
+    p[2][c] = (2 * p[0][c] + p[1][c] + 1) / 3;
+    p[3][c] = (p[0][c] + 2 * p[1][c] + 1) / 3;
+  }
+}
+
+// encodeBlock compresses a 4x4 block of RGBA8 pixels (px, 16 * 4 bytes) with range
+// fitting: endpoints are the corners of the block's color bounding box.
+static void encodeBlock(const uint8_t* px, uint8_t* dst) {
+  int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], (int)px[i * 4 + c]);
+      hi[c] = std::max(hi[c], (int)px[i * 4 + c]);
+    }
+  }
+  uint16_t c0 = pack565(hi[0], hi[1], hi[2]);
+  uint16_t c1 = pack565(lo[0], lo[1], lo[2]);
+  int p[4][3];
+  palette(c0, c1, p);
+  uint32_t indices = 0;
+  for (int i = 0; i < 16; i++) {
+    int best = 0, bestDist = 0x7fffffff;
+    for (int j = 0; j < 4; j++) {
+      int dr = px[i * 4] - p[j][0], dg = px[i * 4 + 1] - p[j][1], db = px[i * 4 + 2] - p[j][2];
+      int dist = dr * dr + dg * dg + db * db;
+      if (dist < bestDist) {
+        bestDist = dist;
+        best = j;
+      }
+    }
+    indices |= (uint32_t)best << (i * 2);
+  }
+  memcpy(&dst[0], &c0, 2);
+  memcpy(&dst[2], &c1, 2);
+  memcpy(&dst[4], &indices, 4);
+}
+
+void uctEncode(const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* dst) {
+  uint8_t px[16 * 4];
+  for (uint32_t by = 0; by < height / 4; by++) {
+    for (uint32_t bx = 0; bx < width / 4; bx++) {
+      for (uint32_t y = 0; y < 4; y++)
+        memcpy(&px[y * 16], &rgba[((size_t)(by * 4 + y) * width + bx * 4) * 4], 16);
+      encodeBlock(px, dst);
+      dst += UCT_BLOCK_SIZE;
+    }
+  }
+}
+
+// A UCT block becomes a BC1 block in four-color mode, which BC1 selects with
+// color0 > color1. Blocks with color0 < color1 have their endpoints swapped, which maps
+// index 0<->1 and 2<->3 (each index XOR 1.) Blocks with equal endpoints would select
+// BC1's three-color mode, where index 3 is black; all their pixels are color0, so
+// their indices are zeroed.
+static inline void transcodeBlockBC1(const uint8_t* src, uint8_t* dst) {
+  uint16_t c0, c1;
+  uint32_t indices;
+  memcpy(&c0, &src[0], 2);
+  memcpy(&c1, &src[2], 2);
+  memcpy(&indices, &src[4], 4);
+  if (c0 < c1) {
+    std::swap(c0, c1);
+    indices ^= 0x55555555;
+  } else if (c0 == c1) {
+    indices = 0;
+  }
+  memcpy(&dst[0], &c0, 2);
+  memcpy(&dst[2], &c1, 2);
+  memcpy(&dst[4], &indices, 4);
+}
+
+void uctTranscodeBC1Scalar(const uint8_t* src, size_t nblocks, uint8_t* dst) {
+  for (size_t i = 0; i < nblocks; i++)
+    transcodeBlockBC1(&src[i * UCT_BLOCK_SIZE], &dst[i * UCT_BLOCK_SIZE]);
+}
+
+static void transcodeBC1(const uint8_t* src, size_t nblocks, uint8_t* dst) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  // two blocks per iteration; 32-bit lanes: endpoints0 indices0 endpoints1 indices1
+  const __m128i lo16 = _mm_set1_epi32(0xFFFF);
+  const __m128i flip = _mm_set1_epi32(0x55555555);
+  const __m128i endpointLanes = _mm_set_epi32(0, -1, 0, -1);
+  for (; i + 2 <= nblocks; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i*)&src[i * UCT_BLOCK_SIZE]);
+    __m128i c0 = _mm_and_si128(v, lo16);
+    __m128i c1 = _mm_srli_epi32(v, 16);
+    __m128i lt = _mm_cmplt_epi32(c0, c1); // meaningful in endpoint lanes
+    __m128i eq = _mm_cmpeq_epi32(c0, c1);
+    __m128i swapped = _mm_or_si128(c1, _mm_slli_epi32(c0, 16));
+    __m128i endpoints = _mm_or_si128(_mm_and_si128(lt, swapped), _mm_andnot_si128(lt, v));
+    // move the endpoint lanes' masks to the index lanes
+    __m128i ltIdx = _mm_slli_si128(lt, 4);
+    __m128i eqIdx = _mm_slli_si128(eq, 4);
+    __m128i indices = _mm_andnot_si128(eqIdx, _mm_xor_si128(v, _mm_and_si128(ltIdx, flip)));
+    __m128i out = _mm_or_si128(
+      _mm_and_si128(endpointLanes, endpoints), _mm_andnot_si128(endpointLanes, indices));
+    _mm_storeu_si128((__m128i*)&dst[i * UCT_BLOCK_SIZE], out);
+  }
+#endif
+  uctTranscodeBC1Scalar(&src[i * UCT_BLOCK_SIZE], nblocks - i, &dst[i * UCT_BLOCK_SIZE]);
+}
+
+// transcodeRGBA8 decodes block rows [by0, by1) into RGBA8 rows
+static void transcodeRGBA8(
+  const uint8_t* src, uint32_t width, uint32_t by0, uint32_t by1, uint8_t* dst)
+{
+  uint32_t bw = width / 4;
+  for (uint32_t by = by0; by < by1; by++) {
+    for (uint32_t bx = 0; bx < bw; bx++) {
+      const uint8_t* b = &src[((size_t)by * bw + bx) * UCT_BLOCK_SIZE];
+      uint16_t c0, c1;
+      uint32_t indices;
+      memcpy(&c0, &b[0], 2);
+      memcpy(&c1, &b[2], 2);
+      memcpy(&indices, &b[4], 4);
+      int p[4][3];
+      palette(c0, c1, p);
+      uint32_t colors[4];
+      for (int j = 0; j < 4; j++) {
+        uint8_t c[4] = { (uint8_t)p[j][0], (uint8_t)p[j][1], (uint8_t)p[j][2], 255 };
+        memcpy(&colors[j], c, 4);
+      }
+      for (uint32_t y = 0; y < 4; y++) {
+        uint32_t row[4];
+        for (uint32_t x = 0; x < 4; x++)
+          row[x] = colors[(indices >> ((y * 4 + x) * 2)) & 3];
+        memcpy(&dst[((size_t)(by * 4 + y) * width + bx * 4) * 4], row, sizeof(row));
+      }
+    }
+  }
+}
+
+// transcodeRows transcodes block rows [by0, by1)
+static void transcodeRows(
+  const uint8_t* src, uint32_t width, uint32_t by0, uint32_t by1, UctTarget target,
+  uint8_t* dst)
+{
+  if (target == UCT_TARGET_BC1) {
+    size_t rowBlocks = width / 4;
+    size_t offs = (size_t)by0 * rowBlocks * UCT_BLOCK_SIZE;
+    transcodeBC1(&src[offs], (by1 - by0) * rowBlocks, &dst[offs]);
+  } else {
+    transcodeRGBA8(src, width, by0, by1, dst);
+  }
+}
+
+wgpu::Texture uploadCompressedTexture(
+  DawnRemoteProtocol& proto, dawn_wire::WireClient* wireClient, const wgpu::Device& device,
+  uint32_t width, uint32_t height, const void* rgba)
+{
+  std::vector<uint8_t> uct(uctSize(width, height));
+  uctEncode((const uint8_t*)rgba, width, height, uct.data());
+  dawn_wire::ReservedTexture r = wireClient->ReserveTexture(device.Get());
+  wgpu::Texture texture = wgpu::Texture::Acquire(r.texture);
+  proto.sendCompressedTexture(r, width, height, uct.data(), uct.size());
+  return texture;
+}
+
+void uctTranscode(
+  const uint8_t* src, uint32_t width, uint32_t height, UctTarget target, uint8_t* dst,
+  unsigned threads)
+{
+  uint32_t rows = height / 4;
+  threads = std::max(1u, std::min(threads, rows / UCT_MIN_ROWS_PER_THREAD));
+  if (threads == 1) {
+    transcodeRows(src, width, 0, rows, target, dst);
+    return;
+  }
+  std::vector<std::thread> workers;
+  uint32_t band = (rows + threads - 1) / threads;
+  for (unsigned i = 1; i < threads; i++) {
+    uint32_t by0 = i * band, by1 = std::min(rows, by0 + band);
+    if (by0 < by1)
+      workers.emplace_back(transcodeRows, src, width, by0, by1, target, dst);
+  }
+  transcodeRows(src, width, 0, std::min(rows, band), target, dst);
+  for (std::thread& t : workers)
+    t.join();
+}
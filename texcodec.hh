@@ -0,0 +1,63 @@
+#pragma once
+#include "protocol.hh"
+#include <stdint.h>
+#include <stddef.h>
+
+// UCT ("universal compressed texture") is the compact texture format which clients send
+// with DawnRemoteProtocol::sendCompressedTexture instead of uploading raw RGBA through
+// WriteTexture. The server transcodes it into a format the GPU can sample: BC1 where
+// the device supports BC texture compression, RGBA8 otherwise.
+//
+// An image is a grid of 4x4 pixel blocks, row by row, 8 bytes per block (4 bits per
+// pixel, 1/8 of RGBA8): two RGB565 endpoints (little-endian uint16) and 16 2-bit
+// indices (little-endian uint32, pixel 0 in the low bits) selecting endpoint 0,
+// endpoint 1, 2/3*e0 + 1/3*e1 or 1/3*e0 + 2/3*e1. Unlike BC1 the endpoints may be in
+// any order and the palette always has those four colors. Alpha is not stored.
+// Width and height must be multiples of 4.
+//
+// Example:
+//   std::vector<uint8_t> uct(uctSize(w, h));
+//   uctEncode(rgba, w, h, uct.data());
+//   ...
+//   std::vector<uint8_t> bc1(uctSize(w, h));
+//   uctTranscode(uct.data(), w, h, UCT_TARGET_BC1, bc1.data(), 4);
+//
+#define UCT_BLOCK_SIZE 8
+
+enum UctTarget {
+  UCT_TARGET_BC1,   // BC1RGBAUnorm: 8 bytes per 4x4 block
+  UCT_TARGET_RGBA8, // RGBA8Unorm, alpha 255: 4 bytes per pixel
+};
+
+// uctSize returns the size in bytes of a width x height UCT image
+inline size_t uctSize(uint32_t width, uint32_t height) {
+  return (size_t)(width / 4) * (height / 4) * UCT_BLOCK_SIZE;
+}
+
+// uctTargetSize returns the size of a width x height image transcoded to target
+size_t uctTargetSize(UctTarget target, uint32_t width, uint32_t height);
+
+// uctTargetBytesPerRow returns the bytes per row (of blocks for BC1) of the target
+uint32_t uctTargetBytesPerRow(UctTarget target, uint32_t width);
+
+// uctEncode compresses width x height RGBA8 pixels into dst (uctSize bytes)
+void uctEncode(const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* dst);
+
+// uctTranscode converts a UCT image into dst (uctTargetSize bytes, rows packed),
+// splitting the work across up to `threads` threads. The BC1 path uses SSE2 when
+// available.
+void uctTranscode(
+  const uint8_t* src, uint32_t width, uint32_t height, UctTarget target, uint8_t* dst,
+  unsigned threads = 1);
+
+// uctTranscodeBC1Scalar is the portable BC1 path (for comparison in benchmarks)
+void uctTranscodeBC1Scalar(const uint8_t* src, size_t nblocks, uint8_t* dst);
+
+// uploadCompressedTexture (client) reserves a texture, compresses width x height RGBA8
+// pixels and sends them to the server, which creates the texture (usage Sampled,
+// CopyDst and CopySrc) and uploads the transcoded data before handling any commands
+// sent after this call. The texture's format is chosen by the server (BC1 or RGBA8),
+// so use it with default views and float sample types only.
+wgpu::Texture uploadCompressedTexture(
+  DawnRemoteProtocol& proto, dawn_wire::WireClient* wireClient, const wgpu::Device& device,
+  uint32_t width, uint32_t height, const void* rgba);
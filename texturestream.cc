@@ -0,0 +1,173 @@
+#include "texturestream.hh"
+#include <string.h>
+#include <algorithm>
+
+// downsample computes the next mip level of an RGBA8 image with a 2x2 box filter
+static void downsample(
+  const uint8_t* src, uint32_t sw, uint32_t sh, std::vector<uint8_t>& dst, uint32_t dw, uint32_t dh)
+{
+  dst.resize((size_t)dw * dh * 4);
+  for (uint32_t y = 0; y < dh; y++) {
+    uint32_t y0 = std::min(y * 2, sh - 1), y1 = std::min(y * 2 + 1, sh - 1);
+    for (uint32_t x = 0; x < dw; x++) {
+      uint32_t x0 = std::min(x * 2, sw - 1), x1 = std::min(x * 2 + 1, sw - 1);
+      const uint8_t* p00 = &src[((size_t)y0 * sw + x0) * 4];
+      const uint8_t* p01 = &src[((size_t)y0 * sw + x1) * 4];
+      const uint8_t* p10 = &src[((size_t)y1 * sw + x0) * 4];
+      const uint8_t* p11 = &src[((size_t)y1 * sw + x1) * 4];
+      uint8_t* d = &dst[((size_t)y * dw + x) * 4];
+      for (int c = 0; c < 4; c++)
+        d[c] = (uint8_t)(((uint32_t)p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+    }
+  }
+}
+
+static inline uint32_t mipSize(uint32_t size, uint32_t level) {
+  return std::max(1u, size >> level);
+}
+
+static void writeRows(
+  const wgpu::Queue& queue, StreamedTexture* t, uint32_t level, uint32_t row, uint32_t nrows)
+{
+  uint32_t w = mipSize(t->width, level);
+  uint32_t bytesPerRow = w * 4;
+  wgpu::ImageCopyTexture dst;
+  dst.texture = t->texture;
+  dst.mipLevel = level;
+  dst.origin = { 0, row, 0 };
+  wgpu::TextureDataLayout layout;
+  layout.offset = 0;
+  layout.bytesPerRow = bytesPerRow;
+  layout.rowsPerImage = nrows;
+  wgpu::Extent3D size = { w, nrows, 1 };
+  const uint8_t* data = &t->_mips[level][(size_t)row * bytesPerRow];
+  queue.WriteTexture(&dst, data, (size_t)nrows * bytesPerRow, &layout, &size);
+}
+
+
+wgpu::TextureView StreamedTexture::view() {
+  if (!_view) {
+    wgpu::TextureViewDescriptor desc;
+    desc.baseMipLevel = _residentMip;
+    desc.mipLevelCount = mipLevelCount - _residentMip;
+    _view = texture.CreateView(&desc);
+  }
+  return _view;
+}
+
+
+TextureStreamer::~TextureStreamer() {
+  for (StreamedTexture* t : _textures)
+    delete t;
+}
+
+StreamedTexture* TextureStreamer::create(
+  const wgpu::Device& device, uint32_t width, uint32_t height, const void* rgba,
+  float importance)
+{
+  StreamedTexture* t = new StreamedTexture();
+  t->width = width;
+  t->height = height;
+  t->importance = importance;
+  t->mipLevelCount = 1;
+  while ((std::max(width, height) >> t->mipLevelCount) > 0)
+    t->mipLevelCount++;
+
+  wgpu::TextureDescriptor desc;
+  desc.size = { width, height, 1 };
+  desc.format = wgpu::TextureFormat::RGBA8Unorm;
+  desc.mipLevelCount = t->mipLevelCount;
+  desc.usage = wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::Sampled;
+  t->texture = device.CreateTexture(&desc);
+
+  // compute the mip chain
+  t->_mips.resize(t->mipLevelCount);
+  t->_mips[0].resize((size_t)width * height * 4);
+  memcpy(t->_mips[0].data(), rgba, t->_mips[0].size());
+  for (uint32_t level = 1; level < t->mipLevelCount; level++) {
+    downsample(
+      t->_mips[level - 1].data(), mipSize(width, level - 1), mipSize(height, level - 1),
+      t->_mips[level], mipSize(width, level), mipSize(height, level));
+  }
+
+  // upload the mip tail now so the texture can be sampled in the very next frame
+  uint32_t tail = 0;
+  while (std::max(mipSize(width, tail), mipSize(height, tail)) > mipTailSize)
+    tail++;
+  wgpu::Queue queue = device.GetQueue();
+  for (uint32_t level = tail; level < t->mipLevelCount; level++) {
+    writeRows(queue, t, level, 0, mipSize(height, level));
+    std::vector<uint8_t>().swap(t->_mips[level]);
+  }
+  t->_residentMip = tail;
+  for (uint32_t level = 0; level < tail; level++)
+    t->_pendingBytes += t->_mips[level].size();
+
+  _textures.push_back(t);
+  return t;
+}
+
+void TextureStreamer::destroy(StreamedTexture* t) {
+  auto it = std::find(_textures.begin(), _textures.end(), t);
+  if (it != _textures.end())
+    _textures.erase(it);
+  t->texture.Destroy();
+  delete t;
+}
+
+size_t TextureStreamer::pendingBytes() const {
+  size_t n = 0;
+  for (const StreamedTexture* t : _textures)
+    n += t->_pendingBytes;
+  return n;
+}
+
+// uploadChunk uploads as many whole rows of t's next level as fit in budget (but at
+// least one row if force is set.) Returns the number of bytes written.
+size_t TextureStreamer::uploadChunk(
+  const wgpu::Queue& queue, StreamedTexture* t, size_t budget, bool force)
+{
+  uint32_t level = t->_residentMip - 1;
+  uint32_t h = mipSize(t->height, level);
+  size_t bytesPerRow = (size_t)mipSize(t->width, level) * 4;
+  size_t nrows = std::min(budget, maxChunkSize) / bytesPerRow;
+  if (nrows == 0) {
+    if (!force)
+      return 0;
+    nrows = 1;
+  }
+  nrows = std::min(nrows, (size_t)(h - t->_uploadRow));
+  writeRows(queue, t, level, t->_uploadRow, (uint32_t)nrows);
+  t->_uploadRow += (uint32_t)nrows;
+  size_t nbytes = nrows * bytesPerRow;
+  t->_pendingBytes -= nbytes;
+
+  if (t->_uploadRow == h) {
+    // level is complete; make it visible through view()
+    std::vector<uint8_t>().swap(t->_mips[level]);
+    t->_residentMip = level;
+    t->_uploadRow = 0;
+    t->_view = nullptr;
+    t->_generation++;
+  }
+  return nbytes;
+}
+
+size_t TextureStreamer::update(const wgpu::Queue& queue, size_t budget) {
+  size_t written = 0;
+  while (written < budget) {
+    // most important texture with pending data; ties go to the oldest
+    StreamedTexture* next = nullptr;
+    for (StreamedTexture* t : _textures) {
+      if (!t->complete() && (next == nullptr || t->importance > next->importance))
+        next = t;
+    }
+    if (next == nullptr)
+      break;
+    size_t n = uploadChunk(queue, next, budget - written, written == 0);
+    if (n == 0)
+      break;
+    written += n;
+  }
+  return written;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <dawn/webgpu_cpp.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// TextureStreamer uploads textures progressively so that a client's first frame does
+// not wait for large textures to cross the wire.
+//
+// When a texture is created, its mip chain is computed on the CPU and the mip tail
+// (all levels no larger than mipTailSize on either side) is uploaded right away.
+// Finer levels are then uploaded by update(), coarse to fine, in chunks of whole rows
+// of at most maxChunkSize bytes, until frameBudget bytes have been written. Call
+// update() once per frame. The most important texture with pending data is served
+// first; importance is provided by the app and can be changed at any time.
+//
+// Sample a streamed texture through view(), which only covers the levels that have
+// been completely uploaded. The view changes as finer levels become resident;
+// generation() tells when to recreate bind groups.
+//
+// Example:
+//   StreamedTexture* t = streamer.create(device, 4096, 4096, pixels, 1.0f);
+//   ...
+//   // every frame:
+//   streamer.update(device.GetQueue());
+//   if (t->generation() != myGeneration) {
+//     myGeneration = t->generation();
+//     bindGroup = makeBindGroup(t->view());
+//   }
+//
+struct StreamedTexture {
+  wgpu::Texture texture;  // RGBA8Unorm with width, height and mipLevelCount
+  uint32_t      width = 0;
+  uint32_t      height = 0;
+  uint32_t      mipLevelCount = 0;
+  float         importance = 0;
+
+  // residentMip is the finest level which has been completely uploaded
+  uint32_t residentMip() const { return _residentMip; }
+  bool     complete() const { return _residentMip == 0; }
+  uint32_t generation() const { return _generation; }
+
+  // view returns a view of the resident mip levels
+  wgpu::TextureView view();
+
+  // internal
+  std::vector<std::vector<uint8_t>> _mips; // RGBA8 pixels per level; freed once uploaded
+  uint32_t          _residentMip = 0;
+  uint32_t          _uploadRow = 0; // next row of level _residentMip-1 to upload
+  uint32_t          _generation = 0;
+  wgpu::TextureView _view;
+  size_t            _pendingBytes = 0;
+};
+
+struct TextureStreamer {
+  // Budget & chunk size must leave room for the frame's other commands in the
+  // connection's command buffer (DAWNCMD_MAX.)
+  uint32_t mipTailSize = 64;         // levels this small are uploaded by create()
+  size_t   frameBudget = 64 * 1024;  // bytes uploaded per update()
+  size_t   maxChunkSize = 32 * 1024; // bytes per write
+
+  ~TextureStreamer();
+
+  // create makes a streamed RGBA8 texture from width*height*4 bytes of pixel data.
+  // The data is copied; the texture is owned by the streamer until destroy() is called.
+  StreamedTexture* create(
+    const wgpu::Device& device, uint32_t width, uint32_t height, const void* rgba,
+    float importance);
+  void destroy(StreamedTexture* t);
+
+  void setImportance(StreamedTexture* t, float importance) { t->importance = importance; }
+
+  // update uploads at most frameBudget (or budget) bytes of pending data.
+  // Returns the number of bytes written.
+  size_t update(const wgpu::Queue& queue) { return update(queue, frameBudget); }
+  size_t update(const wgpu::Queue& queue, size_t budget);
+
+  // pendingBytes returns the number of bytes not yet uploaded, for all textures
+  size_t pendingBytes() const;
+
+  // internal
+  std::vector<StreamedTexture*> _textures;
+
+  size_t uploadChunk(const wgpu::Queue& queue, StreamedTexture* t, size_t budget, bool force);
+};
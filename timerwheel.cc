@@ -0,0 +1,213 @@
+#include "timerwheel.hh"
+#include <assert.h>
+#include <math.h>
+
+#define TW_MASK ((uint64_t)TW_SLOTS - 1)
+
+static inline void listInit(WheelTimer* head) {
+  head->_prev = head;
+  head->_next = head;
+}
+
+static inline bool listEmpty(const WheelTimer* head) {
+  return head->_next == head;
+}
+
+static inline void listRemove(WheelTimer* t) {
+  t->_prev->_next = t->_next;
+  t->_next->_prev = t->_prev;
+  t->_prev = nullptr;
+  t->_next = nullptr;
+}
+
+static inline void listAppend(WheelTimer* head, WheelTimer* t) {
+  t->_prev = head->_prev;
+  t->_next = head;
+  head->_prev->_next = t;
+  head->_prev = t;
+}
+
+// listMove moves all entries of src to the (empty) list dst
+static inline void listMove(WheelTimer* src, WheelTimer* dst) {
+  if (listEmpty(src)) {
+    listInit(dst);
+    return;
+  }
+  dst->_next = src->_next;
+  dst->_prev = src->_prev;
+  dst->_next->_prev = dst;
+  dst->_prev->_next = dst;
+  listInit(src);
+}
+
+
+void TimerWheel::start(struct ev_loop* rl, double tick) {
+  assert(_rl == nullptr);
+  assert(tick > 0);
+  _rl = rl;
+  _tick = tick;
+  _epoch = ev_now(rl);
+  _now = 0;
+  _count = 0;
+  for (int level = 0; level < TW_LEVELS; level++) {
+    for (uint32_t i = 0; i < TW_SLOTS; i++)
+      listInit(&_slots[level][i]);
+  }
+  ev_init(&_timer, onTimer);
+  _timer.data = this;
+}
+
+void TimerWheel::stop() {
+  if (_rl == nullptr)
+    return;
+  for (int level = 0; level < TW_LEVELS; level++) {
+    for (uint32_t i = 0; i < TW_SLOTS; i++) {
+      WheelTimer* head = &_slots[level][i];
+      while (!listEmpty(head))
+        listRemove(head->_next);
+    }
+  }
+  _count = 0;
+  if (ev_is_active(&_timer)) {
+    ev_ref(_rl);
+    ev_timer_stop(_rl, &_timer);
+  }
+  _rl = nullptr;
+}
+
+void TimerWheel::arm(WheelTimer* t, double seconds) {
+  assert(_rl != nullptr);
+  if (t->active())
+    cancel(t);
+
+  double now = (ev_now(_rl) - _epoch) / _tick;
+  if (_count == 0) {
+    // nothing to cascade; catch up with the clock without visiting empty slots
+    uint64_t nowtick = (uint64_t)floor(now);
+    if (nowtick > _now)
+      _now = nowtick;
+  }
+
+  double d = ceil(now + (seconds > 0 ? seconds : 0) / _tick);
+  t->_deadline = d < (double)_now ? _now : (uint64_t)d;
+  link(t);
+  _count++;
+
+  // only touch the libev timer if this timer is due before it fires
+  if (!ev_is_active(&_timer) ||
+      _epoch + (double)t->_deadline * _tick < ev_now(_rl) + ev_timer_remaining(_rl, &_timer))
+  {
+    updateTimer();
+  }
+}
+
+void TimerWheel::cancel(WheelTimer* t) {
+  if (!t->active())
+    return;
+  listRemove(t);
+  assert(_count > 0);
+  _count--;
+  // the libev timer is left alone; a spurious wakeup is cheaper than rescheduling it
+}
+
+void TimerWheel::link(WheelTimer* t) {
+  uint64_t deadline = t->_deadline < _now ? _now : t->_deadline;
+  uint64_t x = deadline ^ _now;
+  int level = 0;
+  while (level < TW_LEVELS && (x >> ((level + 1) * TW_SLOT_BITS)) != 0)
+    level++;
+  uint64_t slot;
+  if (level < TW_LEVELS) {
+    slot = (deadline >> (level * TW_SLOT_BITS)) & TW_MASK;
+  } else {
+    // beyond the range of the wheel; park in the farthest top-level slot
+    level = TW_LEVELS - 1;
+    slot = ((_now >> (level * TW_SLOT_BITS)) + TW_SLOTS - 1) & TW_MASK;
+  }
+  listAppend(&_slots[level][slot], t);
+}
+
+// cascade moves the timers of the current slot of level down into finer levels
+void TimerWheel::cascade(int level) {
+  uint64_t slot = (_now >> (level * TW_SLOT_BITS)) & TW_MASK;
+  WheelTimer tmp;
+  listMove(&_slots[level][slot], &tmp);
+  while (!listEmpty(&tmp)) {
+    WheelTimer* t = tmp._next;
+    listRemove(t);
+    link(t);
+  }
+}
+
+void TimerWheel::advance(uint64_t target) {
+  while (_now <= target) {
+    if (_count == 0) {
+      _now = target + 1;
+      return;
+    }
+    uint64_t tick = _now;
+
+    // cascade levels whose slot changes at this tick, coarsest first
+    if (tick != 0) {
+      for (int level = TW_LEVELS - 1; level > 0; level--) {
+        if ((tick & ((1ull << (level * TW_SLOT_BITS)) - 1)) == 0)
+          cascade(level);
+      }
+    }
+
+    // Run the timers due at this tick. _now is moved past the tick first so that
+    // timers (re)armed by callbacks land in a future slot.
+    WheelTimer due;
+    listMove(&_slots[0][tick & TW_MASK], &due);
+    _now = tick + 1;
+    while (!listEmpty(&due)) {
+      WheelTimer* t = due._next;
+      listRemove(t);
+      _count--;
+      t->cb(t, t->data);
+    }
+  }
+}
+
+// nextExpiry returns the tick of the next slot that needs to be visited
+static uint64_t nextExpiry(const TimerWheel* w) {
+  uint64_t now = w->_now;
+  for (int level = 0; level < TW_LEVELS; level++) {
+    uint64_t base = now >> (level * TW_SLOT_BITS);
+    uint64_t idx = base & TW_MASK;
+    // lower levels only hold slots up to the end of their current rotation, while
+    // the top level wraps around (parked overflow timers)
+    uint64_t n = level == TW_LEVELS - 1 ? TW_SLOTS : TW_SLOTS - idx;
+    // the current slot is still pending if now is exactly at its cascade boundary
+    uint64_t j = (now & ((1ull << (level * TW_SLOT_BITS)) - 1)) == 0 ? 0 : 1;
+    for (; j < n; j++) {
+      if (!listEmpty(&w->_slots[level][(idx + j) & TW_MASK]))
+        return level == 0 ? now + j : (base + j) << (level * TW_SLOT_BITS);
+    }
+  }
+  return now;
+}
+
+void TimerWheel::updateTimer() {
+  if (ev_is_active(&_timer)) {
+    ev_ref(_rl);
+    ev_timer_stop(_rl, &_timer);
+  }
+  if (_count == 0)
+    return;
+  double at = _epoch + (double)nextExpiry(this) * _tick;
+  double delay = at - ev_now(_rl);
+  ev_timer_set(&_timer, delay > 0 ? delay : 0, 0.0);
+  ev_timer_start(_rl, &_timer);
+  ev_unref(_rl); // don't allow the wheel to keep the runloop alive alone
+}
+
+void TimerWheel::onTimer(struct ev_loop* rl, ev_timer* w, int revents) {
+  TimerWheel* tw = (TimerWheel*)w->data;
+  // the timer is not repeating and thus already stopped; rebalance the refcount
+  ev_ref(rl);
+  uint64_t target = (uint64_t)floor((ev_now(rl) - tw->_epoch) / tw->_tick + 1e-6);
+  tw->advance(target);
+  if (tw->_rl != nullptr) // a callback may have stopped the wheel
+    tw->updateTimer();
+}
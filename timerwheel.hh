@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// protocol.hh's libev include, repeated here so timerwheel.hh stands on its own
+_Pragma("GCC diagnostic push")
+_Pragma("GCC diagnostic ignored \"-Wc++17-compat-mangling\"")
+#include <ev.h>
+_Pragma("GCC diagnostic pop")
+
+// TimerWheel is a hierarchical timing wheel which multiplexes any number of timers
+// onto a single libev timer.
+//
+// Arming, re-arming and cancelling a timer are O(1): a timer is an intrusive list node
+// which is linked into the slot for its deadline. The wheel has TW_LEVELS levels of
+// TW_SLOTS slots each; level 0 has a resolution of one tick and each following level
+// covers TW_SLOTS times the range of the one below it. When the wheel advances into a
+// higher-level slot, its timers are cascaded down into finer levels.
+//
+// With 4 levels of 64 slots and a 10ms tick, the wheel covers ~16777216 ticks (~46h).
+// Timers further out than that are parked in the last slot of the top level and
+// re-cascaded until they are due.
+//
+// The wheel only keeps its libev timer running while timers are armed, so an idle
+// wheel does not wake the process.
+//
+// Example:
+//   struct Conn { WheelTimer idleTimer; ... };
+//   conn->idleTimer.init(onIdle, conn);
+//   wheel.arm(&conn->idleTimer, 30.0); // fire in 30 seconds (re-arming is the same call)
+//   wheel.cancel(&conn->idleTimer);
+//
+#define TW_SLOT_BITS 6
+#define TW_SLOTS     (1u << TW_SLOT_BITS)
+#define TW_LEVELS    4
+
+struct TimerWheel;
+
+struct WheelTimer {
+  typedef void(*Callback)(WheelTimer* t, void* data);
+
+  WheelTimer* _prev = nullptr;
+  WheelTimer* _next = nullptr;
+  uint64_t    _deadline = 0; // in wheel ticks
+  Callback    cb = nullptr;
+  void*       data = nullptr;
+
+  void init(Callback cb_, void* data_) { cb = cb_; data = data_; }
+  bool active() const { return _prev != nullptr; }
+};
+
+struct TimerWheel {
+  // tick is the resolution of timers in seconds
+  void start(struct ev_loop* rl, double tick = 0.01);
+  void stop(); // cancels all timers
+
+  // arm (re)schedules t to fire after `seconds`. Rounded up to the next tick.
+  void arm(WheelTimer* t, double seconds);
+  void cancel(WheelTimer* t);
+
+  size_t count() const { return _count; }
+
+  // internal
+  struct ev_loop* _rl = nullptr;
+  ev_timer        _timer;
+  double          _tick = 0.01;
+  double          _epoch = 0;  // ev_now at tick 0
+  uint64_t        _now = 0;    // current tick; all slots before it have been run
+  size_t          _count = 0;  // number of armed timers
+  WheelTimer      _slots[TW_LEVELS][TW_SLOTS]; // list heads
+
+  void link(WheelTimer* t);
+  void advance(uint64_t tick);
+  void cascade(int level);
+  void updateTimer();
+  static void onTimer(struct ev_loop* rl, ev_timer* w, int revents);
+};
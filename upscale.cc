@@ -0,0 +1,155 @@
+#include "upscale.hh"
+#include "utils/ComboRenderPipelineDescriptor.h"
+#include "utils/WGPUHelpers.h"
+#include <math.h>
+
+// Max number of regions with bindings kept for a source texture. A client changing its
+// scale every frame makes a new binding per distinct region; beyond this they are
+// all dropped and made again as needed.
+#define UPSCALE_BINDINGS_MAX 16
+
+// kVertexShader makes a triangle covering the framebuffer, with texture coordinates
+// 0..1 over the framebuffer scaled to the source region
+static const char* kVertexShader = R"(
+  [[block]] struct Params {
+    uvScale : vec2<f32>;
+    uvMax   : vec2<f32>;
+  };
+  [[group(0), binding(0)]] var<uniform> params : Params;
+
+  struct VertexOut {
+    [[builtin(position)]] position : vec4<f32>;
+    [[location(0)]] uv : vec2<f32>;
+  };
+
+  [[stage(vertex)]] fn main(
+    [[builtin(vertex_index)]] VertexIndex : u32
+  ) -> VertexOut {
+    let uv = vec2<f32>(f32((VertexIndex << 1u) & 2u), f32(VertexIndex & 2u));
+    var out : VertexOut;
+    out.position = vec4<f32>(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, 0.0, 1.0);
+    out.uv = uv * params.uvScale;
+    return out;
+  }
+)";
+
+// kFragmentShader samples the source, clamped to half a texel inside the region so
+// that filtering does not pick up pixels outside of it
+static const char* kFragmentShader = R"(
+  [[block]] struct Params {
+    uvScale : vec2<f32>;
+    uvMax   : vec2<f32>;
+  };
+  [[group(0), binding(0)]] var<uniform> params : Params;
+  [[group(0), binding(1)]] var srcSampler : sampler;
+  [[group(0), binding(2)]] var src : texture_2d<f32>;
+
+  [[stage(fragment)]] fn main(
+    [[location(0)]] uv : vec2<f32>
+  ) -> [[location(0)]] vec4<f32> {
+    return textureSample(src, srcSampler, min(uv, params.uvMax));
+  }
+)";
+
+
+void Upscaler::init(const wgpu::Device& device) {
+  _device = device;
+
+  utils::ComboRenderPipelineDescriptor2 desc;
+  desc.vertex.module = utils::CreateShaderModule(device, kVertexShader);
+  desc.cFragment.module = utils::CreateShaderModule(device, kFragmentShader);
+  desc.cTargets[0].format = format;
+  _pipeline = device.CreateRenderPipeline2(&desc);
+
+  wgpu::SamplerDescriptor samplerDesc;
+  samplerDesc.minFilter = wgpu::FilterMode::Linear;
+  samplerDesc.magFilter = wgpu::FilterMode::Linear;
+  _sampler = device.CreateSampler(&samplerDesc);
+
+  _src = nullptr;
+  _bindings.clear();
+}
+
+wgpu::CommandBuffer Upscaler::encode(
+  const wgpu::Device& device, const wgpu::Texture& src, uint32_t srcWidth, uint32_t srcHeight,
+  uint32_t width, uint32_t height, const wgpu::SwapChain& swapchain)
+{
+  if (_device.Get() != device.Get())
+    init(device);
+  if (_src != src.Get() || _bindings.size() >= UPSCALE_BINDINGS_MAX) {
+    _bindings.clear();
+    _src = src.Get();
+  }
+
+  uint64_t key = ((uint64_t)width << 32) | height;
+  auto it = _bindings.find(key);
+  if (it == _bindings.end()) {
+    float params[4] = {
+      (float)width / (float)srcWidth, (float)height / (float)srcHeight,
+      ((float)width - 0.5f) / (float)srcWidth, ((float)height - 0.5f) / (float)srcHeight,
+    };
+    Binding b;
+    b.params = utils::CreateBufferFromData(
+      device, params, sizeof(params), wgpu::BufferUsage::Uniform);
+    b.bindGroup = utils::MakeBindGroup(device, _pipeline.GetBindGroupLayout(0), {
+      {0, b.params},
+      {1, _sampler},
+      {2, src.CreateView()},
+    });
+    it = _bindings.emplace(key, b).first;
+  }
+
+  wgpu::RenderPassColorAttachmentDescriptor colorAttachment;
+  colorAttachment.view = swapchain.GetCurrentTextureView();
+  colorAttachment.loadOp = wgpu::LoadOp::Clear; // every pixel is drawn
+  colorAttachment.storeOp = wgpu::StoreOp::Store;
+
+  wgpu::RenderPassDescriptor renderPassDesc;
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorAttachment;
+
+  wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+  wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&renderPassDesc);
+  pass.SetPipeline(_pipeline);
+  pass.SetBindGroup(0, it->second.bindGroup);
+  pass.Draw(3);
+  pass.EndPass();
+  return encoder.Finish();
+}
+
+
+bool RenderScaleTarget::setScale(
+  DawnRemoteProtocol& proto, dawn_wire::WireClient* wireClient, const wgpu::Device& device,
+  float scale)
+{
+  const DawnRemoteProtocol::FramebufferInfo& fb = proto.fbinfo();
+  uint32_t s = 1000;
+  if (scale < 1.0f && fb.width > 0 && fb.height > 0)
+    s = std::max((uint32_t)RENDER_SCALE_MIN, (uint32_t)lroundf(std::max(scale, 0.0f) * 1000.0f));
+  bool newTexture = s < 1000 && (!_texture || fb.width != _fbWidth || fb.height != _fbHeight);
+  if (newTexture) {
+    _reservation = wireClient->ReserveTexture(device.Get());
+    _texture = wgpu::Texture::Acquire(_reservation.texture);
+    _view = _texture.CreateView();
+    _fbWidth = fb.width;
+    _fbHeight = fb.height;
+  }
+  bool changed = s != _scale || newTexture;
+  _scale = s;
+  _width = s < 1000 ? renderScaleSize(_fbWidth, s) : fb.width;
+  _height = s < 1000 ? renderScaleSize(_fbHeight, s) : fb.height;
+  if (!changed || !_texture)
+    return true; // never scaled, nothing to tell the server
+  return proto.sendRenderScale(_reservation, s);
+}
+
+wgpu::TextureView RenderScaleTarget::view(const wgpu::SwapChain& swapchain) {
+  return _scale < 1000 ? _view : swapchain.GetCurrentTextureView();
+}
+
+void RenderScaleTarget::setViewport(const wgpu::RenderPassEncoder& pass) const {
+  if (_scale >= 1000)
+    return;
+  pass.SetViewport(0, 0, (float)_width, (float)_height, 0, 1);
+  pass.SetScissorRect(0, 0, _width, _height);
+}
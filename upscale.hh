@@ -0,0 +1,84 @@
+#pragma once
+#include "protocol.hh"
+#include <dawn/webgpu_cpp.h>
+#include <stdint.h>
+#include <unordered_map>
+
+// RenderScaleTarget (client) renders frames at a render scale below 1, for dynamic
+// resolution: into the top-left part of a texture of the framebuffer's size which the
+// server creates and upscales to its swapchain on present (see
+// DawnRemoteProtocol::sendRenderScale.) The scale may change every frame; the server is
+// only told when it changes (in steps of 1/1000.) Scale 1 renders into the swapchain.
+//
+// Example:
+//   target.setScale(proto, wireClient, device, 0.5f);
+//   colorAttachment.view = target.view(swapchain);
+//   ...
+//   wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&renderPassDesc);
+//   target.setViewport(pass);
+//
+struct RenderScaleTarget {
+  // setScale sets the scale of frames encoded after it, clamped to
+  // [RENDER_SCALE_MIN/1000, 1]. The first scale below 1 reserves the texture, as does
+  // one after the framebuffer size changed. Until the client has received the
+  // framebuffer info the scale stays 1. Returns false if the message could not be sent.
+  bool setScale(
+    DawnRemoteProtocol& proto, dawn_wire::WireClient* wireClient, const wgpu::Device& device,
+    float scale);
+
+  uint32_t scale() const { return _scale; } // in 1/1000
+  uint32_t width() const { return _width; } // of the region rendered into, in pixels
+  uint32_t height() const { return _height; }
+
+  // view returns the view to render a frame into: the texture's, or the swapchain's
+  // current texture at scale 1
+  wgpu::TextureView view(const wgpu::SwapChain& swapchain);
+
+  // setViewport restricts drawing of pass to the region of the current scale
+  void setViewport(const wgpu::RenderPassEncoder& pass) const;
+
+  // internal
+  dawn_wire::ReservedTexture _reservation = {};
+  wgpu::Texture     _texture; // framebuffer size, made by the server
+  wgpu::TextureView _view;
+  uint32_t _fbWidth = 0, _fbHeight = 0; // size of _texture
+  uint32_t _scale = 1000;
+  uint32_t _width = 0, _height = 0;
+};
+
+// Upscaler draws the top-left width x height pixels of a texture stretched over all of
+// a swapchain's current texture, with bilinear filtering: one full-screen triangle in a
+// render pass which replaces the swapchain's content. The server uses it for clients
+// which render at a render scale below 1 (see DawnRemoteProtocol::sendRenderScale.)
+//
+// Parameters are uniform buffers made per source texture and region, so that changing
+// the render scale does not write to a buffer a pending command buffer reads.
+//
+// Example:
+//   wgpu::CommandBuffer commands = upscaler.encode(
+//     device, target, targetWidth, targetHeight, width, height, swapchain);
+//   device.GetQueue().Submit(1, &commands);
+//   swapchain.Present();
+//
+struct Upscaler {
+  wgpu::TextureFormat format = wgpu::TextureFormat::BGRA8Unorm; // of the swapchain
+
+  // encode returns a command buffer which draws src (srcWidth x srcHeight) scaled from
+  // its top-left width x height pixels onto the current texture of swapchain
+  wgpu::CommandBuffer encode(
+    const wgpu::Device& device, const wgpu::Texture& src, uint32_t srcWidth, uint32_t srcHeight,
+    uint32_t width, uint32_t height, const wgpu::SwapChain& swapchain);
+
+  // internal
+  struct Binding {
+    wgpu::Buffer    params; // uv scale & clamp
+    wgpu::BindGroup bindGroup;
+  };
+  wgpu::Device         _device;
+  wgpu::RenderPipeline _pipeline;
+  wgpu::Sampler        _sampler;
+  WGPUTexture          _src = nullptr; // texture the bindings are for
+  std::unordered_map<uint64_t,Binding> _bindings; // by width << 32 | height
+
+  void init(const wgpu::Device& device);
+};
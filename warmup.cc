@@ -0,0 +1,131 @@
+#include "warmup.hh"
+#include "capture.hh"
+#include "metrics.hh" // monotimeNs
+
+#include "dawn_wire/ObjectType_autogen.h"
+#include "dawn_wire/WireCmd_autogen.h"
+#include <dawn_wire/WireServer.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#define errlog(format, ...) \
+  (({ fprintf(stderr, "E " format "\n", ##__VA_ARGS__); fflush(stderr); }))
+
+using dawn_wire::ObjectType;
+using dawn_wire::WireCmd;
+
+void* Warmup::Serializer::GetCmdSpace(size_t size) {
+  if (buf.size() < size)
+    buf.resize(size);
+  return buf.data();
+}
+
+bool isWarmupCommand(const char* cmd, size_t size) {
+  if (size < CAPTURE_CMD_SELF_OFFS + 4)
+    return false;
+  switch ((WireCmd)captureCmdU32(cmd, size, CAPTURE_CMD_ID_OFFS)) {
+    case WireCmd::DeviceCreateShaderModule:
+    case WireCmd::DeviceCreateBindGroupLayout:
+    case WireCmd::DeviceCreatePipelineLayout:
+    case WireCmd::DeviceCreateRenderPipeline:
+    case WireCmd::DeviceCreateRenderPipeline2:
+    case WireCmd::DeviceCreateComputePipeline:
+      return true;
+    case WireCmd::DestroyObject:
+      switch ((ObjectType)captureCmdU32(cmd, size, CAPTURE_CMD_SELF_OFFS)) {
+        case ObjectType::ShaderModule:
+        case ObjectType::BindGroupLayout:
+        case ObjectType::PipelineLayout:
+        case ObjectType::RenderPipeline:
+        case ObjectType::ComputePipeline:
+          return true;
+        default:
+          return false;
+      }
+    default:
+      return false;
+  }
+}
+
+bool Warmup::replay(const char* filename, WGPUDevice device, const DawnProcTable& procs) {
+  CaptureReader r;
+  if (!r.open(filename)) {
+    errlog("warm-up: %s: %s", filename, strerror(errno));
+    return false;
+  }
+  dawn_wire::WireServer* server = new dawn_wire::WireServer(
+    { .procs = &procs, .serializer = &_serializer });
+  _servers.push_back(server);
+  captures++;
+
+  bool haveDevice = false; // commands before the first reservation have no device
+  CaptureRecord rec;
+  while (r.next(&rec)) {
+    if (rec.type == CAPTURE_RESERVATION && rec.size >= 4 * sizeof(uint32_t)) {
+      uint32_t v[4];
+      memcpy(v, rec.data, sizeof(v));
+      if (server->GetDevice(v[2], v[3]) == nullptr)
+        haveDevice = server->InjectDevice(device, v[2], v[3]);
+    } else if (rec.type == CAPTURE_COMMANDS && haveDevice) {
+      captureForEachCommand(rec.data, rec.size, [&](const char* cmd, size_t size) {
+        if (!isWarmupCommand(cmd, size))
+          return;
+        commands++;
+        if (server->HandleCommands(cmd, size) == nullptr)
+          failed++;
+      });
+    }
+  }
+  if (r.error()) {
+    errlog("warm-up: %s: malformed capture", filename);
+    return false;
+  }
+  return true;
+}
+
+bool Warmup::run(const std::vector<std::string>& paths, WGPUDevice device,
+                 const DawnProcTable& procs)
+{
+  uint64_t t0 = monotimeNs();
+  bool ok = true;
+  for (const std::string& path : paths) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      errlog("warm-up: %s: %s", path.c_str(), strerror(errno));
+      ok = false;
+      continue;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+      ok &= replay(path.c_str(), device, procs);
+      continue;
+    }
+    DIR* d = opendir(path.c_str());
+    if (!d) {
+      errlog("warm-up: %s: %s", path.c_str(), strerror(errno));
+      ok = false;
+      continue;
+    }
+    std::vector<std::string> files;
+    while (struct dirent* e = readdir(d)) {
+      size_t n = strlen(e->d_name);
+      if (n > 5 && strcmp(&e->d_name[n - 5], ".dcap") == 0)
+        files.push_back(path + "/" + e->d_name);
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    for (const std::string& f : files)
+      ok &= replay(f.c_str(), device, procs);
+  }
+  ns += monotimeNs() - t0;
+  return ok;
+}
+
+void Warmup::release() {
+  for (dawn_wire::WireServer* server : _servers)
+    delete server;
+  _servers.clear();
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "protocol.hh"
+#include <dawn/dawn_proc_table.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dawn_wire { class WireServer; }
+
+// isWarmupCommand returns true for the wire commands which create the objects warm-up is
+// for, and the releases of such objects (their IDs may be reused later in the capture)
+bool isWarmupCommand(const char* cmd, size_t size);
+
+// Warmup replays the creation-only part of recorded sessions (captures made with
+// server -capture) against a device before the server accepts clients: the shader
+// modules, bind group & pipeline layouts and pipelines they created, in order, with
+// their releases. Nothing else is replayed; no GPU work is done.
+//
+// The objects which were alive at the end of each session stay alive until release,
+// so that clients creating the same objects get them from Dawn's object caches, and
+// compiling them has warmed the driver's caches.
+struct Warmup {
+  uint32_t captures = 0; // captures replayed
+  uint64_t commands = 0; // creation & release commands replayed
+  uint64_t failed = 0;   // of those, commands the wire server rejected
+  uint64_t ns = 0;       // time spent
+
+  ~Warmup() { release(); }
+
+  // run replays the captures at paths, which are capture files or directories of
+  // them (*.dcap). Returns false if a path could not be read or a capture is
+  // malformed; the others are still replayed.
+  bool run(const std::vector<std::string>& paths, WGPUDevice device, const DawnProcTable& procs);
+
+  // release releases the objects created by run
+  void release();
+
+  // internal
+  struct Serializer : public dawn_wire::CommandSerializer {
+    std::vector<char> buf; // replies are discarded
+    size_t GetMaximumAllocationSize() const override { return DAWNCMD_MAX; }
+    void* GetCmdSpace(size_t size) override;
+    bool Flush() override { return true; }
+  };
+  Serializer                          _serializer;
+  std::vector<dawn_wire::WireServer*> _servers; // one per capture
+  bool replay(const char* filename, WGPUDevice device, const DawnProcTable& procs);
+};